@@ -9,7 +9,7 @@
 #include <stdlib.h>
 
 enum DartCObjectType {
-  TypedData = 7,
+  ExternalTypedData = 8,
 };
 typedef int32_t DartCObjectType;
 
@@ -127,14 +127,18 @@ typedef void (*Callback)(void *context, const uint8_t *msg_ptr, uint64_t msg_len
 
 typedef int64_t Port;
 
-typedef struct DartTypedData {
+typedef void (*DartHandleFinalizer)(void *isolate_callback_data, void *peer);
+
+typedef struct DartExternalTypedData {
   DartTypedDataType type_;
   intptr_t length;
-  uint8_t *values;
-} DartTypedData;
+  uint8_t *data;
+  void *peer;
+  DartHandleFinalizer callback;
+} DartExternalTypedData;
 
 typedef union DartCObjectValue {
-  struct DartTypedData as_typed_data;
+  struct DartExternalTypedData as_external_typed_data;
   uint64_t _align[5];
 } DartCObjectValue;
 
@@ -230,6 +234,33 @@ void session_close_blocking(SessionHandle session);
  */
 void session_channel_send(SessionHandle session, uint8_t *payload_ptr, uint64_t payload_len);
 
+/**
+ * Sends multiple requests at once. This is more efficient than calling `session_channel_send`
+ * for each of them separately.
+ *
+ * The payload is a sequence of frames, each consisting of the request length (big endian `u32`)
+ * followed by the request itself (encoded the same way as in `session_channel_send`). Malformed
+ * payload is discarded as a whole.
+ *
+ * # Safety
+ *
+ * `session` must be a valid session handle, `payload_ptr` must be a pointer to a byte buffer
+ * whose length is at least `payload_len` bytes.
+ */
+void session_channel_send_batch(SessionHandle session, uint8_t *payload_ptr, uint64_t payload_len);
+
+/**
+ * Enables or disables response batching for the given session. When enabled, the responses and
+ * notifications that are ready at the same time are delivered in a single callback invocation /
+ * port message, encoded the same way as the payload of `session_channel_send_batch`. When
+ * disabled (the default), each message is delivered separately.
+ *
+ * # Safety
+ *
+ * `session` must be a valid session handle.
+ */
+void session_channel_set_batch_responses(SessionHandle session, bool enabled);
+
 /**
  * Copy the file contents into the provided raw file descriptor (dart-specific API).
  *
@@ -267,6 +298,96 @@ void file_copy_to_raw_fd_dart(SessionHandle _session,
                               PostDartCObjectFn post_c_object_fn,
                               Port port);
 
+/**
+ * Replace the file contents with the contents read from the provided raw file descriptor
+ * (dart-specific API). The file is flushed afterwards.
+ *
+ * This function takes ownership of the file descriptor and closes it when it finishes. If the
+ * caller needs to access the descriptor afterwards (or while the function is running), he/she
+ * needs to `dup` it before passing it into this function.
+ *
+ * # Safety
+ *
+ * - `session` must be a valid session handle
+ * - `handle` must be a valid file holder handle
+ * - `fd` must be a valid and open file descriptor
+ * - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+ * - `port` must be a valid dart native port
+ */
+void file_copy_from_raw_fd_dart(SessionHandle session,
+                                FileHandle handle,
+                                int fd,
+                                PostDartCObjectFn post_c_object_fn,
+                                Port port);
+
+/**
+ * Always returns `OperationNotSupported` error. Defined to avoid lookup errors on non-unix
+ * platforms. Do not use.
+ *
+ * # Safety
+ *
+ * - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+ * - `port` must be a valid dart native port.
+ * - `session`, `handle` and `fd` are not actually used and so have no safety requirements.
+ */
+void file_copy_from_raw_fd_dart(SessionHandle _session,
+                                FileHandle _handle,
+                                int _fd,
+                                PostDartCObjectFn post_c_object_fn,
+                                Port port);
+
+/**
+ * Read at most `buffer_len` bytes from the file starting at `offset` directly into the
+ * caller-provided buffer (common C-like API).
+ *
+ * On success, `callback` is invoked with a message consisting of the `ErrorCode::Ok` code
+ * (big-endian `u16`) followed by the number of bytes read (big-endian `u64`). The number of bytes
+ * read can be less than `buffer_len` (or zero) in case of EOF. On failure, the message is the
+ * error code followed by the utf-8 encoded error message.
+ *
+ * # Safety
+ *
+ * - `session` must be a valid session handle
+ * - `handle` must be a valid file holder handle
+ * - `buffer_ptr` must be a pointer to a writable byte buffer whose length is at least
+ *   `buffer_len` bytes. The buffer must stay valid and must not be accessed by the caller until
+ *   `callback` is invoked.
+ * - `context` must be a valid pointer to a value that is safe to be sent to other threads or
+ *   null.
+ * - `callback` must be a valid function pointer which does not leak the passed `msg_ptr`.
+ */
+void file_read_to_buffer(SessionHandle session,
+                         FileHandle handle,
+                         uint64_t offset,
+                         uint8_t *buffer_ptr,
+                         uint64_t buffer_len,
+                         void *context,
+                         Callback callback);
+
+/**
+ * Read at most `buffer_len` bytes from the file starting at `offset` directly into the
+ * caller-provided buffer (dart-specific API).
+ *
+ * See [file_read_to_buffer] for the format of the response message.
+ *
+ * # Safety
+ *
+ * - `session` must be a valid session handle
+ * - `handle` must be a valid file holder handle
+ * - `buffer_ptr` must be a pointer to a writable byte buffer whose length is at least
+ *   `buffer_len` bytes. The buffer must stay valid and must not be accessed by the caller until
+ *   the response is posted to `port`.
+ * - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+ * - `port` must be a valid dart native port
+ */
+void file_read_to_buffer_dart(SessionHandle session,
+                              FileHandle handle,
+                              uint64_t offset,
+                              uint8_t *buffer_ptr,
+                              uint64_t buffer_len,
+                              PostDartCObjectFn post_c_object_fn,
+                              Port port);
+
 /**
  * Deallocate string that has been allocated on the rust side
  *
@@ -51,6 +51,12 @@ public class SwiftOuisyncPlugin: NSObject, FlutterPlugin {
     let resultSend = session_channel_send(session, payload, length)
     print(resultSend)
 
+    let resultSendBatch = session_channel_send_batch(session, payload, length)
+    print(resultSendBatch)
+
+    let resultSetBatchResponses = session_channel_set_batch_responses(session, false)
+    print(resultSetBatchResponses)
+
     let handle: UInt64 = 0
 
     let resultFileCopy = file_copy_to_raw_fd_dart(session, handle, 0, function, port)
@@ -58,6 +64,15 @@ public class SwiftOuisyncPlugin: NSObject, FlutterPlugin {
 
     let resultFileCopyNS = file_copy_to_raw_fd_dart(session, handle, 0, function, port)
     print(resultFileCopyNS)
+
+    let resultFileCopyFrom = file_copy_from_raw_fd_dart(session, handle, 0, function, port)
+    print(resultFileCopyFrom)
+
+    let resultFileRead = file_read_to_buffer(session, handle, 0, payload, length, context, callback)
+    print(resultFileRead)
+
+    let resultFileReadDart = file_read_to_buffer_dart(session, handle, 0, payload, length, function, port)
+    print(resultFileReadDart)
     
     let stringPointer: UnsafeMutablePointer<Int>? = nil
 
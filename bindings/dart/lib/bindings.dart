@@ -32,6 +32,14 @@ typedef session_create_dart = SessionCreateResult Function(
 typedef _session_channel_send_c = Void Function(Uint64, Pointer<Uint8>, Uint64);
 typedef session_channel_send_dart = void Function(int, Pointer<Uint8>, int);
 
+typedef _session_channel_send_batch_c = Void Function(
+    Uint64, Pointer<Uint8>, Uint64);
+typedef session_channel_send_batch_dart = void Function(
+    int, Pointer<Uint8>, int);
+
+typedef _session_channel_set_batch_responses_c = Void Function(Uint64, Bool);
+typedef session_channel_set_batch_responses_dart = void Function(int, bool);
+
 typedef _session_close_c = Void Function(
     Uint64, Pointer<NativeFunction<PostCObject>>, Int64);
 typedef session_close_dart = void Function(
@@ -45,6 +53,16 @@ typedef _file_copy_to_raw_fd_c = Void Function(
 typedef file_copy_to_raw_fd_dart = void Function(
     int, int, int, Pointer<NativeFunction<PostCObject>>, int);
 
+typedef _file_copy_from_raw_fd_c = Void Function(
+    Uint64, Uint64, Int, Pointer<NativeFunction<PostCObject>>, Int64);
+typedef file_copy_from_raw_fd_dart = void Function(
+    int, int, int, Pointer<NativeFunction<PostCObject>>, int);
+
+typedef _file_read_to_buffer_c = Void Function(Uint64, Uint64, Uint64,
+    Pointer<Uint8>, Uint64, Pointer<NativeFunction<PostCObject>>, Int64);
+typedef file_read_to_buffer_dart = void Function(int, int, int, Pointer<Uint8>,
+    int, Pointer<NativeFunction<PostCObject>>, int);
+
 typedef _log_print_c = Void Function(Uint8, Pointer<Char>, Pointer<Char>);
 typedef log_print_dart = void Function(int, Pointer<Char>, Pointer<Char>);
 
@@ -70,6 +88,14 @@ class Bindings {
             .lookup<NativeFunction<_session_channel_send_c>>(
                 'session_channel_send')
             .asFunction(),
+        session_channel_send_batch = library
+            .lookup<NativeFunction<_session_channel_send_batch_c>>(
+                'session_channel_send_batch')
+            .asFunction(),
+        session_channel_set_batch_responses = library
+            .lookup<NativeFunction<_session_channel_set_batch_responses_c>>(
+                'session_channel_set_batch_responses')
+            .asFunction(),
         session_close = library
             .lookup<NativeFunction<_session_close_c>>('session_close_dart')
             .asFunction(),
@@ -81,6 +107,14 @@ class Bindings {
             .lookup<NativeFunction<_file_copy_to_raw_fd_c>>(
                 'file_copy_to_raw_fd_dart')
             .asFunction(),
+        file_copy_from_raw_fd = library
+            .lookup<NativeFunction<_file_copy_from_raw_fd_c>>(
+                'file_copy_from_raw_fd_dart')
+            .asFunction(),
+        file_read_to_buffer = library
+            .lookup<NativeFunction<_file_read_to_buffer_c>>(
+                'file_read_to_buffer_dart')
+            .asFunction(),
         log_print = library
             .lookup<NativeFunction<_log_print_c>>('log_print')
             .asFunction(),
@@ -90,9 +124,14 @@ class Bindings {
 
   final session_create_dart session_create;
   final session_channel_send_dart session_channel_send;
+  final session_channel_send_batch_dart session_channel_send_batch;
+  final session_channel_set_batch_responses_dart
+      session_channel_set_batch_responses;
   final session_close_dart session_close;
   final session_close_blocking_dart session_close_blocking;
   final file_copy_to_raw_fd_dart file_copy_to_raw_fd;
+  final file_copy_from_raw_fd_dart file_copy_from_raw_fd;
+  final file_read_to_buffer_dart file_read_to_buffer;
   final log_print_dart log_print;
   final free_string_dart free_string;
 }
@@ -17,8 +17,18 @@ class Client {
   var _nextMessageId = 0;
   final _responses = HashMap<int, Completer<Object?>>();
   final _subscriptions = HashMap<int, StreamSink<Object?>>();
+  // Requests (by their ids) issued since the last time the requests were sent to the native side.
+  final _pendingRequests = <int, Uint8List>{};
+
+  /// If [batchResponses] is true, the native side is asked to deliver the responses and
+  /// notifications that are ready at the same time in a single message, which is then split here.
+  /// Use it only when [stream] carries the messages exactly as sent by the native side.
+  Client(this._handle, Stream<Uint8List> stream, {bool batchResponses = false})
+      : _stream = batchResponses ? stream.expand(_decodeBatch) : stream {
+    if (batchResponses) {
+      bindings.session_channel_set_batch_responses(_handle, true);
+    }
 
-  Client(this._handle, ReceivePort port) : _stream = port.cast<Uint8List>() {
     unawaited(_receive());
   }
 
@@ -49,7 +59,7 @@ class Client {
             ..add(serialize(request)))
           .takeBytes();
 
-      _send(message);
+      _enqueue(id, message);
 
       return await completer.future as T;
     } finally {
@@ -65,17 +75,47 @@ class Client {
 
   bool get isClosed => _handle == 0;
 
-  void _send(Uint8List data) {
+  // Requests issued in the same microtask are sent to the native side together, in a single call.
+  void _enqueue(int id, Uint8List message) {
     if (_handle == 0) {
       throw StateError('session has been closed');
     }
 
+    _pendingRequests[id] = message;
+
+    if (_pendingRequests.length == 1) {
+      scheduleMicrotask(_flush);
+    }
+  }
+
+  void _flush() {
+    final requests = Map.of(_pendingRequests);
+    _pendingRequests.clear();
+
+    if (_handle == 0) {
+      for (final id in requests.keys) {
+        _responses
+            .remove(id)
+            ?.completeError(StateError('session has been closed'));
+      }
+
+      return;
+    }
+
+    if (requests.length == 1) {
+      _send(requests.values.single, bindings.session_channel_send);
+    } else {
+      _send(_encodeBatch(requests.values), bindings.session_channel_send_batch);
+    }
+  }
+
+  void _send(Uint8List data, void Function(int, Pointer<Uint8>, int) send) {
     // TODO: is there a way to do this without having to allocate whole new buffer?
     var buffer = malloc<Uint8>(data.length);
 
     try {
       buffer.asTypedList(data.length).setAll(0, data);
-      bindings.session_channel_send(_handle, buffer, data.length);
+      send(_handle, buffer, data.length);
     } finally {
       malloc.free(buffer);
     }
@@ -87,7 +127,7 @@ class Client {
         continue;
       }
 
-      final id = bytes.buffer.asByteData().getUint64(0);
+      final id = ByteData.sublistView(bytes).getUint64(0);
       final message = deserialize(bytes.sublist(8));
 
       // DEBUG
@@ -185,6 +225,45 @@ class Client {
   }
 }
 
+/// Encodes the messages as a sequence of frames, each consisting of the message length (big endian
+/// 32 bit unsigned int) followed by the message itself. This is the format of the payload of
+/// `session_channel_send_batch` and of the batched responses.
+Uint8List _encodeBatch(Iterable<Uint8List> messages) {
+  final builder = BytesBuilder(copy: false);
+
+  for (final message in messages) {
+    builder
+      ..add((ByteData(4)..setUint32(0, message.length)).buffer.asUint8List())
+      ..add(message);
+  }
+
+  return builder.takeBytes();
+}
+
+/// Inverse of [_encodeBatch]. Discards the rest of the batch if it's malformed.
+Iterable<Uint8List> _decodeBatch(Uint8List batch) sync* {
+  final data = ByteData.sublistView(batch);
+  var offset = 0;
+
+  while (offset < batch.length) {
+    if (offset + 4 > batch.length) {
+      print('malformed response batch');
+      return;
+    }
+
+    final end = offset + 4 + data.getUint32(offset);
+    offset += 4;
+
+    if (end > batch.length) {
+      print('malformed response batch');
+      return;
+    }
+
+    yield Uint8List.sublistView(batch, offset, end);
+    offset = end;
+  }
+}
+
 class Subscription {
   final Client _client;
   final StreamController<Object?> _controller;
@@ -2,11 +2,13 @@ import 'dart:async';
 import 'dart:collection';
 import 'dart:convert';
 import 'dart:ffi';
+import 'dart:io' show Platform;
 import 'dart:isolate';
 import 'dart:typed_data';
 import 'dart:math';
 
 import 'package:ffi/ffi.dart';
+import 'package:flutter/services.dart';
 import 'package:hex/hex.dart';
 
 import 'bindings.dart';
@@ -38,10 +40,14 @@ const defaultLogTag = 'flutter-ouisync';
 class Session {
   final Client _client;
   final Subscription _networkSubscription;
+  // Whether the messages of this session are delivered through the native part of the plugin
+  // (see [createBatched]).
+  final bool _batched;
   String? _mountPoint;
 
-  Session._(this._client)
-      : _networkSubscription = Subscription(_client, "network", null);
+  Session._(this._client, {bool batched = false})
+      : _batched = batched,
+        _networkSubscription = Subscription(_client, "network", null);
 
   /// Creates a new session in this process.
   /// [configPath] is a path to a directory where configuration files shall be stored. If it
@@ -78,11 +84,70 @@ class Session {
       throw Error(errorCode, errorMessage);
     }
 
-    final client = Client(handle, recvPort);
+    // The responses and notifications that are ready at the same time are delivered in a single
+    // port message, to reduce the number of wakeups of this isolate.
+    final client = Client(
+      handle,
+      recvPort.cast<Uint8List>(),
+      batchResponses: true,
+    );
 
     return Session._(client);
   }
 
+  /// Creates a new session in this process whose responses and notifications are delivered in
+  /// batches through the native part of the plugin instead of one port message each. This reduces
+  /// the load on the UI isolate when there are many notifications (e.g., a directory with many
+  /// changing files). Currently supported only on Windows, on other platforms this is the same as
+  /// [create].
+  ///
+  /// The arguments have the same meaning as in [create].
+  static Future<Session> createBatched({
+    SessionKind kind = SessionKind.shared,
+    required String configPath,
+    String? logPath,
+    String logTag = defaultLogTag,
+  }) async {
+    if (!Platform.isWindows) {
+      return create(
+        kind: kind,
+        configPath: configPath,
+        logPath: logPath,
+        logTag: logTag,
+      );
+    }
+
+    if (debugTrace) {
+      print("Session.createBatched $configPath");
+    }
+
+    final int handle;
+
+    try {
+      handle = await _pluginChannel.invokeMethod<int>('sessionCreate', {
+        'kind': kind.encode(),
+        'configPath': configPath,
+        'logPath': logPath,
+        'logTag': logTag,
+      }) as int;
+    } on PlatformException catch (e) {
+      throw Error(
+        ErrorCode.decode(int.tryParse(e.code) ?? ErrorCode.other.encode()),
+        e.message ?? '',
+      );
+    }
+
+    // Each session has its own channel. The messages received before we start listening stay queued
+    // on the native side so none gets lost.
+    final messages = EventChannel('$_batchedMessagesChannelPrefix$handle')
+        .receiveBroadcastStream()
+        .expand((batch) => (batch as List<Object?>).cast<Uint8List>());
+
+    final client = Client(handle, messages);
+
+    return Session._(client, batched: true);
+  }
+
   String? get mountPoint => _mountPoint;
 
   // Mount all repositories that are open now or in future in read or
@@ -220,6 +285,10 @@ class Session {
         port,
       ),
     );
+
+    if (_batched) {
+      await _pluginChannel.invokeMethod<void>('sessionClose', handle);
+    }
   }
 
   /// Try to gracefully close connections to peers then close the session.
@@ -236,6 +305,10 @@ class Session {
     }
 
     bindings.session_close_blocking(handle);
+
+    if (_batched) {
+      unawaited(_pluginChannel.invokeMethod<void>('sessionClose', handle));
+    }
   }
 }
 
@@ -383,6 +456,39 @@ class Repository {
     return Repository._(session._client, handle, store);
   }
 
+  /// Opens multiple existing repositories concurrently. This is faster than opening them one by
+  /// one (e.g. when opening all the repositories at startup). The keys of [stores] are the store
+  /// paths and the values the local secrets (if any). The repositories are returned in the same
+  /// order as [stores]. If any of them fails to open, throws and closes the ones opened by this
+  /// call (repositories that were already open before stay open).
+  ///
+  /// See also [open].
+  static Future<List<Repository>> openMany(
+    Session session, {
+    required Map<String, LocalSecret?> stores,
+  }) async {
+    if (debugTrace) {
+      print("Repository.openMany ${stores.keys}");
+    }
+
+    final handles = await session._client.invoke<List<Object?>>(
+      'repository_open_many',
+      stores.entries
+          .map((entry) => {
+                'path': entry.key,
+                'secret': entry.value?.encode(),
+              })
+          .toList(),
+    );
+
+    final paths = stores.keys.toList();
+
+    return [
+      for (var i = 0; i < paths.length; ++i)
+        Repository._(session._client, handles[i] as int, paths[i])
+    ];
+  }
+
   /// Closes the repository. All outstanding handles become invalid. Invoking any operation on a
   /// repository after it's been closed results in an error being thrown.
   Future<void> close() async {
@@ -475,6 +581,34 @@ class Repository {
     });
   }
 
+  /// Import the directory [src] on the host filesystem (including all its files and
+  /// subdirectories) into the directory [dst] in this repository.
+  Future<void> importDirectory(String src, String dst) async {
+    if (debugTrace) {
+      print("Repository.importDirectory $src -> $dst");
+    }
+
+    await _client.invoke<void>('repository_import_directory', {
+      'repository': _handle,
+      'src': src,
+      'dst': dst,
+    });
+  }
+
+  /// Export the directory [src] in this repository (including all its files and subdirectories)
+  /// into the directory [dst] on the host filesystem.
+  Future<void> exportDirectory(String src, String dst) async {
+    if (debugTrace) {
+      print("Repository.exportDirectory $src -> $dst");
+    }
+
+    await _client.invoke<void>('repository_export_directory', {
+      'repository': _handle,
+      'src': src,
+      'dst': dst,
+    });
+  }
+
   Stream<void> get events => _subscription.stream.cast<void>();
 
   Future<bool> get isDhtEnabled async {
@@ -884,6 +1018,30 @@ class File {
         'file_read', {'file': _handle, 'offset': offset, 'len': size});
   }
 
+  /// Read at most [size] bytes from this file, starting at [offset], directly into the native
+  /// [buffer] which must be at least [size] bytes long. Returns the number of bytes read which can
+  /// be less than [size] (or zero) at the end of the file.
+  ///
+  /// Unlike [read] this doesn't copy the data through the message channel. The [buffer] must not
+  /// be accessed nor freed until the returned future completes.
+  Future<int> readInto(int offset, Pointer<Uint8> buffer, int size) {
+    if (debugTrace) {
+      print("File.readInto");
+    }
+
+    return _invokeLen(
+      (port) => bindings.file_read_to_buffer(
+        _client.handle,
+        _handle,
+        offset,
+        buffer,
+        size,
+        NativeApi.postCObject,
+        port,
+      ),
+    );
+  }
+
   /// Write [data] to this file starting at [offset].
   Future<void> write(int offset, List<int> data) {
     if (debugTrace) {
@@ -936,6 +1094,24 @@ class File {
       ),
     );
   }
+
+  /// Replace the contents of the file with the contents read from the provided raw file
+  /// descriptor and flush the file.
+  Future<void> copyFromRawFd(int fd) {
+    if (debugTrace) {
+      print("File.copyFromRawFd");
+    }
+
+    return _invoke(
+      (port) => bindings.file_copy_from_raw_fd(
+        _client.handle,
+        _handle,
+        fd,
+        NativeApi.postCObject,
+        port,
+      ),
+    );
+  }
 }
 
 /// Print log message
@@ -959,6 +1135,9 @@ class Error implements Exception {
 
 // Private helpers to simplify working with the native API:
 
+const _pluginChannel = MethodChannel('ouisync');
+const _batchedMessagesChannelPrefix = 'ouisync/messages/';
+
 // Call the sync function passing it a [_Pool] which will be released when the function returns.
 T _withPoolSync<T>(T Function(_Pool) fun) {
   final pool = _Pool();
@@ -996,6 +1175,28 @@ Future<void> _invoke(void Function(int) fun) async {
   }
 }
 
+// Helper to invoke a native async function which responds with a length (e.g., number of bytes
+// read).
+Future<int> _invokeLen(void Function(int) fun) async {
+  final recvPort = ReceivePort();
+
+  try {
+    fun(recvPort.sendPort.nativePort);
+
+    final bytes = await recvPort.cast<Uint8List>().first;
+    final data = bytes.buffer.asByteData();
+    final code = ErrorCode.decode(data.getUint16(0));
+
+    if (code == ErrorCode.ok) {
+      return data.getUint64(2);
+    } else {
+      throw Error(code, utf8.decode(bytes.sublist(2)));
+    }
+  } finally {
+    recvPort.close();
+  }
+}
+
 // Allocator that tracks all allocations and frees them all at the same time.
 class _Pool implements Allocator {
   List<Pointer<NativeType>> ptrs = [];
@@ -0,0 +1,38 @@
+#ifndef FLUTTER_PLUGIN_OUISYNC_FFI_H_
+#define FLUTTER_PLUGIN_OUISYNC_FFI_H_
+
+// Subset of the C API exported by the `ouisync_ffi` library (see `ffi/src/lib.rs`) which is used
+// by the native part of the plugin.
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef uint64_t SessionHandle;
+
+typedef struct SessionCreateResult {
+  SessionHandle session;
+  uint16_t error_code;
+  const char *error_message;
+} SessionCreateResult;
+
+typedef void (*Callback)(void *context, const uint8_t *msg_ptr, uint64_t msg_len);
+
+SessionCreateResult session_create(uint8_t kind,
+                                   const char *configs_path,
+                                   const char *log_path,
+                                   const char *log_tag,
+                                   void *context,
+                                   Callback callback);
+
+void session_close_blocking(SessionHandle session);
+
+void free_string(char *ptr);
+
+#if defined(__cplusplus)
+}  // extern "C"
+#endif
+
+#endif  // FLUTTER_PLUGIN_OUISYNC_FFI_H_
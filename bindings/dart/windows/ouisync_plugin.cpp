@@ -6,21 +6,210 @@
 // For getPlatformVersion; remove unless needed for your plugin implementation.
 #include <VersionHelpers.h>
 
+#include <flutter/event_channel.h>
+#include <flutter/event_stream_handler_functions.h>
 #include <flutter/method_channel.h>
 #include <flutter/plugin_registrar_windows.h>
 #include <flutter/standard_method_codec.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ouisync_ffi.h"
 
 namespace {
 
+// Subset of `ErrorCode` from the ouisync library. Used as error codes in method call results.
+constexpr const char *kErrorOperationNotSupported = "8";
+constexpr const char *kErrorInvalidArgument = "11";
+
+// How long to wait for more messages before delivering a batch to dart. Roughly one frame so the
+// UI isolate is woken up at most once per frame.
+constexpr std::chrono::milliseconds kBatchWindow(16);
+
+// Deliver the batch immediately when it reaches this many messages, even if `kBatchWindow` hasn't
+// elapsed yet.
+constexpr size_t kMaxBatchSize = 1024;
+
+// Whether the message is a notification (as opposed to a response). A message consists of the
+// message id (big endian u64) followed by the msgpack encoded `ServerMessage` which, for
+// notifications, is a single entry map keyed by "notification". Anything else (including messages
+// batched by the session itself) is treated as a response so it's never delayed.
+bool IsNotification(const uint8_t *msg_ptr, uint64_t msg_len) {
+  static constexpr char kKey[] = "notification";
+  constexpr size_t kKeyLen = sizeof(kKey) - 1;
+  constexpr size_t kIdLen = 8;
+
+  if (msg_len < kIdLen + 2 + kKeyLen) {
+    return false;
+  }
+
+  const uint8_t *body = msg_ptr + kIdLen;
+
+  // fixmap with one entry, then fixstr of the key length.
+  return body[0] == 0x81 && body[1] == (0xa0 | kKeyLen) &&
+         std::memcmp(body + 2, kKey, kKeyLen) == 0;
+}
+
+// Collects messages sent from a ouisync session and delivers them to the platform thread. There is
+// one batcher per session so messages of different sessions never end up in the same batch.
+// Notifications are delivered in batches, responses immediately (together with any notifications
+// queued before them, to preserve the order).
+//
+// Messages are received on arbitrary threads via `Callback`. A dedicated thread waits for the first
+// message of a batch, lets the batch fill up for `kBatchWindow` (unless a response is queued) and
+// then posts a window message (with the session handle as `WPARAM`) to the top-level flutter window.
+// The platform thread then drains the batch via `Take` and forwards it to dart with a single event.
+// Nothing is posted until the session handle is known (see `SetSession`), the messages received
+// before that stay queued.
+class MessageBatcher {
+ public:
+  MessageBatcher(HWND window, UINT window_message)
+      : window_(window), window_message_(window_message) {
+    thread_ = std::thread([this] { Run(); });
+  }
+
+  ~MessageBatcher() { Stop(); }
+
+  // Disallow copy and assign.
+  MessageBatcher(const MessageBatcher &) = delete;
+  MessageBatcher &operator=(const MessageBatcher &) = delete;
+
+  // The `Callback` passed to `session_create`. `context` must point to a `MessageBatcher`.
+  static void Callback(void *context, const uint8_t *msg_ptr, uint64_t msg_len) {
+    static_cast<MessageBatcher *>(context)->Push(msg_ptr, msg_len);
+  }
+
+  // Sets the handle of the session this batcher collects the messages of. Must be called once the
+  // session is created.
+  void SetSession(uint64_t session) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      session_ = session;
+    }
+
+    cv_.notify_one();
+  }
+
+  // Takes all currently queued messages. Must be called on the platform thread.
+  std::vector<std::vector<uint8_t>> Take() {
+    std::vector<std::vector<uint8_t>> batch;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      batch.swap(queue_);
+      posted_ = false;
+    }
+
+    cv_.notify_one();
+
+    return batch;
+  }
+
+  // Stops the batching thread. Any queued messages and messages received afterwards are discarded.
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopped_) {
+        return;
+      }
+
+      stopped_ = true;
+      queue_.clear();
+    }
+
+    cv_.notify_one();
+    thread_.join();
+  }
+
+ private:
+  void Push(const uint8_t *msg_ptr, uint64_t msg_len) {
+    bool is_response = !IsNotification(msg_ptr, msg_len);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopped_) {
+        return;
+      }
+
+      queue_.emplace_back(msg_ptr, msg_ptr + msg_len);
+      urgent_ = urgent_ || is_response;
+    }
+
+    cv_.notify_one();
+  }
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+      // Wait for the first message of the next batch (and for the previous batch to be taken).
+      cv_.wait(lock,
+               [this] { return stopped_ || (session_ != 0 && !posted_ && !queue_.empty()); });
+
+      if (stopped_) {
+        break;
+      }
+
+      // Let the batch fill up, unless there is a response waiting.
+      cv_.wait_for(lock, kBatchWindow, [this] {
+        return stopped_ || urgent_ || queue_.size() >= kMaxBatchSize;
+      });
+
+      if (stopped_) {
+        break;
+      }
+
+      posted_ = true;
+      urgent_ = false;
+
+      WPARAM session = static_cast<WPARAM>(session_);
+
+      lock.unlock();
+      PostMessage(window_, window_message_, session, 0);
+      lock.lock();
+    }
+  }
+
+  const HWND window_;
+  const UINT window_message_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::vector<uint8_t>> queue_;
+  // Handle of the session, zero until it's created.
+  uint64_t session_ = 0;
+  // Whether a window message has been posted for the current batch but the batch hasn't been taken
+  // yet.
+  bool posted_ = false;
+  // Whether the queue contains a response which should be delivered without waiting for the batch
+  // to fill up.
+  bool urgent_ = false;
+  bool stopped_ = false;
+  std::thread thread_;
+};
+
+// Session created through the plugin, together with the channel its messages are delivered through.
+struct BatchedSession {
+  std::unique_ptr<MessageBatcher> batcher;
+  std::unique_ptr<flutter::EventChannel<flutter::EncodableValue>> event_channel;
+  std::unique_ptr<flutter::EventSink<flutter::EncodableValue>> event_sink;
+};
+
 class OuisyncPlugin : public flutter::Plugin {
  public:
   static void RegisterWithRegistrar(flutter::PluginRegistrarWindows *registrar);
 
-  OuisyncPlugin();
+  OuisyncPlugin(flutter::PluginRegistrarWindows *registrar);
 
   virtual ~OuisyncPlugin();
 
@@ -29,6 +218,34 @@ class OuisyncPlugin : public flutter::Plugin {
   void HandleMethodCall(
       const flutter::MethodCall<flutter::EncodableValue> &method_call,
       std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  // Creates a ouisync session whose messages are delivered through the event channel.
+  void HandleSessionCreate(
+      const flutter::EncodableMap &args,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  // Stops delivering the messages of a session created by `HandleSessionCreate`. Must be called
+  // after the session has been closed.
+  void HandleSessionClose(
+      int64_t session,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+  // Called on the platform thread for every message received by the top-level window.
+  std::optional<LRESULT> HandleWindowProc(HWND hwnd, UINT message, WPARAM wparam,
+                                          LPARAM lparam);
+
+  // Forwards the queued messages of the session to dart. If there is no event sink yet (dart is
+  // not listening), the messages stay queued until it's attached.
+  void DeliverMessages(BatchedSession &session);
+
+  flutter::PluginRegistrarWindows *registrar_;
+  int window_proc_id_ = -1;
+  UINT window_message_;
+  // Top-level flutter window, null if there is no view.
+  HWND window_ = nullptr;
+
+  // Sessions created through the plugin and not closed yet, by their handles.
+  std::map<uint64_t, std::unique_ptr<BatchedSession>> sessions_;
 };
 
 // static
@@ -39,7 +256,7 @@ void OuisyncPlugin::RegisterWithRegistrar(
           registrar->messenger(), "ouisync",
           &flutter::StandardMethodCodec::GetInstance());
 
-  auto plugin = std::make_unique<OuisyncPlugin>();
+  auto plugin = std::make_unique<OuisyncPlugin>(registrar);
 
   channel->SetMethodCallHandler(
       [plugin_pointer = plugin.get()](const auto &call, auto result) {
@@ -49,9 +266,31 @@ void OuisyncPlugin::RegisterWithRegistrar(
   registrar->AddPlugin(std::move(plugin));
 }
 
-OuisyncPlugin::OuisyncPlugin() {}
+OuisyncPlugin::OuisyncPlugin(flutter::PluginRegistrarWindows *registrar)
+    : registrar_(registrar),
+      window_message_(RegisterWindowMessage(L"OuisyncPluginMessages")) {
+  window_proc_id_ = registrar_->RegisterTopLevelWindowProcDelegate(
+      [this](HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam) {
+        return HandleWindowProc(hwnd, message, wparam, lparam);
+      });
+
+  if (auto view = registrar_->GetView()) {
+    window_ = GetAncestor(view->GetNativeWindow(), GA_ROOT);
+  }
+}
+
+OuisyncPlugin::~OuisyncPlugin() {
+  registrar_->UnregisterTopLevelWindowProcDelegate(window_proc_id_);
 
-OuisyncPlugin::~OuisyncPlugin() {}
+  for (auto &[handle, session] : sessions_) {
+    session->batcher->Stop();
+
+    // The batcher is the `context` of the session callback and as such it must outlive the session.
+    // The session is owned (and closed) by the dart side so we can't guarantee it's closed by now.
+    // Leak the (stopped) batcher to stay on the safe side.
+    session->batcher.release();
+  }
+}
 
 void OuisyncPlugin::HandleMethodCall(
     const flutter::MethodCall<flutter::EncodableValue> &method_call,
@@ -67,11 +306,175 @@ void OuisyncPlugin::HandleMethodCall(
       version_stream << "7";
     }
     result->Success(flutter::EncodableValue(version_stream.str()));
+  } else if (method_call.method_name().compare("sessionCreate") == 0) {
+    const auto *args = std::get_if<flutter::EncodableMap>(method_call.arguments());
+    if (!args) {
+      result->Error(kErrorInvalidArgument, "expected map of arguments");
+      return;
+    }
+
+    HandleSessionCreate(*args, std::move(result));
+  } else if (method_call.method_name().compare("sessionClose") == 0) {
+    // The codec encodes dart ints as 32 bit ints when they fit, as 64 bit ints otherwise.
+    const auto *args = method_call.arguments();
+    int64_t session = 0;
+
+    if (const auto *value = args ? std::get_if<int32_t>(args) : nullptr) {
+      session = *value;
+    } else if (const auto *value = args ? std::get_if<int64_t>(args) : nullptr) {
+      session = *value;
+    } else {
+      result->Error(kErrorInvalidArgument, "expected session handle");
+      return;
+    }
+
+    HandleSessionClose(session, std::move(result));
   } else {
     result->NotImplemented();
   }
 }
 
+void OuisyncPlugin::HandleSessionCreate(
+    const flutter::EncodableMap &args,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  if (!window_) {
+    result->Error(kErrorOperationNotSupported, "no flutter view to deliver messages to");
+    return;
+  }
+
+  auto get_string = [&](const char *key) -> std::optional<std::string> {
+    auto it = args.find(flutter::EncodableValue(key));
+    if (it == args.end()) {
+      return std::nullopt;
+    }
+
+    if (const auto *value = std::get_if<std::string>(&it->second)) {
+      return *value;
+    } else {
+      return std::nullopt;
+    }
+  };
+
+  uint8_t kind = 0;
+  auto kind_it = args.find(flutter::EncodableValue("kind"));
+  if (kind_it != args.end()) {
+    if (const auto *value = std::get_if<int32_t>(&kind_it->second)) {
+      kind = static_cast<uint8_t>(*value);
+    }
+  }
+
+  auto config_path = get_string("configPath");
+  auto log_path = get_string("logPath");
+  auto log_tag = get_string("logTag");
+
+  if (!config_path || !log_tag) {
+    result->Error(kErrorInvalidArgument, "missing configPath or logTag");
+    return;
+  }
+
+  auto batcher = std::make_unique<MessageBatcher>(window_, window_message_);
+
+  SessionCreateResult session_result = session_create(
+      kind, config_path->c_str(), log_path ? log_path->c_str() : nullptr,
+      log_tag->c_str(), batcher.get(), &MessageBatcher::Callback);
+
+  if (session_result.error_code != 0) {
+    std::string message = session_result.error_message
+                              ? std::string(session_result.error_message)
+                              : std::string();
+    free_string(const_cast<char *>(session_result.error_message));
+
+    result->Error(std::to_string(session_result.error_code), message);
+    return;
+  }
+
+  uint64_t handle = session_result.session;
+
+  auto session = std::make_unique<BatchedSession>();
+  session->batcher = std::move(batcher);
+  session->event_channel =
+      std::make_unique<flutter::EventChannel<flutter::EncodableValue>>(
+          registrar_->messenger(), "ouisync/messages/" + std::to_string(handle),
+          &flutter::StandardMethodCodec::GetInstance());
+
+  BatchedSession *session_ptr = session.get();
+
+  session->event_channel->SetStreamHandler(
+      std::make_unique<flutter::StreamHandlerFunctions<flutter::EncodableValue>>(
+          [this, session_ptr](const flutter::EncodableValue *arguments,
+                              std::unique_ptr<flutter::EventSink<flutter::EncodableValue>> &&events)
+              -> std::unique_ptr<flutter::StreamHandlerError<flutter::EncodableValue>> {
+            session_ptr->event_sink = std::move(events);
+            // Deliver the messages queued while nobody was listening.
+            DeliverMessages(*session_ptr);
+            return nullptr;
+          },
+          [session_ptr](const flutter::EncodableValue *arguments)
+              -> std::unique_ptr<flutter::StreamHandlerError<flutter::EncodableValue>> {
+            session_ptr->event_sink = nullptr;
+            return nullptr;
+          }));
+
+  session->batcher->SetSession(handle);
+  sessions_[handle] = std::move(session);
+
+  result->Success(
+      flutter::EncodableValue(static_cast<int64_t>(session_result.session)));
+}
+
+void OuisyncPlugin::HandleSessionClose(
+    int64_t session,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+  auto it = sessions_.find(static_cast<uint64_t>(session));
+  if (it == sessions_.end()) {
+    result->Error(kErrorInvalidArgument, "unknown session");
+    return;
+  }
+
+  it->second->batcher->Stop();
+  it->second->event_channel->SetStreamHandler(nullptr);
+  sessions_.erase(it);
+
+  result->Success();
+}
+
+std::optional<LRESULT> OuisyncPlugin::HandleWindowProc(HWND hwnd, UINT message,
+                                                       WPARAM wparam,
+                                                       LPARAM lparam) {
+  if (message != window_message_) {
+    return std::nullopt;
+  }
+
+  // The session might have been closed since the message was posted.
+  auto it = sessions_.find(static_cast<uint64_t>(wparam));
+  if (it != sessions_.end()) {
+    DeliverMessages(*it->second);
+  }
+
+  return 0;
+}
+
+void OuisyncPlugin::DeliverMessages(BatchedSession &session) {
+  if (!session.event_sink) {
+    return;
+  }
+
+  auto batch = session.batcher->Take();
+
+  if (batch.empty()) {
+    return;
+  }
+
+  flutter::EncodableList list;
+  list.reserve(batch.size());
+
+  for (auto &msg : batch) {
+    list.emplace_back(std::move(msg));
+  }
+
+  session.event_sink->Success(flutter::EncodableValue(std::move(list)));
+}
+
 }  // namespace
 
 void OuisyncPluginRegisterWithRegistrar(
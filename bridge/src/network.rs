@@ -45,6 +45,11 @@ const LAST_USED_UDP_PORT_COMMENT: &str =
 
 const PEX_KEY: ConfigKey<PexConfig> = ConfigKey::new("pex", "Peer exchange configuration");
 
+const SEND_RATE_LIMIT_KEY: ConfigKey<u64> = ConfigKey::new(
+    "send_rate_limit",
+    "Max total rate (in bytes per second) at which data is sent to peers. Zero means unlimited",
+);
+
 #[derive(Eq, PartialEq, Debug, Serialize, Deserialize)]
 pub struct NetworkDefaults {
     pub port_forwarding_enabled: bool,
@@ -78,6 +83,9 @@ pub async fn init(network: &Network, config: &ConfigStore, defaults: NetworkDefa
     let PexConfig { send, recv } = config.entry(PEX_KEY).get().await.unwrap_or_default();
     network.set_pex_send_enabled(send);
     network.set_pex_recv_enabled(recv);
+
+    let limit = config.entry(SEND_RATE_LIMIT_KEY).get().await.unwrap_or(0);
+    network.set_send_rate_limit(Some(limit).filter(|limit| *limit > 0));
 }
 
 /// Binds the network to the specified addresses.
@@ -190,6 +198,17 @@ pub async fn set_pex_recv_enabled(network: &Network, config: &ConfigStore, enabl
     network.set_pex_recv_enabled(enabled);
 }
 
+/// Sets the max total send rate in bytes per second. `None` means unlimited.
+pub async fn set_send_rate_limit(network: &Network, config: &ConfigStore, limit: Option<u64>) {
+    config
+        .entry(SEND_RATE_LIMIT_KEY)
+        .set(&limit.unwrap_or(0))
+        .await
+        .ok();
+
+    network.set_send_rate_limit(limit);
+}
+
 /// Utility to help reuse bind ports across network restarts.
 struct LastUsedPorts {
     quic_v4: u16,
@@ -4,12 +4,19 @@ use crate::{
     protocol::remote::{v1, Request, ServerError},
     transport::RemoteClient,
 };
+use metrics::Label;
+use metrics_ext::{AddLabels, Pair, Shared};
 use ouisync_lib::{
     crypto::sign::Signature, Access, AccessMode, AccessSecrets, LocalSecret, Repository,
     RepositoryId, RepositoryParams, SetLocalSecret, ShareToken, StorageSize, WriteSecrets,
 };
-use state_monitor::StateMonitor;
-use std::{io, path::PathBuf, sync::Arc, time::Duration};
+use state_monitor::{metrics::MetricsRecorder, StateMonitor};
+use std::{
+    io,
+    path::{Path, PathBuf},
+    sync::Arc,
+    time::Duration,
+};
 use thiserror::Error;
 use tokio_rustls::rustls;
 use tracing::instrument;
@@ -56,10 +63,9 @@ pub async fn create(
     share_token: Option<ShareToken>,
     config: &ConfigStore,
     repos_monitor: &StateMonitor,
+    exporter: Option<&Shared>,
 ) -> Result<Repository, OpenError> {
-    let params = RepositoryParams::new(store)
-        .with_device_id(device_id::get_or_create(config).await?)
-        .with_parent_monitor(repos_monitor.clone());
+    let params = make_params(store, config, repos_monitor, exporter).await?;
 
     let access_secrets = if let Some(share_token) = share_token {
         share_token.into_secrets()
@@ -86,16 +92,56 @@ pub async fn open(
     local_secret: Option<LocalSecret>,
     config: &ConfigStore,
     repos_monitor: &StateMonitor,
+    exporter: Option<&Shared>,
 ) -> Result<Repository, OpenError> {
-    let params = RepositoryParams::new(store)
-        .with_device_id(device_id::get_or_create(config).await?)
-        .with_parent_monitor(repos_monitor.clone());
-
+    let params = make_params(store, config, repos_monitor, exporter).await?;
     let repository = Repository::open(&params, local_secret, AccessMode::Write).await?;
 
     Ok(repository)
 }
 
+/// The repository metrics are always reported to the state monitor. If `exporter` is given, they
+/// are also reported to it, labeled with the repository name (the store file name without the
+/// extension). The full store path is not used as the label because it would expose the directory
+/// layout of the device to anyone who can scrape the metrics.
+async fn make_params(
+    store: PathBuf,
+    config: &ConfigStore,
+    repos_monitor: &StateMonitor,
+    exporter: Option<&Shared>,
+) -> Result<RepositoryParams<Shared>, OpenError> {
+    // Same name the repository uses for its own monitor node, so the metrics end up next to the
+    // other repository values.
+    let name = store.to_string_lossy().into_owned();
+    let recorder = MetricsRecorder::new(repos_monitor.make_child(name));
+
+    let recorder = if let Some(exporter) = exporter {
+        Shared::new(Pair(
+            recorder,
+            AddLabels::new(
+                vec![Label::new("repo", repository_name(&store))],
+                exporter.clone(),
+            ),
+        ))
+    } else {
+        Shared::new(recorder)
+    };
+
+    Ok(RepositoryParams::new(store)
+        .with_device_id(device_id::get_or_create(config).await?)
+        .with_parent_monitor(repos_monitor.clone())
+        .with_recorder(recorder))
+}
+
+fn repository_name(store: &Path) -> String {
+    store
+        .with_extension("")
+        .file_name()
+        .unwrap_or(store.as_os_str())
+        .to_string_lossy()
+        .into_owned()
+}
+
 /// The `key` parameter is optional, if `None` the current access level of the opened
 /// repository is used. If provided, the highest access level that the key can unlock is used.
 pub async fn create_share_token(
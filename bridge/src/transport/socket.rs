@@ -4,7 +4,9 @@
 use super::{Handler, SessionContext, TransportError};
 use crate::protocol::{ServerMessage, SessionCookie};
 use bytes::{Bytes, BytesMut};
-use futures_util::{stream::FuturesUnordered, Sink, SinkExt, Stream, StreamExt, TryStreamExt};
+use futures_util::{
+    stream::FuturesUnordered, FutureExt, Sink, SinkExt, Stream, StreamExt, TryStreamExt,
+};
 use serde::{de::DeserializeOwned, Serialize};
 use std::{collections::HashMap, io, marker::PhantomData};
 use tokio::{
@@ -54,11 +56,27 @@ pub mod server_connection {
                     // unwrap is OK because the sender exists at this point.
                     let (id, notification) = notification.unwrap();
                     let message = ServerMessage::<H::Response, H::Error>::notification(notification);
-                    send(&mut socket, id, message).await;
+                    feed(&mut socket, id, message).await;
+
+                    // Coalesce with notifications that are already queued.
+                    while let Ok((id, notification)) = notification_rx.try_recv() {
+                        let message = ServerMessage::<H::Response, H::Error>::notification(notification);
+                        feed(&mut socket, id, message).await;
+                    }
+
+                    flush(&mut socket).await;
                 }
                 Some((id, result)) = request_handlers.next() => {
                     let message = ServerMessage::response(result);
-                    send(&mut socket, id, message).await;
+                    feed(&mut socket, id, message).await;
+
+                    // Coalesce with responses to requests that are already finished.
+                    while let Some(Some((id, result))) = request_handlers.next().now_or_never() {
+                        let message = ServerMessage::response(result);
+                        feed(&mut socket, id, message).await;
+                    }
+
+                    flush(&mut socket).await;
                 }
             }
         }
@@ -233,6 +251,15 @@ where
 }
 
 async fn send<W, M>(writer: &mut W, id: u64, message: M) -> bool
+where
+    W: Sink<Bytes, Error = io::Error> + Unpin,
+    M: Serialize,
+{
+    feed(writer, id, message).await && flush(writer).await
+}
+
+/// Like `send` but doesn't flush the writer. Used to send multiple messages with a single flush.
+async fn feed<W, M>(writer: &mut W, id: u64, message: M) -> bool
 where
     W: Sink<Bytes, Error = io::Error> + Unpin,
     M: Serialize,
@@ -247,7 +274,19 @@ where
         return false;
     };
 
-    if let Err(error) = writer.send(buffer.into()).await {
+    if let Err(error) = writer.feed(buffer.into()).await {
+        tracing::error!(?error, "failed to send message");
+        return false;
+    }
+
+    true
+}
+
+async fn flush<W>(writer: &mut W) -> bool
+where
+    W: Sink<Bytes, Error = io::Error> + Unpin,
+{
+    if let Err(error) = writer.flush().await {
         tracing::error!(?error, "failed to send message");
         return false;
     }
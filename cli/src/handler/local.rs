@@ -6,7 +6,9 @@ use crate::{
 };
 use async_trait::async_trait;
 use ouisync_bridge::{network, transport::SessionContext};
-use ouisync_lib::{crypto::Password, Credentials, LocalSecret, SetLocalSecret, ShareToken};
+use ouisync_lib::{
+    crypto::Password, Credentials, LocalSecret, SetLocalSecret, ShareToken, StorageSize,
+};
 use std::{sync::Arc, time::Duration};
 use tokio::fs;
 
@@ -39,6 +41,7 @@ impl LocalHandler {
             password.map(LocalSecret::Password),
             &self.state.config,
             &self.state.repositories_monitor,
+            Some(self.state.metrics_server.exporter()),
         )
         .await?;
 
@@ -127,6 +130,7 @@ impl ouisync_bridge::transport::Handler for LocalHandler {
                     share_token,
                     &self.state.config,
                     &self.state.repositories_monitor,
+                    Some(self.state.metrics_server.exporter()),
                 )
                 .await?;
 
@@ -426,6 +430,44 @@ impl ouisync_bridge::transport::Handler for LocalHandler {
                     .into())
                 }
             }
+            Request::SendRateLimit {
+                name,
+                remove,
+                value,
+            } => {
+                let value = if remove {
+                    Some(None)
+                } else {
+                    value.map(|value| Some(value.to_bytes()))
+                };
+
+                let limit = if let Some(name) = name {
+                    let holder = self.state.repositories.find(&name)?;
+
+                    if let Some(value) = value {
+                        holder.registration.set_send_rate_limit(value).await;
+                        return Ok(().into());
+                    }
+
+                    holder.registration.send_rate_limit()
+                } else if let Some(value) = value {
+                    ouisync_bridge::network::set_send_rate_limit(
+                        &self.state.network,
+                        &self.state.config,
+                        value,
+                    )
+                    .await;
+                    return Ok(().into());
+                } else {
+                    self.state.network.send_rate_limit()
+                };
+
+                if let Some(limit) = limit {
+                    Ok(StorageSize::from_bytes(limit).into())
+                } else {
+                    Ok(().into())
+                }
+            }
             Request::Quota {
                 name,
                 default: _,
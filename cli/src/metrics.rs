@@ -10,10 +10,11 @@ use hyper::{
 };
 use hyper_rustls::TlsAcceptor;
 use metrics::{Gauge, Key, KeyName, Label, Level, Metadata, Recorder, Unit};
-use metrics_exporter_prometheus::{PrometheusBuilder, PrometheusRecorder};
+use metrics_exporter_prometheus::{PrometheusBuilder, PrometheusHandle};
+use metrics_ext::Shared;
 use ouisync_bridge::config::{ConfigError, ConfigKey};
 use ouisync_lib::{PeerInfoCollector, PeerState, PublicRuntimeId};
-use scoped_task::ScopedAbortHandle;
+use scoped_task::{ScopedAbortHandle, ScopedJoinHandle};
 use std::{
     collections::HashMap,
     convert::Infallible,
@@ -23,7 +24,7 @@ use std::{
     sync::Mutex,
     time::{Duration, Instant},
 };
-use tokio::task;
+use tokio::{task, time};
 
 const BIND_METRICS_KEY: ConfigKey<SocketAddr> =
     ConfigKey::new("bind_metrics", "Addresses to bind the metrics endpoint to");
@@ -34,17 +35,39 @@ const GEO_IP_PATH: &str = "GeoLite2-Country.mmdb";
 // Rate limit for metrics collection (at most once per this interval)
 const COLLECT_INTERVAL: Duration = Duration::from_secs(10);
 
+// Interval of folding the recorded histogram samples into their summaries. The samples are
+// otherwise folded only when the metrics are served, so they would pile up in memory while the
+// server is not running or nobody is scraping it.
+const UPKEEP_INTERVAL: Duration = Duration::from_secs(5);
+
 pub(crate) struct MetricsServer {
     handle: Mutex<Option<ScopedAbortHandle>>,
+    recorder: Shared,
+    recorder_handle: PrometheusHandle,
+    _upkeep_task: ScopedJoinHandle<()>,
 }
 
 impl MetricsServer {
     pub fn new() -> Self {
+        let recorder = PrometheusBuilder::new().build_recorder();
+        let recorder_handle = recorder.handle();
+        let upkeep_task = scoped_task::spawn(upkeep(recorder_handle.clone()));
+
         Self {
             handle: Mutex::new(None),
+            recorder: Shared::new(recorder),
+            recorder_handle,
+            _upkeep_task: upkeep_task,
         }
     }
 
+    /// Recorder for the metrics (e.g. of the repositories) to be served by this server. The
+    /// recorder is the same for the whole lifetime of the server (even across rebinds) so the
+    /// metrics can be registered before the server is started.
+    pub fn exporter(&self) -> &Shared {
+        &self.recorder
+    }
+
     pub async fn init(&self, state: &State) -> Result<(), Error> {
         let entry = state.config.entry(BIND_METRICS_KEY);
 
@@ -83,8 +106,8 @@ impl MetricsServer {
 }
 
 async fn start(state: &State, addr: SocketAddr) -> Result<ScopedAbortHandle, Error> {
-    let recorder = PrometheusBuilder::new().build_recorder();
-    let recorder_handle = recorder.handle();
+    let recorder = state.metrics_server.recorder.clone();
+    let recorder_handle = state.metrics_server.recorder_handle.clone();
 
     let (collect_requester, collect_acceptor) = sync::new(COLLECT_INTERVAL);
 
@@ -137,7 +160,7 @@ async fn start(state: &State, addr: SocketAddr) -> Result<ScopedAbortHandle, Err
 
 async fn collect(
     mut acceptor: sync::Acceptor,
-    recorder: PrometheusRecorder,
+    recorder: Shared,
     peer_info_collector: PeerInfoCollector,
     geo_ip_path: PathBuf,
 ) {
@@ -204,16 +227,20 @@ async fn collect(
     }
 }
 
+async fn upkeep(recorder_handle: PrometheusHandle) {
+    let mut interval = time::interval(UPKEEP_INTERVAL);
+
+    loop {
+        interval.tick().await;
+        recorder_handle.run_upkeep();
+    }
+}
+
 #[derive(Default)]
 struct GaugeMap(HashMap<CountryCode, Gauge>);
 
 impl GaugeMap {
-    fn fetch(
-        &mut self,
-        country: CountryCode,
-        recorder: &PrometheusRecorder,
-        key_name: &KeyName,
-    ) -> &Gauge {
+    fn fetch(&mut self, country: CountryCode, recorder: &Shared, key_name: &KeyName) -> &Gauge {
         self.0.entry(country).or_insert_with(|| {
             let label = Label::new("country", country.to_string());
             let key = Key::from_parts(key_name.clone(), vec![label]);
@@ -248,6 +248,21 @@ pub(crate) enum Request {
         )]
         enabled: Option<bool>,
     },
+    /// Get or set the max rate at which data is sent to peers
+    SendRateLimit {
+        /// Name of the repository to get/set the limit for. If omitted, gets/sets the total limit
+        /// for all repositories.
+        #[arg(short, long)]
+        name: Option<String>,
+
+        /// Remove the limit
+        #[arg(short, long, conflicts_with = "value")]
+        remove: bool,
+
+        /// Limit to set, in bytes per second. If omitted, prints the current limit. Support binary
+        /// (ki, Mi, Ti, Gi, ...) and decimal (k, M, T, G, ...) suffixes.
+        value: Option<StorageSize>,
+    },
     /// Get or set storage quota
     Quota {
         /// Name of the repository to get/set the quota for
@@ -413,6 +413,7 @@ pub(crate) async fn find_all(
     network: &Network,
     config: &ConfigStore,
     monitor: &StateMonitor,
+    exporter: &metrics_ext::Shared,
 ) -> RepositoryMap {
     let repositories = RepositoryMap::new();
 
@@ -441,15 +442,21 @@ pub(crate) async fn find_all(
             continue;
         }
 
-        let repository =
-            match ouisync_bridge::repository::open(path.to_path_buf(), None, config, monitor).await
-            {
-                Ok(repository) => repository,
-                Err(error) => {
-                    tracing::error!(?error, ?path, "Failed to open repository");
-                    continue;
-                }
-            };
+        let repository = match ouisync_bridge::repository::open(
+            path.to_path_buf(),
+            None,
+            config,
+            monitor,
+            Some(exporter),
+        )
+        .await
+        {
+            Ok(repository) => repository,
+            Err(error) => {
+                tracing::error!(?error, ?path, "Failed to open repository");
+                continue;
+            }
+        };
 
         let metadata = repository.metadata();
 
@@ -54,8 +54,15 @@ impl State {
         .await;
 
         let repositories_monitor = monitor.make_child("Repositories");
-        let repositories =
-            repository::find_all(dirs, &network, &config, &repositories_monitor).await;
+        let metrics_server = MetricsServer::new();
+        let repositories = repository::find_all(
+            dirs,
+            &network,
+            &config,
+            &repositories_monitor,
+            metrics_server.exporter(),
+        )
+        .await;
 
         let state = Self {
             config,
@@ -65,7 +72,7 @@ impl State {
             repositories,
             repositories_monitor,
             rpc_servers: ServerContainer::new(),
-            metrics_server: MetricsServer::new(),
+            metrics_server,
             server_config: OnceCell::new(),
             client_config: OnceCell::new(),
         };
@@ -5,7 +5,7 @@
 
 use crate::sender::Sender;
 use bytes::Bytes;
-use std::mem;
+use std::{ffi::c_void, mem, ptr};
 
 pub(crate) struct PortSender {
     post_c_object_fn: PostDartCObjectFn,
@@ -26,10 +26,17 @@ impl PortSender {
 
 impl Sender for PortSender {
     fn send(&self, msg: Bytes) {
+        let mut object = DartCObject::from(msg);
+
         // Safety: `self` must be created via `PortSender::new` and its safety instructions must be
         // followed and `self.post_c_object_fn` can't be modified afterwards.
-        unsafe {
-            (self.post_c_object_fn)(self.port, &mut msg.into());
+        let posted = unsafe { (self.post_c_object_fn)(self.port, &mut object) };
+
+        // If the message was posted, dart took ownership of the external data and will release it
+        // by invoking the finalizer. Otherwise the ownership remains with us and it's released when
+        // `object` is dropped.
+        if posted {
+            mem::forget(object);
         }
     }
 }
@@ -43,22 +50,27 @@ pub struct DartCObject {
     value: DartCObjectValue,
 }
 
-// TODO: consider using `ExternallyTypedData` to avoid copies
+/// Converts the message into `ExternalTypedData` which dart exposes as a mutable `Uint8List`. To
+/// not let dart write through memory shared with other owners, the backing buffer is always
+/// uniquely owned: the `Bytes` buffer itself is reused (no copy) when this is its only owner,
+/// otherwise it's copied. The buffer is released by the finalizer once dart garbage collects the
+/// corresponding `Uint8List`.
 impl From<Bytes> for DartCObject {
     fn from(value: Bytes) -> Self {
-        let value = Vec::from(value);
-        let mut slice = value.into_boxed_slice();
-        let ptr = slice.as_mut_ptr();
-        let len = slice.len() as u64;
-        mem::forget(slice);
+        let mut value = Box::new(Vec::from(value));
+        let length = value.len() as isize;
+        let data = value.as_mut_ptr();
+        let peer = Box::into_raw(value) as *mut c_void;
 
         Self {
-            type_: DartCObjectType::TypedData,
+            type_: DartCObjectType::ExternalTypedData,
             value: DartCObjectValue {
-                as_typed_data: DartTypedData {
+                as_external_typed_data: DartExternalTypedData {
                     type_: DartTypedDataType::Uint8,
-                    length: len as isize,
-                    values: ptr,
+                    length,
+                    data,
+                    peer,
+                    callback: finalize_bytes,
                 },
             },
         }
@@ -68,27 +80,23 @@ impl From<Bytes> for DartCObject {
 impl Drop for DartCObject {
     fn drop(&mut self) {
         match self.type_ {
-            DartCObjectType::TypedData => {
-                // SAFETY: When `type_` is `TypedData` then `value` is a `DartTypedData`. This is
-                // guaranteed by construction.
+            DartCObjectType::ExternalTypedData => {
+                // SAFETY: When `type_` is `ExternalTypedData` then `value` is a
+                // `DartExternalTypedData` whose `peer` is a boxed `Vec<u8>`. This is guaranteed by
+                // construction.
                 unsafe {
-                    let value = self.value.as_typed_data;
-
-                    match value.type_ {
-                        DartTypedDataType::Uint8 => {
-                            let _ = Vec::from_raw_parts(
-                                value.values,
-                                value.length as usize,
-                                value.length as usize,
-                            );
-                        }
-                    }
+                    let value = self.value.as_external_typed_data;
+                    (value.callback)(ptr::null_mut(), value.peer);
                 }
             }
         }
     }
 }
 
+unsafe extern "C" fn finalize_bytes(_isolate_callback_data: *mut c_void, peer: *mut c_void) {
+    let _ = Box::from_raw(peer as *mut Vec<u8>);
+}
+
 #[repr(i32)]
 #[derive(Copy, Clone)]
 pub(crate) enum DartCObjectType {
@@ -99,8 +107,8 @@ pub(crate) enum DartCObjectType {
     // Double = 4,
     // String = 5,
     // Array = 6,
-    TypedData = 7,
-    // ExternalTypedData = 8,
+    // TypedData = 7,
+    ExternalTypedData = 8,
     // SendPort = 9,
     // Capability = 10,
     // NativePointer = 11,
@@ -118,8 +126,8 @@ pub(crate) union DartCObjectValue {
     // as_send_port: DartSendPort,
     // as_capability: DartCapability,
     // as_array: DartArray,
-    as_typed_data: DartTypedData,
-    // as_external_typed_data: DartExternalTypedData,
+    // as_typed_data: DartTypedData,
+    as_external_typed_data: DartExternalTypedData,
     // as_native_pointer: DartPointer,
     _align: [u64; 5usize],
 }
@@ -141,13 +149,12 @@ pub(crate) union DartCObjectValue {
 //     values: *mut *mut DartCObject,
 // }
 
-#[repr(C)]
-#[derive(Copy, Clone)]
-pub(crate) struct DartTypedData {
-    pub type_: DartTypedDataType,
-    pub length: isize,
-    pub values: *mut u8,
-}
+// #[repr(C)]
+// struct DartTypedData {
+//     type_: DartTypedDataType,
+//     length: isize,
+//     values: *mut u8,
+// }
 
 #[repr(i32)]
 #[derive(Copy, Clone)]
@@ -168,14 +175,15 @@ pub(crate) enum DartTypedDataType {
     // Invalid = 13,
 }
 
-// #[repr(C)]
-// struct DartExternalTypedData {
-//     ty: DartTypedDataType,
-//     length: isize, // in elements, not bytes
-//     data: *mut u8,
-//     peer: *mut c_void,
-//     callback: DartHandleFinalizer,
-// }
+#[repr(C)]
+#[derive(Copy, Clone)]
+pub(crate) struct DartExternalTypedData {
+    pub type_: DartTypedDataType,
+    pub length: isize, // in elements, not bytes
+    pub data: *mut u8,
+    pub peer: *mut c_void,
+    pub callback: DartHandleFinalizer,
+}
 
 // #[repr(C)]
 // struct DartPointer {
@@ -184,5 +192,37 @@ pub(crate) enum DartTypedDataType {
 //     callback: DartHandleFinalizer,
 // }
 
-// type DartHandleFinalizer =
-//     unsafe extern "C" fn(isolate_callback_data: *mut c_void, peer: *mut c_void);
+pub(crate) type DartHandleFinalizer =
+    unsafe extern "C" fn(isolate_callback_data: *mut c_void, peer: *mut c_void);
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn from_bytes_unique_buffer_is_not_copied() {
+        let bytes = Bytes::from(vec![1, 2, 3]);
+        let ptr = bytes.as_ptr();
+
+        let object = DartCObject::from(bytes);
+        let data = unsafe { object.value.as_external_typed_data };
+
+        assert_eq!(data.data as *const u8, ptr);
+        assert_eq!(data.length, 3);
+    }
+
+    #[test]
+    fn from_bytes_shared_buffer_is_copied() {
+        let bytes = Bytes::from(vec![1, 2, 3]);
+        let other = bytes.clone();
+
+        let object = DartCObject::from(bytes);
+        let data = unsafe { object.value.as_external_typed_data };
+
+        assert_ne!(data.data as *const u8, other.as_ptr());
+        assert_eq!(
+            unsafe { std::slice::from_raw_parts(data.data, data.length as usize) },
+            &other[..]
+        );
+    }
+}
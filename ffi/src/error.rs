@@ -108,9 +108,12 @@ impl ToErrorCode for ouisync_lib::Error {
                 ErrorCode::InvalidArgument
             }
             Self::StorageVersionMismatch => ErrorCode::StorageVersionMismatch,
-            Self::EntryIsFile | Self::EntryIsDirectory | Self::Writer(_) | Self::Locked => {
-                ErrorCode::Other
-            }
+            Self::EntryIsFile
+            | Self::EntryIsDirectory
+            | Self::Reader(_)
+            | Self::Writer(_)
+            | Self::Locked
+            | Self::Interrupted => ErrorCode::Other,
         }
     }
 }
@@ -116,19 +116,30 @@ pub(crate) async fn read(
     offset: u64,
     len: u64,
 ) -> Result<Vec<u8>, Error> {
-    let len = len as usize;
-    let mut buffer = vec![0; len];
+    let mut buffer = vec![0; len as usize];
+    let len = read_into(state, handle, offset, &mut buffer).await?;
+    buffer.truncate(len);
 
+    Ok(buffer)
+}
+
+/// Read at most `buffer.len()` bytes from the file directly into `buffer` and returns the number
+/// of bytes read. Returns less than `buffer.len()` (possibly zero) in case of EOF.
+pub(crate) async fn read_into(
+    state: &State,
+    handle: FileHandle,
+    offset: u64,
+    buffer: &mut [u8],
+) -> Result<usize, Error> {
     let holder = state.files.get(handle)?;
     let mut file = holder.file.lock().await;
 
     file.seek(SeekFrom::Start(offset));
 
     // TODO: consider using just `read`
-    let len = file.read_all(&mut buffer).await?;
-    buffer.truncate(len);
+    let len = file.read_all(buffer).await?;
 
-    Ok(buffer)
+    Ok(len)
 }
 
 /// Write `len` bytes from `buffer` into the file.
@@ -10,7 +10,7 @@ use crate::{
 use async_trait::async_trait;
 use ouisync_bridge::transport::SessionContext;
 use ouisync_lib::{crypto::cipher::SecretKey, PeerAddr};
-use std::{net::SocketAddr, sync::Arc};
+use std::{net::SocketAddr, sync::Arc, time::Instant};
 
 #[derive(Clone)]
 pub(crate) struct Handler {
@@ -36,6 +36,23 @@ impl ouisync_bridge::transport::Handler for Handler {
     ) -> Result<Self::Response, Self::Error> {
         tracing::trace!(?request);
 
+        let name = request.name();
+        let start = Instant::now();
+
+        let result = self.handle_request(request, context).await;
+
+        self.state.request_monitor.record(name, start.elapsed());
+
+        result
+    }
+}
+
+impl Handler {
+    async fn handle_request(
+        &self,
+        request: Request,
+        context: &SessionContext,
+    ) -> Result<Response, Error> {
         let response = match request {
             Request::RepositoryCreate {
                 path,
@@ -56,6 +73,14 @@ impl ouisync_bridge::transport::Handler for Handler {
                     .await?
                     .into()
             }
+            Request::RepositoryOpenMany(args) => repository::open_many(
+                &self.state,
+                args.into_iter()
+                    .map(|args| (args.path.into_std_path_buf(), args.secret))
+                    .collect(),
+            )
+            .await?
+            .into(),
             Request::RepositoryClose(handle) => {
                 repository::close(&self.state, handle).await?.into()
             }
@@ -160,6 +185,30 @@ impl ouisync_bridge::transport::Handler for Handler {
             } => repository::move_entry(&self.state, repository, src, dst)
                 .await?
                 .into(),
+            Request::RepositoryImportDirectory {
+                repository,
+                src,
+                dst,
+            } => self
+                .state
+                .repositories
+                .get(repository)?
+                .repository
+                .import_directory(src.as_std_path(), dst)
+                .await?
+                .into(),
+            Request::RepositoryExportDirectory {
+                repository,
+                src,
+                dst,
+            } => self
+                .state
+                .repositories
+                .get(repository)?
+                .repository
+                .export_directory(src, dst.as_std_path())
+                .await?
+                .into(),
             Request::RepositoryIsDhtEnabled(repository) => {
                 repository::is_dht_enabled(&self.state, repository)
                     .await?
@@ -184,6 +233,15 @@ impl ouisync_bridge::transport::Handler for Handler {
                 repository::set_pex_enabled(&self.state, repository, enabled).await?;
                 ().into()
             }
+            Request::RepositorySendRateLimit(repository) => {
+                repository::send_rate_limit(&self.state, repository)
+                    .await?
+                    .into()
+            }
+            Request::RepositorySetSendRateLimit { repository, limit } => {
+                repository::set_send_rate_limit(&self.state, repository, limit).await?;
+                ().into()
+            }
             Request::RepositoryCreateShareToken {
                 repository,
                 secret,
@@ -412,6 +470,16 @@ impl ouisync_bridge::transport::Handler for Handler {
                 .await;
                 ().into()
             }
+            Request::NetworkSendRateLimit => self.state.network.send_rate_limit().into(),
+            Request::NetworkSetSendRateLimit(limit) => {
+                ouisync_bridge::network::set_send_rate_limit(
+                    &self.state.network,
+                    &self.state.config,
+                    limit,
+                )
+                .await;
+                ().into()
+            }
             Request::NetworkExternalAddrV4 => self.state.network.external_addr_v4().await.into(),
             Request::NetworkExternalAddrV6 => self.state.network.external_addr_v6().await.into(),
             Request::NetworkNatBehavior => self.state.network.nat_behavior().await.into(),
@@ -14,6 +14,7 @@ mod network;
 mod protocol;
 mod registry;
 mod repository;
+mod request_monitor;
 mod sender;
 mod session;
 mod share_token;
@@ -24,7 +25,7 @@ mod transport;
 use crate::{
     c::{Callback, CallbackSender},
     dart::{Port, PortSender, PostDartCObjectFn},
-    error::Error,
+    error::{Error, ErrorCode},
     file::FileHandle,
     log::LogLevel,
     sender::Sender,
@@ -162,7 +163,50 @@ pub unsafe extern "C" fn session_channel_send(
     let payload = slice::from_raw_parts(payload_ptr, payload_len as usize);
     let payload = payload.into();
 
-    session.get().client_tx.send(payload).ok();
+    session.get().client_tx.send(payload);
+}
+
+/// Sends multiple requests at once. This is more efficient than calling `session_channel_send`
+/// for each of them separately.
+///
+/// The payload is a sequence of frames, each consisting of the request length (big endian `u32`)
+/// followed by the request itself (encoded the same way as in `session_channel_send`). Malformed
+/// payload is discarded as a whole.
+///
+/// # Safety
+///
+/// `session` must be a valid session handle, `payload_ptr` must be a pointer to a byte buffer
+/// whose length is at least `payload_len` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn session_channel_send_batch(
+    session: SessionHandle,
+    payload_ptr: *mut u8,
+    payload_len: u64,
+) {
+    let payload = slice::from_raw_parts(payload_ptr, payload_len as usize);
+
+    let Some(requests) = transport::decode_batch(payload) else {
+        tracing::error!("malformed request batch");
+        return;
+    };
+
+    session.get().client_tx.send_batch(requests);
+}
+
+/// Enables or disables response batching for the given session. When enabled, the responses and
+/// notifications that are ready at the same time are delivered in a single callback invocation /
+/// port message, encoded the same way as the payload of `session_channel_send_batch`. When
+/// disabled (the default), each message is delivered separately.
+///
+/// # Safety
+///
+/// `session` must be a valid session handle.
+#[no_mangle]
+pub unsafe extern "C" fn session_channel_set_batch_responses(
+    session: SessionHandle,
+    enabled: bool,
+) {
+    session.get().client_tx.set_batch_responses(enabled);
 }
 
 /// Copy the file contents into the provided raw file descriptor (dart-specific API).
@@ -239,6 +283,206 @@ pub unsafe extern "C" fn file_copy_to_raw_fd_dart(
     ))
 }
 
+/// Replace the file contents with the contents read from the provided raw file descriptor
+/// (dart-specific API). The file is flushed afterwards.
+///
+/// This function takes ownership of the file descriptor and closes it when it finishes. If the
+/// caller needs to access the descriptor afterwards (or while the function is running), he/she
+/// needs to `dup` it before passing it into this function.
+///
+/// # Safety
+///
+/// - `session` must be a valid session handle
+/// - `handle` must be a valid file holder handle
+/// - `fd` must be a valid and open file descriptor
+/// - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+/// - `port` must be a valid dart native port
+#[cfg(unix)]
+#[no_mangle]
+pub unsafe extern "C" fn file_copy_from_raw_fd_dart(
+    session: SessionHandle,
+    handle: FileHandle,
+    fd: c_int,
+    post_c_object_fn: PostDartCObjectFn,
+    port: Port,
+) {
+    use bytes::Bytes;
+    use std::{io::SeekFrom, os::fd::FromRawFd};
+    use tokio::fs;
+
+    let session = session.get();
+    let sender = PortSender::new(post_c_object_fn, port);
+
+    let dst = match session.shared.state.files.get(handle) {
+        Ok(file) => file,
+        Err(error) => {
+            sender.send(encode_error(&error.into()));
+            return;
+        }
+    };
+
+    let mut src = fs::File::from_raw_fd(fd);
+
+    session.shared.runtime.spawn(async move {
+        let mut dst = dst.file.lock().await;
+
+        let result = async {
+            dst.truncate(0)?;
+            dst.seek(SeekFrom::Start(0));
+            dst.copy_from_reader(&mut src).await?;
+            dst.flush().await
+        }
+        .await;
+
+        match result {
+            Ok(()) => sender.send(Bytes::new()),
+            Err(error) => sender.send(encode_error(&error.into())),
+        }
+    });
+}
+
+/// Always returns `OperationNotSupported` error. Defined to avoid lookup errors on non-unix
+/// platforms. Do not use.
+///
+/// # Safety
+///
+/// - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+/// - `port` must be a valid dart native port.
+/// - `session`, `handle` and `fd` are not actually used and so have no safety requirements.
+#[cfg(not(unix))]
+#[no_mangle]
+pub unsafe extern "C" fn file_copy_from_raw_fd_dart(
+    _session: SessionHandle,
+    _handle: FileHandle,
+    _fd: c_int,
+    post_c_object_fn: PostDartCObjectFn,
+    port: Port,
+) {
+    let sender = PortSender::new(post_c_object_fn, port);
+    sender.send(encode_error(
+        &ouisync_lib::Error::OperationNotSupported.into(),
+    ))
+}
+
+/// Read at most `buffer_len` bytes from the file starting at `offset` directly into the
+/// caller-provided buffer (common C-like API).
+///
+/// On success, `callback` is invoked with a message consisting of the `ErrorCode::Ok` code
+/// (big-endian `u16`) followed by the number of bytes read (big-endian `u64`). The number of bytes
+/// read can be less than `buffer_len` (or zero) in case of EOF. On failure, the message is the
+/// error code followed by the utf-8 encoded error message.
+///
+/// # Safety
+///
+/// - `session` must be a valid session handle
+/// - `handle` must be a valid file holder handle
+/// - `buffer_ptr` must be a pointer to a writable byte buffer whose length is at least
+///   `buffer_len` bytes. The buffer must stay valid and must not be accessed by the caller until
+///   `callback` is invoked.
+/// - `context` must be a valid pointer to a value that is safe to be sent to other threads or
+///   null.
+/// - `callback` must be a valid function pointer which does not leak the passed `msg_ptr`.
+#[no_mangle]
+pub unsafe extern "C" fn file_read_to_buffer(
+    session: SessionHandle,
+    handle: FileHandle,
+    offset: u64,
+    buffer_ptr: *mut u8,
+    buffer_len: u64,
+    context: *mut (),
+    callback: Callback,
+) {
+    let sender = CallbackSender::new(context, callback);
+    read_to_buffer(session, handle, offset, buffer_ptr, buffer_len, sender)
+}
+
+/// Read at most `buffer_len` bytes from the file starting at `offset` directly into the
+/// caller-provided buffer (dart-specific API).
+///
+/// See [file_read_to_buffer] for the format of the response message.
+///
+/// # Safety
+///
+/// - `session` must be a valid session handle
+/// - `handle` must be a valid file holder handle
+/// - `buffer_ptr` must be a pointer to a writable byte buffer whose length is at least
+///   `buffer_len` bytes. The buffer must stay valid and must not be accessed by the caller until
+///   the response is posted to `port`.
+/// - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+/// - `port` must be a valid dart native port
+#[no_mangle]
+pub unsafe extern "C" fn file_read_to_buffer_dart(
+    session: SessionHandle,
+    handle: FileHandle,
+    offset: u64,
+    buffer_ptr: *mut u8,
+    buffer_len: u64,
+    post_c_object_fn: PostDartCObjectFn,
+    port: Port,
+) {
+    let sender = PortSender::new(post_c_object_fn, port);
+    read_to_buffer(session, handle, offset, buffer_ptr, buffer_len, sender)
+}
+
+unsafe fn read_to_buffer<S: Sender>(
+    session: SessionHandle,
+    handle: FileHandle,
+    offset: u64,
+    buffer_ptr: *mut u8,
+    buffer_len: u64,
+    sender: S,
+) {
+    let session = session.get();
+    let state = session.shared.state.clone();
+    let buffer = RawBuffer {
+        ptr: buffer_ptr,
+        len: buffer_len as usize,
+    };
+
+    session.shared.runtime.spawn(async move {
+        // Safety: the caller guarantees the buffer stays valid and untouched until the response is
+        // sent.
+        let buffer = unsafe { buffer.as_mut_slice() };
+
+        match file::read_into(&state, handle, offset, buffer).await {
+            Ok(len) => sender.send(encode_len(len as u64)),
+            Err(error) => sender.send(encode_error(&error)),
+        }
+    });
+}
+
+/// Caller-owned buffer that can be moved into a task.
+struct RawBuffer {
+    ptr: *mut u8,
+    len: usize,
+}
+
+impl RawBuffer {
+    /// # Safety
+    ///
+    /// `ptr` must point to a writable buffer of at least `len` bytes that is not accessed by
+    /// anything else for the lifetime of the returned slice.
+    unsafe fn as_mut_slice<'a>(self) -> &'a mut [u8] {
+        if self.len == 0 {
+            &mut []
+        } else {
+            slice::from_raw_parts_mut(self.ptr, self.len)
+        }
+    }
+}
+
+// Safety: The safety contract of `RawBuffer::as_mut_slice` must be upheld.
+unsafe impl Send for RawBuffer {}
+
+fn encode_len(len: u64) -> bytes::Bytes {
+    use bytes::{BufMut, BytesMut};
+
+    let mut buffer = BytesMut::with_capacity(10);
+    buffer.put_u16(ErrorCode::Ok as u16);
+    buffer.put_u64(len);
+    buffer.freeze()
+}
+
 fn encode_error(error: &Error) -> bytes::Bytes {
     use bytes::{BufMut, BytesMut};
 
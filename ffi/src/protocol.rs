@@ -34,6 +34,8 @@ pub(crate) enum Request {
         path: Utf8PathBuf,
         secret: Option<LocalSecret>,
     },
+    /// Opens multiple repositories concurrently (e.g. all the repositories at startup).
+    RepositoryOpenMany(Vec<RepositoryOpenArgs>),
     RepositoryClose(RepositoryHandle),
     RepositorySubscribe(RepositoryHandle),
     ListRepositories,
@@ -77,6 +79,18 @@ pub(crate) enum Request {
         src: Utf8PathBuf,
         dst: Utf8PathBuf,
     },
+    /// Imports a directory tree from the host filesystem (`src`) into the repository (`dst`).
+    RepositoryImportDirectory {
+        repository: RepositoryHandle,
+        src: Utf8PathBuf,
+        dst: Utf8PathBuf,
+    },
+    /// Exports a directory tree from the repository (`src`) into the host filesystem (`dst`).
+    RepositoryExportDirectory {
+        repository: RepositoryHandle,
+        src: Utf8PathBuf,
+        dst: Utf8PathBuf,
+    },
     RepositoryIsDhtEnabled(RepositoryHandle),
     RepositorySetDhtEnabled {
         repository: RepositoryHandle,
@@ -87,6 +101,11 @@ pub(crate) enum Request {
         repository: RepositoryHandle,
         enabled: bool,
     },
+    RepositorySendRateLimit(RepositoryHandle),
+    RepositorySetSendRateLimit {
+        repository: RepositoryHandle,
+        limit: Option<u64>,
+    },
     RepositoryCreateShareToken {
         repository: RepositoryHandle,
         secret: Option<LocalSecret>,
@@ -205,6 +224,8 @@ pub(crate) enum Request {
     NetworkSetPortForwardingEnabled(bool),
     NetworkIsLocalDiscoveryEnabled,
     NetworkSetLocalDiscoveryEnabled(bool),
+    NetworkSendRateLimit,
+    NetworkSetSendRateLimit(Option<u64>),
     NetworkExternalAddrV4,
     NetworkExternalAddrV6,
     NetworkNatBehavior,
@@ -222,6 +243,184 @@ pub(crate) enum Request {
     GetWritePasswordSalt(RepositoryHandle),
 }
 
+impl Request {
+    /// Name of the request (same as its serialized tag). Used to break down the request metrics.
+    pub fn name(&self) -> &'static str {
+        variant_tag::get(self).unwrap_or("unknown")
+    }
+}
+
+/// Gets the serialized tag of an enum variant without serializing its content. Unlike a hand
+/// written `match`, this can never get out of sync with the serde attributes.
+mod variant_tag {
+    use serde::{
+        ser::{self, Impossible},
+        Serialize, Serializer,
+    };
+    use std::fmt;
+
+    /// Returns the tag of the variant `value` serializes as, or `None` if it's not an enum.
+    pub(super) fn get<T: Serialize + ?Sized>(value: &T) -> Option<&'static str> {
+        match value.serialize(TagSerializer) {
+            Err(Outcome::Tag(tag)) => Some(tag),
+            Ok(()) | Err(Outcome::NotEnum) => None,
+        }
+    }
+
+    // The tag is returned as an error to stop the serialization as soon as it's known.
+    #[derive(Debug)]
+    enum Outcome {
+        Tag(&'static str),
+        NotEnum,
+    }
+
+    impl fmt::Display for Outcome {
+        fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+            match self {
+                Self::Tag(tag) => write!(f, "variant {tag}"),
+                Self::NotEnum => write!(f, "not an enum"),
+            }
+        }
+    }
+
+    impl std::error::Error for Outcome {}
+
+    impl ser::Error for Outcome {
+        fn custom<T: fmt::Display>(_msg: T) -> Self {
+            Self::NotEnum
+        }
+    }
+
+    struct TagSerializer;
+
+    macro_rules! not_enum {
+        ($($method:ident($($arg:ty),*);)*) => {
+            $(
+                fn $method(self, $(_: $arg),*) -> Result<Self::Ok, Self::Error> {
+                    Err(Outcome::NotEnum)
+                }
+            )*
+        };
+    }
+
+    impl Serializer for TagSerializer {
+        type Ok = ();
+        type Error = Outcome;
+        type SerializeSeq = Impossible<(), Outcome>;
+        type SerializeTuple = Impossible<(), Outcome>;
+        type SerializeTupleStruct = Impossible<(), Outcome>;
+        type SerializeTupleVariant = Impossible<(), Outcome>;
+        type SerializeMap = Impossible<(), Outcome>;
+        type SerializeStruct = Impossible<(), Outcome>;
+        type SerializeStructVariant = Impossible<(), Outcome>;
+
+        not_enum! {
+            serialize_bool(bool);
+            serialize_i8(i8);
+            serialize_i16(i16);
+            serialize_i32(i32);
+            serialize_i64(i64);
+            serialize_u8(u8);
+            serialize_u16(u16);
+            serialize_u32(u32);
+            serialize_u64(u64);
+            serialize_f32(f32);
+            serialize_f64(f64);
+            serialize_char(char);
+            serialize_str(&str);
+            serialize_bytes(&[u8]);
+            serialize_none();
+            serialize_unit();
+            serialize_unit_struct(&'static str);
+        }
+
+        fn serialize_some<T: Serialize + ?Sized>(self, _value: &T) -> Result<(), Outcome> {
+            Err(Outcome::NotEnum)
+        }
+
+        fn serialize_newtype_struct<T: Serialize + ?Sized>(
+            self,
+            _name: &'static str,
+            _value: &T,
+        ) -> Result<(), Outcome> {
+            Err(Outcome::NotEnum)
+        }
+
+        fn serialize_seq(self, _len: Option<usize>) -> Result<Self::SerializeSeq, Outcome> {
+            Err(Outcome::NotEnum)
+        }
+
+        fn serialize_tuple(self, _len: usize) -> Result<Self::SerializeTuple, Outcome> {
+            Err(Outcome::NotEnum)
+        }
+
+        fn serialize_tuple_struct(
+            self,
+            _name: &'static str,
+            _len: usize,
+        ) -> Result<Self::SerializeTupleStruct, Outcome> {
+            Err(Outcome::NotEnum)
+        }
+
+        fn serialize_map(self, _len: Option<usize>) -> Result<Self::SerializeMap, Outcome> {
+            Err(Outcome::NotEnum)
+        }
+
+        fn serialize_struct(
+            self,
+            _name: &'static str,
+            _len: usize,
+        ) -> Result<Self::SerializeStruct, Outcome> {
+            Err(Outcome::NotEnum)
+        }
+
+        fn serialize_unit_variant(
+            self,
+            _name: &'static str,
+            _index: u32,
+            variant: &'static str,
+        ) -> Result<(), Outcome> {
+            Err(Outcome::Tag(variant))
+        }
+
+        fn serialize_newtype_variant<T: Serialize + ?Sized>(
+            self,
+            _name: &'static str,
+            _index: u32,
+            variant: &'static str,
+            _value: &T,
+        ) -> Result<(), Outcome> {
+            Err(Outcome::Tag(variant))
+        }
+
+        fn serialize_tuple_variant(
+            self,
+            _name: &'static str,
+            _index: u32,
+            variant: &'static str,
+            _len: usize,
+        ) -> Result<Self::SerializeTupleVariant, Outcome> {
+            Err(Outcome::Tag(variant))
+        }
+
+        fn serialize_struct_variant(
+            self,
+            _name: &'static str,
+            _index: u32,
+            variant: &'static str,
+            _len: usize,
+        ) -> Result<Self::SerializeStructVariant, Outcome> {
+            Err(Outcome::Tag(variant))
+        }
+    }
+}
+
+#[derive(Eq, PartialEq, Debug, Deserialize, Serialize)]
+pub(crate) struct RepositoryOpenArgs {
+    pub path: Utf8PathBuf,
+    pub secret: Option<LocalSecret>,
+}
+
 #[derive(Eq, PartialEq, Serialize, Deserialize)]
 #[serde(rename_all = "snake_case")]
 pub(crate) enum Response {
@@ -620,6 +819,16 @@ mod tests {
                 share_token: None,
             },
             Request::RepositoryClose(Handle::from_id(1)),
+            Request::RepositoryOpenMany(vec![
+                RepositoryOpenArgs {
+                    path: Utf8PathBuf::from("/tmp/a.db"),
+                    secret: None,
+                },
+                RepositoryOpenArgs {
+                    path: Utf8PathBuf::from("/tmp/b.db"),
+                    secret: None,
+                },
+            ]),
             Request::RepositorySetCredentials {
                 repository: Handle::from_id(1),
                 credentials: credentials.encode().into(),
@@ -633,6 +842,38 @@ mod tests {
         }
     }
 
+    #[test]
+    fn request_name() {
+        let cases = [
+            (Request::ListRepositories, "list_repositories"),
+            (
+                Request::RepositoryClose(Handle::from_id(1)),
+                "repository_close",
+            ),
+            (
+                Request::RepositoryOpen {
+                    path: Utf8PathBuf::from("/tmp/repo.db"),
+                    secret: None,
+                },
+                "repository_open",
+            ),
+            (
+                Request::NetworkSetPortForwardingEnabled(true),
+                "network_set_port_forwarding_enabled",
+            ),
+        ];
+
+        for (request, name) in cases {
+            assert_eq!(request.name(), name);
+
+            // The name is the same as the serialized tag.
+            let encoded = rmp_serde::to_vec(&request).unwrap();
+            assert!(encoded
+                .windows(name.len())
+                .any(|window| window == name.as_bytes()));
+        }
+    }
+
     #[test]
     fn response_serialize_deserialize() {
         let origs = [
@@ -4,6 +4,7 @@ use crate::{
     state::{State, TaskHandle},
 };
 use camino::Utf8PathBuf;
+use futures_util::future;
 use ouisync_bridge::{protocol::Notification, repository, transport::NotificationSender};
 use ouisync_lib::{
     self, crypto::Hashable, path, AccessMode, Credentials, Event, LocalSecret, Progress,
@@ -52,6 +53,7 @@ pub(crate) async fn create(
         share_token,
         &state.config,
         &state.repos_monitor,
+        None,
     )
     .await?;
 
@@ -71,6 +73,18 @@ pub(crate) async fn open(
     store_path: PathBuf,
     local_secret: Option<LocalSecret>,
 ) -> Result<RepositoryHandle, Error> {
+    open_or_reuse(state, store_path, local_secret)
+        .await
+        .map(|(handle, _)| handle)
+}
+
+/// Like `open` but also returns whether the repository was opened by this call (`true`) or was
+/// already open before (`false`).
+async fn open_or_reuse(
+    state: &State,
+    store_path: PathBuf,
+    local_secret: Option<LocalSecret>,
+) -> Result<(RepositoryHandle, bool), Error> {
     let entry = match state.repositories.entry(store_path.clone()).await {
         RepositoryEntry::Occupied(handle) => {
             // If `local_secret` provides higher access mode than what the repo currently has,
@@ -82,7 +96,7 @@ pub(crate) async fn open(
                 .set_access_mode(AccessMode::Write, local_secret.clone())
                 .await?;
 
-            return Ok(handle);
+            return Ok((handle, false));
         }
         RepositoryEntry::Vacant(entry) => entry,
     };
@@ -92,6 +106,7 @@ pub(crate) async fn open(
         local_secret,
         &state.config,
         &state.repos_monitor,
+        None,
     )
     .await?;
 
@@ -102,7 +117,47 @@ pub(crate) async fn open(
     };
     let handle = entry.insert(holder);
 
-    Ok(handle)
+    Ok((handle, true))
+}
+
+/// Opens multiple existing repositories concurrently. Returns their handles in the same order as
+/// the given paths. Fails if any of them fails to open, in which case the ones opened by this call
+/// are closed again (those that were already open before stay open).
+pub(crate) async fn open_many(
+    state: &State,
+    repos: Vec<(PathBuf, Option<LocalSecret>)>,
+) -> Result<Vec<RepositoryHandle>, Error> {
+    let results = future::join_all(
+        repos
+            .into_iter()
+            .map(|(store_path, local_secret)| open_or_reuse(state, store_path, local_secret)),
+    )
+    .await;
+
+    let mut opened = Vec::with_capacity(results.len());
+    let mut first_error = None;
+
+    for result in results {
+        match result {
+            Ok(item) => opened.push(item),
+            Err(error) => {
+                first_error.get_or_insert(error);
+            }
+        }
+    }
+
+    let Some(error) = first_error else {
+        return Ok(opened.into_iter().map(|(handle, _)| handle).collect());
+    };
+
+    // Best effort: if closing some repository fails, continue with the rest.
+    for (handle, _) in opened.into_iter().filter(|(_, new)| *new) {
+        if let Err(error) = close(state, handle).await {
+            tracing::warn!("Failed to close repository after failed open_many: {error:?}");
+        }
+    }
+
+    Err(error)
 }
 
 async fn ensure_vacant_entry(
@@ -431,6 +486,39 @@ pub(crate) async fn set_pex_enabled(
     Ok(())
 }
 
+pub(crate) async fn send_rate_limit(
+    state: &State,
+    handle: RepositoryHandle,
+) -> Result<Option<u64>, Error> {
+    Ok(state
+        .repositories
+        .get(handle)?
+        .registration
+        .read()
+        .await
+        .as_ref()
+        .ok_or(RegistrationRequired)?
+        .send_rate_limit())
+}
+
+pub(crate) async fn set_send_rate_limit(
+    state: &State,
+    handle: RepositoryHandle,
+    limit: Option<u64>,
+) -> Result<(), Error> {
+    state
+        .repositories
+        .get(handle)?
+        .registration
+        .read()
+        .await
+        .as_ref()
+        .ok_or(RegistrationRequired)?
+        .set_send_rate_limit(limit)
+        .await;
+    Ok(())
+}
+
 /// The `local_secret` parameter is optional, if `None` the current access level of the opened
 /// repository is used. If provided, the highest access level that the local_secret can unlock is
 /// used.
@@ -0,0 +1,42 @@
+use metrics::{Histogram, Key, KeyName, Level, Metadata, Recorder, Unit};
+use state_monitor::{metrics::MetricsRecorder, StateMonitor};
+use std::{collections::HashMap, sync::Mutex, time::Duration};
+
+/// Monitors the time it takes to handle the requests, broken down by the request type.
+pub(crate) struct RequestMonitor {
+    recorder: MetricsRecorder,
+    // NOTE: Never held across an await point.
+    latencies: Mutex<HashMap<&'static str, Histogram>>,
+}
+
+impl RequestMonitor {
+    pub fn new(node: StateMonitor) -> Self {
+        Self {
+            recorder: MetricsRecorder::new(node),
+            latencies: Mutex::new(HashMap::default()),
+        }
+    }
+
+    /// Records the time it took to handle a request with the given name. The histograms are
+    /// created lazily so only the requests that are actually used show up in the state monitor.
+    pub fn record(&self, name: &'static str, latency: Duration) {
+        let histogram = self
+            .latencies
+            .lock()
+            .unwrap()
+            .entry(name)
+            .or_insert_with(|| {
+                let key_name = KeyName::from(name);
+
+                self.recorder
+                    .describe_histogram(key_name.clone(), Some(Unit::Seconds), "".into());
+                self.recorder.register_histogram(
+                    &Key::from_name(key_name),
+                    &Metadata::new(module_path!(), Level::INFO, None),
+                )
+            })
+            .clone();
+
+        histogram.record(latency);
+    }
+}
@@ -3,6 +3,7 @@ use crate::{
     mounter::Mounter,
     registry::{Handle, SharedRegistry},
     repository::Repositories,
+    request_monitor::RequestMonitor,
 };
 use ouisync_bridge::{config::ConfigStore, transport};
 use ouisync_lib::Network;
@@ -24,6 +25,7 @@ pub(crate) struct State {
     pub remote_client_config: OnceCell<Arc<rustls::ClientConfig>>,
     pub repositories: Repositories,
     pub repos_monitor: StateMonitor,
+    pub request_monitor: RequestMonitor,
     pub root_monitor: StateMonitor,
     tasks: SharedRegistry<ScopedJoinHandle<()>>,
 }
@@ -39,6 +41,7 @@ impl State {
         );
 
         let repos_monitor = root_monitor.make_child("Repositories");
+        let request_monitor = RequestMonitor::new(root_monitor.make_child("Requests"));
 
         Self {
             config,
@@ -48,6 +51,7 @@ impl State {
             remote_client_config: OnceCell::new(),
             repositories: Repositories::new(),
             repos_monitor,
+            request_monitor,
             root_monitor,
             tasks: SharedRegistry::new(),
         }
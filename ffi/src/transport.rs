@@ -2,13 +2,18 @@
 //! language than the Server.
 
 use crate::{handler::Handler, sender::Sender};
-use bytes::{Bytes, BytesMut};
+use bytes::{BufMut, Bytes, BytesMut};
 use futures_util::StreamExt;
 use ouisync_bridge::{protocol::SessionCookie, transport::socket_server_connection};
 use std::{
     io,
     pin::Pin,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc,
+    },
     task::{ready, Context, Poll},
+    vec,
 };
 use tokio::sync::mpsc;
 use tokio_stream::wrappers::UnboundedReceiverStream;
@@ -35,20 +40,100 @@ where
     }
 }
 
-pub(crate) type ClientSender = mpsc::UnboundedSender<BytesMut>;
+/// Sending half of the client-to-server channel.
+pub(crate) struct ClientSender {
+    tx: mpsc::UnboundedSender<Vec<BytesMut>>,
+    batch_responses: Arc<AtomicBool>,
+}
+
+impl ClientSender {
+    /// Sends a single request to the server.
+    pub fn send(&self, request: BytesMut) {
+        self.tx.send(vec![request]).ok();
+    }
+
+    /// Sends multiple requests to the server at once. This is more efficient than sending them one
+    /// by one as the server is woken up only once for the whole batch.
+    pub fn send_batch(&self, requests: Vec<BytesMut>) {
+        if requests.is_empty() {
+            return;
+        }
+
+        self.tx.send(requests).ok();
+    }
+
+    /// Enables/disables response batching. When enabled, all the messages (responses and
+    /// notifications) that are ready at the same time are delivered to the client in a single
+    /// message encoded with [encode_batch]. Otherwise each message is delivered separately.
+    ///
+    /// Switching the batching off while some responses are still queued doesn't reorder them:
+    /// the queued responses are delivered (as a batch) before any subsequent one.
+    pub fn set_batch_responses(&self, enabled: bool) {
+        self.batch_responses.store(enabled, Ordering::Relaxed);
+    }
+}
+
+/// Splits a batch of messages encoded as a sequence of frames, each consisting of the message
+/// length (big endian u32) followed by the message itself. Returns `None` if the batch is
+/// malformed.
+pub(crate) fn decode_batch(mut input: &[u8]) -> Option<Vec<BytesMut>> {
+    let mut output = Vec::new();
+
+    while !input.is_empty() {
+        let len = input.get(..4)?;
+        let len = usize::try_from(u32::from_be_bytes(len.try_into().unwrap())).ok()?;
+        // The length comes from the client so it can't be trusted.
+        let end = len.checked_add(4)?;
+        if end > input.len() {
+            return None;
+        }
+
+        output.push(BytesMut::from(&input[4..end]));
+        input = &input[end..];
+    }
+
+    Some(output)
+}
+
+/// Inverse of [decode_batch].
+pub(crate) fn encode_batch(messages: &[Bytes]) -> Bytes {
+    let len = messages.iter().map(|message| 4 + message.len()).sum();
+    let mut output = BytesMut::with_capacity(len);
+
+    for message in messages {
+        output.put_u32(message.len() as u32);
+        output.put_slice(message);
+    }
+
+    output.freeze()
+}
 
 struct Socket<T> {
     tx: T,
-    rx: UnboundedReceiverStream<BytesMut>,
+    rx: UnboundedReceiverStream<Vec<BytesMut>>,
+    // Requests received as part of a batch but not yet yielded by the stream.
+    pending_requests: vec::IntoIter<BytesMut>,
+    // Responses queued since the last flush (only if `batch_responses` is enabled).
+    pending_responses: Vec<Bytes>,
+    batch_responses: Arc<AtomicBool>,
 }
 
 impl<T> Socket<T> {
     fn new(sender: T) -> (Self, ClientSender) {
         let (client_tx, server_rx) = mpsc::unbounded_channel();
+        let batch_responses = Arc::new(AtomicBool::new(false));
 
         let socket = Self {
             tx: sender,
             rx: UnboundedReceiverStream::new(server_rx),
+            pending_requests: Vec::new().into_iter(),
+            pending_responses: Vec::new(),
+            batch_responses: batch_responses.clone(),
+        };
+
+        let client_tx = ClientSender {
+            tx: client_tx,
+            batch_responses,
         };
 
         (socket, client_tx)
@@ -62,7 +147,29 @@ where
     type Item = io::Result<BytesMut>;
 
     fn poll_next(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Option<Self::Item>> {
-        Poll::Ready(ready!(self.rx.poll_next_unpin(cx)).map(Ok))
+        loop {
+            if let Some(request) = self.pending_requests.next() {
+                return Poll::Ready(Some(Ok(request)));
+            }
+
+            match ready!(self.rx.poll_next_unpin(cx)) {
+                Some(requests) => self.pending_requests = requests.into_iter(),
+                None => return Poll::Ready(None),
+            }
+        }
+    }
+}
+
+impl<T> Socket<T>
+where
+    T: Sender,
+{
+    fn flush_pending_responses(&mut self) {
+        if !self.pending_responses.is_empty() {
+            let batch = encode_batch(&self.pending_responses);
+            self.pending_responses.clear();
+            self.tx.send(batch);
+        }
     }
 }
 
@@ -76,16 +183,99 @@ where
         Poll::Ready(Ok(()))
     }
 
-    fn start_send(self: Pin<&mut Self>, item: Bytes) -> Result<(), Self::Error> {
-        self.tx.send(item);
+    fn start_send(mut self: Pin<&mut Self>, item: Bytes) -> Result<(), Self::Error> {
+        if self.batch_responses.load(Ordering::Relaxed) {
+            self.pending_responses.push(item);
+        } else {
+            // The batching might have been disabled after some responses were queued. Send those
+            // first so the responses are delivered in order.
+            self.flush_pending_responses();
+            self.tx.send(item);
+        }
+
         Ok(())
     }
 
-    fn poll_flush(self: Pin<&mut Self>, _cx: &mut Context<'_>) -> Poll<Result<(), Self::Error>> {
+    fn poll_flush(
+        mut self: Pin<&mut Self>,
+        _cx: &mut Context<'_>,
+    ) -> Poll<Result<(), Self::Error>> {
+        self.flush_pending_responses();
         Poll::Ready(Ok(()))
     }
 
-    fn poll_close(self: Pin<&mut Self>, _cx: &mut Context<'_>) -> Poll<Result<(), Self::Error>> {
-        Poll::Ready(Ok(()))
+    fn poll_close(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Result<(), Self::Error>> {
+        self.poll_flush(cx)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use futures_util::Sink;
+    use std::sync::Mutex;
+
+    #[derive(Clone, Default)]
+    struct TestSender(Arc<Mutex<Vec<Bytes>>>);
+
+    impl Sender for TestSender {
+        fn send(&self, msg: Bytes) {
+            self.0.lock().unwrap().push(msg);
+        }
+    }
+
+    #[test]
+    fn disable_batching_preserves_order() {
+        let sender = TestSender::default();
+        let (mut socket, client_tx) = Socket::new(sender.clone());
+
+        client_tx.set_batch_responses(true);
+        Pin::new(&mut socket)
+            .start_send(Bytes::from_static(b"a"))
+            .unwrap();
+        Pin::new(&mut socket)
+            .start_send(Bytes::from_static(b"b"))
+            .unwrap();
+
+        client_tx.set_batch_responses(false);
+        Pin::new(&mut socket)
+            .start_send(Bytes::from_static(b"c"))
+            .unwrap();
+
+        assert_eq!(
+            *sender.0.lock().unwrap(),
+            [
+                encode_batch(&[Bytes::from_static(b"a"), Bytes::from_static(b"b")]),
+                Bytes::from_static(b"c"),
+            ]
+        );
+    }
+
+    #[test]
+    fn batch_encode_decode_roundtrip() {
+        let messages = vec![
+            Bytes::from_static(b"hello"),
+            Bytes::new(),
+            Bytes::from_static(b"world"),
+        ];
+
+        let encoded = encode_batch(&messages);
+        let decoded = decode_batch(&encoded).unwrap();
+
+        assert_eq!(
+            decoded
+                .into_iter()
+                .map(BytesMut::freeze)
+                .collect::<Vec<_>>(),
+            messages
+        );
+    }
+
+    #[test]
+    fn batch_decode_malformed() {
+        assert!(decode_batch(&[0, 0, 0]).is_none());
+        assert!(decode_batch(&[0, 0, 0, 2, 1]).is_none());
+        assert!(decode_batch(&[0xff, 0xff, 0xff, 0xff, 1, 2, 3]).is_none());
+        assert_eq!(decode_batch(&[]).unwrap().len(), 0);
     }
 }
@@ -2,13 +2,26 @@ mod utils;
 
 use camino::Utf8Path;
 use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+use futures_util::future;
+use ouisync::AccessMode;
 use rand::{rngs::StdRng, SeedableRng};
 use state_monitor::StateMonitor;
 use tempfile::TempDir;
 use tokio::runtime::Runtime;
 use utils::Actor;
 
-criterion_group!(default, write_file, read_file, sync);
+criterion_group!(
+    default,
+    write_file,
+    read_file,
+    remove_file,
+    sync,
+    open_repositories,
+    write_small_files,
+    list_directory,
+    merge_directories,
+    churn
+);
 criterion_main!(default);
 
 fn write_file(c: &mut Criterion) {
@@ -106,6 +119,65 @@ fn read_file(c: &mut Criterion) {
     group.finish();
 }
 
+// Measures removing a file including the garbage collection of its blocks. Dominated by the bulk
+// block removal from the store.
+fn remove_file(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("remove_file");
+    group.sample_size(10);
+
+    let buffer_size = 4096;
+
+    for m in [1, 8, 16] {
+        let file_size = m * 1024 * 1024;
+
+        group.throughput(Throughput::Bytes(file_size));
+        group.bench_function(BenchmarkId::from_parameter(format!("{m} MiB")), |b| {
+            let file_name = Utf8Path::new("file.dat");
+
+            b.iter_batched_ref(
+                || {
+                    let mut rng = StdRng::from_entropy();
+                    let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+
+                    let repo = runtime.block_on(async {
+                        let repo = utils::create_repo(
+                            &mut rng,
+                            &base_dir.path().join("repo.db"),
+                            0,
+                            StateMonitor::make_root(),
+                        )
+                        .await;
+
+                        utils::write_file(
+                            &mut rng,
+                            &repo,
+                            file_name,
+                            file_size as usize,
+                            buffer_size,
+                            false,
+                        )
+                        .await;
+                        repo
+                    });
+
+                    (base_dir, repo)
+                },
+                |(_base_dir, repo)| {
+                    runtime.block_on(async {
+                        repo.remove_entry(file_name).await.unwrap();
+                        // Only the root directory block remains.
+                        utils::wait_for_block_count(repo, 1).await;
+                    })
+                },
+                BatchSize::LargeInput,
+            );
+        });
+    }
+    group.finish();
+}
+
 fn sync(c: &mut Criterion) {
     let runtime = Runtime::new().unwrap();
 
@@ -154,3 +226,314 @@ fn sync(c: &mut Criterion) {
     }
     group.finish();
 }
+
+// Measures the startup time: opening the given number of existing repositories at the same time
+// (as the app does on cold start).
+fn open_repositories(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("open_repositories");
+    group.sample_size(10);
+
+    for n in [1, 16, 64] {
+        group.throughput(Throughput::Elements(n));
+        group.bench_function(BenchmarkId::from_parameter(n), |b| {
+            let file_name = Utf8Path::new("file.dat");
+
+            b.iter_batched_ref(
+                || {
+                    let mut rng = StdRng::from_entropy();
+                    let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+
+                    let (stores, repos) = runtime.block_on(async {
+                        let mut stores = Vec::new();
+                        let mut repos = Vec::new();
+
+                        for id in 0..n {
+                            let store = base_dir.path().join(format!("repo-{id}.db"));
+                            let repo = utils::create_repo(
+                                &mut StdRng::seed_from_u64(id),
+                                &store,
+                                id,
+                                StateMonitor::make_root(),
+                            )
+                            .await;
+
+                            utils::write_file(&mut rng, &repo, file_name, 1024 * 1024, 4096, false)
+                                .await;
+
+                            stores.push((id, store));
+                            repos.push(repo);
+                        }
+
+                        (stores, repos)
+                    });
+
+                    // Close the repos (outside of the runtime).
+                    drop(repos);
+
+                    (base_dir, stores)
+                },
+                |(_base_dir, stores)| {
+                    runtime.block_on(future::join_all(stores.iter().map(
+                        |(id, store)| async move {
+                            utils::open_repo(
+                                &mut StdRng::seed_from_u64(*id),
+                                store,
+                                StateMonitor::make_root(),
+                            )
+                            .await
+                        },
+                    )))
+                },
+                BatchSize::PerIteration,
+            );
+        });
+    }
+    group.finish();
+}
+
+// Measures creating many small files one after another. Dominated by the per-file overhead (write
+// transactions, directory updates) rather than by the encryption of the content.
+fn write_small_files(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("write_small_files");
+    group.sample_size(10);
+
+    let file_size = 4096;
+
+    for n in [100, 1000] {
+        group.throughput(Throughput::Elements(n));
+        group.bench_function(BenchmarkId::from_parameter(n), |b| {
+            b.iter_batched_ref(
+                || {
+                    let mut rng = StdRng::from_entropy();
+                    let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+                    let repo = runtime.block_on(utils::create_repo(
+                        &mut rng,
+                        &base_dir.path().join("repo.db"),
+                        0,
+                        StateMonitor::make_root(),
+                    ));
+                    (rng, base_dir, repo)
+                },
+                |(rng, _base_dir, repo)| {
+                    runtime.block_on(async {
+                        for i in 0..n {
+                            utils::write_file(
+                                rng,
+                                repo,
+                                Utf8Path::new(&format!("file-{i}.dat")),
+                                file_size,
+                                file_size,
+                                false,
+                            )
+                            .await;
+                        }
+                    })
+                },
+                BatchSize::LargeInput,
+            );
+        });
+    }
+    group.finish();
+}
+
+// Measures opening and listing a large directory. The directory is not the root so that it's
+// loaded from the store on every iteration instead of being served from the root cache.
+fn list_directory(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("list_directory");
+    group.sample_size(10);
+
+    let dir_name = Utf8Path::new("dir");
+
+    for n in [10_000, 100_000] {
+        // Creating the entries takes much longer than listing them so it's done only once for all
+        // the iterations.
+        let mut rng = StdRng::from_entropy();
+        let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+        let repo = runtime.block_on(async {
+            let repo = utils::create_repo(
+                &mut rng,
+                &base_dir.path().join("repo.db"),
+                0,
+                StateMonitor::make_root(),
+            )
+            .await;
+
+            repo.create_directory(dir_name).await.unwrap();
+
+            for i in 0..n {
+                let mut file = repo
+                    .create_file(dir_name.join(format!("file-{i}.dat")))
+                    .await
+                    .unwrap();
+                file.flush().await.unwrap();
+            }
+
+            repo
+        });
+
+        group.throughput(Throughput::Elements(n as u64));
+        group.bench_function(BenchmarkId::from_parameter(n), |b| {
+            b.iter(|| {
+                runtime.block_on(async {
+                    let dir = repo.open_directory(dir_name).await.unwrap();
+                    assert_eq!(dir.entries().count(), n);
+                })
+            });
+        });
+
+        // Close the repo (outside of the runtime).
+        drop(repo);
+    }
+    group.finish();
+}
+
+// Measures opening and listing a directory that's been concurrently modified by multiple writers.
+// The reader doesn't merge the branches so every open has to merge the versions of the directory
+// from all the writers.
+fn merge_directories(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("merge_directories");
+    group.sample_size(10);
+
+    let dir_name = Utf8Path::new("dir");
+    let files_per_writer = 100;
+
+    for num_writers in [2, 8] {
+        let mut rng = StdRng::from_entropy();
+        let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+        let expected = num_writers * files_per_writer;
+
+        let (reader, writers) = runtime.block_on(async {
+            let reader = Actor::with_access_mode(
+                &mut rng,
+                &base_dir.path().join("reader"),
+                AccessMode::Read,
+            )
+            .await;
+
+            let mut writers = Vec::new();
+
+            for i in 0..num_writers {
+                let writer =
+                    Actor::new(&mut rng, &base_dir.path().join(format!("writer-{i}"))).await;
+
+                writer.repo.create_directory(dir_name).await.unwrap();
+
+                for j in 0..files_per_writer {
+                    utils::write_file(
+                        &mut rng,
+                        &writer.repo,
+                        &dir_name.join(format!("file-{i}-{j}.dat")),
+                        4096,
+                        4096,
+                        false,
+                    )
+                    .await;
+                }
+
+                // The writers are not connected to each other so their branches stay concurrent.
+                reader.connect_to(&writer);
+                writers.push(writer);
+            }
+
+            utils::wait_for_entry_count(&reader.repo, dir_name, expected).await;
+
+            (reader, writers)
+        });
+
+        group.throughput(Throughput::Elements(expected as u64));
+        group.bench_function(BenchmarkId::from_parameter(num_writers), |b| {
+            b.iter(|| {
+                runtime.block_on(async {
+                    let dir = reader.repo.open_directory(dir_name).await.unwrap();
+                    assert_eq!(dir.entries().count(), expected);
+                })
+            });
+        });
+
+        // Close the repos (outside of the runtime).
+        drop(reader);
+        drop(writers);
+    }
+    group.finish();
+}
+
+// Measures a churn workload - the same files being repeatedly overwritten and finally removed -
+// including the garbage collection of all the blocks orphaned by it.
+fn churn(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("churn");
+    group.sample_size(10);
+
+    let dir_name = Utf8Path::new("dir");
+    let num_files = 64;
+    let file_size = 64 * 1024;
+
+    for rounds in [1, 8] {
+        group.throughput(Throughput::Bytes((rounds * num_files * file_size) as u64));
+        group.bench_function(BenchmarkId::from_parameter(rounds), |b| {
+            b.iter_batched_ref(
+                || {
+                    let mut rng = StdRng::from_entropy();
+                    let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+                    let repo = runtime.block_on(async {
+                        let repo = utils::create_repo(
+                            &mut rng,
+                            &base_dir.path().join("repo.db"),
+                            0,
+                            StateMonitor::make_root(),
+                        )
+                        .await;
+
+                        repo.create_directory(dir_name).await.unwrap();
+                        repo
+                    });
+
+                    (rng, base_dir, repo)
+                },
+                |(rng, _base_dir, repo)| {
+                    runtime.block_on(async {
+                        for i in 0..num_files {
+                            utils::write_file(
+                                rng,
+                                repo,
+                                &dir_name.join(format!("file-{i}.dat")),
+                                file_size,
+                                4096,
+                                false,
+                            )
+                            .await;
+                        }
+
+                        for _ in 1..rounds {
+                            for i in 0..num_files {
+                                utils::overwrite_file(
+                                    rng,
+                                    repo,
+                                    &dir_name.join(format!("file-{i}.dat")),
+                                    file_size,
+                                    4096,
+                                )
+                                .await;
+                            }
+                        }
+
+                        repo.remove_entry_recursively(dir_name).await.unwrap();
+                        // Only the root directory block remains.
+                        utils::wait_for_block_count(repo, 1).await;
+                    })
+                },
+                BatchSize::LargeInput,
+            );
+        });
+    }
+    group.finish();
+}
@@ -22,7 +22,7 @@ use std::{
     sync::Arc,
     time::Duration,
 };
-use summary::SummaryRecorder;
+use summary::{Summary, SummaryRecorder};
 use tokio::{select, sync::Barrier, time};
 
 mod future {
@@ -37,12 +37,44 @@ fn main() -> ExitCode {
         return ExitCode::FAILURE;
     }
 
+    if options.latency.is_some() && !cfg!(feature = "simulation") {
+        eprintln!("error: --latency requires the `simulation` feature");
+        return ExitCode::FAILURE;
+    }
+
+    // Run the simulation once for each number of readers so that the time to full sync can be
+    // compared across swarm sizes.
+    for num_readers in options.num_readers.iter().copied() {
+        let summary = run(&options, num_readers);
+
+        if let Some(path) = &options.output {
+            let mut file = match OpenOptions::new().create(true).append(true).open(path) {
+                Ok(file) => file,
+                Err(error) => {
+                    eprintln!("error: failed to open/create {}: {}", path.display(), error);
+                    return ExitCode::FAILURE;
+                }
+            };
+
+            serde_json::to_writer(&mut file, &summary).unwrap();
+            file.write_all(b"\n").unwrap();
+        } else {
+            println!();
+            serde_json::to_writer_pretty(io::stdout().lock(), &summary).unwrap();
+            println!();
+        }
+    }
+
+    ExitCode::SUCCESS
+}
+
+fn run(options: &Options, num_readers: usize) -> Summary {
     let actors: Vec<_> = (0..options.num_writers)
         .map(|index| ActorId {
             access_mode: AccessMode::Write,
             index,
         })
-        .chain((0..options.num_readers).map(|index| ActorId {
+        .chain((0..num_readers).map(|index| ActorId {
             access_mode: AccessMode::Read,
             index,
         }))
@@ -53,7 +85,7 @@ fn main() -> ExitCode {
         .collect();
     let proto = options.protocol;
 
-    let mut env = Env::new();
+    let mut env = make_env(options);
 
     // Wait until everyone is fully synced.
     let watch_txs: Vec<_> = (0..options.num_writers)
@@ -181,26 +213,24 @@ fn main() -> ExitCode {
     drop(env);
     drop(progress_reporter);
 
-    let summary = summary_recorder.finalize(options.label);
-
-    if let Some(path) = options.output {
-        let mut file = match OpenOptions::new().create(true).append(true).open(&path) {
-            Ok(file) => file,
-            Err(error) => {
-                eprintln!("error: failed to open/create {}: {}", path.display(), error);
-                return ExitCode::FAILURE;
-            }
-        };
-
-        serde_json::to_writer(&mut file, &summary).unwrap();
-        file.write_all(b"\n").unwrap();
-    } else {
-        println!();
-        serde_json::to_writer_pretty(io::stdout().lock(), &summary).unwrap();
-        println!();
-    }
+    summary_recorder.finalize(
+        options.label.clone(),
+        actors.len(),
+        make_params(options, num_readers),
+    )
+}
 
-    ExitCode::SUCCESS
+/// Parameters of a single simulation run, recorded in its summary so that runs with different
+/// parameters are never compared with each other.
+fn make_params(options: &Options, num_readers: usize) -> serde_json::Value {
+    serde_json::json!({
+        "file_sizes": options.file_sizes,
+        "num_writers": options.num_writers,
+        "num_readers": num_readers,
+        "num_blinds": options.num_blinds,
+        "protocol": options.protocol.to_string(),
+        "latency": options.latency,
+    })
 }
 
 #[derive(Parser, Debug)]
@@ -221,9 +251,11 @@ struct Options {
     #[arg(short = 'w', long, default_value_t = 2)]
     pub num_writers: usize,
 
-    /// Number of replicas with read access.
-    #[arg(short = 'r', long, default_value_t = 0)]
-    pub num_readers: usize,
+    /// Number of replicas with read access. Can take multiple values to run the simulation
+    /// multiple times, once for each value (e.g., `-r 0,4,8,16` to see how the time to full sync
+    /// scales with the swarm size).
+    #[arg(short = 'r', long, value_delimiter = ',', default_values_t = [0])]
+    pub num_readers: Vec<usize>,
 
     /// Number of replicas with blind access.
     #[arg(short = 'b', long, default_value_t = 0)]
@@ -247,6 +279,12 @@ struct Options {
     #[arg(long)]
     pub progress: bool,
 
+    /// One-way latency of the simulated network in milliseconds (e.g., 100 for a 200 ms round
+    /// trip). Useful to measure how the index sync of a cold replica degrades on slow links.
+    /// Requires the `simulation` feature.
+    #[arg(long, value_name = "MS")]
+    pub latency: Option<u64>,
+
     // The following arguments may be passed down from `cargo bench` so we need to accept them even
     // if we don't use them.
     #[arg(
@@ -266,6 +304,22 @@ struct Options {
     _profile_time: Option<String>,
 }
 
+#[cfg(feature = "simulation")]
+fn make_env<'a>(options: &Options) -> Env<'a> {
+    match options.latency {
+        Some(latency) => {
+            let latency = Duration::from_millis(latency);
+            Env::with_message_latency(latency, latency)
+        }
+        None => Env::new(),
+    }
+}
+
+#[cfg(not(feature = "simulation"))]
+fn make_env(_options: &Options) -> Env {
+    Env::new()
+}
+
 #[derive(Clone, Copy, Eq, PartialEq)]
 struct ActorId {
     access_mode: AccessMode,
@@ -6,7 +6,8 @@ use camino::Utf8Path;
 use common::sync_watch;
 use futures_util::future;
 use ouisync::{
-    Access, Network, PeerAddr, Registration, Repository, RepositoryParams, WriteSecrets,
+    Access, AccessMode, AccessSecrets, File, Network, PeerAddr, Registration, Repository,
+    RepositoryParams, WriteSecrets,
 };
 use rand::{rngs::StdRng, Rng, SeedableRng};
 use state_monitor::StateMonitor;
@@ -22,15 +23,47 @@ pub async fn create_repo(
     store: &Path,
     id: u64,
     monitor: StateMonitor,
+) -> RepositoryGuard {
+    create_repo_with_mode(rng, store, id, AccessMode::Write, monitor).await
+}
+
+/// Like `create_repo` but with the given access mode.
+pub async fn create_repo_with_mode(
+    rng: &mut StdRng,
+    store: &Path,
+    id: u64,
+    access_mode: AccessMode,
+    monitor: StateMonitor,
 ) -> RepositoryGuard {
     let mut secret_rng = StdRng::seed_from_u64(id);
-    let secrets = WriteSecrets::generate(&mut secret_rng);
+    let secrets = AccessSecrets::Write(WriteSecrets::generate(&mut secret_rng));
 
     let repository = Repository::create(
         &RepositoryParams::new(store)
             .with_device_id(rng.gen())
             .with_parent_monitor(monitor),
-        Access::WriteUnlocked { secrets },
+        Access::new(None, None, secrets.with_mode(access_mode)),
+    )
+    .await
+    .unwrap();
+
+    RepositoryGuard {
+        repository,
+        handle: Handle::current(),
+    }
+}
+
+/// Opens a repository previously created with `create_repo`. `rng` is used to generate the device
+/// id so it needs to be in the same state as the one passed to `create_repo` for the repo to be
+/// opened on the same device.
+#[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
+pub async fn open_repo(rng: &mut StdRng, store: &Path, monitor: StateMonitor) -> RepositoryGuard {
+    let repository = Repository::open(
+        &RepositoryParams::new(store)
+            .with_device_id(rng.gen())
+            .with_parent_monitor(monitor),
+        None,
+        AccessMode::Write,
     )
     .await
     .unwrap();
@@ -77,6 +110,32 @@ pub async fn write_file(
         return;
     }
 
+    write_content(rng, &mut file, size, buffer_size, print_progress).await;
+}
+
+/// Replace the content of an existing file at `path` with `size` random bytes (`buffer_size`
+/// bytes at a time).
+#[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
+pub async fn overwrite_file(
+    rng: &mut StdRng,
+    repo: &Repository,
+    path: &Utf8Path,
+    size: usize,
+    buffer_size: usize,
+) {
+    let mut file = repo.open_file(path).await.unwrap();
+    file.truncate(0).unwrap();
+
+    write_content(rng, &mut file, size, buffer_size, false).await;
+}
+
+async fn write_content(
+    rng: &mut StdRng,
+    file: &mut File,
+    size: usize,
+    buffer_size: usize,
+    print_progress: bool,
+) {
     let mut remaining = size;
     let mut buffer = vec![0; buffer_size];
 
@@ -116,6 +175,27 @@ pub async fn read_file(repo: &Repository, path: &Utf8Path, buffer_size: usize) -
     size
 }
 
+/// Waits until the repository contains exactly `expected` blocks.
+#[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
+pub async fn wait_for_block_count(repo: &Repository, expected: u64) {
+    common::eventually(repo, || async {
+        repo.count_blocks().await.unwrap() == expected
+    })
+    .await
+}
+
+/// Waits until the directory at `path` exists and contains exactly `expected` entries.
+#[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
+pub async fn wait_for_entry_count(repo: &Repository, path: &Utf8Path, expected: usize) {
+    common::eventually(repo, || async {
+        repo.open_directory(path)
+            .await
+            .map(|dir| dir.entries().count() == expected)
+            .unwrap_or(false)
+    })
+    .await
+}
+
 #[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
 pub(crate) struct Actor {
     pub network: Network,
@@ -126,6 +206,15 @@ pub(crate) struct Actor {
 impl Actor {
     #[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
     pub(crate) async fn new(rng: &mut StdRng, base_dir: &Path) -> Self {
+        Self::with_access_mode(rng, base_dir, AccessMode::Write).await
+    }
+
+    #[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
+    pub(crate) async fn with_access_mode(
+        rng: &mut StdRng,
+        base_dir: &Path,
+        access_mode: AccessMode,
+    ) -> Self {
         let monitor = StateMonitor::make_root();
 
         let network = Network::new(monitor.clone(), None, None);
@@ -133,7 +222,8 @@ impl Actor {
             .bind(&[PeerAddr::Quic((Ipv4Addr::LOCALHOST, 0).into())])
             .await;
 
-        let repo = create_repo(rng, &base_dir.join("repo.db"), 0, monitor).await;
+        let repo =
+            create_repo_with_mode(rng, &base_dir.join("repo.db"), 0, access_mode, monitor).await;
         let reg = network.register(repo.handle()).await;
 
         Self {
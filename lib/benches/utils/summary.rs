@@ -31,12 +31,19 @@ impl SummaryRecorder {
         }
     }
 
-    pub fn finalize(mut self, label: String) -> Summary {
+    pub fn finalize(
+        mut self,
+        label: String,
+        replicas: usize,
+        params: serde_json::Value,
+    ) -> Summary {
         self.send.refresh();
         self.recv.refresh();
 
         Summary {
             label,
+            replicas,
+            params,
             duration: self.start.elapsed(),
             send: mem::replace(&mut self.send, Histogram::new(3).unwrap()),
             recv: mem::replace(&mut self.recv, Histogram::new(3).unwrap()),
@@ -66,6 +73,11 @@ impl ActorSummaryRecorder {
 pub(crate) struct Summary {
     #[serde(skip_serializing_if = "String::is_empty")]
     pub label: String,
+    // Total number of replicas in the swarm.
+    pub replicas: usize,
+    // Parameters of the bench run. Only runs with the same parameters are comparable.
+    #[serde(skip_serializing_if = "serde_json::Value::is_null")]
+    pub params: serde_json::Value,
     #[serde(serialize_with = "serialize_duration")]
     pub duration: Duration,
     #[serde(serialize_with = "serialize_histogram")]
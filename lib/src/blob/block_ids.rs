@@ -2,6 +2,7 @@ use super::{block_count, read_len};
 use crate::{
     blob::BlobId,
     branch::Branch,
+    crypto::Hash,
     error::{Error, Result},
     protocol::{BlockId, Locator, RootNode, RootNodeFilter, SingleBlockPresence},
     store::{self, ReadTransaction},
@@ -66,6 +67,46 @@ impl BlockIds {
         }
     }
 
+    /// Like `try_next` but yields only the blocks whose encoded locators satisfy the given
+    /// predicate. The other blocks are skipped without being looked up in the index, which makes
+    /// this much cheaper than `try_next` when only a few blocks are of interest.
+    ///
+    /// Falls back to `try_next` (with the predicate applied afterwards) if the blob length is not
+    /// known.
+    pub async fn try_next_matching<F>(
+        &mut self,
+        mut predicate: F,
+    ) -> Result<Option<(BlockId, SingleBlockPresence)>>
+    where
+        F: FnMut(&Hash) -> bool,
+    {
+        let Some(upper_bound) = self.upper_bound else {
+            loop {
+                let encoded = self.locator.encode(self.branch.keys().read());
+
+                let Some(block_info) = self.try_next().await? else {
+                    return Ok(None);
+                };
+
+                if predicate(&encoded) {
+                    return Ok(Some(block_info));
+                }
+            }
+        };
+
+        while self.locator.number() < upper_bound {
+            let encoded = self.locator.encode(self.branch.keys().read());
+
+            if predicate(&encoded) {
+                return self.try_next().await;
+            }
+
+            self.locator = self.locator.next();
+        }
+
+        Ok(None)
+    }
+
     #[cfg(test)]
     pub async fn try_collect<B>(&mut self) -> Result<B>
     where
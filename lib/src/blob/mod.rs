@@ -3,16 +3,18 @@ pub(crate) mod lock;
 mod block_ids;
 mod id;
 mod position;
+mod read_ahead;
 
 #[cfg(test)]
 mod tests;
 
 pub(crate) use self::{block_ids::BlockIds, id::BlobId};
 
-use self::position::Position;
+use self::{position::Position, read_ahead::ReadAhead};
 use crate::{
+    block_tracker::Priority,
     branch::Branch,
-    collections::{hash_map::Entry, HashMap},
+    collections::{hash_map::Entry, HashMap, HashSet},
     crypto::{
         cipher::{self, Nonce, SecretKey},
         sign::{Keypair, PublicKey},
@@ -23,10 +25,13 @@ use crate::{
         Block, BlockContent, BlockId, BlockNonce, Locator, RootNode, RootNodeFilter,
         SingleBlockPresence, BLOCK_SIZE,
     },
-    store::{self, Changeset, ReadTransaction},
+    store::{self, Changeset, ReadTransaction, Store},
 };
-use std::{io::SeekFrom, iter, mem};
+use futures_util::future;
+use scoped_task::ScopedJoinHandle;
+use std::{io::SeekFrom, iter, mem, num::NonZeroUsize, panic, sync::Arc, thread, time::Instant};
 use thiserror::Error;
+use tokio::task;
 
 /// Size of the blob header in bytes.
 // Using u64 instead of usize because HEADER_SIZE must be the same irrespective of whether we're on
@@ -53,6 +58,10 @@ pub(crate) struct Blob {
     len_original: u64,
     len_modified: u64,
     position: Position,
+    read_ahead: ReadAhead,
+    // Prefetch of the following blocks started by the last sequential cache miss, if any. Aborted
+    // when the blob is dropped.
+    prefetch: Option<ScopedJoinHandle<()>>,
 }
 
 impl Blob {
@@ -87,6 +96,8 @@ impl Blob {
             len_original: len,
             len_modified: len,
             position,
+            read_ahead: ReadAhead::default(),
+            prefetch: None,
         })
     }
 
@@ -102,6 +113,8 @@ impl Blob {
             len_original: 0,
             len_modified: 0,
             position: Position::ZERO,
+            read_ahead: ReadAhead::default(),
+            prefetch: None,
         }
     }
 
@@ -298,9 +311,7 @@ impl Blob {
 
         let write_len = buffer.len().min(block.content.len() - self.position.offset);
 
-        block
-            .content
-            .write(self.position.offset, &buffer[..write_len]);
+        Arc::make_mut(&mut block.content).write(self.position.offset, &buffer[..write_len]);
         block.dirty = true;
 
         self.position.advance(write_len);
@@ -346,21 +357,56 @@ impl Blob {
     }
 
     /// Load the current block at the given snapshot into the cache.
+    ///
+    /// If the blob is being accessed sequentially, this also starts prefetching the following
+    /// blocks in the background (see [`ReadAhead`]).
     pub async fn warmup_at(
         &mut self,
         tx: &mut ReadTransaction,
         root_node: &RootNode,
     ) -> Result<()> {
-        match self.cache.entry(self.position.block) {
-            Entry::Occupied(_) => (),
+        let number = self.position.block;
+
+        match self.cache.entry(number) {
+            Entry::Occupied(_) => return Ok(()),
             Entry::Vacant(entry) => {
-                let locator = Locator::head(self.id).nth(self.position.block);
+                let locator = Locator::head(self.id).nth(number);
                 let (_, buffer) =
                     read_block(tx, root_node, &locator, self.branch.keys().read()).await?;
                 entry.insert(CachedBlock::from(buffer));
             }
         }
 
+        // At most one prefetch per blob is in flight. The blocks it's loading are likely the ones
+        // being read now so starting another one would only compete with it.
+        if self
+            .prefetch
+            .as_ref()
+            .map(|prefetch| !prefetch.is_finished())
+            .unwrap_or(false)
+        {
+            return Ok(());
+        }
+
+        // The access is sequential if the reader has just finished the previous block.
+        let sequential = number > 0 && self.cache.contains_key(&(number - 1));
+        let range = self.read_ahead.on_miss(number, sequential);
+        let end = range.end.min(self.block_count());
+
+        let locators: Vec<_> = (range.start..end)
+            .filter(|number| !self.cache.contains_key(number))
+            .map(|number| Locator::head(self.id).nth(number))
+            .collect();
+
+        if !locators.is_empty() {
+            self.prefetch = Some(scoped_task::spawn(prefetch(
+                self.branch.store().clone(),
+                root_node.clone(),
+                locators,
+                self.branch.keys().read().clone(),
+            )));
+        }
+
         Ok(())
     }
 
@@ -392,7 +438,7 @@ impl Blob {
         changeset: &mut Changeset,
     ) -> Result<()> {
         self.write_len(tx, changeset).await?;
-        self.write_blocks(changeset);
+        self.write_blocks(changeset).await?;
 
         Ok(())
     }
@@ -439,7 +485,7 @@ impl Blob {
         }
 
         if let Some(block) = self.cache.get_mut(&0) {
-            block.content.write_u64(0, self.len_modified);
+            Arc::make_mut(&mut block.content).write_u64(0, self.len_modified);
             block.dirty = true;
         } else {
             let locator = Locator::head(self.id);
@@ -449,7 +495,13 @@ impl Blob {
             let (_, mut content) =
                 read_block(tx, &root_node, &locator, self.branch.keys().read()).await?;
             content.write_u64(0, self.len_modified);
-            write_block(changeset, &locator, content, self.branch.keys().read());
+            write_block(
+                changeset,
+                &locator,
+                &content,
+                self.branch.keys().read(),
+                self.branch.block_deduplication(),
+            );
         }
 
         self.len_original = self.len_modified;
@@ -457,22 +509,43 @@ impl Blob {
         Ok(())
     }
 
-    fn write_blocks(&mut self, changeset: &mut Changeset) {
-        // Poor man's `drain_filter`.
-        let cache = mem::take(&mut self.cache);
-        let (dirty, clean): (HashMap<_, _>, _) =
-            cache.into_iter().partition(|(_, block)| block.dirty);
-        self.cache = clean;
+    async fn write_blocks(&mut self, changeset: &mut Changeset) -> Result<()> {
+        // Keep the blocks in the order they appear in the blob so the resulting changeset doesn't
+        // depend on the hash map iteration order.
+        let mut numbers: Vec<_> = self
+            .cache
+            .iter()
+            .filter(|(_, block)| block.dirty)
+            .map(|(number, _)| *number)
+            .collect();
+        numbers.sort_unstable();
+
+        // The dirty blocks are shared with the sealing (which encrypts them into new buffers), not
+        // copied, and stay in the cache until they are in the changeset, so they are not lost if
+        // this future is dropped before the sealing completes. Should a block be written to while
+        // a sealing task still holds it, it's copied on write.
+        let blocks = numbers
+            .iter()
+            .map(|number| {
+                (
+                    Locator::head(self.id).nth(*number),
+                    self.cache[number].content.clone(),
+                )
+            })
+            .collect();
 
-        for (number, block) in dirty {
-            let locator = Locator::head(self.id).nth(number);
-            write_block(
-                changeset,
-                &locator,
-                block.content,
-                self.branch.keys().read(),
-            );
+        let read_key = self.branch.keys().read();
+        let deduplicate = self.branch.block_deduplication();
+
+        for (locator, block) in seal_blocks(blocks, read_key, deduplicate).await? {
+            store_block(changeset, &locator, block, read_key);
         }
+
+        for number in numbers {
+            self.cache.remove(&number);
+        }
+
+        Ok(())
     }
 }
 
@@ -486,13 +559,15 @@ impl Clone for Blob {
             len_original: self.len_original,
             len_modified: self.len_original,
             position: self.position,
+            read_ahead: ReadAhead::default(),
+            prefetch: None,
         }
     }
 }
 
 #[derive(Default)]
 struct CachedBlock {
-    content: BlockContent,
+    content: Arc<BlockContent>,
     dirty: bool,
 }
 
@@ -509,7 +584,7 @@ impl CachedBlock {
 impl From<BlockContent> for CachedBlock {
     fn from(content: BlockContent) -> Self {
         Self {
-            content,
+            content: Arc::new(content),
             dirty: false,
         }
     }
@@ -607,6 +682,24 @@ pub(crate) async fn fork(blob_id: BlobId, src_branch: &Branch, dst_branch: &Bran
     Ok(())
 }
 
+/// Returns the number of blocks of the specified blob, or `None` if its first block is not
+/// available and so its length can't be obtained.
+pub(crate) async fn load_block_count(
+    tx: &mut ReadTransaction,
+    branch: &Branch,
+    blob_id: BlobId,
+) -> Result<Option<u32>> {
+    let root_node = tx
+        .load_latest_approved_root_node(branch.id(), RootNodeFilter::Any)
+        .await?;
+
+    match read_len(tx, &root_node, blob_id, branch.keys().read()).await {
+        Ok(len) => Ok(Some(block_count(len))),
+        Err(Error::Store(store::Error::BlockNotFound)) => Ok(None),
+        Err(error) => Err(error),
+    }
+}
+
 fn block_count(len: u64) -> u32 {
     // https://stackoverflow.com/questions/2745074/fast-ceiling-of-an-integer-division-in-c-c
     (1 + (len + HEADER_SIZE as u64 - 1) / BLOCK_SIZE as u64)
@@ -645,28 +738,219 @@ async fn read_block(
     locator: &Locator,
     read_key: &cipher::SecretKey,
 ) -> Result<(BlockId, BlockContent)> {
-    let (id, _) = tx
+    let (id, presence) = tx
         .find_block_at(root_node, &locator.encode(read_key))
         .await?;
 
+    // Consult the cache only for blocks that are known to be present, so that blocks that have
+    // been expired or removed are reported as not found.
+    if presence == SingleBlockPresence::Present {
+        if let Some(content) = tx.load_cached_block(&id) {
+            return Ok((id, content));
+        }
+    }
+
     let mut content = BlockContent::new();
     let nonce = tx.read_block(&id, &mut content).await?;
 
+    let start = Instant::now();
     decrypt_block(read_key, &nonce, &mut content);
+    tx.record_block_decrypt_time(start.elapsed());
+
+    tx.cache_block(id, &content);
 
     Ok((id, content))
 }
 
+/// Loads the given blocks into the store-wide decrypted block cache so that subsequent
+/// `read_block` calls on them don't have to touch the db. Blocks already in the cache are skipped.
+/// Missing blocks are marked as required with high priority so they are downloaded from peers
+/// before any other blocks.
+///
+/// Runs in the background (aborted when the blob that started it is dropped) and is best effort:
+/// errors are logged and the blocks that failed to be prefetched are then read on demand.
+async fn prefetch(
+    store: Store,
+    root_node: RootNode,
+    locators: Vec<Locator>,
+    read_key: cipher::SecretKey,
+) {
+    let result = async {
+        let mut tx = store.begin_read().await?;
+        // The blocks are about to be read so request them before the background downloads.
+        let mut require_batch = store
+            .block_download_tracker()
+            .require_batch()
+            .with_priority(Priority::High);
+        let mut ids = Vec::with_capacity(locators.len());
+
+        for locator in locators {
+            let (id, presence) = match tx
+                .find_block_at(&root_node, &locator.encode(&read_key))
+                .await
+            {
+                Ok(block) => block,
+                Err(store::Error::LocatorNotFound) => break,
+                Err(error) => return Err(error),
+            };
+
+            match presence {
+                SingleBlockPresence::Present => (),
+                SingleBlockPresence::Missing | SingleBlockPresence::Expired => {
+                    require_batch.add(id);
+                    continue;
+                }
+            }
+
+            if !tx.is_block_cached(&id) {
+                ids.push(id);
+            }
+        }
+
+        // Read all the blocks with a single query. Only the decryption is parallelized.
+        let loaded = tx.read_blocks(&ids).await?;
+
+        if loaded.len() < ids.len() {
+            let found: HashSet<_> = loaded.iter().map(|(id, _, _)| *id).collect();
+
+            for id in ids.iter().filter(|id| !found.contains(id)) {
+                require_batch.add(*id);
+            }
+        }
+
+        require_batch.commit();
+
+        let decrypted = future::join_all(loaded.into_iter().map(|(id, nonce, mut content)| {
+            let read_key = read_key.clone();
+
+            task::spawn_blocking(move || {
+                let start = Instant::now();
+                decrypt_block(&read_key, &nonce, &mut content);
+                (id, content, start.elapsed())
+            })
+        }))
+        .await;
+
+        for result in decrypted {
+            match result {
+                Ok((id, content, decrypt_time)) => {
+                    tx.record_block_decrypt_time(decrypt_time);
+                    tx.cache_block(id, &content);
+                }
+                Err(error) => tracing::warn!(?error, "block prefetch decryption failed"),
+            }
+        }
+
+        Ok::<_, store::Error>(())
+    }
+    .await;
+
+    // The blocks that failed to be prefetched are simply read on demand.
+    if let Err(error) = result {
+        tracing::warn!(?error, "block prefetch failed");
+    }
+}
+
 fn write_block(
     changeset: &mut Changeset,
     locator: &Locator,
-    mut content: BlockContent,
+    content: &BlockContent,
     read_key: &cipher::SecretKey,
+    deduplicate: bool,
 ) -> BlockId {
-    let nonce = make_block_nonce(locator, &content, read_key);
-    encrypt_block(read_key, &nonce, &mut content);
+    let block = seal_block(locator, content, read_key, deduplicate);
+    store_block(changeset, locator, block, read_key)
+}
+
+// Min number of blocks for which it's worth to offload the sealing to the blocking thread pool.
+const PARALLEL_SEAL_THRESHOLD: usize = 4;
+
+/// Seals (encrypts and hashes) multiple blocks, fanning the work out across the blocking thread
+/// pool. The returned blocks are in the same order as the input ones.
+async fn seal_blocks(
+    blocks: Vec<(Locator, Arc<BlockContent>)>,
+    read_key: &cipher::SecretKey,
+    deduplicate: bool,
+) -> Result<Vec<(Locator, Block)>> {
+    if blocks.len() < PARALLEL_SEAL_THRESHOLD {
+        return Ok(blocks
+            .into_iter()
+            .map(|(locator, content)| {
+                (
+                    locator,
+                    seal_block(&locator, &content, read_key, deduplicate),
+                )
+            })
+            .collect());
+    }
+
+    let workers = thread::available_parallelism()
+        .map(NonZeroUsize::get)
+        .unwrap_or(1);
+    let count = blocks.len();
+    let chunk_size = count.div_ceil(workers);
+
+    let mut blocks = blocks.into_iter();
+    let tasks = iter::from_fn(|| {
+        let chunk: Vec<_> = blocks.by_ref().take(chunk_size).collect();
+        (!chunk.is_empty()).then_some(chunk)
+    })
+    .map(|chunk| {
+        let read_key = read_key.clone();
+
+        task::spawn_blocking(move || {
+            chunk
+                .into_iter()
+                .map(|(locator, content)| {
+                    (
+                        locator,
+                        seal_block(&locator, &content, &read_key, deduplicate),
+                    )
+                })
+                .collect::<Vec<_>>()
+        })
+    });
 
-    let block = Block::new(content, nonce);
+    let mut sealed = Vec::with_capacity(count);
+
+    for result in future::join_all(tasks).await {
+        match result {
+            Ok(chunk) => sealed.extend(chunk),
+            Err(error) if error.is_panic() => panic::resume_unwind(error.into_panic()),
+            // The blocking tasks are cancelled only when the runtime is shutting down.
+            Err(_) => return Err(Error::Interrupted),
+        }
+    }
+
+    Ok(sealed)
+}
+
+/// Encrypts the block content into a new buffer and computes its id.
+fn seal_block(
+    locator: &Locator,
+    plaintext: &BlockContent,
+    read_key: &cipher::SecretKey,
+    deduplicate: bool,
+) -> Block {
+    let nonce = if deduplicate {
+        make_convergent_block_nonce(plaintext, read_key)
+    } else {
+        make_block_nonce(locator, plaintext, read_key)
+    };
+
+    let mut content = BlockContent::new();
+    encrypt_block(read_key, &nonce, plaintext, &mut content);
+
+    Block::new(content, nonce)
+}
+
+/// Links the (already sealed) block to the locator and adds it to the changeset.
+fn store_block(
+    changeset: &mut Changeset,
+    locator: &Locator,
+    block: Block,
+    read_key: &cipher::SecretKey,
+) -> BlockId {
     let block_id = block.id;
 
     changeset.link_block(
@@ -686,9 +970,14 @@ fn decrypt_block(blob_key: &cipher::SecretKey, block_nonce: &BlockNonce, content
     block_key.decrypt_no_aead(&Nonce::default(), content);
 }
 
-fn encrypt_block(blob_key: &cipher::SecretKey, block_nonce: &BlockNonce, content: &mut [u8]) {
+fn encrypt_block(
+    blob_key: &cipher::SecretKey,
+    block_nonce: &BlockNonce,
+    plaintext: &[u8],
+    ciphertext: &mut [u8],
+) {
     let block_key = SecretKey::derive_from_key(blob_key.as_array(), block_nonce);
-    block_key.encrypt_no_aead(&Nonce::default(), content);
+    block_key.encrypt_no_aead_b2b(&Nonce::default(), plaintext, ciphertext);
 }
 
 /// Compute nonce for a block at the given locator and with the given plaintext content.
@@ -715,3 +1004,21 @@ fn make_block_nonce(
         .hash()
         .into()
 }
+
+/// Compute nonce for a block with the given plaintext content, regardless of its locator. Used when
+/// block deduplication is enabled.
+///
+/// Blocks with the same content get the same nonce and thus the same block id wherever they are
+/// (in the same blob, in different blobs or in different branches), so their content is stored
+/// and synced only once. This is not a nonce reuse for the same reason as in [make_block_nonce].
+///
+/// The price is that anyone who can see the block ids (including blind replicas) can tell which
+/// blocks of the repository have the same content. Because `read_key` is part of the hashed
+/// material, they still can't tell whether a block contains some known plaintext, unless they
+/// also hold the read key (see `Repository::set_block_deduplication`).
+fn make_convergent_block_nonce(
+    plaintext_content: &[u8],
+    read_key: &cipher::SecretKey,
+) -> BlockNonce {
+    (read_key.as_ref(), plaintext_content).hash().into()
+}
@@ -0,0 +1,104 @@
+use std::ops::Range;
+
+/// Number of blocks prefetched after the first sequential cache miss.
+const MIN_WINDOW: u32 = 4; // 128 KiB
+
+/// Max number of blocks prefetched on a single cache miss.
+pub(super) const MAX_WINDOW: u32 = 32; // 1 MiB
+
+/// Adaptive read-ahead state of a blob.
+///
+/// Every cache miss is classified as either sequential (the block immediately preceding the missed
+/// one is cached, meaning the reader just finished it) or random. Each sequential miss doubles the
+/// read-ahead window (up to `MAX_WINDOW`), a random miss resets it so that random access doesn't
+/// load more than what's actually read.
+///
+/// The end of the last prefetched range is remembered (the high-water mark) so that consecutive
+/// misses don't prefetch the same blocks again while a previous prefetch is still in flight. A new
+/// prefetch is started only once less than half of the window remains prefetched ahead of the
+/// reader and it covers only the blocks past the high-water mark.
+#[derive(Default, Clone, Copy)]
+pub(super) struct ReadAhead {
+    window: u32,
+    high_water: u32,
+}
+
+impl ReadAhead {
+    /// Records a cache miss of the block `number` and returns the range of the blocks that should
+    /// be prefetched (possibly empty).
+    pub fn on_miss(&mut self, number: u32, sequential: bool) -> Range<u32> {
+        let next = number.saturating_add(1);
+
+        if !sequential {
+            self.window = 0;
+            self.high_water = next;
+            return next..next;
+        }
+
+        self.window = self.window.saturating_mul(2).clamp(MIN_WINDOW, MAX_WINDOW);
+
+        // The reader moved outside of the previously prefetched range (e.g. seeked) so it no
+        // longer applies.
+        if self.high_water < next || self.high_water > next.saturating_add(MAX_WINDOW) {
+            self.high_water = next;
+        }
+
+        let end = next.saturating_add(self.window);
+
+        // Still enough prefetched ahead of the reader.
+        if self.high_water - next >= self.window / 2 || self.high_water >= end {
+            return self.high_water..self.high_water;
+        }
+
+        let start = self.high_water;
+        self.high_water = end;
+
+        start..end
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn window_grows_on_sequential_and_resets_on_random() {
+        let mut read_ahead = ReadAhead::default();
+
+        assert!(read_ahead.on_miss(0, false).is_empty());
+        assert_eq!(read_ahead.on_miss(1, true), 2..2 + MIN_WINDOW);
+        // Only the blocks past the previous prefetch.
+        assert_eq!(
+            read_ahead.on_miss(2, true),
+            2 + MIN_WINDOW..3 + 2 * MIN_WINDOW
+        );
+
+        // Random access resets the window.
+        assert!(read_ahead.on_miss(100, false).is_empty());
+        assert_eq!(read_ahead.on_miss(101, true), 102..102 + MIN_WINDOW);
+    }
+
+    #[test]
+    fn sequential_misses_prefetch_only_past_high_water_mark() {
+        let mut read_ahead = ReadAhead::default();
+        let mut prefetched = Vec::new();
+
+        read_ahead.on_miss(0, false);
+
+        for number in 1..1000 {
+            let range = read_ahead.on_miss(number, true);
+
+            assert!(range.is_empty() || range.start > number);
+            assert!(range.len() <= MAX_WINDOW as usize);
+
+            prefetched.extend(range);
+        }
+
+        // Every block is prefetched exactly once and in order.
+        assert_eq!(
+            prefetched,
+            (2..prefetched.len() as u32 + 2).collect::<Vec<_>>()
+        );
+        assert!(*prefetched.last().unwrap() >= 999);
+    }
+}
@@ -3,8 +3,26 @@ use crate::{
     protocol::BlockId,
 };
 use deadlock::BlockingMutex;
-use std::{collections::hash_map::Entry, sync::Arc};
-use tokio::sync::watch;
+use std::{collections::hash_map::Entry, mem, sync::Arc, time::Duration};
+use tokio::{
+    select,
+    sync::watch,
+    time::{self, Instant},
+};
+
+/// Max number of eligible blocks considered when choosing the next block to request from a peer.
+/// Choosing the rarest among a sample (instead of among all blocks) keeps the cost of each choice
+/// bounded while still approximating rarest-first well.
+const MAX_CANDIDATES: usize = 16;
+
+/// When at most this many required blocks are still missing, the download enters the "end game":
+/// blocks already requested from one peer can be requested from other peers as well, so that a
+/// single slow peer doesn't hold back the completion of the whole download.
+const END_GAME_THRESHOLD: usize = 8;
+
+/// In the end game, a block is requested from another peer only if the previous request has been
+/// outstanding for at least this long.
+const END_GAME_DELAY: Duration = Duration::from_secs(2);
 
 /// Helper for tracking required missing blocks.
 #[derive(Clone)]
@@ -23,6 +41,9 @@ impl BlockTracker {
                     clients: HashMap::default(),
                     next_client_id: 0,
                     request_mode: RequestMode::Greedy,
+                    required_count: 0,
+                    accepted: HashSet::default(),
+                    high_priority: HashSet::default(),
                 }),
                 notify_tx,
             }),
@@ -41,7 +62,13 @@ impl BlockTracker {
 
     /// Marks the block with the given id as required.
     pub fn require(&self, block_id: BlockId) {
-        if self.shared.inner.lock().unwrap().require(block_id) {
+        if self
+            .shared
+            .inner
+            .lock()
+            .unwrap()
+            .require(block_id, Priority::Normal)
+        {
             self.shared.notify()
         }
     }
@@ -50,6 +77,7 @@ impl BlockTracker {
     pub fn require_batch(&self) -> RequireBatch<'_> {
         RequireBatch {
             shared: &self.shared,
+            priority: Priority::Normal,
             notify: false,
         }
     }
@@ -64,7 +92,7 @@ impl BlockTracker {
         };
 
         let required = match &mut missing_block.state {
-            State::Idle { approved: true, .. } | State::Accepted(_) => return,
+            State::Idle { approved: true, .. } | State::Accepted { .. } => return,
             State::Idle { approved, required } => {
                 *approved = true;
                 *required
@@ -95,6 +123,16 @@ pub(crate) enum OfferState {
     Approved,
 }
 
+/// Priority of a required block. Offered blocks with higher priority are requested before those
+/// with lower priority, regardless of their rarity.
+#[derive(Clone, Copy, Eq, PartialEq, Debug)]
+pub(crate) enum Priority {
+    /// Blocks required in the background (e.g., greedy download, scanning).
+    Normal,
+    /// Blocks required by someone who is waiting for them (e.g., a file being read).
+    High,
+}
+
 #[derive(Clone, Copy)]
 pub(crate) enum RequestMode {
     // Request only required blocks
@@ -105,12 +143,25 @@ pub(crate) enum RequestMode {
 
 pub(crate) struct RequireBatch<'a> {
     shared: &'a Shared,
+    priority: Priority,
     notify: bool,
 }
 
 impl RequireBatch<'_> {
+    /// Sets the priority of the blocks subsequently added to this batch.
+    pub fn with_priority(mut self, priority: Priority) -> Self {
+        self.priority = priority;
+        self
+    }
+
     pub fn add(&mut self, block_id: BlockId) {
-        if self.shared.inner.lock().unwrap().require(block_id) {
+        if self
+            .shared
+            .inner
+            .lock()
+            .unwrap()
+            .require(block_id, self.priority)
+        {
             self.notify = true;
         }
     }
@@ -171,6 +222,7 @@ impl TrackerClient {
                     required: false,
                     approved: false,
                 },
+                high_priority: false,
             });
 
         missing_block
@@ -192,13 +244,15 @@ impl TrackerClient {
                     notify = true;
                 }
             }
-            State::Accepted(_) => (),
+            State::Accepted { .. } => (),
         }
 
+        inner.update_high_priority(&block_id);
+
         match inner.request_mode {
             RequestMode::Lazy => (),
             RequestMode::Greedy => {
-                if inner.require(block_id) {
+                if inner.require(block_id, Priority::Normal) {
                     notify = true;
                 }
             }
@@ -237,25 +291,38 @@ impl BlockOffers {
     /// Returns the next offer, waiting for one to appear if necessary.
     pub async fn next(&mut self) -> BlockOffer {
         loop {
-            if let Some(offer) = self.try_next() {
-                return offer;
-            }
+            let retry_at = match self.propose() {
+                Ok(offer) => return offer,
+                Err(retry_at) => retry_at,
+            };
 
             // unwrap is ok because the sender exists in self.shared.
-            self.notify_rx.changed().await.unwrap();
+            if let Some(retry_at) = retry_at {
+                select! {
+                    result = self.notify_rx.changed() => result.unwrap(),
+                    _ = time::sleep_until(retry_at) => (),
+                }
+            } else {
+                self.notify_rx.changed().await.unwrap();
+            }
         }
     }
 
     /// Returns the next offer or `None` if none exists currently.
     pub fn try_next(&self) -> Option<BlockOffer> {
+        self.propose().ok()
+    }
+
+    // On failure returns the time when an end game offer might become available, if any.
+    fn propose(&self) -> Result<BlockOffer, Option<Instant>> {
         let block_id = self
             .shared
             .inner
             .lock()
             .unwrap()
-            .propose_offer(self.client_id)?;
+            .propose_offer(self.client_id, Instant::now())?;
 
-        Some(BlockOffer {
+        Ok(BlockOffer {
             shared: self.shared.clone(),
             client_id: self.client_id,
             block_id,
@@ -279,16 +346,16 @@ impl BlockOffer {
     }
 
     /// Accepts the offer. There can be multiple offers for the same block (each from a different
-    /// peer) but only one returns `Some` here. The returned `BlockPromise` is a commitment to send
-    /// the block request through this client.
+    /// peer) but normally only one returns `Some` here. The exception is the end game (see
+    /// `END_GAME_THRESHOLD`) when a block whose request is taking too long can be accepted again
+    /// by another client. The returned `BlockPromise` is a commitment to send the block request
+    /// through this client.
     pub fn accept(self) -> Option<BlockPromise> {
-        if self
-            .shared
-            .inner
-            .lock()
-            .unwrap()
-            .accept_offer(&self.block_id, self.client_id)
-        {
+        if self.shared.inner.lock().unwrap().accept_offer(
+            &self.block_id,
+            self.client_id,
+            Instant::now(),
+        ) {
             Some(BlockPromise(self))
         } else {
             None
@@ -359,6 +426,14 @@ struct Inner {
     clients: HashMap<ClientId, HashSet<BlockId>>,
     next_client_id: ClientId,
     request_mode: RequestMode,
+    // Number of missing blocks that are required.
+    required_count: usize,
+    // Missing blocks in the `Accepted` state.
+    accepted: HashSet<BlockId>,
+    // Missing blocks required with `Priority::High` which are not accepted yet and have at least
+    // one offer. Blocks leave it when they get accepted, completed or lose all their offers, so
+    // it stays small.
+    high_priority: HashSet<BlockId>,
 }
 
 impl Inner {
@@ -384,18 +459,22 @@ impl Inner {
             missing_block.offers.remove(&client_id);
 
             if missing_block.unaccept_by(client_id) {
+                self.accepted.remove(&block_id);
                 notify = true;
             }
 
+            self.update_high_priority(&block_id);
+
             // TODO: if the block hasn't other offers and isn't required, remove it
         }
 
         notify
     }
 
-    /// Mark the block with the given id as required. Returns true if the block wasn't already
-    /// required and if it has at least one offer. Otherwise returns false.
-    fn require(&mut self, block_id: BlockId) -> bool {
+    /// Mark the block with the given id as required (or raise its priority). Returns true if the
+    /// block wasn't already required (or had lower priority), isn't accepted yet and if it has at
+    /// least one offer. Otherwise returns false.
+    fn require(&mut self, block_id: BlockId, priority: Priority) -> bool {
         let missing_block = self
             .missing_blocks
             .entry(block_id)
@@ -405,15 +484,30 @@ impl Inner {
                     required: false,
                     approved: false,
                 },
+                high_priority: false,
             });
 
-        match &mut missing_block.state {
-            State::Idle { required: true, .. } | State::Accepted(_) => false,
-            State::Idle { required, .. } => {
-                *required = true;
-                !missing_block.offers.is_empty()
-            }
+        let (was_required, idle) = match &mut missing_block.state {
+            State::Idle { required, .. } => (mem::replace(required, true), true),
+            State::Accepted { .. } => (true, false),
+        };
+
+        if !was_required {
+            self.required_count += 1;
         }
+
+        let raised = match priority {
+            Priority::High => !mem::replace(&mut missing_block.high_priority, true),
+            Priority::Normal => false,
+        };
+
+        let notify = (!was_required || raised) && idle && !missing_block.offers.is_empty();
+
+        if raised {
+            self.update_high_priority(&block_id);
+        }
+
+        notify
     }
 
     fn complete(&mut self, block_id: &BlockId) {
@@ -421,6 +515,18 @@ impl Inner {
             return;
         };
 
+        match missing_block.state {
+            State::Idle { required: true, .. } | State::Accepted { .. } => {
+                self.required_count -= 1;
+            }
+            State::Idle {
+                required: false, ..
+            } => (),
+        }
+
+        self.accepted.remove(block_id);
+        self.high_priority.remove(block_id);
+
         for (client_id, _) in missing_block.offers {
             if let Some(block_ids) = self.clients.get_mut(&client_id) {
                 block_ids.remove(block_id);
@@ -428,36 +534,136 @@ impl Inner {
         }
     }
 
-    fn propose_offer(&mut self, client_id: ClientId) -> Option<BlockId> {
-        // TODO: OPTIMIZE (but profile first) this linear lookup
-        for block_id in self.clients.get(&client_id).into_iter().flatten() {
-            // unwrap is ok because of the invariant in `Inner`
-            let missing_block = self.missing_blocks.get_mut(block_id).unwrap();
+    /// Chooses the next block to request from the given client. In order of preference:
+    ///
+    /// 1. high priority blocks,
+    /// 2. the rarest (offered by the fewest clients) of a sample of the other blocks,
+    /// 3. in the end game, blocks whose request through another client is taking too long.
+    ///
+    /// On failure returns the time when an end game block might become available, if any.
+    fn propose_offer(
+        &mut self,
+        client_id: ClientId,
+        now: Instant,
+    ) -> Result<BlockId, Option<Instant>> {
+        let block_id = match self
+            .propose_high_priority(client_id)
+            .or_else(|| self.propose_rarest(client_id))
+        {
+            Some(block_id) => block_id,
+            None => self.propose_end_game(client_id, now)?,
+        };
 
-            match missing_block.state {
-                State::Idle {
-                    required: true,
-                    approved: true,
-                } => (),
-                State::Idle { .. } | State::Accepted(_) => continue,
+        // unwrap is ok because the block has been chosen from the existing ones and because of the
+        // invariant.
+        *self
+            .missing_blocks
+            .get_mut(&block_id)
+            .unwrap()
+            .offers
+            .get_mut(&client_id)
+            .unwrap() = Offer::Proposed;
+
+        Ok(block_id)
+    }
+
+    fn propose_high_priority(&self, client_id: ClientId) -> Option<BlockId> {
+        let client_block_ids = self.clients.get(&client_id)?;
+
+        // Walk the smaller of the two sets and look the blocks up in the other one.
+        let (candidates, other) = if self.high_priority.len() <= client_block_ids.len() {
+            (&self.high_priority, client_block_ids)
+        } else {
+            (client_block_ids, &self.high_priority)
+        };
+
+        candidates
+            .iter()
+            .filter(|block_id| other.contains(*block_id))
+            .filter_map(|block_id| self.eligible(block_id, client_id))
+            .min_by_key(|(_, rarity)| *rarity)
+            .map(|(block_id, _)| block_id)
+    }
+
+    fn propose_rarest(&self, client_id: ClientId) -> Option<BlockId> {
+        // Note the iteration order of the blocks is random and different for each client, so
+        // different clients sample different blocks.
+        self.clients
+            .get(&client_id)
+            .into_iter()
+            .flatten()
+            .filter_map(|block_id| self.eligible(block_id, client_id))
+            .take(MAX_CANDIDATES)
+            .min_by_key(|(_, rarity)| *rarity)
+            .map(|(block_id, _)| block_id)
+    }
+
+    fn propose_end_game(
+        &self,
+        client_id: ClientId,
+        now: Instant,
+    ) -> Result<BlockId, Option<Instant>> {
+        if self.required_count > END_GAME_THRESHOLD {
+            return Err(None);
+        }
+
+        let mut retry_at: Option<Instant> = None;
+        let mut best: Option<(BlockId, Instant)> = None;
+
+        for block_id in &self.accepted {
+            // unwrap is ok because `accepted` contains only existing blocks.
+            let missing_block = self.missing_blocks.get(block_id).unwrap();
+
+            let State::Accepted {
+                client_id: other_client_id,
+                timestamp,
+            } = missing_block.state
+            else {
+                continue;
+            };
+
+            if other_client_id == client_id
+                || !matches!(missing_block.offers.get(&client_id), Some(Offer::Available))
+            {
+                continue;
             }
 
-            // unwrap is ok because of the invariant.
-            let offer = missing_block.offers.get_mut(&client_id).unwrap();
-            match offer {
-                Offer::Available => {
-                    *offer = Offer::Proposed;
-                }
-                Offer::Proposed | Offer::Accepted => continue,
+            let eligible_at = timestamp + END_GAME_DELAY;
+
+            if eligible_at > now {
+                retry_at = Some(retry_at.map_or(eligible_at, |retry_at| retry_at.min(eligible_at)));
+                continue;
             }
 
-            return Some(*block_id);
+            if best.map_or(true, |(_, best_timestamp)| timestamp < best_timestamp) {
+                best = Some((*block_id, timestamp));
+            }
+        }
+
+        best.map(|(block_id, _)| block_id).ok_or(retry_at)
+    }
+
+    // If the block can be proposed to the given client, returns its id and rarity (number of
+    // clients offering it).
+    fn eligible(&self, block_id: &BlockId, client_id: ClientId) -> Option<(BlockId, usize)> {
+        // unwrap is ok because of the invariant in `Inner`
+        let missing_block = self.missing_blocks.get(block_id).unwrap();
+
+        match missing_block.state {
+            State::Idle {
+                required: true,
+                approved: true,
+            } => (),
+            State::Idle { .. } | State::Accepted { .. } => return None,
         }
 
-        None
+        match missing_block.offers.get(&client_id) {
+            Some(Offer::Available) => Some((*block_id, missing_block.offers.len())),
+            Some(Offer::Proposed | Offer::Accepted) | None => None,
+        }
     }
 
-    fn accept_offer(&mut self, block_id: &BlockId, client_id: ClientId) -> bool {
+    fn accept_offer(&mut self, block_id: &BlockId, client_id: ClientId, now: Instant) -> bool {
         let Some(missing_block) = self.missing_blocks.get_mut(block_id) else {
             return false;
         };
@@ -466,11 +672,24 @@ impl Inner {
             State::Idle {
                 required: true,
                 approved: true,
-            } => (),
-            State::Idle { .. } | State::Accepted(_) => return false,
+            } => {
+                missing_block.state = State::Accepted {
+                    client_id,
+                    timestamp: now,
+                };
+                self.accepted.insert(*block_id);
+                self.high_priority.remove(block_id);
+            }
+            // End game duplicate request. Keep the original acceptor as the owner of the state.
+            State::Accepted {
+                client_id: other_client_id,
+                timestamp,
+            } if other_client_id != client_id
+                && self.required_count <= END_GAME_THRESHOLD
+                && timestamp + END_GAME_DELAY <= now => {}
+            State::Idle { .. } | State::Accepted { .. } => return false,
         }
 
-        missing_block.state = State::Accepted(client_id);
         missing_block.offers.insert(client_id, Offer::Accepted);
 
         true
@@ -502,7 +721,29 @@ impl Inner {
             Offer::Available => unreachable!(),
         }
 
-        missing_block.unaccept_by(client_id)
+        let notify = if missing_block.unaccept_by(client_id) {
+            self.accepted.remove(block_id);
+            true
+        } else {
+            false
+        };
+
+        self.update_high_priority(block_id);
+
+        notify
+    }
+
+    // Keeps `high_priority` in sync with the state of the given block.
+    fn update_high_priority(&mut self, block_id: &BlockId) {
+        if self
+            .missing_blocks
+            .get(block_id)
+            .is_some_and(MissingBlock::is_high_priority_candidate)
+        {
+            self.high_priority.insert(*block_id);
+        } else {
+            self.high_priority.remove(block_id);
+        }
     }
 }
 
@@ -511,27 +752,43 @@ struct MissingBlock {
     // Clients that offered this block.
     offers: HashMap<ClientId, Offer>,
     state: State,
+    // Whether the block has been required with `Priority::High`.
+    high_priority: bool,
 }
 
 impl MissingBlock {
+    fn is_high_priority_candidate(&self) -> bool {
+        self.high_priority && matches!(self.state, State::Idle { .. }) && !self.offers.is_empty()
+    }
+
     fn unaccept_by(&mut self, client_id: ClientId) -> bool {
         match self.state {
-            State::Accepted(other_client_id) if other_client_id == client_id => {
+            State::Accepted {
+                client_id: other_client_id,
+                ..
+            } if other_client_id == client_id => {
                 self.state = State::Idle {
                     required: true,
                     approved: true,
                 };
                 true
             }
-            State::Accepted(_) | State::Idle { .. } => false,
+            State::Accepted { .. } | State::Idle { .. } => false,
         }
     }
 }
 
 #[derive(Debug)]
 enum State {
-    Idle { required: bool, approved: bool },
-    Accepted(ClientId),
+    Idle {
+        required: bool,
+        approved: bool,
+    },
+    Accepted {
+        client_id: ClientId,
+        // When the block was accepted.
+        timestamp: Instant,
+    },
 }
 
 #[derive(Debug)]
@@ -847,6 +1104,127 @@ mod tests {
         assert!(offer2.is_none());
     }
 
+    #[test]
+    fn rarest_first() {
+        let tracker = BlockTracker::new();
+
+        let client0 = tracker.client();
+        let client1 = tracker.client();
+
+        let common_block: Block = rand::random();
+        let rare_block: Block = rand::random();
+
+        client0.register(common_block.id, OfferState::Approved);
+        client1.register(common_block.id, OfferState::Approved);
+        client0.register(rare_block.id, OfferState::Approved);
+
+        let offer = client0.offers().try_next().unwrap();
+        assert_eq!(offer.block_id(), &rare_block.id);
+    }
+
+    #[test]
+    fn high_priority_first() {
+        let tracker = BlockTracker::new();
+        tracker.set_request_mode(RequestMode::Lazy);
+
+        let client = tracker.client();
+
+        let blocks: [Block; 4] = rand::random();
+
+        for block in &blocks {
+            client.register(block.id, OfferState::Approved);
+            tracker.require(block.id);
+        }
+
+        let urgent_block: Block = rand::random();
+        client.register(urgent_block.id, OfferState::Approved);
+        tracker
+            .require_batch()
+            .with_priority(Priority::High)
+            .add(urgent_block.id);
+
+        let offer = client.offers().try_next().unwrap();
+        assert_eq!(offer.block_id(), &urgent_block.id);
+    }
+
+    #[test]
+    fn high_priority_pruned() {
+        let tracker = BlockTracker::new();
+        tracker.set_request_mode(RequestMode::Lazy);
+
+        let client = tracker.client();
+        let high_priority = || tracker.shared.inner.lock().unwrap().high_priority.len();
+
+        let block: Block = rand::random();
+        client.register(block.id, OfferState::Approved);
+        tracker
+            .require_batch()
+            .with_priority(Priority::High)
+            .add(block.id);
+        assert_eq!(high_priority(), 1);
+
+        // Accepted blocks are removed...
+        let promise = client
+            .offers()
+            .try_next()
+            .and_then(BlockOffer::accept)
+            .unwrap();
+        assert_eq!(high_priority(), 0);
+
+        // ...and cancelling the request doesn't bring them back when they have no offers left.
+        drop(promise);
+        assert_eq!(high_priority(), 0);
+
+        // Offering the block again does.
+        client.register(block.id, OfferState::Approved);
+        assert_eq!(high_priority(), 1);
+
+        // Completed blocks are removed.
+        client
+            .offers()
+            .try_next()
+            .and_then(BlockOffer::accept)
+            .unwrap()
+            .complete();
+        assert_eq!(high_priority(), 0);
+    }
+
+    #[tokio::test(start_paused = true)]
+    async fn end_game() {
+        let tracker = BlockTracker::new();
+
+        let client0 = tracker.client();
+        let client1 = tracker.client();
+
+        let block: Block = rand::random();
+
+        client0.register(block.id, OfferState::Approved);
+        client1.register(block.id, OfferState::Approved);
+
+        let promise0 = client0
+            .offers()
+            .try_next()
+            .and_then(BlockOffer::accept)
+            .unwrap();
+
+        // Not offered to the other client until the first request is taking too long...
+        assert!(client1.offers().try_next().is_none());
+
+        // ...then it is.
+        let promise1 = time::timeout(2 * END_GAME_DELAY, client1.offers().next())
+            .await
+            .unwrap()
+            .accept()
+            .unwrap();
+        assert_eq!(promise1.block_id(), &block.id);
+
+        promise1.complete();
+        drop(promise0);
+
+        assert!(client0.offers().try_next().is_none());
+        assert!(client1.offers().try_next().is_none());
+    }
+
     #[tokio::test(flavor = "multi_thread")]
     async fn race() {
         let num_clients = 10;
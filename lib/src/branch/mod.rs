@@ -13,6 +13,10 @@ use crate::{
     version_vector::VersionVector,
 };
 use camino::{Utf8Component, Utf8Path};
+use std::sync::{
+    atomic::{AtomicBool, Ordering},
+    Arc,
+};
 
 #[derive(Clone)]
 pub struct Branch {
@@ -151,6 +155,14 @@ impl Branch {
         Ok(block_id)
     }
 
+    pub(crate) fn block_deduplication(&self) -> bool {
+        self.shared.block_deduplication.load(Ordering::Relaxed)
+    }
+
+    pub(crate) fn paged_directories(&self) -> bool {
+        self.shared.paged_directories.load(Ordering::Relaxed)
+    }
+
     pub(crate) fn locker(&self) -> BranchLocker {
         self.shared.locker.branch(*self.id())
     }
@@ -213,12 +225,19 @@ impl Branch {
 #[derive(Clone)]
 pub(crate) struct BranchShared {
     pub locker: Locker,
+    // Whether the blocks written from now on are deduplicated (see `Blob` for details).
+    pub block_deduplication: Arc<AtomicBool>,
+    // Whether big directories are saved in the paged format (see
+    // `Repository::set_paged_directories`).
+    pub paged_directories: Arc<AtomicBool>,
 }
 
 impl BranchShared {
     pub fn new() -> Self {
         Self {
             locker: Locker::new(),
+            block_deduplication: Arc::new(AtomicBool::new(false)),
+            paged_directories: Arc::new(AtomicBool::new(false)),
         }
     }
 }
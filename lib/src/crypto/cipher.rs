@@ -103,6 +103,19 @@ impl SecretKey {
         cipher.apply_keystream(buffer)
     }
 
+    /// Encrypt a message from `input` into `output` without using Authenticated Encryption with
+    /// Associated Data.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `input` and `output` have different lengths.
+    pub(crate) fn encrypt_no_aead_b2b(&self, nonce: &Nonce, input: &[u8], output: &mut [u8]) {
+        let mut cipher = ChaCha20::new(self.as_ref().into(), nonce.into());
+        cipher
+            .apply_keystream_b2b(input, output)
+            .expect("input and output lengths differ")
+    }
+
     /// Decrypt a message in place without using Authenticated Encryption with Associated Data.
     pub(crate) fn decrypt_no_aead(&self, nonce: &Nonce, buffer: &mut [u8]) {
         let mut cipher = ChaCha20::new(self.as_ref().into(), nonce.into());
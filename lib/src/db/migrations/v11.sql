@@ -0,0 +1,18 @@
+--------------------------------------------------------------------------------
+--
+-- Incremental garbage collection
+--
+--------------------------------------------------------------------------------
+
+-- Blocks whose reachability might have changed since they were last checked by the garbage
+-- collector. Processed in the insertion (rowid) order. Re-inserting an existing block (using
+-- `INSERT OR REPLACE`) moves it to the end of the queue so it's not lost when the batch it was
+-- previously part of is removed. The blocks are inserted in bulk by the code that adds them to or
+-- removes them from a branch, not by triggers, so that inserting or pruning a snapshot doesn't
+-- rescan the version history of every locator it touches.
+CREATE TABLE gc_candidates (
+    block_id BLOB NOT NULL UNIQUE
+);
+
+CREATE INDEX index_snapshot_leaf_nodes_on_locator
+    ON snapshot_leaf_nodes (locator);
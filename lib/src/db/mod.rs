@@ -11,6 +11,7 @@ pub use migrations::SCHEMA_VERSION;
 use tracing::Span;
 
 use deadlock::ExpectShortLifetime;
+use metrics::{Gauge, Histogram};
 use ref_cast::RefCast;
 use sqlx::{
     sqlite::{
@@ -26,13 +27,19 @@ use std::{
     ops::{Deref, DerefMut},
     panic::Location,
     path::Path,
-    time::Duration,
+    sync::{Arc, OnceLock},
+    time::{Duration, Instant},
 };
 #[cfg(test)]
 use tempfile::TempDir;
 use thiserror::Error;
-use tokio::{fs, task};
+use tokio::{
+    fs,
+    sync::{OwnedSemaphorePermit, Semaphore},
+    task,
+};
 
+const MAX_READ_CONNECTIONS: u32 = 8;
 const ACQUIRE_TIMEOUT: Duration = Duration::from_secs(5 * 60);
 const IDLE_TIMEOUT: Duration = Duration::from_secs(60);
 const WARN_AFTER_CONNECTION_LIFETIME: Duration = Duration::from_secs(30);
@@ -46,6 +53,11 @@ pub struct Pool {
     reads: SqlitePool,
     // Pool with a single writable connection.
     write: SqlitePool,
+    // Explicit FIFO queue of the tasks waiting to begin a write transaction. Waiting here instead
+    // of on the write pool itself means the wait for the write connection is not limited by
+    // `ACQUIRE_TIMEOUT` and can be monitored.
+    write_queue: Arc<Semaphore>,
+    metrics: Arc<OnceLock<PoolMetrics>>,
 }
 
 impl Pool {
@@ -69,37 +81,98 @@ impl Pool {
             .await?;
 
         let reads = pool_options
-            .max_connections(8)
+            .max_connections(MAX_READ_CONNECTIONS)
             .connect_with(conn_options.read_only(true))
             .await?;
 
-        Ok(Self { reads, write })
+        Ok(Self {
+            reads,
+            write,
+            write_queue: Arc::new(Semaphore::new(1)),
+            metrics: Arc::new(OnceLock::new()),
+        })
     }
 
     /// Acquire a read-only database connection.
     #[track_caller]
     pub fn acquire(&self) -> impl Future<Output = Result<PoolConnection, sqlx::Error>> + '_ {
-        PoolConnection::acquire(&self.reads, Location::caller())
+        let location = Location::caller();
+
+        async move {
+            let start = Instant::now();
+            let conn = PoolConnection::acquire(&self.reads, location).await?;
+
+            if let Some(metrics) = self.metrics.get() {
+                metrics.read_wait_time.record(start.elapsed());
+            }
+
+            Ok(conn)
+        }
     }
 
     /// Begin a read-only transaction. See [`ReadTransaction`] for more details.
     #[track_caller]
     pub fn begin_read(&self) -> impl Future<Output = Result<ReadTransaction, sqlx::Error>> + '_ {
-        ReadTransaction::begin(&self.reads, Location::caller())
+        let location = Location::caller();
+
+        async move {
+            let start = Instant::now();
+            let tx = ReadTransaction::begin(&self.reads, location).await?;
+
+            if let Some(metrics) = self.metrics.get() {
+                metrics.read_wait_time.record(start.elapsed());
+            }
+
+            Ok(tx)
+        }
     }
 
     /// Begin a write transaction. See [`WriteTransaction`] for more details.
+    ///
+    /// Concurrent calls are served in the order they were made.
     #[track_caller]
     pub fn begin_write(&self) -> impl Future<Output = Result<WriteTransaction, sqlx::Error>> + '_ {
         let location = Location::caller();
 
         async move {
+            let metrics = self.metrics.get();
+            let start = Instant::now();
+
+            let queued = metrics.map(|metrics| Queued::new(&metrics.write_queue_depth));
+            // unwrap is OK because the semaphore is never closed.
+            let permit = self.write_queue.clone().acquire_owned().await.unwrap();
+            drop(queued);
+
+            let inner = ReadTransaction::begin(&self.write, location).await?;
+
+            if let Some(metrics) = metrics {
+                metrics.write_wait_time.record(start.elapsed());
+            }
+
             Ok(WriteTransaction {
-                inner: ReadTransaction::begin(&self.write, location).await?,
+                inner,
+                _permit: permit,
             })
         }
     }
 
+    /// Sets the metrics to report the connection wait times and the write queue depth to. Can be
+    /// set only once. Until then, nothing is reported.
+    pub(crate) fn set_metrics(
+        &self,
+        read_wait_time: Histogram,
+        write_wait_time: Histogram,
+        write_queue_depth: Gauge,
+    ) {
+        self.metrics
+            .set(PoolMetrics {
+                read_wait_time,
+                write_wait_time,
+                write_queue_depth,
+            })
+            .ok();
+    }
+
     pub(crate) async fn close(&self) -> Result<(), sqlx::Error> {
         // Make sure to first close `reads` and only then `write`. That way when closing the write
         // connection it is the last remaining connection and so it performs a WAL checkpoint and
@@ -111,6 +184,32 @@ impl Pool {
     }
 }
 
+struct PoolMetrics {
+    // Time to acquire a read connection or begin a read transaction.
+    read_wait_time: Histogram,
+    // Time to begin a write transaction, including waiting in the write queue.
+    write_wait_time: Histogram,
+    // Number of tasks currently waiting in the write queue.
+    write_queue_depth: Gauge,
+}
+
+// Counts a task waiting in the write queue for as long as this is alive (so it also works when the
+// waiting is cancelled).
+struct Queued<'a>(&'a Gauge);
+
+impl<'a> Queued<'a> {
+    fn new(depth: &'a Gauge) -> Self {
+        depth.increment(1.0);
+        Self(depth)
+    }
+}
+
+impl Drop for Queued<'_> {
+    fn drop(&mut self) {
+        self.0.decrement(1.0);
+    }
+}
+
 /// Database connection from pool
 pub struct PoolConnection {
     inner: sqlx::pool::PoolConnection<Sqlite>,
@@ -225,6 +324,9 @@ struct Committed(#[allow(dead_code)] ReadTransaction);
 /// transaction until that transaction is committed however.
 pub struct WriteTransaction {
     inner: ReadTransaction,
+    // Released only after the transaction is closed (and after the `commit_and_then` callback
+    // completes), letting the next queued writer in.
+    _permit: OwnedSemaphorePermit,
 }
 
 impl WriteTransaction {
@@ -286,14 +388,37 @@ impl WriteTransaction {
         let span = Span::current();
 
         task::spawn(async move {
-            // IMPORTANT: `_committed` must live until `f` completes.
-            let _committed = self.inner.commit().await?;
+            // IMPORTANT: `_committed` and `_permit` must live until `f` completes.
+            let Self { inner, _permit } = self;
+            let _committed = inner.commit().await?;
             let result = span.in_scope(f);
             Ok(result)
         })
         .await
         .unwrap()
     }
+
+    /// Same as `commit_and_then` but runs the closure on a thread dedicated for blocking
+    /// operations (see `tokio::task::spawn_blocking`). Use this when the closure does blocking io.
+    pub async fn commit_and_then_blocking<F, R>(self, f: F) -> Result<R, sqlx::Error>
+    where
+        F: FnOnce() -> R + Send + 'static,
+        R: Send + 'static,
+    {
+        let span = Span::current();
+
+        task::spawn(async move {
+            // IMPORTANT: `_committed` and `_permit` must live until `f` completes.
+            let Self { inner, _permit } = self;
+            let _committed = inner.commit().await?;
+            let result = task::spawn_blocking(move || span.in_scope(f))
+                .await
+                .unwrap();
+            Ok(result)
+        })
+        .await
+        .unwrap()
+    }
 }
 
 impl Deref for WriteTransaction {
@@ -419,6 +544,8 @@ async fn set_pragma(conn: &mut Connection, name: &str, value: u32) -> Result<(),
 #[cfg(test)]
 mod tests {
     use super::*;
+    use std::pin::pin;
+    use tokio::time;
 
     // Check the casts are lossless
 
@@ -434,6 +561,24 @@ mod tests {
         assert_eq!(decode_u64(i64::MAX), u64::MAX / 2);
     }
 
+    #[tokio::test]
+    async fn begin_write_waits_for_previous_write() {
+        let (_base_dir, pool) = create_temp().await.unwrap();
+
+        let tx = pool.begin_write().await.unwrap();
+
+        // Reads are not blocked by the pending write.
+        pool.begin_read().await.unwrap();
+
+        let mut next = pin!(pool.begin_write());
+        assert!(time::timeout(Duration::from_millis(100), next.as_mut())
+            .await
+            .is_err());
+
+        tx.commit().await.unwrap();
+        next.await.unwrap();
+    }
+
     #[test]
     fn encode_u64_sanity_check() {
         assert_eq!(encode_u64(0), 0);
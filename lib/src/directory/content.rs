@@ -1,8 +1,13 @@
 //! Directory content
 
+mod paged;
+
+use self::paged::Layout;
 use super::entry_data::EntryData;
 use crate::{
     blob::BlobId,
+    collections::HashMap,
+    crypto::Hash,
     error::{Error, Result},
     protocol::Bump,
     version_vector::VersionVector,
@@ -12,43 +17,89 @@ use std::{
     cmp::Ordering,
     collections::{
         btree_map::{self, Entry},
-        BTreeMap,
+        BTreeMap, BTreeSet,
     },
 };
 
 /// Version of the Directory serialization format.
-pub const VERSION: u64 = 2;
+pub const VERSION: u64 = paged::VERSION;
+
+/// Version of the format which stores all the entries as a single serialized map. Still used for
+/// directories that fit into a single block, as it's more compact and it's always written in full
+/// anyway.
+const FLAT_VERSION: u64 = 2;
 
 #[derive(Clone, Debug)]
 pub(super) struct Content {
     entries: v2::Entries,
+    // How the content is stored in the blob, if it's in the paged format.
+    layout: Option<Layout>,
+    // Names of the entries modified since the content was loaded or last encoded.
+    dirty: BTreeSet<String>,
 }
 
 impl Content {
     pub fn empty() -> Self {
         Self {
             entries: BTreeMap::new(),
+            layout: None,
+            dirty: BTreeSet::new(),
         }
     }
 
+    /// Deserializes content stored in the flat format (the current one or any of the previous
+    /// ones).
     pub fn deserialize(mut input: &[u8]) -> Result<Self> {
         let version = vint64::decode(&mut input).map_err(|_| Error::MalformedDirectory)?;
         let entries = match version {
-            VERSION => deserialize_entries(input),
+            FLAT_VERSION => deserialize_entries(input),
             1 => Ok(v2::from_v1(deserialize_entries(input)?)),
             0 => Ok(v2::from_v1(v1::from_v0(deserialize_entries(input)?))),
             _ => Err(Error::StorageVersionMismatch),
         };
 
-        Ok(Self { entries: entries? })
+        Ok(Self {
+            entries: entries?,
+            layout: None,
+            dirty: BTreeSet::new(),
+        })
     }
 
-    pub fn serialize(&self) -> Vec<u8> {
-        let mut output = Vec::new();
-        output.extend_from_slice(vint64::encode(VERSION).as_ref());
-        bincode::serialize_into(&mut output, &self.entries)
-            .expect("failed to serialize directory content");
-        output
+    /// Encodes this content for saving into the blob it's been loaded from (or into a new blob)
+    /// and marks it as unmodified. The paged format is used only if `paged` is true.
+    pub fn encode(&mut self, paged: bool) -> Encoded {
+        let dirty = std::mem::take(&mut self.dirty);
+
+        if !paged || !paged::is_worth_it(&self.entries, self.layout.as_ref()) {
+            self.layout = None;
+
+            let mut output = Vec::new();
+            output.extend_from_slice(vint64::encode(FLAT_VERSION).as_ref());
+            bincode::serialize_into(&mut output, &self.entries)
+                .expect("failed to serialize directory content");
+
+            return Encoded::Flat(output);
+        }
+
+        let save = paged::save(&self.entries, self.layout.as_ref(), &dirty);
+        self.layout = Some(save.layout);
+
+        Encoded::Paged {
+            writes: save.writes,
+            len: save.len,
+        }
+    }
+
+    /// Is this content stored in the paged format?
+    #[cfg(test)]
+    pub fn is_paged(&self) -> bool {
+        self.layout.is_some()
+    }
+
+    /// Forgets how this content is stored so that it's encoded in full next time. Needed when
+    /// saving it into a different blob than the one it's been loaded from.
+    pub fn reset_layout(&mut self) {
+        self.layout = None;
     }
 
     pub fn iter(&self) -> btree_map::Iter<String, EntryData> {
@@ -60,7 +111,9 @@ impl Content {
     }
 
     pub fn get_mut(&mut self, name: &str) -> Option<&mut EntryData> {
-        self.entries.get_mut(name)
+        let data = self.entries.get_mut(name)?;
+        self.dirty.insert(name.to_owned());
+        Some(data)
     }
 
     /// Inserts an entry into this directory. Returns the difference between the new and the old
@@ -70,10 +123,11 @@ impl Content {
         name: String,
         new_data: EntryData,
     ) -> Result<VersionVector, EntryExists> {
-        match self.entries.entry(name) {
+        match self.entries.entry(name.clone()) {
             Entry::Vacant(entry) => {
                 let diff = new_data.version_vector().clone();
                 entry.insert(new_data);
+                self.dirty.insert(name);
                 Ok(diff)
             }
             Entry::Occupied(mut entry) => {
@@ -82,6 +136,7 @@ impl Content {
                     .version_vector()
                     .saturating_sub(entry.get().version_vector());
                 entry.insert(new_data);
+                self.dirty.insert(name);
                 Ok(diff)
             }
         }
@@ -105,8 +160,7 @@ impl Content {
     /// the new version vectors.
     pub fn bump(&mut self, name: &str, bump: Bump) -> Result<VersionVector> {
         Ok(bump.apply(
-            self.entries
-                .get_mut(name)
+            self.get_mut(name)
                 .ok_or(Error::EntryNotFound)?
                 .version_vector_mut(),
         ))
@@ -122,6 +176,110 @@ impl Content {
     }
 }
 
+/// Encoded directory content.
+pub(super) enum Encoded {
+    /// The whole content, to replace the current content of the blob.
+    Flat(Vec<u8>),
+    /// Data to write at the given offsets of the blob (in the offset order) after which the blob
+    /// is to be truncated to `len`.
+    Paged {
+        writes: Vec<(u64, Vec<u8>)>,
+        len: u64,
+    },
+}
+
+/// Loads content stored in the paged format one chunk at a time, reusing the chunks that haven't
+/// changed since the content was loaded previously.
+pub(super) struct PagedLoader<'a> {
+    layout: Layout,
+    entries: v2::Entries,
+    // Chunks of the previous content by their hash.
+    prev: HashMap<&'a Hash, (&'a Content, usize)>,
+    next: usize,
+}
+
+impl<'a> PagedLoader<'a> {
+    /// Length of the start of the blob that's enough to tell in which format the content is.
+    pub const PREFIX_LEN: usize = paged::FIRST_PAGE_SIZE;
+
+    /// Returns the length of the whole header if `prefix` (the start of the blob) is in the paged
+    /// format. Returns `None` if it's in the flat format.
+    pub fn header_len(prefix: &[u8]) -> Option<usize> {
+        paged::header_len(prefix)
+    }
+
+    pub fn new(header: &[u8], blob_len: u64, prev: Option<&'a Content>) -> Result<Self> {
+        let layout = paged::decode_header(header, blob_len)?;
+
+        // Only content whose layout describes exactly its entries can be reused.
+        let prev = prev
+            .filter(|prev| prev.dirty.is_empty())
+            .and_then(|prev| Some((prev, prev.layout.as_ref()?)))
+            .map(|(prev, prev_layout)| {
+                (0..prev_layout.chunk_count())
+                    .map(|index| (prev_layout.chunk_hash(index), (prev, index)))
+                    .collect()
+            })
+            .unwrap_or_default();
+
+        Ok(Self {
+            layout,
+            entries: BTreeMap::new(),
+            prev,
+            next: 0,
+        })
+    }
+
+    /// Location (offset and length) of the next chunk that needs to be read from the blob and
+    /// passed to [`Self::insert`]. Returns `None` when all chunks have been loaded.
+    pub fn next_chunk(&mut self) -> Option<(u64, usize)> {
+        while self.next < self.layout.chunk_count() {
+            // The chunk can be reused only if it covers the same range of names, otherwise the
+            // entries wouldn't be validated against the current header.
+            let reusable = self
+                .prev
+                .get(self.layout.chunk_hash(self.next))
+                .map(|(prev, index)| {
+                    // unwrap is OK because only content with a layout is in `prev`.
+                    (prev, prev.layout.as_ref().unwrap(), *index)
+                })
+                .filter(|(_, prev_layout, index)| {
+                    prev_layout.chunk_bounds(*index) == self.layout.chunk_bounds(self.next)
+                });
+
+            let Some((prev, prev_layout, index)) = reusable else {
+                return Some(self.layout.chunk_location(self.next));
+            };
+
+            self.entries.extend(
+                prev_layout
+                    .chunk_entries(&prev.entries, index)
+                    .map(|(name, data)| (name.clone(), data.clone())),
+            );
+            self.next += 1;
+        }
+
+        None
+    }
+
+    /// Inserts the chunk returned by the last call to [`Self::next_chunk`].
+    pub fn insert(&mut self, chunk: &[u8]) -> Result<()> {
+        self.entries
+            .extend(self.layout.decode_chunk(self.next, chunk)?);
+        self.next += 1;
+
+        Ok(())
+    }
+
+    pub fn finish(self) -> Content {
+        Content {
+            entries: self.entries,
+            layout: Some(self.layout),
+            dirty: BTreeSet::new(),
+        }
+    }
+}
+
 #[derive(Debug)]
 pub(crate) enum EntryExists {
     /// The existing entry is more up-to-date and points to the same blob than the one being
@@ -0,0 +1,682 @@
+//! Paged serialization format of the directory content.
+//!
+//! The entries are split into chunks of entries with consecutive names and every chunk is stored
+//! in its own run of pages, where a page is exactly one block of the blob. Inserting, updating or
+//! removing an entry then rewrites only the pages of the chunk containing it and the pages of the
+//! header that changed, instead of the whole blob. The header starts at the beginning of the blob
+//! and lists the chunks: the name of their first entry, where they are stored, their length and
+//! hash. Chunks that grow over a page are split and chunks that shrink too much are merged into
+//! their neighbour, so the chunks stay about one page big.
+//!
+//! The format only makes saving incremental. Opening a directory still loads all its chunks (except
+//! those unchanged since the previous load) and lookups are done on the whole in-memory content.
+//!
+//! Older versions of the library can't read this format, so it's written only when enabled with
+//! `Repository::set_paged_directories`. It's always readable though. Content is not migrated
+//! eagerly: a directory is converted to or from this format the next time it's saved.
+//!
+//! Layout of the header:
+//!
+//! - the format version (vint64)
+//! - the length of the encoded chunk list (u32 little endian)
+//! - the chunk list (bincode)
+//!
+//! Each chunk is the bincode-encoded sequence of its `(name, data)` pairs, in the name order.
+
+use super::super::entry_data::EntryData;
+use crate::{
+    blob,
+    crypto::{Hash, Hashable},
+    error::{Error, Result},
+    protocol::BLOCK_SIZE,
+};
+use serde::{Deserialize, Serialize};
+use std::{
+    collections::{BTreeMap, BTreeSet},
+    ops::Bound,
+};
+
+/// Version of the paged format.
+pub(super) const VERSION: u64 = 3;
+
+/// Size of the first page. It's smaller than the other pages because the first block of the blob
+/// also contains the blob header.
+pub(super) const FIRST_PAGE_SIZE: usize = BLOCK_SIZE - blob::HEADER_SIZE;
+const PAGE_SIZE: usize = BLOCK_SIZE;
+
+/// Chunks bigger than this are split.
+const MAX_CHUNK_SIZE: usize = PAGE_SIZE;
+/// Modified chunks smaller than this are merged with their neighbour.
+const MIN_CHUNK_SIZE: usize = PAGE_SIZE / 4;
+
+// Size of the encoded number of entries at the start of every chunk.
+const CHUNK_PREFIX_SIZE: u64 = 8;
+// Size of the version and the chunk list length at the start of the header.
+const HEADER_PREFIX_SIZE: usize = 1 + 4;
+
+type Entries = BTreeMap<String, EntryData>;
+
+/// Where the chunks of a directory are stored in its blob.
+#[derive(Clone, Debug)]
+pub(super) struct Layout {
+    chunks: Vec<Chunk>,
+    // The encoded header (without padding), to find which of its pages changed on save.
+    header: Vec<u8>,
+    page_count: u32,
+}
+
+#[derive(Clone, Debug, Serialize, Deserialize)]
+struct Chunk {
+    // The chunk contains the entries from this name (inclusive) up to the `first` of the next
+    // chunk (exclusive). Empty for the first chunk.
+    first: String,
+    // Index of the first page of the chunk. The chunk occupies `page_count(len)` consecutive pages.
+    page: u32,
+    len: u32,
+    hash: Hash,
+}
+
+impl Layout {
+    /// Location (offset and length) of the given chunk in the blob.
+    pub fn chunk_location(&self, index: usize) -> (u64, usize) {
+        let chunk = &self.chunks[index];
+        (page_offset(chunk.page), chunk.len as usize)
+    }
+
+    pub fn chunk_count(&self) -> usize {
+        self.chunks.len()
+    }
+
+    pub fn chunk_hash(&self, index: usize) -> &Hash {
+        &self.chunks[index].hash
+    }
+
+    /// Name of the first entry of the given chunk and of the first entry of the next chunk.
+    pub fn chunk_bounds(&self, index: usize) -> (&str, Option<&str>) {
+        (
+            &self.chunks[index].first,
+            self.chunks.get(index + 1).map(|next| next.first.as_str()),
+        )
+    }
+
+    /// Entries of `entries` belonging to the given chunk of this layout.
+    pub fn chunk_entries<'a>(
+        &self,
+        entries: &'a Entries,
+        index: usize,
+    ) -> impl Iterator<Item = (&'a String, &'a EntryData)> {
+        chunk_range(entries, &self.chunks, index)
+    }
+
+    /// Decodes the given chunk, checking that it's what the header says it is.
+    pub fn decode_chunk(&self, index: usize, input: &[u8]) -> Result<Vec<(String, EntryData)>> {
+        let chunk = &self.chunks[index];
+
+        if input.len() != chunk.len as usize || input.hash() != chunk.hash {
+            return Err(Error::MalformedDirectory);
+        }
+
+        let entries: Vec<(String, EntryData)> =
+            bincode::deserialize(input).map_err(|_| Error::MalformedDirectory)?;
+
+        let (first, end) = self.chunk_bounds(index);
+        let mut prev: Option<&str> = None;
+
+        for (name, _) in &entries {
+            let name = name.as_str();
+
+            if name < first
+                || end.map(|end| name >= end).unwrap_or(false)
+                || prev.map(|prev| name <= prev).unwrap_or(false)
+            {
+                return Err(Error::MalformedDirectory);
+            }
+
+            prev = Some(name);
+        }
+
+        Ok(entries)
+    }
+}
+
+/// Returns the length of the whole header if `prefix` (the start of the blob) is the start of
+/// content in the paged format. Returns `None` if it's in some other format.
+pub(super) fn header_len(prefix: &[u8]) -> Option<usize> {
+    let mut input = prefix;
+
+    if vint64::decode(&mut input).ok()? != VERSION {
+        return None;
+    }
+
+    let len = u32::from_le_bytes(input.get(..4)?.try_into().ok()?);
+
+    Some(HEADER_PREFIX_SIZE + len as usize)
+}
+
+/// Decodes the header and checks it's consistent with the length of the blob.
+pub(super) fn decode_header(header: &[u8], blob_len: u64) -> Result<Layout> {
+    let chunks: Vec<Chunk> = header
+        .get(HEADER_PREFIX_SIZE..)
+        .and_then(|input| bincode::deserialize(input).ok())
+        .ok_or(Error::MalformedDirectory)?;
+
+    let header_pages = header_page_count(header.len());
+    let mut page_count = header_pages as u64;
+
+    for (index, chunk) in chunks.iter().enumerate() {
+        let valid_first = if index == 0 {
+            chunk.first.is_empty()
+        } else {
+            chunk.first > chunks[index - 1].first
+        };
+
+        if !valid_first || chunk.page < header_pages || (chunk.len as u64) < CHUNK_PREFIX_SIZE {
+            return Err(Error::MalformedDirectory);
+        }
+
+        page_count =
+            page_count.max(chunk.page as u64 + chunk_page_count(chunk.len as usize) as u64);
+    }
+
+    // No two chunks may share a page, otherwise writing one would corrupt the other.
+    let mut ranges: Vec<_> = chunks
+        .iter()
+        .map(|chunk| {
+            let start = chunk.page as u64;
+            (start, start + chunk_page_count(chunk.len as usize) as u64)
+        })
+        .collect();
+    ranges.sort_unstable();
+
+    if ranges.windows(2).any(|pair| pair[0].1 > pair[1].0) {
+        return Err(Error::MalformedDirectory);
+    }
+
+    let page_count: u32 = page_count
+        .try_into()
+        .map_err(|_| Error::MalformedDirectory)?;
+
+    if chunks.is_empty() || page_offset(page_count) != blob_len {
+        return Err(Error::MalformedDirectory);
+    }
+
+    Ok(Layout {
+        chunks,
+        header: header.to_vec(),
+        page_count,
+    })
+}
+
+/// Whether the content should be stored in the paged format.
+pub(super) fn is_worth_it(entries: &Entries, layout: Option<&Layout>) -> bool {
+    match layout {
+        // Switch back to the flat format only once the content shrinks well below the size of a
+        // single page, so a directory around that size doesn't switch back and forth.
+        Some(layout) => {
+            layout.chunks.len() > 1 || serialized_size(entries) > FIRST_PAGE_SIZE as u64 / 2
+        }
+        None => serialized_size(entries) > FIRST_PAGE_SIZE as u64,
+    }
+}
+
+/// Result of saving the content in the paged format.
+pub(super) struct Save {
+    pub layout: Layout,
+    /// Data to write at the given offsets, in the offset order.
+    pub writes: Vec<(u64, Vec<u8>)>,
+    /// The new length of the blob.
+    pub len: u64,
+}
+
+/// Prepares saving `entries` which were previously saved in the `old` layout (if any) and of which
+/// only the entries with the names in `dirty` have been modified (inserted, updated or removed)
+/// since.
+pub(super) fn save(entries: &Entries, old: Option<&Layout>, dirty: &BTreeSet<String>) -> Save {
+    let mut plans = plan_chunks(entries, old, dirty);
+
+    // The header size doesn't depend on where the chunks are so its size is known before they are
+    // allocated.
+    let header_pages = header_page_count(encode_header(&plans_to_chunks(&plans)).len());
+
+    // Allocate the pages. The chunks that stay as they were keep their pages unless the header
+    // grew over them.
+    let mut used = vec![false; old.map(|old| old.page_count).unwrap_or(0) as usize];
+    mark_used(&mut used, 0, header_pages);
+
+    for plan in &mut plans {
+        let Some(chunk) = &plan.clean else {
+            continue;
+        };
+
+        if chunk.page < header_pages {
+            plan.clean = None;
+        } else {
+            mark_used(&mut used, chunk.page, chunk_page_count(chunk.len as usize));
+        }
+    }
+
+    let mut writes = Vec::new();
+    let mut chunks = Vec::with_capacity(plans.len());
+
+    for (index, plan) in plans.iter().enumerate() {
+        if let Some(chunk) = &plan.clean {
+            chunks.push(chunk.clone());
+            continue;
+        }
+
+        let end = plans.get(index + 1).map(|next| next.first.as_str());
+        let data = encode_chunk(range(entries, &plan.first, end));
+        let page_count = chunk_page_count(data.len());
+        let page = allocate(&mut used, header_pages, page_count);
+
+        chunks.push(Chunk {
+            first: plan.first.clone(),
+            page,
+            len: data.len() as u32,
+            hash: data.hash(),
+        });
+
+        writes.push((
+            page_offset(page),
+            pad(data, page_count as usize * PAGE_SIZE),
+        ));
+    }
+
+    let header = encode_header(&chunks);
+    let old_header = old.map(|old| old.header.as_slice()).unwrap_or(&[]);
+    let old_header_pages = if old.is_some() {
+        header_page_count(old_header.len())
+    } else {
+        0
+    };
+
+    let padded_header = pad(header.clone(), page_offset(header_pages) as usize);
+    let padded_old_header = pad(old_header.to_vec(), page_offset(old_header_pages) as usize);
+
+    // Write only the pages of the header that changed.
+    for page in 0..header_pages {
+        let start = page_offset(page) as usize;
+        let end = page_offset(page + 1) as usize;
+
+        if page >= old_header_pages || padded_header[start..end] != padded_old_header[start..end] {
+            writes.push((start as u64, padded_header[start..end].to_vec()));
+        }
+    }
+
+    writes.sort_by_key(|(offset, _)| *offset);
+
+    let page_count = used
+        .iter()
+        .rposition(|used| *used)
+        .map(|page| page as u32 + 1)
+        .unwrap_or(header_pages);
+
+    Save {
+        layout: Layout {
+            chunks,
+            header,
+            page_count,
+        },
+        writes,
+        len: page_offset(page_count),
+    }
+}
+
+// Chunk to be saved. If `clean` is set, the chunk hasn't changed and is stored as described by it.
+struct Plan {
+    first: String,
+    clean: Option<Chunk>,
+}
+
+// Decides how to split the entries into chunks.
+fn plan_chunks(entries: &Entries, old: Option<&Layout>, dirty: &BTreeSet<String>) -> Vec<Plan> {
+    let mut plans: Vec<_> = match old {
+        Some(old) => old
+            .chunks
+            .iter()
+            .enumerate()
+            .map(|(index, chunk)| {
+                let end = old.chunks.get(index + 1).map(|next| next.first.as_str());
+                let modified = dirty
+                    .range::<str, _>((Bound::Included(chunk.first.as_str()), upper_bound(end)))
+                    .next()
+                    .is_some();
+
+                Plan {
+                    first: chunk.first.clone(),
+                    clean: (!modified).then(|| chunk.clone()),
+                }
+            })
+            .collect(),
+        None => vec![Plan {
+            first: String::new(),
+            clean: None,
+        }],
+    };
+
+    // Merge small modified chunks into their neighbours.
+    let mut index = 0;
+
+    while index < plans.len() {
+        if plans.len() == 1
+            || plans[index].clean.is_some()
+            || plan_size(entries, &plans, index) >= MIN_CHUNK_SIZE as u64
+        {
+            index += 1;
+            continue;
+        }
+
+        if index + 1 < plans.len() {
+            plans.remove(index + 1);
+        } else {
+            plans.remove(index);
+            index -= 1;
+            plans[index].clean = None;
+        }
+    }
+
+    // Split big modified chunks.
+    let mut output = Vec::with_capacity(plans.len());
+
+    for (index, plan) in plans.iter().enumerate() {
+        if plan.clean.is_some() {
+            output.push(Plan {
+                first: plan.first.clone(),
+                clean: plan.clean.clone(),
+            });
+            continue;
+        }
+
+        let end = plans.get(index + 1).map(|next| next.first.as_str());
+        let sizes: Vec<_> = range(entries, &plan.first, end)
+            .map(|entry| (entry.0, entry_size(entry)))
+            .collect();
+
+        let payload: u64 = sizes.iter().map(|(_, size)| size).sum();
+        let max_payload = MAX_CHUNK_SIZE as u64 - CHUNK_PREFIX_SIZE;
+        let piece_count = payload.div_ceil(max_payload).max(1);
+        let target = payload.div_ceil(piece_count);
+
+        output.push(Plan {
+            first: plan.first.clone(),
+            clean: None,
+        });
+
+        let mut acc = 0;
+
+        for (name, size) in sizes {
+            if acc > 0 && acc + size > target {
+                output.push(Plan {
+                    first: name.clone(),
+                    clean: None,
+                });
+                acc = 0;
+            }
+
+            acc += size;
+        }
+    }
+
+    output
+}
+
+fn plan_size(entries: &Entries, plans: &[Plan], index: usize) -> u64 {
+    if let Some(chunk) = &plans[index].clean {
+        return chunk.len as u64;
+    }
+
+    let end = plans.get(index + 1).map(|next| next.first.as_str());
+
+    CHUNK_PREFIX_SIZE
+        + range(entries, &plans[index].first, end)
+            .map(entry_size)
+            .sum::<u64>()
+}
+
+// Chunks with placeholder locations, to compute the header size.
+fn plans_to_chunks(plans: &[Plan]) -> Vec<Chunk> {
+    plans
+        .iter()
+        .map(|plan| Chunk {
+            first: plan.first.clone(),
+            page: 0,
+            len: 0,
+            hash: Hash::from([0; Hash::SIZE]),
+        })
+        .collect()
+}
+
+fn encode_header(chunks: &[Chunk]) -> Vec<u8> {
+    let list = bincode::serialize(chunks).expect("failed to serialize directory header");
+
+    let mut output = Vec::with_capacity(HEADER_PREFIX_SIZE + list.len());
+    output.extend_from_slice(vint64::encode(VERSION).as_ref());
+    output.extend_from_slice(&(list.len() as u32).to_le_bytes());
+    output.extend_from_slice(&list);
+    output
+}
+
+fn encode_chunk<'a>(entries: impl Iterator<Item = (&'a String, &'a EntryData)>) -> Vec<u8> {
+    let entries: Vec<_> = entries.collect();
+    bincode::serialize(&entries).expect("failed to serialize directory chunk")
+}
+
+fn chunk_range<'a>(
+    entries: &'a Entries,
+    chunks: &[Chunk],
+    index: usize,
+) -> impl Iterator<Item = (&'a String, &'a EntryData)> {
+    let end = chunks.get(index + 1).map(|next| next.first.as_str());
+    range(entries, &chunks[index].first, end)
+}
+
+fn range<'a>(
+    entries: &'a Entries,
+    first: &str,
+    end: Option<&str>,
+) -> impl Iterator<Item = (&'a String, &'a EntryData)> {
+    entries.range::<str, _>((Bound::Included(first), upper_bound(end)))
+}
+
+fn upper_bound(end: Option<&str>) -> Bound<&str> {
+    end.map(Bound::Excluded).unwrap_or(Bound::Unbounded)
+}
+
+fn serialized_size(entries: &Entries) -> u64 {
+    bincode::serialized_size(entries).expect("failed to serialize directory content")
+}
+
+fn entry_size(entry: (&String, &EntryData)) -> u64 {
+    bincode::serialized_size(&entry).expect("failed to serialize directory entry")
+}
+
+/// Offset of the given page in the blob.
+fn page_offset(page: u32) -> u64 {
+    if page == 0 {
+        0
+    } else {
+        FIRST_PAGE_SIZE as u64 + (page as u64 - 1) * PAGE_SIZE as u64
+    }
+}
+
+fn header_page_count(len: usize) -> u32 {
+    if len <= FIRST_PAGE_SIZE {
+        1
+    } else {
+        1 + (len - FIRST_PAGE_SIZE).div_ceil(PAGE_SIZE) as u32
+    }
+}
+
+fn chunk_page_count(len: usize) -> u32 {
+    len.div_ceil(PAGE_SIZE).max(1) as u32
+}
+
+fn mark_used(used: &mut Vec<bool>, page: u32, count: u32) {
+    let start = page as usize;
+    let end = start + count as usize;
+
+    if used.len() < end {
+        used.resize(end, false);
+    }
+
+    used[start..end].fill(true);
+}
+
+// First fit allocation of `count` consecutive pages, not before `start`. The pages past the end of
+// the blob are always free so this never fails.
+fn allocate(used: &mut Vec<bool>, start: u32, count: u32) -> u32 {
+    let is_free = |page: usize| !used.get(page).copied().unwrap_or(false);
+    let mut page = start as usize;
+
+    while !(page..page + count as usize).all(is_free) {
+        page += 1;
+    }
+
+    mark_used(used, page as u32, count);
+    page as u32
+}
+
+fn pad(mut data: Vec<u8>, len: usize) -> Vec<u8> {
+    data.resize(len, 0);
+    data
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{crypto::sign::PublicKey, version_vector::VersionVector};
+    use assert_matches::assert_matches;
+
+    #[test]
+    fn save_new_big_content() {
+        let entries = make_entries(0..5000);
+        let save = save(&entries, None, &BTreeSet::new());
+
+        assert!(save.layout.chunks.len() > 1);
+        assert_eq!(write_end(&save.writes), save.len);
+        assert_eq!(load(&save), entries);
+    }
+
+    #[test]
+    fn save_modified_entry_rewrites_only_its_chunk() {
+        let mut entries = make_entries(0..5000);
+        let first = save(&entries, None, &BTreeSet::new());
+        let name = make_name(2500);
+
+        entries.insert(name.clone(), make_data(1));
+        let second = save(&entries, Some(&first.layout), &[name].into());
+
+        // One page of the chunk and (at most) one page of the header.
+        assert!(second.writes.len() <= 2, "{}", second.writes.len());
+        assert!(second
+            .writes
+            .iter()
+            .all(|(_, data)| data.len() == PAGE_SIZE || data.len() == FIRST_PAGE_SIZE));
+        assert_eq!(second.len, first.len);
+    }
+
+    #[test]
+    fn save_removed_entries_merges_chunks() {
+        let mut entries = make_entries(0..5000);
+        let first = save(&entries, None, &BTreeSet::new());
+
+        let removed: BTreeSet<_> = (1000..2000).map(make_name).collect();
+        for name in &removed {
+            entries.remove(name);
+        }
+
+        let second = save(&entries, Some(&first.layout), &removed);
+
+        assert!(second.layout.chunks.len() < first.layout.chunks.len());
+        assert!(second.len <= first.len);
+        assert_eq!(apply(&first, &second), entries);
+    }
+
+    #[test]
+    fn decode_header_rejects_overlapping_chunks() {
+        let entries = make_entries(0..5000);
+        let save = save(&entries, None, &BTreeSet::new());
+        let blob = write(Vec::new(), &save);
+
+        let mut chunks = save.layout.chunks.clone();
+        assert!(chunks.len() > 1);
+        chunks[1].page = chunks[0].page;
+
+        let header = encode_header(&chunks);
+
+        assert_matches!(
+            decode_header(&header, blob.len() as u64),
+            Err(Error::MalformedDirectory)
+        );
+    }
+
+    #[test]
+    fn header_len_of_other_formats() {
+        assert_eq!(header_len(&[]), None);
+        assert_eq!(header_len(vint64::encode(2).as_ref()), None);
+    }
+
+    fn make_entries(range: std::ops::Range<u32>) -> Entries {
+        range.map(|i| (make_name(i), make_data(0))).collect()
+    }
+
+    fn make_name(i: u32) -> String {
+        format!("file-{i:06}.txt")
+    }
+
+    fn make_data(version: u64) -> EntryData {
+        let mut version_vector = VersionVector::new();
+        version_vector.insert(PublicKey::random(), version);
+
+        EntryData::file(rand::random(), version_vector)
+    }
+
+    fn write_end(writes: &[(u64, Vec<u8>)]) -> u64 {
+        writes
+            .iter()
+            .map(|(offset, data)| offset + data.len() as u64)
+            .max()
+            .unwrap()
+    }
+
+    // Simulates writing `save` into an empty blob and loading it back.
+    fn load(save: &Save) -> Entries {
+        read(&write(Vec::new(), save))
+    }
+
+    // Simulates writing `second` over a blob that contains `first` and loading it back.
+    fn apply(first: &Save, second: &Save) -> Entries {
+        read(&write(write(Vec::new(), first), second))
+    }
+
+    fn write(mut blob: Vec<u8>, save: &Save) -> Vec<u8> {
+        for (offset, data) in &save.writes {
+            let offset = *offset as usize;
+            assert!(offset <= blob.len());
+
+            if blob.len() < offset + data.len() {
+                blob.resize(offset + data.len(), 0);
+            }
+
+            blob[offset..offset + data.len()].copy_from_slice(data);
+        }
+
+        blob.truncate(save.len as usize);
+        blob
+    }
+
+    fn read(blob: &[u8]) -> Entries {
+        let header_len = header_len(blob).unwrap();
+        let layout = decode_header(&blob[..header_len], blob.len() as u64).unwrap();
+
+        (0..layout.chunk_count())
+            .flat_map(|index| {
+                let (offset, len) = layout.chunk_location(index);
+                let offset = offset as usize;
+                layout
+                    .decode_chunk(index, &blob[offset..offset + len])
+                    .unwrap()
+            })
+            .collect()
+    }
+}
@@ -16,9 +16,9 @@ pub(crate) use self::{
     parent_context::ParentContext,
 };
 
-use self::content::Content;
+use self::content::{Content, Encoded, PagedLoader};
 use crate::{
-    blob::{lock::ReadLock, Blob, BlobId},
+    blob::{self, lock::ReadLock, Blob, BlobId},
     branch::Branch,
     crypto::sign::PublicKey,
     debug::DebugPrinter,
@@ -29,7 +29,7 @@ use crate::{
     version_vector::VersionVector,
 };
 use async_recursion::async_recursion;
-use std::{cmp::Ordering, fmt, mem};
+use std::{cmp::Ordering, fmt, io::SeekFrom, mem};
 use tracing::instrument;
 
 #[derive(Clone)]
@@ -94,7 +94,8 @@ impl Directory {
             };
 
             let mut dir = Self::create(lock, branch, blob_id, None);
-            dir.save(&mut tx, &mut changeset, &Content::empty()).await?;
+            dir.save(&mut tx, &mut changeset, &mut Content::empty())
+                .await?;
             dir.bump(&mut tx, &mut changeset, bump).await?;
             dir.commit(tx, changeset).await?;
             dir
@@ -145,7 +146,7 @@ impl Directory {
         let diff = content.insert(name, data)?;
 
         file.save(&mut tx, &mut changeset).await?;
-        self.save(&mut tx, &mut changeset, &content).await?;
+        self.save(&mut tx, &mut changeset, &mut content).await?;
         self.bump(&mut tx, &mut changeset, Bump::Add(diff)).await?;
         self.commit(tx, changeset).await?;
         self.finalize(content);
@@ -219,8 +220,8 @@ impl Directory {
 
         let diff = content.insert(name, data)?;
 
-        dir.save(tx, changeset, &Content::empty()).await?;
-        self.save(tx, changeset, &content).await?;
+        dir.save(tx, changeset, &mut Content::empty()).await?;
+        self.save(tx, changeset, &mut content).await?;
         self.bump(tx, changeset, Bump::Add(diff)).await?;
 
         Ok((dir, content))
@@ -615,13 +616,14 @@ impl Directory {
 
             dir.lock = Some(new_lock);
 
-            let dir_content = mem::replace(&mut dir.content, Content::empty());
-            dir.save(tx, changeset, &dir_content).await?;
+            let mut dir_content = mem::replace(&mut dir.content, Content::empty());
+            dir_content.reset_layout();
+            dir.save(tx, changeset, &mut dir_content).await?;
 
             entry.blob_id = new_blob_id;
         }
 
-        self.save(tx, changeset, &self_content).await?;
+        self.save(tx, changeset, &mut self_content).await?;
         self.bump(tx, changeset, Bump::Add(diff)).await?;
 
         Ok((dir, self_content))
@@ -639,6 +641,11 @@ impl Directory {
         self.parent.is_none()
     }
 
+    /// Replaces the read lock held by this directory (if any) with `lock`.
+    pub(crate) fn with_lock(self, lock: Option<ReadLock>) -> Self {
+        Self { lock, ..self }
+    }
+
     async fn open_in(
         lock: Option<ReadLock>,
         tx: &mut ReadTransaction,
@@ -647,7 +654,7 @@ impl Directory {
         parent: Option<ParentContext>,
         fallback: DirectoryFallback,
     ) -> Result<Self> {
-        let (blob, content) = load(tx, branch, blob_id, fallback).await?;
+        let (blob, content) = load(tx, branch, blob_id, fallback, None).await?;
 
         Ok(Self {
             blob,
@@ -663,7 +670,7 @@ impl Directory {
         locator: Locator,
         fallback: DirectoryFallback,
     ) -> Result<Content> {
-        let (_, content) = load(tx, branch, *locator.blob_id(), fallback).await?;
+        let (_, content) = load(tx, branch, *locator.blob_id(), fallback, None).await?;
         Ok(content)
     }
 
@@ -853,13 +860,43 @@ impl Directory {
         self.refresh_in(tx).await?;
 
         let mut content = self.content.clone();
+        let old_blob_id = content.check_insert(&name, &data)?;
+        let new_blob_id = data.blob_id().copied();
         let diff = content.insert(name, data)?;
-        self.save(tx, changeset, &content).await?;
+        self.save(tx, changeset, &mut content).await?;
         self.bump(tx, changeset, Bump::Add(diff)).await?;
 
+        // The blocks of the replaced blob might now be unreachable (e.g. when removing a file that
+        // came from another branch) even though nothing changed at their locators. Let the garbage
+        // collector know.
+        if let Some(old_blob_id) = old_blob_id.filter(|id| Some(*id) != new_blob_id) {
+            self.mark_gc_candidates(tx, changeset, old_blob_id).await?;
+        }
+
         Ok(content)
     }
 
+    async fn mark_gc_candidates(
+        &self,
+        tx: &mut ReadTransaction,
+        changeset: &mut Changeset,
+        blob_id: BlobId,
+    ) -> Result<()> {
+        // Read the length from the blob header instead of probing the locators one by one. If the
+        // header is not available, only the blocks at the head locator are marked and the rest is
+        // left to the periodic full garbage collection.
+        let block_count = blob::load_block_count(tx, self.branch(), blob_id)
+            .await?
+            .unwrap_or(1);
+        let read_key = self.branch().keys().read();
+
+        for locator in Locator::head(blob_id).sequence().take(block_count as usize) {
+            changeset.mark_gc_candidates(locator.encode(read_key));
+        }
+
+        Ok(())
+    }
+
     async fn refresh_in(&mut self, tx: &mut ReadTransaction) -> Result<()> {
         if self.blob.is_dirty() {
             Ok(())
@@ -877,24 +914,80 @@ impl Directory {
         tx: &mut ReadTransaction,
         fallback: DirectoryFallback,
     ) -> Result<(Blob, Content)> {
-        load(tx, self.branch().clone(), *self.blob_id(), fallback).await
+        load(
+            tx,
+            self.branch().clone(),
+            *self.blob_id(),
+            fallback,
+            Some(&self.content),
+        )
+        .await
     }
 
     async fn save(
         &mut self,
         tx: &mut ReadTransaction,
         changeset: &mut Changeset,
-        content: &Content,
+        content: &mut Content,
     ) -> Result<()> {
+        let paged = self.branch().paged_directories();
+
         // Save the directory content into the store
-        let buffer = content.serialize();
-        self.blob.truncate(0)?;
-        self.blob.write_all(tx, changeset, &buffer).await?;
+        let encoded = content.encode(paged);
+
+        match self.write_content(tx, changeset, encoded).await {
+            Ok(()) => (),
+            Err(Error::MalformedDirectory) => {
+                // The blob doesn't match the layout the content was loaded with. Rewrite it in
+                // full instead of patching it.
+                tracing::warn!(
+                    blob_id = ?self.blob_id(),
+                    "directory blob doesn't match its layout, rewriting it"
+                );
+
+                content.reset_layout();
+                self.blob.truncate(0)?;
+                let encoded = content.encode(paged);
+                self.write_content(tx, changeset, encoded).await?;
+            }
+            Err(error) => return Err(error),
+        }
+
         self.blob.flush(tx, changeset).await?;
 
         Ok(())
     }
 
+    async fn write_content(
+        &mut self,
+        tx: &mut ReadTransaction,
+        changeset: &mut Changeset,
+        encoded: Encoded,
+    ) -> Result<()> {
+        match encoded {
+            Encoded::Flat(buffer) => {
+                self.blob.truncate(0)?;
+                self.blob.write_all(tx, changeset, &buffer).await?;
+            }
+            Encoded::Paged { writes, len } => {
+                // Write only the modified pages. The writes are in the offset order and never
+                // start past the end of the blob, unless the blob has been modified in some other
+                // way since the layout was computed.
+                for (offset, buffer) in writes {
+                    if self.blob.seek(SeekFrom::Start(offset)) != offset {
+                        return Err(Error::MalformedDirectory);
+                    }
+
+                    self.blob.write_all(tx, changeset, &buffer).await?;
+                }
+
+                self.blob.truncate(len)?;
+            }
+        }
+
+        Ok(())
+    }
+
     /// Atomically commits the transaction and sends notification event.
     async fn commit(&mut self, tx: WriteTransaction, changeset: Changeset) -> Result<()> {
         commit(tx, changeset, self.branch()).await
@@ -973,13 +1066,14 @@ async fn load(
     branch: Branch,
     blob_id: BlobId,
     fallback: DirectoryFallback,
+    prev: Option<&Content>,
 ) -> Result<(Blob, Content)> {
     let mut root_node = tx
         .load_latest_approved_root_node(branch.id(), RootNodeFilter::Any)
         .await?;
 
     loop {
-        let error = match load_at(tx, &root_node, branch.clone(), blob_id).await {
+        let error = match load_at(tx, &root_node, branch.clone(), blob_id, prev).await {
             Ok((blob, content)) => return Ok((blob, content)),
             Err(error @ Error::Store(store::Error::BlockNotFound)) => error,
             Err(error) => return Err(error),
@@ -1003,14 +1097,62 @@ async fn load_at(
     root_node: &RootNode,
     branch: Branch,
     blob_id: BlobId,
+    prev: Option<&Content>,
 ) -> Result<(Blob, Content)> {
     let mut blob = Blob::open_at(tx, root_node, branch, blob_id).await?;
-    let buffer = blob.read_to_end_at(tx, root_node).await?;
-    let content = Content::deserialize(&buffer)?;
+    let content = read_content(tx, root_node, &mut blob, prev).await?;
 
     Ok((blob, content))
 }
 
+// Reads the whole directory content from the blob. If the content is in the paged format, the
+// chunks that are the same as in `prev` are not read again, but all the other chunks are, even if
+// only a single entry is going to be looked up.
+async fn read_content(
+    tx: &mut ReadTransaction,
+    root_node: &RootNode,
+    blob: &mut Blob,
+    prev: Option<&Content>,
+) -> Result<Content> {
+    let mut buffer = vec![0; blob.len().min(PagedLoader::PREFIX_LEN as u64) as usize];
+    blob.read_all_at(tx, root_node, &mut buffer).await?;
+
+    let Some(header_len) = PagedLoader::header_len(&buffer) else {
+        buffer.extend(blob.read_to_end_at(tx, root_node).await?);
+        return Content::deserialize(&buffer);
+    };
+
+    if header_len as u64 > blob.len() {
+        return Err(Error::MalformedDirectory);
+    }
+
+    if header_len > buffer.len() {
+        let offset = buffer.len();
+        buffer.resize(header_len, 0);
+        blob.read_all_at(tx, root_node, &mut buffer[offset..])
+            .await?;
+    } else {
+        buffer.truncate(header_len);
+    }
+
+    let mut loader = PagedLoader::new(&buffer, blob.len(), prev)?;
+
+    while let Some((offset, len)) = loader.next_chunk() {
+        buffer.clear();
+        buffer.resize(len, 0);
+
+        blob.seek(SeekFrom::Start(offset));
+
+        if blob.read_all_at(tx, root_node, &mut buffer).await? != len {
+            return Err(Error::MalformedDirectory);
+        }
+
+        loader.insert(&buffer)?;
+    }
+
+    Ok(loader.finish())
+}
+
 /// Apply the changeset, commit the transaction and send a notification event.
 async fn commit(mut tx: WriteTransaction, changeset: Changeset, branch: &Branch) -> Result<()> {
     let changed = changeset
@@ -56,7 +56,7 @@ impl ParentContext {
         let mut directory = self.open_in(tx, branch).await?;
         let mut content = directory.content.clone();
         let diff = content.bump(&self.entry_name, bump)?;
-        directory.save(tx, changeset, &content).await?;
+        directory.save(tx, changeset, &mut content).await?;
         directory.bump(tx, changeset, Bump::Add(diff)).await?;
 
         Ok(())
@@ -160,7 +160,9 @@ impl ParentContext {
 
         match content.insert(self.entry_name.clone(), src_entry_data) {
             Ok(diff) => {
-                directory.save(&mut tx, &mut changeset, &content).await?;
+                directory
+                    .save(&mut tx, &mut changeset, &mut content)
+                    .await?;
                 directory
                     .bump(&mut tx, &mut changeset, Bump::Add(diff))
                     .await?;
@@ -8,7 +8,7 @@ use crate::{
     test_utils,
 };
 use assert_matches::assert_matches;
-use std::collections::BTreeSet;
+use std::{collections::BTreeSet, sync::atomic};
 use tempfile::TempDir;
 use tracing::Instrument;
 
@@ -713,6 +713,79 @@ async fn create_tombstone_is_idempotent() {
     assert_eq!(proof2, proof1);
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn large_directory() {
+    large_directory_case(false).await
+}
+
+#[tokio::test(flavor = "multi_thread")]
+async fn large_paged_directory() {
+    large_directory_case(true).await
+}
+
+async fn large_directory_case(paged: bool) {
+    let (_base_dir, pool) = db::create_temp().await.unwrap();
+    let keys = AccessKeys::from(WriteSecrets::random());
+    let shared = BranchShared::new();
+    shared
+        .paged_directories
+        .store(paged, atomic::Ordering::Relaxed);
+    let branch = create_branch_with_shared(pool, keys, shared.clone());
+
+    // Enough entries to not fit into a single block.
+    let names: Vec<_> = (0..1000).map(|i| format!("file-{i:04}.txt")).collect();
+
+    let mut dir = branch.open_or_create_root().await.unwrap();
+
+    for name in &names {
+        dir.create_file(name.clone()).await.unwrap();
+    }
+
+    assert!(dir.blob.block_count() > 1);
+    assert_eq!(dir.content.is_paged(), paged);
+
+    // Modify the directory through another instance and check the first one sees the change after
+    // refresh.
+    let mut other = branch
+        .open_root(DirectoryLocking::Enabled, DirectoryFallback::Disabled)
+        .await
+        .unwrap();
+    other.create_file("file-0500-new.txt".into()).await.unwrap();
+
+    dir.refresh().await.unwrap();
+
+    // Reopen and check all the entries are there.
+    let reopened = branch
+        .open_root(DirectoryLocking::Enabled, DirectoryFallback::Disabled)
+        .await
+        .unwrap();
+
+    for dir in [&dir, &reopened] {
+        assert_eq!(dir.entries().count(), names.len() + 1);
+        assert!(dir.lookup("file-0500-new.txt").is_ok());
+
+        for name in &names {
+            assert_matches!(dir.lookup(name), Ok(EntryRef::File(_)));
+        }
+    }
+
+    assert_eq!(reopened.content.is_paged(), paged);
+
+    // Toggling the format converts the directory the next time it's modified.
+    shared
+        .paged_directories
+        .store(!paged, atomic::Ordering::Relaxed);
+    dir.create_file("file-0500-new-2.txt".into()).await.unwrap();
+    assert_eq!(dir.content.is_paged(), !paged);
+
+    let reopened = branch
+        .open_root(DirectoryLocking::Enabled, DirectoryFallback::Disabled)
+        .await
+        .unwrap();
+    assert_eq!(reopened.entries().count(), names.len() + 2);
+    assert_eq!(reopened.content.is_paged(), !paged);
+}
+
 async fn setup() -> (TempDir, Branch) {
     let (base_dir, [branch]) = setup_multiple().await;
     (base_dir, branch)
@@ -727,9 +800,12 @@ async fn setup_multiple<const N: usize>() -> (TempDir, [Branch; N]) {
 }
 
 fn create_branch(pool: db::Pool, keys: AccessKeys) -> Branch {
+    create_branch_with_shared(pool, keys, BranchShared::new())
+}
+
+fn create_branch_with_shared(pool: db::Pool, keys: AccessKeys, shared: BranchShared) -> Branch {
     let store = Store::new(pool);
     let id = PublicKey::random();
-    let shared = BranchShared::new();
     let event_tx = EventSender::new(1);
     Branch::new(id, store, keys, shared, event_tx)
 }
@@ -39,12 +39,16 @@ pub enum Error {
     DirectoryNotEmpty,
     #[error("operation is not supported")]
     OperationNotSupported,
+    #[error("failed to read from reader")]
+    Reader(#[source] io::Error),
     #[error("failed to write into writer")]
     Writer(#[source] io::Error),
     #[error("storage version mismatch")]
     StorageVersionMismatch,
     #[error("file or directory is locked")]
     Locked,
+    #[error("operation interrupted")]
+    Interrupted,
 }
 
 impl Error {
@@ -7,8 +7,12 @@ use crate::{
     store::{Changeset, ReadTransaction},
     version_vector::VersionVector,
 };
-use std::{fmt, future::Future, io::SeekFrom};
-use tokio::io::{AsyncWrite, AsyncWriteExt};
+use futures_util::future;
+use std::{fmt, future::Future, io, io::SeekFrom, mem};
+use tokio::io::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt};
+
+/// Size of the chunks in which the content is copied between a file and an outside reader/writer.
+const COPY_CHUNK_SIZE: usize = 16 * BLOCK_SIZE; // 512 KiB
 
 pub struct File {
     blob: Blob,
@@ -230,16 +234,41 @@ impl File {
     /// Copy the entire contents of this file into the provided writer (e.g. a file on a regular
     /// filesystem)
     pub async fn copy_to_writer<W: AsyncWrite + Unpin>(&mut self, dst: &mut W) -> Result<()> {
-        let mut buffer = vec![0; BLOCK_SIZE];
+        let mut buffer = vec![0; COPY_CHUNK_SIZE];
+        let mut next = vec![0; COPY_CHUNK_SIZE];
+        let mut len = self.read_all(&mut buffer).await?;
 
-        loop {
-            let len = self.read(&mut buffer).await?;
+        while len > 0 {
+            // Read the next chunk while the current one is being written.
+            let (write, read) =
+                future::join(dst.write_all(&buffer[..len]), self.read_all(&mut next)).await;
 
-            dst.write_all(&buffer[..len]).await.map_err(Error::Writer)?;
+            write.map_err(Error::Writer)?;
+            len = read?;
 
-            if len < buffer.len() {
-                break;
-            }
+            mem::swap(&mut buffer, &mut next);
+        }
+
+        Ok(())
+    }
+
+    /// Writes the entire content of the provided reader (e.g. a file on a regular filesystem) into
+    /// this file at the current seek position. Doesn't flush the file.
+    pub async fn copy_from_reader<R: AsyncRead + Unpin>(&mut self, src: &mut R) -> Result<()> {
+        let mut buffer = vec![0; COPY_CHUNK_SIZE];
+        let mut next = vec![0; COPY_CHUNK_SIZE];
+        let mut len = read_chunk(src, &mut buffer).await.map_err(Error::Reader)?;
+
+        while len > 0 {
+            // Read the next chunk while the current one is being written (and, when the write
+            // fills up the block cache, flushed).
+            let (write, read) =
+                future::join(self.write_all(&buffer[..len]), read_chunk(src, &mut next)).await;
+
+            write?;
+            len = read.map_err(Error::Reader)?;
+
+            mem::swap(&mut buffer, &mut next);
         }
 
         Ok(())
@@ -286,6 +315,20 @@ impl File {
     }
 }
 
+/// Reads from `src` until `buffer` is full or EOF is reached. Returns the number of bytes read.
+async fn read_chunk<R: AsyncRead + Unpin>(src: &mut R, buffer: &mut [u8]) -> io::Result<usize> {
+    let mut offset = 0;
+
+    while offset < buffer.len() {
+        match src.read(&mut buffer[offset..]).await? {
+            0 => break,
+            n => offset += n,
+        }
+    }
+
+    Ok(offset)
+}
+
 impl fmt::Debug for File {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         f.debug_struct("File")
@@ -449,6 +492,42 @@ mod tests {
         assert_eq!(dst_content, src_content);
     }
 
+    #[tokio::test(flavor = "multi_thread")]
+    async fn copy_from_reader() {
+        let (_base_dir, [branch]) = setup().await;
+
+        // Spans multiple copy chunks and doesn't end on a block boundary.
+        let src_content: Vec<u8> = (0..2 * COPY_CHUNK_SIZE + 1234)
+            .map(|_| rand::random())
+            .collect();
+
+        let mut dst = branch.ensure_file_exists("dst.dat".into()).await.unwrap();
+        dst.copy_from_reader(&mut &src_content[..]).await.unwrap();
+        dst.flush().await.unwrap();
+        drop(dst);
+
+        let mut dst = branch
+            .open_root(DirectoryLocking::Enabled, DirectoryFallback::Disabled)
+            .await
+            .unwrap()
+            .lookup("dst.dat")
+            .unwrap()
+            .file()
+            .unwrap()
+            .open()
+            .await
+            .unwrap();
+
+        assert_eq!(dst.read_to_end().await.unwrap(), src_content);
+
+        // And back.
+        let mut copy = Vec::new();
+        dst.seek(SeekFrom::Start(0));
+        dst.copy_to_writer(&mut copy).await.unwrap();
+
+        assert_eq!(copy, src_content);
+    }
+
     async fn setup<const N: usize>() -> (TempDir, [Branch; N]) {
         let (base_dir, pool) = db::create_temp().await.unwrap();
         let store = Store::new(pool);
@@ -1,37 +1,54 @@
-use std::iter::Peekable;
+use std::{
+    cmp::{Ordering, Reverse},
+    collections::BinaryHeap,
+};
 
 /// Iterator adaptor that flattens an iterator of iterators by merging then in ascending order of
 /// the keys returned from the given closure.
-/// If the input iterators are sorted, the resulting iterator is sorted as well.
-pub struct SortedUnion<I, GetKey>
+/// If the input iterators are sorted, the resulting iterator is sorted as well. Items with equal
+/// keys are returned in the order of their input iterators.
+///
+/// The next items of the input iterators are kept in a heap so getting the next item takes
+/// `O(log n)` where `n` is the number of the input iterators.
+pub struct SortedUnion<I, Key, GetKey>
 where
     I: Iterator,
 {
-    iters: Vec<Peekable<I>>,
+    iters: Vec<I>,
+    heads: BinaryHeap<Reverse<Head<I::Item, Key>>>,
     get_key: GetKey,
 }
 
-impl<I, Key, GetKey> SortedUnion<I, GetKey>
+impl<I, Key, GetKey> SortedUnion<I, Key, GetKey>
 where
     I: Iterator,
     GetKey: FnMut(&I::Item) -> Key,
+    Key: Ord,
 {
-    pub fn new<J>(iters: J, get_key: GetKey) -> Self
+    pub fn new<J>(iters: J, mut get_key: GetKey) -> Self
     where
         J: IntoIterator,
         J::Item: IntoIterator<IntoIter = I>,
     {
+        let mut iters: Vec<_> = iters.into_iter().map(|i| i.into_iter()).collect();
+        let heads = iters
+            .iter_mut()
+            .enumerate()
+            .filter_map(|(index, iter)| {
+                let item = iter.next()?;
+                Some(Reverse(Head::new(item, index, &mut get_key)))
+            })
+            .collect();
+
         Self {
-            iters: iters
-                .into_iter()
-                .map(|i| i.into_iter().peekable())
-                .collect(),
+            iters,
+            heads,
             get_key,
         }
     }
 }
 
-impl<I, Key, GetKey> Iterator for SortedUnion<I, GetKey>
+impl<I, Key, GetKey> Iterator for SortedUnion<I, Key, GetKey>
 where
     I: Iterator,
     GetKey: FnMut(&I::Item) -> Key,
@@ -40,15 +57,54 @@ where
     type Item = I::Item;
 
     fn next(&mut self) -> Option<Self::Item> {
-        let get_key = &mut self.get_key;
-        let index = self
-            .iters
-            .iter_mut()
-            .enumerate()
-            .filter_map(|(index, iter)| iter.peek().map(|e| (index, e)))
-            .min_by_key(|(_, e)| (get_key)(e))
-            .map(|(index, _)| index)?;
-        self.iters[index].next()
+        let Reverse(head) = self.heads.pop()?;
+
+        if let Some(item) = self.iters[head.index].next() {
+            self.heads
+                .push(Reverse(Head::new(item, head.index, &mut self.get_key)));
+        }
+
+        Some(head.item)
+    }
+}
+
+// Next item of one of the input iterators. Ordered by the key and then by the index of the
+// iterator.
+struct Head<T, Key> {
+    item: T,
+    key: Key,
+    index: usize,
+}
+
+impl<T, Key> Head<T, Key> {
+    fn new(item: T, index: usize, get_key: &mut impl FnMut(&T) -> Key) -> Self {
+        Self {
+            key: get_key(&item),
+            item,
+            index,
+        }
+    }
+}
+
+impl<T, Key: Ord> PartialEq for Head<T, Key> {
+    fn eq(&self, other: &Self) -> bool {
+        self.cmp(other) == Ordering::Equal
+    }
+}
+
+impl<T, Key: Ord> Eq for Head<T, Key> {}
+
+impl<T, Key: Ord> PartialOrd for Head<T, Key> {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl<T, Key: Ord> Ord for Head<T, Key> {
+    fn cmp(&self, other: &Self) -> Ordering {
+        self.key
+            .cmp(&other.key)
+            .then_with(|| self.index.cmp(&other.index))
     }
 }
 
@@ -93,6 +149,27 @@ mod tests {
         );
     }
 
+    #[test]
+    fn test_sorted_union_many() {
+        let lists: Vec<Vec<(u32, usize)>> = (0..40)
+            .map(|index| {
+                (0..100)
+                    .map(|i| ((i * 7 + index as u32 * 3) % 50, index))
+                    .collect::<Vec<_>>()
+            })
+            .map(|mut list| {
+                list.sort();
+                list
+            })
+            .collect();
+
+        let mut expected: Vec<_> = lists.iter().flatten().collect();
+        expected.sort();
+
+        let u = SortedUnion::new(&lists, |(num, _)| num);
+        assert_eq!(u.collect::<Vec<_>>(), expected);
+    }
+
     #[test]
     fn test_sorted_union_three() {
         let v0 = &[(1, "00"), (3, "01"), (4, "02")];
@@ -19,6 +19,7 @@ use crate::{
 use async_recursion::async_recursion;
 use camino::{Utf8Component, Utf8Path};
 use either::Either;
+use futures_util::future;
 use std::{
     borrow::Cow,
     collections::{BTreeMap, VecDeque},
@@ -351,13 +352,19 @@ impl JointDirectory {
 
     // Merge the version vectors of all the versions in this joint directory.
     async fn merge_version_vectors(&self) -> Result<VersionVector> {
-        let mut outcome = VersionVector::new();
-
-        for version in self.versions.values() {
-            outcome.merge(&version.version_vector().await?);
-        }
+        let version_vectors = future::try_join_all(
+            self.versions
+                .values()
+                .map(|version| version.version_vector()),
+        )
+        .await?;
 
-        Ok(outcome)
+        Ok(version_vectors
+            .into_iter()
+            .fold(VersionVector::new(), |mut outcome, vv| {
+                outcome.merge(&vv);
+                outcome
+            }))
     }
 
     async fn fork(&mut self) -> Result<&mut Directory> {
@@ -560,9 +567,14 @@ impl<'a> JointDirectoryRef<'a> {
         missing_version_strategy: MissingVersionStrategy,
         fallback: DirectoryFallback,
     ) -> Result<JointDirectory> {
-        let mut versions = Vec::new();
-        for version in &self.versions {
-            match version.open(fallback).await {
+        // Open the versions concurrently, there can be many branches.
+        let results =
+            future::join_all(self.versions.iter().map(|version| version.open(fallback))).await;
+
+        let mut versions = Vec::with_capacity(results.len());
+
+        for (version, result) in self.versions.iter().zip(results) {
+            match result {
                 Ok(open_dir) => versions.push(open_dir),
                 Err(e)
                     if self
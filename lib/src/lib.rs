@@ -62,8 +62,8 @@ pub use self::{
     progress::Progress,
     protocol::{RepositoryId, StorageSize, BLOCK_SIZE},
     repository::{
-        delete as delete_repository, Credentials, Metadata, Repository, RepositoryHandle,
-        RepositoryParams,
+        delete as delete_repository, BlockStorage, Credentials, Metadata, Repository,
+        RepositoryHandle, RepositoryParams,
     },
     store::{Error as StoreError, DATA_VERSION},
     version_vector::VersionVector,
@@ -1,6 +1,7 @@
 use super::message_dispatcher::{
     ChannelClosed, ContentSinkTrait, ContentStreamError, ContentStreamTrait,
 };
+use bytes::Bytes;
 use state_monitor::{MonitoredValue, StateMonitor};
 use std::{fmt, mem::size_of};
 use tokio::time::{self, Duration};
@@ -88,7 +89,7 @@ impl<'a> Barrier<'a> {
 
         // I think we send this empty message in order to break the encryption on the other side and
         // thus forcing it to start this barrier process again.
-        self.sink.send(vec![]).await?;
+        self.sink.send(Bytes::new()).await?;
 
         let mut next_round: u32 = 0;
 
@@ -296,7 +297,9 @@ impl<'a> Barrier<'a> {
             }
         }
         self.sink
-            .send(construct_message(barrier_id, our_round, our_step).to_vec())
+            .send(Bytes::copy_from_slice(&construct_message(
+                barrier_id, our_round, our_step,
+            )))
             .await
     }
 
@@ -501,12 +504,12 @@ mod tests {
     #[derive(Clone)]
     struct Sink {
         drop_count: Arc<Mutex<u32>>,
-        tx: mpsc::Sender<Vec<u8>>,
+        tx: mpsc::Sender<Bytes>,
     }
 
     #[async_trait]
     impl ContentSinkTrait for Sink {
-        async fn send(&self, message: Vec<u8>) -> Result<(), ChannelClosed> {
+        async fn send(&self, message: Bytes) -> Result<(), ChannelClosed> {
             {
                 let mut drop_count = self.drop_count.lock().await;
                 if *drop_count > 0 {
@@ -521,12 +524,12 @@ mod tests {
     // --- Stream --------------------------------------------------------------
     #[derive(Clone)]
     struct Stream {
-        rx: Arc<Mutex<mpsc::Receiver<Vec<u8>>>>,
+        rx: Arc<Mutex<mpsc::Receiver<Bytes>>>,
     }
 
     #[async_trait]
     impl ContentStreamTrait for Stream {
-        async fn recv(&mut self) -> Result<Vec<u8>, ContentStreamError> {
+        async fn recv(&mut self) -> Result<Bytes, ContentStreamError> {
             let mut guard = self.rx.lock().await;
             let vec = guard.recv().await.unwrap();
             Ok(vec)
@@ -1,6 +1,7 @@
 use super::{
     constants::RESPONSE_BATCH_SIZE,
     debug_payload::{DebugResponse, PendingDebugRequest},
+    index_sketch::{self, IndexSketch},
     message::{Content, Response, ResponseDisambiguator},
     pending::{
         EphemeralResponse, PendingRequest, PendingRequests, PersistableResponse, PreparedResponse,
@@ -8,17 +9,20 @@ use super::{
 };
 use crate::{
     block_tracker::{BlockPromise, TrackerClient},
-    crypto::{sign::PublicKey, CacheHash, Hashable},
+    collections::{HashMap, HashSet},
+    crypto::{sign::PublicKey, CacheHash, Hash, Hashable},
     error::Result,
     event::Payload,
     protocol::{
-        Block, BlockId, InnerNodes, LeafNodes, MultiBlockPresence, ProofError, RootNodeFilter,
-        UntrustedProof,
+        Block, BlockId, InnerNodes, LeafNodes, MultiBlockPresence, Proof, ProofError,
+        RootNodeFilter,
     },
-    repository::Vault,
-    store::{ClientReader, ClientWriter},
+    repository::{LinkMonitor, Vault},
+    store::{self, ClientReader, ClientWriter},
 };
-use std::iter;
+use futures_util::TryStreamExt;
+use metrics::Histogram;
+use std::{iter, sync::Arc};
 use tokio::{select, sync::mpsc};
 use tracing::{instrument, Level};
 
@@ -30,33 +34,45 @@ mod future {
 pub(super) struct Client {
     inner: Inner,
     response_rx: mpsc::Receiver<Response>,
+    reconcile_rx: mpsc::UnboundedReceiver<Reconcile>,
 }
 
 impl Client {
     pub fn new(
         vault: Vault,
+        link_monitor: Arc<LinkMonitor>,
         content_tx: mpsc::UnboundedSender<Content>,
         response_rx: mpsc::Receiver<Response>,
     ) -> Self {
-        let pending_requests = PendingRequests::new(vault.monitor.clone());
+        let pending_requests = PendingRequests::new(vault.monitor.clone(), link_monitor);
         let block_tracker = vault.block_tracker.client();
+        let (reconcile_tx, reconcile_rx) = mpsc::unbounded_channel();
 
         let inner = Inner {
             vault,
             pending_requests,
             block_tracker,
             content_tx,
+            reconcile_tx,
         };
 
-        Self { inner, response_rx }
+        Self {
+            inner,
+            response_rx,
+            reconcile_rx,
+        }
     }
 }
 
 impl Client {
     pub async fn run(&mut self) -> Result<()> {
-        let Self { inner, response_rx } = self;
+        let Self {
+            inner,
+            response_rx,
+            reconcile_rx,
+        } = self;
 
-        inner.run(response_rx).await
+        inner.run(response_rx, reconcile_rx).await
     }
 }
 
@@ -65,22 +81,32 @@ struct Inner {
     pending_requests: PendingRequests,
     block_tracker: TrackerClient,
     content_tx: mpsc::UnboundedSender<Content>,
+    reconcile_tx: mpsc::UnboundedSender<Reconcile>,
 }
 
 impl Inner {
-    async fn run(&mut self, response_rx: &mut mpsc::Receiver<Response>) -> Result<()> {
+    async fn run(
+        &mut self,
+        response_rx: &mut mpsc::Receiver<Response>,
+        reconcile_rx: &mut mpsc::UnboundedReceiver<Reconcile>,
+    ) -> Result<()> {
         select! {
             result = self.handle_responses(response_rx) => result,
+            result = self.handle_reconciles(reconcile_rx) => result,
             _ = self.handle_available_block_offers() => Ok(()),
             _ = self.handle_reload_index() => Ok(()),
         }
     }
 
-    fn send_request(&self, request: PendingRequest) {
+    /// Returns whether the request was actually sent (that is, it was not a duplicate).
+    fn send_request(&self, request: PendingRequest) -> bool {
         if let Some(request) = self.pending_requests.insert(request) {
             self.content_tx
                 .send(Content::Request(request))
                 .unwrap_or(());
+            true
+        } else {
+            false
         }
     }
 
@@ -89,7 +115,7 @@ impl Inner {
         let mut persistable = Vec::with_capacity(RESPONSE_BATCH_SIZE);
 
         loop {
-            for response in recv_iter(rx).await {
+            for response in recv_iter(rx, &self.vault.monitor.response_queue_depth).await {
                 self.vault.monitor.responses_received.increment(1);
 
                 let response = self.pending_requests.remove(response);
@@ -114,9 +140,22 @@ impl Inner {
                     PreparedResponse::BlockOffer(block_id, debug) => {
                         ephemeral.push(EphemeralResponse::BlockOffer(block_id, debug));
                     }
-                    PreparedResponse::RootNodeError(..)
-                    | PreparedResponse::ChildNodesError(..)
-                    | PreparedResponse::BlockError(..) => (),
+                    PreparedResponse::IndexDiff(hash, disambiguator, parents, debug) => {
+                        tracing::trace!(?hash, ?debug, "Received index diff of {}", parents.len());
+
+                        // The children of these parents are pushed right after this response.
+                        self.pending_requests.expect(parents);
+                        self.reconcile(Reconcile::Done(hash, disambiguator));
+                    }
+                    PreparedResponse::IndexDiffError(hash, disambiguator, debug) => {
+                        self.reconcile(Reconcile::Failed(hash, disambiguator, debug.follow_up()));
+                    }
+                    PreparedResponse::ChildNodesError(hash, disambiguator, _) => {
+                        // This might be a response to a sketch whose snapshot the peer no longer
+                        // has.
+                        self.reconcile(Reconcile::Done(hash, disambiguator));
+                    }
+                    PreparedResponse::RootNodeError(..) | PreparedResponse::BlockError(..) => (),
                 }
 
                 if ephemeral.len() >= RESPONSE_BATCH_SIZE {
@@ -133,6 +172,8 @@ impl Inner {
                 self.handle_persistable_responses(&mut persistable),
             )
             .await?;
+
+            self.pending_requests.forget_received();
         }
     }
 
@@ -144,13 +185,41 @@ impl Inner {
             return Ok(());
         }
 
+        // Verify the proofs before starting the write transaction so the db is not locked while
+        // the signatures are being checked.
+        let proofs = batch
+            .iter()
+            .filter_map(|response| match response {
+                PersistableResponse::RootNode(proof, _, _) => Some(proof.clone()),
+                _ => None,
+            })
+            .collect();
+        let mut proofs = self
+            .vault
+            .proof_cache
+            .verify(self.vault.repository_id(), proofs)
+            .await
+            .into_iter();
+
         let mut writer = self.vault.store().begin_client_write().await?;
 
         for response in batch.drain(..) {
             match response {
-                PersistableResponse::RootNode(proof, block_presence, debug) => {
-                    self.handle_root_node(&mut writer, proof, block_presence, debug)
-                        .await?;
+                PersistableResponse::RootNode(_, block_presence, debug) => {
+                    // unwrap is OK because there is one result per root node response.
+                    match proofs.next().unwrap() {
+                        Ok(proof) => {
+                            self.handle_root_node(&mut writer, proof, block_presence, debug)
+                                .await?;
+                        }
+                        Err(ProofError(proof)) => {
+                            tracing::trace!(
+                                writer_id = ?proof.writer_id,
+                                hash = ?proof.hash,
+                                "Invalid proof"
+                            );
+                        }
+                    }
                 }
                 PersistableResponse::InnerNodes(nodes, debug) => {
                     self.handle_inner_nodes(&mut writer, nodes, debug).await?;
@@ -203,30 +272,24 @@ impl Inner {
     async fn handle_root_node(
         &self,
         writer: &mut ClientWriter,
-        proof: UntrustedProof,
+        proof: Proof,
         block_presence: MultiBlockPresence,
         debug_payload: DebugResponse,
     ) -> Result<()> {
-        let proof = match proof.verify(self.vault.repository_id()) {
-            Ok(proof) => proof,
-            Err(ProofError(_)) => {
-                tracing::trace!("Invalid proof");
-                return Ok(());
-            }
-        };
-
         // Ignore branches with empty version vectors because they have no content yet.
         if proof.version_vector.is_empty() {
             return Ok(());
         }
 
+        let writer_id = proof.writer_id;
         let hash = proof.hash;
         let status = writer.save_root_node(proof, &block_presence).await?;
 
         tracing::debug!("Received root node - {status}");
 
         if status.request_children() {
-            self.send_request(PendingRequest::ChildNodes(
+            self.reconcile(Reconcile::Start(
+                writer_id,
                 hash,
                 ResponseDisambiguator::new(block_presence),
                 debug_payload.follow_up(),
@@ -353,10 +416,127 @@ impl Inner {
         Ok(())
     }
 
+    fn reconcile(&self, command: Reconcile) {
+        self.reconcile_tx.send(command).unwrap_or(());
+    }
+
+    /// Requests the children of the root nodes received from the peer, using a sketch of the
+    /// previous snapshot of the branch if we have one. This allows the peer to find all the nodes
+    /// that changed since that snapshot and send them all at once, avoiding one round trip per
+    /// index layer.
+    ///
+    /// Only the first snapshot of each branch received during this connection is reconciled this
+    /// way, because building the sketch (on both sides) requires loading all the inner nodes of
+    /// the snapshot. The later snapshots tend to differ only little from the previous ones and
+    /// their changes arrive as soon as they are made so the latency matters less.
+    async fn handle_reconciles(&self, rx: &mut mpsc::UnboundedReceiver<Reconcile>) -> Result<()> {
+        let mut reconciled_branches = HashSet::default();
+        // Sketch keys for the sketches in flight and the size of the sent sketch, by the root
+        // hash of the remote snapshot.
+        let mut in_flight = HashMap::default();
+
+        while let Some(command) = rx.recv().await {
+            match command {
+                Reconcile::Start(branch_id, hash, disambiguator, debug) => {
+                    let keys = if reconciled_branches.insert(branch_id) {
+                        self.load_sketch_keys(&branch_id).await?
+                    } else {
+                        None
+                    };
+
+                    let Some(keys) = keys else {
+                        self.send_request(PendingRequest::ChildNodes(hash, disambiguator, debug));
+                        continue;
+                    };
+
+                    let sketch = build_sketch(&keys, index_sketch::INITIAL_SIZE);
+                    let size = sketch.len();
+
+                    if self.send_request(PendingRequest::IndexSketch(
+                        hash,
+                        disambiguator,
+                        sketch,
+                        debug,
+                    )) {
+                        in_flight.insert((hash, disambiguator), (keys, size));
+                    }
+                }
+                Reconcile::Failed(hash, disambiguator, debug) => {
+                    match in_flight.remove(&(hash, disambiguator)) {
+                        Some((keys, size)) if size < index_sketch::MAX_SIZE => {
+                            tracing::trace!(?hash, size, "Index sketch too small, retrying");
+
+                            let sketch = build_sketch(&keys, index_sketch::MAX_SIZE);
+                            let size = sketch.len();
+
+                            if self.send_request(PendingRequest::IndexSketch(
+                                hash,
+                                disambiguator,
+                                sketch,
+                                debug,
+                            )) {
+                                in_flight.insert((hash, disambiguator), (keys, size));
+                            }
+                        }
+                        _ => {
+                            tracing::trace!(?hash, "Index sketch failed, walking the index");
+
+                            self.send_request(PendingRequest::ChildNodes(
+                                hash,
+                                disambiguator,
+                                debug,
+                            ));
+                        }
+                    }
+                }
+                Reconcile::Done(hash, disambiguator) => {
+                    in_flight.remove(&(hash, disambiguator));
+                }
+            }
+        }
+
+        Ok(())
+    }
+
+    /// Loads the sketch keys of all the parent nodes of the latest complete snapshot of the given
+    /// branch. Returns `None` if there is no such snapshot.
+    async fn load_sketch_keys(&self, branch_id: &PublicKey) -> Result<Option<Vec<u64>>> {
+        let mut reader = self.vault.store().acquire_read().await?;
+
+        let root_node = match reader
+            .load_latest_approved_root_node(branch_id, RootNodeFilter::Any)
+            .await
+        {
+            Ok(root_node) => root_node,
+            Err(store::Error::BranchNotFound) => return Ok(None),
+            Err(error) => return Err(error.into()),
+        };
+
+        let mut keys = vec![index_sketch::node_key(
+            &root_node.proof.hash,
+            &ResponseDisambiguator::new(root_node.summary.block_presence),
+        )];
+
+        let mut nodes = reader.load_descendant_inner_nodes(&root_node.proof.hash);
+
+        while let Some((_, node)) = nodes.try_next().await? {
+            keys.push(index_sketch::node_key(
+                &node.hash,
+                &ResponseDisambiguator::new(node.summary.block_presence),
+            ));
+        }
+
+        Ok(Some(keys))
+    }
+
     async fn handle_available_block_offers(&self) {
         let mut block_offers = self.block_tracker.offers();
 
         loop {
+            // Take the next offer only when there is room in the request window. Until then it
+            // remains available to the other peers.
+            self.pending_requests.block_request_slot().await;
+
             let block_offer = block_offers.next().await;
             let debug = PendingDebugRequest::start();
             self.send_request(PendingRequest::Block(block_offer, debug));
@@ -440,11 +620,37 @@ impl Inner {
     }
 }
 
+/// Commands for the index reconciliation task (see `Inner::handle_reconciles`).
+enum Reconcile {
+    /// Request the children of the given root node of the given branch.
+    Start(PublicKey, Hash, ResponseDisambiguator, PendingDebugRequest),
+    /// The peer failed to decode the sketch sent for the given root node.
+    Failed(Hash, ResponseDisambiguator, PendingDebugRequest),
+    /// The peer responded to the sketch sent for the given root node.
+    Done(Hash, ResponseDisambiguator),
+}
+
+fn build_sketch(keys: &[u64], size: usize) -> IndexSketch {
+    let mut sketch = IndexSketch::new(size);
+
+    for key in keys {
+        sketch.insert(*key);
+    }
+
+    sketch
+}
+
 /// Waits for at least one item to become available (or the chanel getting closed) and then yields
-/// all the buffered items from the channel.
-async fn recv_iter<T>(rx: &mut mpsc::Receiver<T>) -> impl Iterator<Item = T> + '_ {
-    rx.recv()
-        .await
+/// all the buffered items from the channel. Records the number of the buffered items into
+/// `queue_depth` (sampled only after the first item arrives so the idle periods don't skew it).
+async fn recv_iter<'a, T>(
+    rx: &'a mut mpsc::Receiver<T>,
+    queue_depth: &Histogram,
+) -> impl Iterator<Item = T> + 'a {
+    let first = rx.recv().await;
+    queue_depth.record((rx.len() + usize::from(first.is_some())) as f64);
+
+    first
         .into_iter()
         .chain(iter::from_fn(|| rx.try_recv().ok()))
 }
@@ -459,7 +665,7 @@ mod tests {
         db,
         event::EventSender,
         protocol::{Proof, RepositoryId, EMPTY_INNER_HASH},
-        repository::RepositoryMonitor,
+        repository::{LinkMonitor, RepositoryMonitor},
         version_vector::VersionVector,
     };
     use futures_util::TryStreamExt;
@@ -551,16 +757,21 @@ mod tests {
 
         vault.block_tracker.set_request_mode(RequestMode::Lazy);
 
-        let pending_requests = PendingRequests::new(vault.monitor.clone());
+        let pending_requests = PendingRequests::new(
+            vault.monitor.clone(),
+            Arc::new(LinkMonitor::new(&StateMonitor::make_root())),
+        );
         let block_tracker = vault.block_tracker.client();
 
         let (content_tx, _content_rx) = mpsc::unbounded_channel();
+        let (reconcile_tx, _reconcile_rx) = mpsc::unbounded_channel();
 
         let inner = Inner {
             vault,
             pending_requests,
             block_tracker,
             content_tx,
+            reconcile_tx,
         };
 
         (base_dir, inner, secrets)
@@ -13,9 +13,9 @@ use super::{
     stats::Instrumented,
 };
 use crate::protocol::RepositoryId;
+use bytes::{Bytes, BytesMut};
 use noise_protocol::Cipher as _;
 use noise_rust_crypto::{Blake2s, ChaCha20Poly1305, X25519};
-use std::mem;
 use thiserror::Error;
 
 type Cipher = ChaCha20Poly1305;
@@ -64,16 +64,18 @@ const MAX_NONCE: u64 = u64::MAX - 1;
 pub(super) struct DecryptingStream<'a> {
     inner: &'a mut Instrumented<ContentStream>,
     cipher: CipherState,
-    buffer: Vec<u8>,
+    // Decrypted messages are split off of this buffer. Its allocation gets reused once the
+    // previously returned messages are dropped.
+    buffer: BytesMut,
 }
 
 impl DecryptingStream<'_> {
-    pub async fn recv(&mut self) -> Result<Vec<u8>, RecvError> {
+    pub async fn recv(&mut self) -> Result<Bytes, RecvError> {
         if self.cipher.get_next_n() >= MAX_NONCE {
             return Err(RecvError::Exhausted);
         }
 
-        let mut content = self.inner.recv().await?;
+        let content = self.inner.recv().await?;
 
         let plain_len = content
             .len()
@@ -84,9 +86,7 @@ impl DecryptingStream<'_> {
             .decrypt_ad(self.inner.channel().as_ref(), &content, &mut self.buffer)
             .map_err(|_| RecvError::Crypto)?;
 
-        mem::swap(&mut content, &mut self.buffer);
-
-        Ok(content)
+        Ok(self.buffer.split().freeze())
     }
 }
 
@@ -94,7 +94,6 @@ impl DecryptingStream<'_> {
 pub(super) struct EncryptingSink<'a> {
     inner: &'a mut Instrumented<ContentSink>,
     cipher: CipherState,
-    buffer: Vec<u8>,
 }
 
 impl EncryptingSink<'_> {
@@ -103,13 +102,13 @@ impl EncryptingSink<'_> {
             return Err(SendError::Exhausted);
         }
 
-        self.buffer.resize(content.len() + Cipher::tag_len(), 0);
+        // Encrypt in place to avoid copying the content into another buffer.
+        let plain_len = content.len();
+        content.resize(plain_len + Cipher::tag_len(), 0);
         self.cipher
-            .encrypt_ad(self.inner.channel().as_ref(), &content, &mut self.buffer);
-
-        mem::swap(&mut content, &mut self.buffer);
+            .encrypt_ad_in_place(self.inner.channel().as_ref(), &mut content, plain_len);
 
-        Ok(self.inner.send(content).await?)
+        Ok(self.inner.send(content.into()).await?)
     }
 }
 
@@ -146,13 +145,12 @@ pub(super) async fn establish_channel<'a>(
     let stream = DecryptingStream {
         inner: stream,
         cipher: recv_cipher,
-        buffer: vec![],
+        buffer: BytesMut::new(),
     };
 
     let sink = EncryptingSink {
         inner: sink,
         cipher: send_cipher,
-        buffer: vec![],
     };
 
     Ok((stream, sink))
@@ -246,7 +244,7 @@ async fn handshake_send(
     msg: &[u8],
 ) -> Result<(), EstablishError> {
     let content = state.write_message_vec(msg)?;
-    Ok(sink.send(content).await?)
+    Ok(sink.send(content.into()).await?)
 }
 
 async fn handshake_recv(
@@ -11,20 +11,29 @@ mod meaningful_data {
 
     static NEXT_ID: AtomicU64 = AtomicU64::new(0);
 
+    // `round_trip` is the number of request/response round trips since the start of the exchange.
+    // It's zero for unsolicited responses and incremented by each follow-up request. This allows
+    // measuring how many round trips a sync takes.
+
     #[derive(Clone, Eq, PartialEq, Hash, Debug)]
     pub(crate) struct PendingDebugRequest {
         exchange_id: u64,
+        round_trip: u32,
     }
 
     impl PendingDebugRequest {
         pub(crate) fn start() -> Self {
             let exchange_id = NEXT_ID.fetch_add(1, Ordering::Relaxed);
-            Self { exchange_id }
+            Self {
+                exchange_id,
+                round_trip: 1,
+            }
         }
 
         pub(crate) fn send(&self) -> DebugRequest {
             DebugRequest {
                 exchange_id: self.exchange_id,
+                round_trip: self.round_trip,
             }
         }
     }
@@ -32,12 +41,14 @@ mod meaningful_data {
     #[derive(Clone, Eq, PartialEq, Serialize, Deserialize, Debug)]
     pub(crate) struct DebugRequest {
         exchange_id: u64,
+        round_trip: u32,
     }
 
     impl DebugRequest {
         pub(crate) fn begin_reply(self) -> PendingDebugResponse {
             PendingDebugResponse {
                 exchange_id: self.exchange_id,
+                round_trip: self.round_trip,
             }
         }
     }
@@ -45,12 +56,14 @@ mod meaningful_data {
     #[derive(Clone, Eq, PartialEq, Serialize, Deserialize, Debug)]
     pub(crate) struct PendingDebugResponse {
         exchange_id: u64,
+        round_trip: u32,
     }
 
     impl PendingDebugResponse {
         pub(crate) fn send(self) -> DebugResponse {
             DebugResponse {
                 exchange_id: self.exchange_id,
+                round_trip: self.round_trip,
             }
         }
     }
@@ -58,17 +71,22 @@ mod meaningful_data {
     #[derive(Clone, Eq, PartialEq, Serialize, Deserialize, Debug)]
     pub(crate) struct DebugResponse {
         exchange_id: u64,
+        round_trip: u32,
     }
 
     impl DebugResponse {
         pub(crate) fn unsolicited() -> Self {
             let exchange_id = NEXT_ID.fetch_add(1, Ordering::Relaxed);
-            Self { exchange_id }
+            Self {
+                exchange_id,
+                round_trip: 0,
+            }
         }
 
         pub(crate) fn follow_up(self) -> PendingDebugRequest {
             PendingDebugRequest {
                 exchange_id: self.exchange_id,
+                round_trip: self.round_trip + 1,
             }
         }
     }
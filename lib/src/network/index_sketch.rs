@@ -0,0 +1,258 @@
+use super::message::ResponseDisambiguator;
+use crate::crypto::{Hash, Hashable};
+use serde::{Deserialize, Serialize};
+use std::collections::VecDeque;
+
+/// Number of cells of the sketch sent on the first reconciliation attempt. Enough to decode a
+/// difference of about 80 nodes which corresponds to roughly ten modified leaves.
+pub(super) const INITIAL_SIZE: usize = 129;
+
+/// Number of cells of the sketch sent when the initial one failed to decode. This is the largest
+/// size that still fits into a single message.
+pub(super) const MAX_SIZE: usize = 2049;
+
+/// Max number of parent nodes whose children are pushed in response to a single sketch. Keeps the
+/// `IndexDiff` response within the message size limit.
+pub(super) const MAX_DIFF_LEN: usize = 1024;
+
+/// Number of cells each key is inserted into.
+const HASH_COUNT: usize = 3;
+
+const SEEDS: [u64; HASH_COUNT] = [
+    0x9e37_79b9_7f4a_7c15,
+    0xc2b2_ae3d_27d4_eb4f,
+    0x1656_67b1_9e37_79f9,
+];
+
+/// Invertible Bloom Lookup Table of the parent nodes of a snapshot, used to reconcile the index
+/// of a branch with a peer in a single round trip.
+///
+/// The client inserts the keys (see [`node_key`]) of all the parent nodes of its latest complete
+/// snapshot of the branch and sends the sketch. The server removes the keys of the parent nodes of
+/// its snapshot and decodes the remainder which yields exactly the nodes whose children differ
+/// between the two snapshots. The size of the sketch and the decoding work are proportional to the
+/// size of the difference, not to the size of the index. If the difference is too big, decoding
+/// fails and the peers fall back to walking the index tree node by node.
+#[derive(Clone, PartialEq, Eq, Serialize, Deserialize, Debug)]
+pub(crate) struct IndexSketch {
+    cells: Vec<Cell>,
+}
+
+#[derive(Clone, Copy, Default, PartialEq, Eq, Serialize, Deserialize, Debug)]
+struct Cell {
+    count: i32,
+    key_sum: u64,
+    check_sum: u64,
+}
+
+impl Cell {
+    fn is_empty(&self) -> bool {
+        self.count == 0 && self.key_sum == 0 && self.check_sum == 0
+    }
+
+    fn is_pure(&self) -> bool {
+        (self.count == 1 || self.count == -1) && self.check_sum == check(self.key_sum)
+    }
+}
+
+/// Result of decoding a sketch.
+#[derive(Default, Debug)]
+pub(crate) struct Difference {
+    /// Keys that were inserted but not removed.
+    pub inserted: Vec<u64>,
+    /// Keys that were removed but not inserted.
+    pub removed: Vec<u64>,
+}
+
+impl IndexSketch {
+    /// Creates an empty sketch with (at least) the given number of cells.
+    pub fn new(size: usize) -> Self {
+        let size = size.div_ceil(HASH_COUNT).max(1) * HASH_COUNT;
+
+        Self {
+            cells: vec![Cell::default(); size],
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.cells.len()
+    }
+
+    /// Checks that the sketch has been constructed with valid parameters. This is needed for
+    /// sketches received from peers.
+    pub fn is_valid(&self) -> bool {
+        !self.cells.is_empty() && self.cells.len() % HASH_COUNT == 0 && self.cells.len() <= MAX_SIZE
+    }
+
+    pub fn insert(&mut self, key: u64) {
+        self.update(key, 1);
+    }
+
+    pub fn remove(&mut self, key: u64) {
+        self.update(key, -1);
+    }
+
+    /// Lists the keys that were inserted but not removed and vice versa. Returns `None` if the
+    /// difference is too big to be decoded from a sketch of this size.
+    pub fn decode(mut self) -> Option<Difference> {
+        let mut difference = Difference::default();
+        let mut queue: VecDeque<_> = (0..self.cells.len())
+            .filter(|index| self.cells[*index].is_pure())
+            .collect();
+
+        while let Some(index) = queue.pop_front() {
+            let cell = self.cells[index];
+
+            // The cell might have been peeled already via another cell.
+            if !cell.is_pure() {
+                continue;
+            }
+
+            // A valid sketch never decodes into more keys than it has cells. This guards against
+            // malformed sketches.
+            if difference.inserted.len() + difference.removed.len() >= self.cells.len() {
+                return None;
+            }
+
+            if cell.count > 0 {
+                difference.inserted.push(cell.key_sum);
+            } else {
+                difference.removed.push(cell.key_sum);
+            }
+
+            for index in self.indices(cell.key_sum) {
+                let other = &mut self.cells[index];
+                other.count = other.count.wrapping_sub(cell.count);
+                other.key_sum ^= cell.key_sum;
+                other.check_sum ^= cell.check_sum;
+
+                if other.is_pure() {
+                    queue.push_back(index);
+                }
+            }
+        }
+
+        if self.cells.iter().all(Cell::is_empty) {
+            Some(difference)
+        } else {
+            None
+        }
+    }
+
+    fn update(&mut self, key: u64, count: i32) {
+        let check_sum = check(key);
+
+        for index in self.indices(key) {
+            let cell = &mut self.cells[index];
+            cell.count = cell.count.wrapping_add(count);
+            cell.key_sum ^= key;
+            cell.check_sum ^= check_sum;
+        }
+    }
+
+    // The cells are split into `HASH_COUNT` equal partitions and each key maps to one cell in
+    // each of them. This guarantees the cells of a single key are distinct.
+    fn indices(&self, key: u64) -> impl Iterator<Item = usize> {
+        let partition = (self.cells.len() / HASH_COUNT) as u64;
+
+        SEEDS
+            .into_iter()
+            .enumerate()
+            .map(move |(i, seed)| (i as u64 * partition + mix(key ^ seed) % partition) as usize)
+    }
+}
+
+/// Key of a parent node in the sketch. It covers both the node hash (which determines the
+/// structure of the subtree) and its block presence (which determines whether the blocks present
+/// in the subtree changed), so the difference contains exactly the nodes whose children need to be
+/// (re)sent.
+pub(super) fn node_key(hash: &Hash, disambiguator: &ResponseDisambiguator) -> u64 {
+    let digest = (hash, disambiguator).hash();
+    // unwrap is OK because the hash is longer than 8 bytes.
+    u64::from_le_bytes(digest.as_ref()[..8].try_into().unwrap())
+}
+
+fn check(key: u64) -> u64 {
+    mix(!key)
+}
+
+// SplitMix64 finalizer.
+fn mix(mut x: u64) -> u64 {
+    x = (x ^ (x >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+    x = (x ^ (x >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+    x ^ (x >> 31)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use rand::{rngs::StdRng, Rng, SeedableRng};
+
+    #[test]
+    fn decode_small_difference() {
+        let mut rng = StdRng::seed_from_u64(0);
+
+        let common: Vec<u64> = (0..10_000).map(|_| rng.gen()).collect();
+        let local_only: Vec<u64> = (0..20).map(|_| rng.gen()).collect();
+        let remote_only: Vec<u64> = (0..20).map(|_| rng.gen()).collect();
+
+        let mut sketch = IndexSketch::new(INITIAL_SIZE);
+
+        for key in common.iter().chain(&remote_only) {
+            sketch.insert(*key);
+        }
+
+        for key in common.iter().chain(&local_only) {
+            sketch.remove(*key);
+        }
+
+        let mut difference = sketch.decode().unwrap();
+        difference.inserted.sort();
+        difference.removed.sort();
+
+        let mut expected_inserted = remote_only;
+        expected_inserted.sort();
+
+        let mut expected_removed = local_only;
+        expected_removed.sort();
+
+        assert_eq!(difference.inserted, expected_inserted);
+        assert_eq!(difference.removed, expected_removed);
+    }
+
+    #[test]
+    fn decode_empty_difference() {
+        let mut rng = StdRng::seed_from_u64(0);
+        let mut sketch = IndexSketch::new(INITIAL_SIZE);
+
+        for _ in 0..1000 {
+            let key = rng.gen();
+            sketch.insert(key);
+            sketch.remove(key);
+        }
+
+        let difference = sketch.decode().unwrap();
+        assert!(difference.inserted.is_empty());
+        assert!(difference.removed.is_empty());
+    }
+
+    #[test]
+    fn decode_too_big_difference() {
+        let mut rng = StdRng::seed_from_u64(0);
+        let mut sketch = IndexSketch::new(INITIAL_SIZE);
+
+        // More keys than cells can never be decoded.
+        for _ in 0..2 * INITIAL_SIZE {
+            sketch.insert(rng.gen());
+        }
+
+        assert!(sketch.decode().is_none());
+    }
+
+    #[test]
+    fn max_size_fits_into_message() {
+        let sketch = IndexSketch::new(MAX_SIZE);
+        assert!(sketch.is_valid());
+        assert!(bincode::serialize(&sketch).unwrap().len() < u16::MAX as usize - 1024);
+    }
+}
@@ -1,16 +1,18 @@
 use super::{
     crypto::Role,
     debug_payload::{DebugRequest, DebugResponse},
+    index_sketch::IndexSketch,
     peer_exchange::PexPayload,
     runtime_id::PublicRuntimeId,
 };
 use crate::{
-    crypto::{sign::PublicKey, Hash, Hashable},
+    crypto::{sign::PublicKey, Digest, Hash, Hashable},
     protocol::{
         BlockContent, BlockId, BlockNonce, InnerNodes, LeafNodes, MultiBlockPresence, RepositoryId,
         UntrustedProof,
     },
 };
+use bytes::Bytes;
 use serde::{Deserialize, Serialize};
 use std::{fmt, io::Write};
 
@@ -22,6 +24,9 @@ pub(crate) enum Request {
     ChildNodes(Hash, ResponseDisambiguator, DebugRequest),
     /// Request block with the given id.
     Block(BlockId, DebugRequest),
+    /// Request all the child nodes of the snapshot with the given root hash that differ from the
+    /// snapshot summarized by the sketch.
+    IndexSketch(Hash, ResponseDisambiguator, IndexSketch, DebugRequest),
 }
 
 /// ResponseDisambiguator is used to uniquelly assign a response to a request.
@@ -36,6 +41,12 @@ impl ResponseDisambiguator {
     }
 }
 
+impl Hashable for ResponseDisambiguator {
+    fn update_hash<S: Digest>(&self, state: &mut S) {
+        self.0.update_hash(state)
+    }
+}
+
 #[derive(Serialize, Deserialize, Debug)]
 pub(crate) enum Response {
     /// Send the latest root node of this replica to another replica.
@@ -58,6 +69,17 @@ pub(crate) enum Response {
     Block(BlockContent, BlockNonce, DebugResponse),
     /// Send that a Block request failed
     BlockError(BlockId, DebugResponse),
+    /// Send the list of parent nodes (with their disambiguators) whose children are about to be
+    /// sent in response to an `IndexSketch` request. The `InnerNodes` / `LeafNodes` responses
+    /// follow immediately, parents always before their children.
+    IndexDiff(
+        Hash,
+        ResponseDisambiguator,
+        Vec<(Hash, ResponseDisambiguator)>,
+        DebugResponse,
+    ),
+    /// Send that an `IndexSketch` request failed because the difference was too big to decode.
+    IndexDiffError(Hash, ResponseDisambiguator, DebugResponse),
 }
 
 const LEGACY_TAG: u8 = 2;
@@ -91,10 +113,10 @@ impl Header {
     }
 }
 
-#[derive(Clone, Eq, PartialEq, Serialize, Deserialize)]
+#[derive(Clone, Eq, PartialEq)]
 pub(crate) struct Message {
     pub channel: MessageChannelId,
-    pub content: Vec<u8>,
+    pub content: Bytes,
 }
 
 impl Message {
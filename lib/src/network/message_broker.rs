@@ -6,6 +6,7 @@ use super::{
     message::{Content, MessageChannelId, Request, Response},
     message_dispatcher::{ContentSink, ContentStream, MessageDispatcher},
     peer_exchange::{PexPeer, PexReceiver, PexRepository, PexSender},
+    rate_limiter::RateLimiter,
     raw,
     runtime_id::PublicRuntimeId,
     server::Server,
@@ -15,11 +16,11 @@ use crate::{
     collections::{hash_map::Entry, HashMap},
     network::constants::{REQUEST_BUFFER_SIZE, RESPONSE_BUFFER_SIZE},
     protocol::RepositoryId,
-    repository::Vault,
+    repository::{LinkMonitor, Vault},
 };
 use backoff::{backoff::Backoff, ExponentialBackoffBuilder};
 use state_monitor::StateMonitor;
-use std::{future, sync::Arc};
+use std::{collections::VecDeque, future, sync::Arc};
 use tokio::{
     select,
     sync::{mpsc, oneshot, Semaphore},
@@ -67,10 +68,20 @@ impl MessageBroker {
         }
     }
 
-    pub fn add_connection(&self, stream: Instrumented<raw::Stream>, permit: ConnectionPermit) {
+    pub fn add_connection(
+        &self,
+        stream: Instrumented<raw::Stream>,
+        permit: ConnectionPermit,
+        channel_streams: bool,
+    ) {
         self.pex_peer
             .handle_connection(permit.addr(), permit.source(), permit.released());
-        self.dispatcher.bind(stream, permit)
+
+        if channel_streams {
+            self.dispatcher.bind_with_channel_streams(stream, permit)
+        } else {
+            self.dispatcher.bind(stream, permit)
+        }
     }
 
     /// Has this broker at least one live connection?
@@ -86,6 +97,7 @@ impl MessageBroker {
         vault: Vault,
         pex_repo: &PexRepository,
         response_limiter: Arc<Semaphore>,
+        send_limiter: RateLimiter,
         byte_counters: Arc<ByteCounters>,
     ) {
         let monitor = self.monitor.make_child(vault.monitor.name());
@@ -132,15 +144,19 @@ impl MessageBroker {
             Instrumented::new(self.dispatcher.open_recv(channel_id), byte_counters.clone());
         let sink = Instrumented::new(self.dispatcher.open_send(channel_id), byte_counters);
 
+        let link_monitor = Arc::new(LinkMonitor::new(&monitor));
+
         let mut link = Link {
             role,
             stream,
             sink,
             vault,
             response_limiter,
+            send_limiter,
             pex_tx,
             pex_rx,
             monitor,
+            link_monitor,
         };
 
         drop(span_enter);
@@ -194,9 +210,11 @@ struct Link {
     sink: Instrumented<ContentSink>,
     vault: Vault,
     response_limiter: Arc<Semaphore>,
+    send_limiter: RateLimiter,
     pex_tx: PexSender,
     pex_rx: PexReceiver,
     monitor: StateMonitor,
+    link_monitor: Arc<LinkMonitor>,
 }
 
 impl Link {
@@ -257,7 +275,9 @@ impl Link {
                 crypto_stream,
                 crypto_sink,
                 &self.vault,
+                &self.link_monitor,
                 self.response_limiter.clone(),
+                &self.send_limiter,
                 &mut self.pex_tx,
                 &mut self.pex_rx,
             )
@@ -289,11 +309,14 @@ async fn establish_channel<'a>(
     }
 }
 
+#[allow(clippy::too_many_arguments)]
 async fn run_link(
     stream: DecryptingStream<'_>,
     sink: EncryptingSink<'_>,
     repo: &Vault,
+    link_monitor: &Arc<LinkMonitor>,
     response_limiter: Arc<Semaphore>,
+    send_limiter: &RateLimiter,
     pex_tx: &mut PexSender,
     pex_rx: &mut PexReceiver,
 ) -> ControlFlow {
@@ -308,10 +331,15 @@ async fn run_link(
 
     // Run everything in parallel:
     let flow = select! {
-        flow = run_client(repo.clone(), content_tx.clone(), response_rx) => flow,
+        flow = run_client(
+            repo.clone(),
+            link_monitor.clone(),
+            content_tx.clone(),
+            response_rx,
+        ) => flow,
         flow = run_server(repo.clone(), content_tx.clone(), request_rx, response_limiter) => flow,
         flow = recv_messages(stream, request_tx, response_tx, pex_rx) => flow,
-        flow = send_messages(content_rx, sink) => flow,
+        flow = send_messages(content_rx, sink, send_limiter) => flow,
         _ = pex_tx.run(content_tx) => ControlFlow::Continue,
     };
 
@@ -368,18 +396,35 @@ async fn recv_messages(
 async fn send_messages(
     mut content_rx: mpsc::UnboundedReceiver<Content>,
     mut sink: EncryptingSink<'_>,
+    send_limiter: &RateLimiter,
 ) -> ControlFlow {
+    let mut queue = SendQueue::default();
+
     loop {
-        let content = if let Some(content) = content_rx.recv().await {
-            content
-        } else {
-            forever().await
+        let content = loop {
+            // Take everything that's ready so the index messages can overtake the blocks queued
+            // before them.
+            while let Ok(content) = content_rx.try_recv() {
+                queue.push(content);
+            }
+
+            if let Some(content) = queue.pop() {
+                break content;
+            }
+
+            if let Some(content) = content_rx.recv().await {
+                queue.push(content);
+            } else {
+                forever().await
+            }
         };
 
         // unwrap is OK because serialization into a vec should never fail unless we have a bug
         // somewhere.
         let content = bincode::serialize(&content).unwrap();
 
+        send_limiter.acquire(content.len()).await;
+
         match sink.send(content).await {
             Ok(()) => (),
             Err(SendError::Exhausted) => {
@@ -394,13 +439,36 @@ async fn send_messages(
     }
 }
 
+/// Outgoing messages waiting to be sent. Block responses are sent only when there is nothing else
+/// to send, because they are big and the other messages (index nodes, requests, ...) are what
+/// drives the sync forward. This matters most when the send rate is limited.
+#[derive(Default)]
+struct SendQueue {
+    high: VecDeque<Content>,
+    low: VecDeque<Content>,
+}
+
+impl SendQueue {
+    fn push(&mut self, content: Content) {
+        match content {
+            Content::Response(Response::Block(..)) => self.low.push_back(content),
+            _ => self.high.push_back(content),
+        }
+    }
+
+    fn pop(&mut self) -> Option<Content> {
+        self.high.pop_front().or_else(|| self.low.pop_front())
+    }
+}
+
 // Create and run client. Returns only on error.
 async fn run_client(
     repo: Vault,
+    link_monitor: Arc<LinkMonitor>,
     content_tx: mpsc::UnboundedSender<Content>,
     response_rx: mpsc::Receiver<Response>,
 ) -> ControlFlow {
-    let mut client = Client::new(repo, content_tx, response_rx);
+    let mut client = Client::new(repo, link_monitor, content_tx, response_rx);
     let result = client.run().await;
 
     tracing::debug!("Client stopped running with result {:?}", result);
@@ -5,11 +5,16 @@ use super::{
     message::{Message, MessageChannelId},
     message_io::{MessageSink, MessageStream, MESSAGE_OVERHEAD},
     raw,
-    stats::Instrumented,
+    stats::{ByteCounters, Instrumented},
+};
+use crate::{
+    collections::{hash_map::Entry, HashMap, HashSet},
+    sync::{AwaitDrop, DropAwaitable},
 };
-use crate::{collections::HashMap, sync::AwaitDrop};
 use async_trait::async_trait;
+use bytes::Bytes;
 use futures_util::{future, ready, stream::SelectAll, FutureExt, Sink, SinkExt, Stream, StreamExt};
+use net::quic;
 use std::{
     io,
     pin::Pin,
@@ -21,11 +26,20 @@ use std::{
 };
 use tokio::{
     select,
-    sync::{mpsc, oneshot},
+    sync::{
+        mpsc::{self, error::TryRecvError},
+        oneshot,
+    },
     task,
 };
+use tokio_util::sync::PollSender;
 
 const CONTENT_STREAM_BUFFER_SIZE: usize = 1024;
+// Allows messages from multiple sinks to queue up so they can be coalesced into a single write.
+const CONTENT_SINK_BUFFER_SIZE: usize = 32;
+// Messages queued for a single channel stream. Lets a busy channel get ahead of the others by this
+// much before its stream applies backpressure to the whole connection.
+const CHANNEL_STREAM_BUFFER_SIZE: usize = 32;
 
 /// Reads/writes messages from/to the underlying TCP or QUIC streams and dispatches them to
 /// individual streams/sinks based on their channel ids (in the MessageDispatcher's and
@@ -41,7 +55,7 @@ pub(super) struct MessageDispatcher {
 impl MessageDispatcher {
     pub fn new() -> Self {
         let (command_tx, command_rx) = mpsc::unbounded_channel();
-        let (sink_tx, sink_rx) = mpsc::channel(1);
+        let (sink_tx, sink_rx) = mpsc::channel(CONTENT_SINK_BUFFER_SIZE);
         let connection_count = Arc::new(AtomicUsize::new(0));
 
         let worker = Worker::new(command_rx, sink_rx, connection_count.clone());
@@ -57,7 +71,32 @@ impl MessageDispatcher {
     /// Bind this dispatcher to the given TCP of QUIC socket. Can be bound to multiple sockets and
     /// the failed ones are automatically removed.
     pub fn bind(&self, socket: Instrumented<raw::Stream>, permit: ConnectionPermit) {
-        self.command_tx.send(Command::Bind { socket, permit }).ok();
+        self.command_tx
+            .send(Command::Bind {
+                socket,
+                permit,
+                channel_streams: false,
+            })
+            .ok();
+    }
+
+    /// Like `bind` but if the socket is a QUIC connection (and the peer supports it), messages of
+    /// each channel are sent on their own QUIC stream, so that a busy channel doesn't block the
+    /// others. Other sockets use a single stream, same as with `bind`.
+    ///
+    /// Note: incoming channel streams are accepted regardless of how the socket was bound.
+    pub fn bind_with_channel_streams(
+        &self,
+        socket: Instrumented<raw::Stream>,
+        permit: ConnectionPermit,
+    ) {
+        self.command_tx
+            .send(Command::Bind {
+                socket,
+                permit,
+                channel_streams: true,
+            })
+            .ok();
     }
 
     /// Is this dispatcher bound to at least one connection?
@@ -108,14 +147,14 @@ impl MessageDispatcher {
 pub(super) struct ContentStream {
     channel: MessageChannelId,
     command_tx: mpsc::UnboundedSender<Command>,
-    stream_rx: mpsc::Receiver<(ConnectionId, Vec<u8>)>,
+    stream_rx: mpsc::Receiver<(ConnectionId, Bytes)>,
     last_transport_id: Option<ConnectionId>,
-    parked_message: Option<Vec<u8>>,
+    parked_message: Option<Bytes>,
 }
 
 impl ContentStream {
     /// Receive the next message content.
-    pub async fn recv(&mut self) -> Result<Vec<u8>, ContentStreamError> {
+    pub async fn recv(&mut self) -> Result<Bytes, ContentStreamError> {
         if let Some(content) = self.parked_message.take() {
             return Ok(content);
         }
@@ -146,7 +185,7 @@ impl ContentStream {
 }
 
 impl Instrumented<ContentStream> {
-    pub async fn recv(&mut self) -> Result<Vec<u8>, ContentStreamError> {
+    pub async fn recv(&mut self) -> Result<Bytes, ContentStreamError> {
         let content = self.as_mut().recv().await?;
         self.counters()
             .increment_rx(content.len() as u64 + MESSAGE_OVERHEAD as u64);
@@ -186,7 +225,7 @@ impl ContentSink {
     }
 
     /// Returns whether the send succeeded.
-    pub async fn send(&self, content: Vec<u8>) -> Result<(), ChannelClosed> {
+    pub async fn send(&self, content: Bytes) -> Result<(), ChannelClosed> {
         self.sink_tx
             .send(Message {
                 channel: self.channel,
@@ -198,7 +237,7 @@ impl ContentSink {
 }
 
 impl Instrumented<ContentSink> {
-    pub async fn send(&self, content: Vec<u8>) -> Result<(), ChannelClosed> {
+    pub async fn send(&self, content: Bytes) -> Result<(), ChannelClosed> {
         let len = content.len();
         self.as_ref().send(content).await?;
         self.counters()
@@ -217,24 +256,24 @@ impl Instrumented<ContentSink> {
 
 #[async_trait]
 pub(super) trait ContentSinkTrait {
-    async fn send(&self, content: Vec<u8>) -> Result<(), ChannelClosed>;
+    async fn send(&self, content: Bytes) -> Result<(), ChannelClosed>;
 }
 
 #[async_trait]
 pub(super) trait ContentStreamTrait {
-    async fn recv(&mut self) -> Result<Vec<u8>, ContentStreamError>;
+    async fn recv(&mut self) -> Result<Bytes, ContentStreamError>;
 }
 
 #[async_trait]
 impl ContentSinkTrait for ContentSink {
-    async fn send(&self, content: Vec<u8>) -> Result<(), ChannelClosed> {
+    async fn send(&self, content: Bytes) -> Result<(), ChannelClosed> {
         self.send(content).await
     }
 }
 
 #[async_trait]
 impl ContentStreamTrait for ContentStream {
-    async fn recv(&mut self) -> Result<Vec<u8>, ContentStreamError> {
+    async fn recv(&mut self) -> Result<Bytes, ContentStreamError> {
         self.recv().await
     }
 }
@@ -247,13 +286,17 @@ pub(super) struct ChannelClosed;
 
 // Stream for receiving messages from a single connection. Contains a connection permit half which
 // gets released on drop. Automatically closes when the corresponding `ConnectionSink` closes.
+//
+// QUIC connections can also have additional channel streams. Those don't hold the permit but they
+// close together with the main stream of their connection.
 struct ConnectionStream {
     // The reader is doubly instrumented - first time to track per connection stats and second time
     // to track cumulative stats across all connections.
     reader: MessageStream<Instrumented<Instrumented<raw::OwnedReadHalf>>>,
-    permit: ConnectionPermitHalf,
+    connection_id: ConnectionId,
     permit_released: AwaitDrop,
-    connection_count: Arc<AtomicUsize>,
+    // `None` for the channel streams.
+    main: Option<(ConnectionPermitHalf, Arc<AtomicUsize>)>,
 }
 
 impl ConnectionStream {
@@ -264,13 +307,24 @@ impl ConnectionStream {
     ) -> Self {
         connection_count.fetch_add(1, Ordering::Release);
 
-        let permit_released = permit.released();
-
         Self {
             reader: MessageStream::new(Instrumented::new(reader, permit.byte_counters())),
-            permit,
-            permit_released,
-            connection_count,
+            connection_id: permit.id(),
+            permit_released: permit.released(),
+            main: Some((permit, connection_count)),
+        }
+    }
+
+    fn channel_stream(
+        reader: Instrumented<Instrumented<raw::OwnedReadHalf>>,
+        connection_id: ConnectionId,
+        connection_closed: AwaitDrop,
+    ) -> Self {
+        Self {
+            reader: MessageStream::new(reader),
+            connection_id,
+            permit_released: connection_closed,
+            main: None,
         }
     }
 }
@@ -288,7 +342,7 @@ impl Stream for ConnectionStream {
         }
 
         match ready!(self.reader.poll_next_unpin(cx)) {
-            Some(Ok(message)) => Poll::Ready(Some((self.permit.id(), message))),
+            Some(Ok(message)) => Poll::Ready(Some((self.connection_id, message))),
             Some(Err(_)) | None => Poll::Ready(None),
         }
     }
@@ -296,7 +350,46 @@ impl Stream for ConnectionStream {
 
 impl Drop for ConnectionStream {
     fn drop(&mut self) {
-        self.connection_count.fetch_sub(1, Ordering::Release);
+        if let Some((_, connection_count)) = &self.main {
+            connection_count.fetch_sub(1, Ordering::Release);
+        }
+    }
+}
+
+// Accepts the channel streams opened by the peer and hands them over to the worker. The streams are
+// closed when the connection permit gets released.
+async fn accept_channel_streams(
+    uni_streams: quic::UniStreams,
+    connection_id: ConnectionId,
+    counters: [Arc<ByteCounters>; 2],
+    permit_released: AwaitDrop,
+    stream_tx: mpsc::UnboundedSender<ConnectionStream>,
+) {
+    let [total_counters, connection_counters] = counters;
+    let connection_closed = DropAwaitable::new();
+
+    let accept = async {
+        while let Ok(stream) = uni_streams.accept().await {
+            let reader = Instrumented::new(
+                Instrumented::new(raw::OwnedReadHalf::QuicUni(stream), total_counters.clone()),
+                connection_counters.clone(),
+            );
+
+            let stream = ConnectionStream::channel_stream(
+                reader,
+                connection_id,
+                connection_closed.subscribe(),
+            );
+
+            if stream_tx.send(stream).is_err() {
+                break;
+            }
+        }
+    };
+
+    select! {
+        _ = accept => (),
+        _ = permit_released => (),
     }
 }
 
@@ -306,16 +399,29 @@ struct ConnectionSink {
     // The writer is doubly instrumented - first time to track per connection stats and second time
     // to track cumulative stats across all connections.
     writer: MessageSink<Instrumented<Instrumented<raw::OwnedWriteHalf>>>,
+    channel_streams: Option<ChannelStreams>,
     _permit: ConnectionPermitHalf,
     permit_released: AwaitDrop,
 }
 
 impl ConnectionSink {
-    fn new(writer: Instrumented<raw::OwnedWriteHalf>, permit: ConnectionPermitHalf) -> Self {
+    fn new(
+        writer: Instrumented<raw::OwnedWriteHalf>,
+        permit: ConnectionPermitHalf,
+        uni_streams: Option<quic::UniStreams>,
+    ) -> Self {
         let permit_released = permit.released();
+        let channel_streams = uni_streams.map(|uni_streams| ChannelStreams {
+            uni_streams,
+            counters: [writer.shared_counters().clone(), permit.byte_counters()],
+            streams: HashMap::default(),
+            pinned: HashSet::default(),
+            pending: None,
+        });
 
         Self {
             writer: MessageSink::new(Instrumented::new(writer, permit.byte_counters())),
+            channel_streams,
             _permit: permit,
             permit_released,
         }
@@ -337,27 +443,155 @@ impl Sink<Message> for ConnectionSink {
             }
         }
 
+        if let Some(channel_streams) = &mut self.channel_streams {
+            ready!(channel_streams.poll_ready(cx))?;
+        }
+
         self.writer.poll_ready_unpin(cx)
     }
 
     fn start_send(mut self: Pin<&mut Self>, item: Message) -> Result<(), Self::Error> {
+        let item = match &mut self.channel_streams {
+            Some(channel_streams) => match channel_streams.start_send(item) {
+                Some(item) => item,
+                None => return Ok(()),
+            },
+            None => item,
+        };
+
         self.writer.start_send_unpin(item)
     }
 
     fn poll_flush(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Result<(), Self::Error>> {
+        // The channel streams flush themselves, only make sure the pending message is handed over.
+        if let Some(channel_streams) = &mut self.channel_streams {
+            ready!(channel_streams.poll_ready(cx))?;
+        }
+
         self.writer.poll_flush_unpin(cx)
     }
 
     fn poll_close(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Result<(), Self::Error>> {
+        if let Some(channel_streams) = &mut self.channel_streams {
+            ready!(channel_streams.poll_ready(cx))?;
+        }
+
         self.writer.poll_close_unpin(cx)
     }
 }
 
+// Sends the messages of each channel on their own QUIC stream.
+struct ChannelStreams {
+    uni_streams: quic::UniStreams,
+    counters: [Arc<ByteCounters>; 2],
+    streams: HashMap<MessageChannelId, PollSender<Message>>,
+    // Channels whose messages are sent on the main stream because their own stream couldn't be
+    // opened. They stay there so their messages don't get reordered (which would break their
+    // decryption).
+    pinned: HashSet<MessageChannelId>,
+    // Message accepted by `start_send` which is waiting for capacity in the queue of its channel
+    // stream.
+    pending: Option<Message>,
+}
+
+impl ChannelStreams {
+    // Hands the pending message (if any) over to its channel stream, waiting for the stream's queue
+    // to have capacity. This is what propagates the backpressure of the channel streams to the
+    // dispatcher.
+    fn poll_ready(&mut self, cx: &mut Context<'_>) -> Poll<io::Result<()>> {
+        let Some(message) = &self.pending else {
+            return Poll::Ready(Ok(()));
+        };
+
+        // The stream of the pending message's channel is always opened in `start_send`.
+        let tx = self.streams.get_mut(&message.channel).unwrap();
+
+        ready!(tx.poll_reserve(cx)).map_err(|_| channel_stream_closed())?;
+        tx.send_item(self.pending.take().unwrap())
+            .map_err(|_| channel_stream_closed())?;
+
+        Poll::Ready(Ok(()))
+    }
+
+    // Queues the message for sending on the stream of its channel, opening the stream if needed.
+    // Gives the message back if it should be sent on the main stream instead. Must be called only
+    // after `poll_ready` returned `Ready(Ok(()))`.
+    fn start_send(&mut self, message: Message) -> Option<Message> {
+        debug_assert!(self.pending.is_none());
+
+        if self.pinned.contains(&message.channel) {
+            return Some(message);
+        }
+
+        if let Entry::Vacant(entry) = self.streams.entry(message.channel) {
+            let Some(stream) = self.uni_streams.try_open() else {
+                self.pinned.insert(message.channel);
+                return Some(message);
+            };
+
+            let [total_counters, connection_counters] = &self.counters;
+            let writer = MessageSink::new(Instrumented::new(
+                Instrumented::new(raw::OwnedWriteHalf::QuicUni(stream), total_counters.clone()),
+                connection_counters.clone(),
+            ));
+
+            let (tx, rx) = mpsc::channel(CHANNEL_STREAM_BUFFER_SIZE);
+            task::spawn(run_channel_stream(writer, rx));
+
+            entry.insert(PollSender::new(tx));
+        }
+
+        self.pending = Some(message);
+
+        None
+    }
+}
+
+// The channel stream failed. Some of its messages might have been lost so the whole connection has
+// to be considered failed.
+fn channel_stream_closed() -> io::Error {
+    io::Error::new(io::ErrorKind::BrokenPipe, "channel stream closed")
+}
+
+async fn run_channel_stream(
+    mut writer: MessageSink<Instrumented<Instrumented<raw::OwnedWriteHalf>>>,
+    mut rx: mpsc::Receiver<Message>,
+) {
+    loop {
+        // Same as in `SendState::run`, flush only when there are no more messages immediately
+        // available.
+        let message = match rx.try_recv() {
+            Ok(message) => message,
+            Err(TryRecvError::Empty) => {
+                if writer.flush().await.is_err() {
+                    return;
+                }
+
+                let Some(message) = rx.recv().await else {
+                    break;
+                };
+
+                message
+            }
+            Err(TryRecvError::Disconnected) => break,
+        };
+
+        if writer.feed(message).await.is_err() {
+            return;
+        }
+    }
+
+    writer.close().await.ok();
+}
+
 struct Worker {
     command_rx: mpsc::UnboundedReceiver<Command>,
     connection_count: Arc<AtomicUsize>,
     send: SendState,
     recv: RecvState,
+    // Channel streams accepted on the bound QUIC connections.
+    channel_stream_tx: mpsc::UnboundedSender<ConnectionStream>,
+    channel_stream_rx: mpsc::UnboundedReceiver<ConnectionStream>,
 }
 
 impl Worker {
@@ -366,9 +600,13 @@ impl Worker {
         sink_rx: mpsc::Receiver<Message>,
         connection_count: Arc<AtomicUsize>,
     ) -> Self {
+        let (channel_stream_tx, channel_stream_rx) = mpsc::unbounded_channel();
+
         Self {
             command_rx,
             connection_count,
+            channel_stream_tx,
+            channel_stream_rx,
             send: SendState {
                 sink_rx,
                 sinks: Vec::new(),
@@ -391,6 +629,9 @@ impl Worker {
                         break;
                     }
                 }
+                Some(stream) = self.channel_stream_rx.recv() => {
+                    self.recv.streams.push(stream);
+                }
                 _ = self.send.run()=> unreachable!(),
                 _ = self.recv.run()=> unreachable!(),
             }
@@ -407,13 +648,33 @@ impl Worker {
             Command::Close { channel } => {
                 self.recv.channels.remove(&channel);
             }
-            Command::Bind { socket, permit } => {
+            Command::Bind {
+                socket,
+                permit,
+                channel_streams,
+            } => {
+                let uni_streams = socket.as_ref().uni_streams();
                 let (reader, writer) = socket.into_split();
                 let (send_permit, recv_permit) = permit.into_split();
 
-                self.send
-                    .sinks
-                    .push(ConnectionSink::new(writer, send_permit));
+                if let Some(uni_streams) = &uni_streams {
+                    task::spawn(accept_channel_streams(
+                        uni_streams.clone(),
+                        recv_permit.id(),
+                        [
+                            reader.shared_counters().clone(),
+                            recv_permit.byte_counters(),
+                        ],
+                        recv_permit.released(),
+                        self.channel_stream_tx.clone(),
+                    ));
+                }
+
+                self.send.sinks.push(ConnectionSink::new(
+                    writer,
+                    send_permit,
+                    uni_streams.filter(|_| channel_streams),
+                ));
 
                 self.recv.streams.push(ConnectionStream::new(
                     reader,
@@ -447,7 +708,7 @@ impl Worker {
 enum Command {
     Open {
         channel: MessageChannelId,
-        stream_tx: mpsc::Sender<(ConnectionId, Vec<u8>)>,
+        stream_tx: mpsc::Sender<(ConnectionId, Bytes)>,
     },
     Close {
         channel: MessageChannelId,
@@ -455,6 +716,7 @@ enum Command {
     Bind {
         socket: Instrumented<raw::Stream>,
         permit: ConnectionPermit,
+        channel_streams: bool,
     },
     Shutdown {
         tx: oneshot::Sender<()>,
@@ -482,8 +744,26 @@ impl SendState {
                 }
             }
 
-            let Some(message) = self.sink_rx.recv().await else {
-                break;
+            // Messages are buffered by the sink so that back-to-back ones are coalesced. Flush
+            // them once there are no more messages immediately available.
+            let message = match self.sink_rx.try_recv() {
+                Ok(message) => message,
+                Err(TryRecvError::Empty) => {
+                    match future::poll_fn(|cx| sink.poll_flush_unpin(cx)).await {
+                        Ok(()) => (),
+                        Err(_) => {
+                            self.sinks.swap_remove(0);
+                            continue;
+                        }
+                    }
+
+                    let Some(message) = self.sink_rx.recv().await else {
+                        break;
+                    };
+
+                    message
+                }
+                Err(TryRecvError::Disconnected) => break,
             };
 
             match sink.start_send_unpin(message) {
@@ -501,8 +781,8 @@ impl SendState {
 
 struct RecvState {
     streams: SelectAll<ConnectionStream>,
-    channels: HashMap<MessageChannelId, mpsc::Sender<(ConnectionId, Vec<u8>)>>,
-    message: Option<(MessageChannelId, ConnectionId, Vec<u8>)>,
+    channels: HashMap<MessageChannelId, mpsc::Sender<(ConnectionId, Bytes)>>,
+    message: Option<(MessageChannelId, ConnectionId, Bytes)>,
 }
 
 impl RecvState {
@@ -566,13 +846,13 @@ mod tests {
         client_sink
             .send(Message {
                 channel,
-                content: send_content.to_vec(),
+                content: Bytes::from_static(send_content),
             })
             .await
             .unwrap();
 
         let recv_content = server_stream.recv().await.unwrap();
-        assert_eq!(recv_content, send_content);
+        assert_eq!(recv_content, &send_content[..]);
     }
 
     #[tokio::test(flavor = "multi_thread")]
@@ -595,7 +875,7 @@ mod tests {
             client_sink
                 .send(Message {
                     channel,
-                    content: content.to_vec(),
+                    content: Bytes::from_static(content),
                 })
                 .await
                 .unwrap();
@@ -606,7 +886,7 @@ mod tests {
             (server_stream1, send_content1),
         ] {
             let recv_content = server_stream.recv().await.unwrap();
-            assert_eq!(recv_content, send_content);
+            assert_eq!(recv_content, &send_content[..]);
         }
     }
 
@@ -632,7 +912,7 @@ mod tests {
         let num_messages = 20;
         let mut send_tasks = vec![];
 
-        let build_message = |channel, i| format!("{:?}:{}", channel, i).as_bytes().to_vec();
+        let build_message = |channel, i| Bytes::from(format!("{:?}:{}", channel, i));
 
         for sink in [client_sink0, client_sink1] {
             send_tasks.push(task::spawn(async move {
@@ -679,7 +959,7 @@ mod tests {
             client_sink
                 .send(Message {
                     channel,
-                    content: content.to_vec(),
+                    content: Bytes::from_static(content),
                 })
                 .await
                 .unwrap();
@@ -689,8 +969,8 @@ mod tests {
             server_stream0.recv().await,
             Err(ContentStreamError::ChannelClosed)
         );
-        assert_eq!(server_stream1.recv().await.unwrap(), send_content0);
-        assert_eq!(server_stream1.recv().await.unwrap(), send_content1);
+        assert_eq!(server_stream1.recv().await.unwrap(), &send_content0[..]);
+        assert_eq!(server_stream1.recv().await.unwrap(), &send_content1[..]);
     }
 
     #[tokio::test(flavor = "multi_thread")]
@@ -718,7 +998,7 @@ mod tests {
             client_sink
                 .send(Message {
                     channel,
-                    content: content.to_vec(),
+                    content: Bytes::from_static(content),
                 })
                 .await
                 .unwrap();
@@ -735,7 +1015,7 @@ mod tests {
 
         // The messages may be received in any order
         assert_eq!(
-            [recv_content0.as_slice(), recv_content1.as_slice()]
+            [&recv_content0[..], &recv_content1[..]]
                 .into_iter()
                 .collect::<BTreeSet<_>>(),
             [send_content0.as_slice(), send_content1.as_slice()]
@@ -764,7 +1044,7 @@ mod tests {
         server_dispatcher.bind(server_socket1, ConnectionPermit::dummy());
 
         for content in [send_content0, send_content1] {
-            server_sink.send(content.to_vec()).await.unwrap();
+            server_sink.send(Bytes::from_static(content)).await.unwrap();
         }
 
         // The messages may be received on any stream
@@ -776,9 +1056,12 @@ mod tests {
 
         assert_eq!(
             recv_contents,
-            [send_content0.to_vec(), send_content1.to_vec()]
-                .into_iter()
-                .collect::<BTreeSet<_>>(),
+            [
+                Bytes::from_static(send_content0),
+                Bytes::from_static(send_content1)
+            ]
+            .into_iter()
+            .collect::<BTreeSet<_>>(),
         );
     }
 
@@ -795,7 +1078,80 @@ mod tests {
             Err(ContentStreamError::ChannelClosed)
         );
 
-        assert_matches!(server_sink.send(vec![]).await, Err(ChannelClosed));
+        assert_matches!(server_sink.send(Bytes::new()).await, Err(ChannelClosed));
+    }
+
+    #[tokio::test(flavor = "multi_thread")]
+    async fn quic_channel_streams() {
+        let channel0 = MessageChannelId::random();
+        let channel1 = MessageChannelId::random();
+
+        let client_dispatcher = MessageDispatcher::new();
+        let client_sink0 = client_dispatcher.open_send(channel0);
+        let client_sink1 = client_dispatcher.open_send(channel1);
+
+        let server_dispatcher = MessageDispatcher::new();
+        let mut server_stream0 = server_dispatcher.open_recv(channel0);
+        let mut server_stream1 = server_dispatcher.open_recv(channel1);
+
+        let (client_socket, server_socket) = create_connected_quic_sockets().await;
+        client_dispatcher.bind_with_channel_streams(client_socket, ConnectionPermit::dummy());
+        server_dispatcher.bind(server_socket, ConnectionPermit::dummy());
+
+        let num_messages = 10;
+
+        for i in 0..num_messages {
+            for sink in [&client_sink0, &client_sink1] {
+                sink.send(Bytes::from(format!("{:?}:{}", sink.channel, i)))
+                    .await
+                    .unwrap();
+            }
+        }
+
+        for server_stream in [&mut server_stream0, &mut server_stream1] {
+            for i in 0..num_messages {
+                let recv_content = server_stream.recv().await.unwrap();
+                assert_eq!(
+                    from_utf8(&recv_content).unwrap(),
+                    format!("{:?}:{}", server_stream.channel, i)
+                );
+            }
+        }
+    }
+
+    async fn create_connected_quic_sockets(
+    ) -> (Instrumented<raw::Stream>, Instrumented<raw::Stream>) {
+        use tokio::io::{AsyncReadExt, AsyncWriteExt};
+
+        let (connector, _, _) = net::quic::configure((Ipv4Addr::LOCALHOST, 0).into())
+            .await
+            .unwrap();
+        let (_, mut acceptor, _) = net::quic::configure((Ipv4Addr::LOCALHOST, 0).into())
+            .await
+            .unwrap();
+
+        let addr = *acceptor.local_addr();
+
+        let (client, server) = future::join(
+            async {
+                let mut client = connector.connect(addr).await.unwrap();
+                // The main stream is announced to the peer only after something is written to it
+                // (this would normally be the handshake).
+                client.write_all(&[0]).await.unwrap();
+                client
+            },
+            async {
+                let mut server = acceptor.accept().await.unwrap().finish().await.unwrap();
+                server.read_exact(&mut [0]).await.unwrap();
+                server
+            },
+        )
+        .await;
+
+        (
+            Instrumented::new(raw::Stream::Quic(client), Arc::new(ByteCounters::default())),
+            Instrumented::new(raw::Stream::Quic(server), Arc::new(ByteCounters::default())),
+        )
     }
 
     async fn create_connected_sockets() -> (Instrumented<raw::Stream>, Instrumented<raw::Stream>) {
@@ -1,12 +1,15 @@
 use super::message::{Header, Message};
+use bytes::{Buf, BufMut, Bytes, BytesMut};
 use futures_util::{ready, Sink, Stream};
 use std::{
-    io, mem,
+    collections::VecDeque,
+    io::{self, IoSlice},
     pin::Pin,
     task::{Context, Poll},
 };
 use thiserror::Error;
-use tokio::io::{AsyncRead, AsyncWrite, ReadBuf};
+use tokio::io::{AsyncRead, AsyncWrite};
+use tokio_util::io::poll_read_buf;
 
 /// Max message size when serialized in bytes.
 /// This is also the maximum allowed message size in the Noise Protocol Framework.
@@ -49,6 +52,9 @@ where
 }
 
 /// Wrapper that turns a writer (`AsyncWrite`) into a `Sink` of `Message`.
+///
+/// Messages are buffered and written out (coalesced into as few writes as possible) on flush or
+/// when the buffer gets full.
 pub(crate) struct MessageSink<W> {
     write: W,
     encoder: Encoder,
@@ -80,104 +86,78 @@ where
     }
 
     fn poll_flush(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Result<(), Self::Error>> {
-        ready!(self.as_mut().poll_ready(cx))?;
-
-        match &self.encoder.state {
-            EncodeState::Idle => Poll::Ready(Ok(())),
-            EncodeState::Sending {
-                phase: SendingPhase::Done,
-                ..
-            } => {
-                let result = ready!(Pin::new(&mut self.write).poll_flush(cx));
-                self.encoder.state = EncodeState::Idle;
-                Poll::Ready(result)
-            }
-            EncodeState::Sending { .. } => unreachable!(),
-        }
+        let this = &mut *self;
+        let mut write = Pin::new(&mut this.write);
+        ready!(this.encoder.poll_write_all(write.as_mut(), cx))?;
+        write.poll_flush(cx)
     }
 
     fn poll_close(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<Result<(), Self::Error>> {
-        ready!(self.as_mut().poll_ready(cx))?;
-
-        match &self.encoder.state {
-            EncodeState::Idle
-            | EncodeState::Sending {
-                phase: SendingPhase::Done,
-                ..
-            } => {
-                let result = ready!(Pin::new(&mut self.write).poll_shutdown(cx));
-                self.encoder.state = EncodeState::Idle;
-                Poll::Ready(result)
-            }
-            EncodeState::Sending { .. } => unreachable!(),
-        }
+        let this = &mut *self;
+        let mut write = Pin::new(&mut this.write);
+        ready!(this.encoder.poll_write_all(write.as_mut(), cx))?;
+        write.poll_shutdown(cx)
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Encoder
 
-struct Encoder {
-    state: EncodeState,
-    offset: usize,
-}
+/// Contents up to this size are copied into the write buffer right after their header so that
+/// many small messages go out in a single write. Larger contents are written straight from their
+/// own buffers (using vectored writes, if supported) to avoid copying them.
+const COALESCE_THRESHOLD: usize = 1024;
 
-enum EncodeState {
-    Idle,
-    Sending {
-        message: Message,
-        phase: SendingPhase,
-    },
-}
+/// Number of buffered bytes after which `poll_ready` starts writing them out instead of accepting
+/// more messages.
+const WRITE_BUFFER_LIMIT: usize = 64 * 1024;
 
-enum SendingPhase {
-    Header,
-    Len,
-    Content,
-    Done,
-}
+/// Max number of buffers passed to a single vectored write.
+const MAX_IO_SLICES: usize = 64;
 
-impl Default for Encoder {
-    fn default() -> Self {
-        Self {
-            state: EncodeState::Idle,
-            offset: 0,
-        }
-    }
+#[derive(Default)]
+struct Encoder {
+    // Serialized headers and coalesced small contents not yet moved to `chunks`.
+    buffer: BytesMut,
+    // Buffers waiting to be written, in order.
+    chunks: VecDeque<Bytes>,
+    // Total number of bytes in `buffer` and `chunks`.
+    len: usize,
 }
 
 impl Encoder {
-    fn is_sending(&self) -> bool {
-        match &self.state {
-            EncodeState::Idle => false,
-            EncodeState::Sending {
-                phase: SendingPhase::Done,
-                ..
-            } => false,
-            EncodeState::Sending { .. } => true,
-        }
-    }
-
     fn start(&mut self, message: Message) -> Result<(), io::Error> {
-        assert!(
-            !self.is_sending(),
-            "start_send called while already sending"
-        );
-
         if message.content.len() > MAX_MESSAGE_SIZE as usize {
             return Err(io::Error::new(io::ErrorKind::InvalidInput, LengthError));
         }
 
-        self.state = EncodeState::Sending {
-            message,
-            phase: SendingPhase::Header,
-        };
-        self.offset = 0;
+        self.buffer.put_slice(&message.header().serialize());
+        self.buffer.put_u16(message.content.len() as u16);
+        self.len += MESSAGE_OVERHEAD + message.content.len();
+
+        if message.content.len() <= COALESCE_THRESHOLD {
+            self.buffer.put_slice(&message.content);
+        } else {
+            self.chunks.push_back(self.buffer.split().freeze());
+            self.chunks.push_back(message.content);
+        }
 
         Ok(())
     }
 
-    fn poll_ready<W>(
+    fn poll_ready<W>(&mut self, io: Pin<&mut W>, cx: &mut Context) -> Poll<Result<(), io::Error>>
+    where
+        W: AsyncWrite,
+    {
+        if self.len < WRITE_BUFFER_LIMIT {
+            Poll::Ready(Ok(()))
+        } else {
+            self.poll_write_all(io, cx)
+        }
+    }
+
+    /// Writes out everything buffered so far.
+    fn poll_write_all<W>(
         &mut self,
         mut io: Pin<&mut W>,
         cx: &mut Context,
@@ -185,116 +165,74 @@ impl Encoder {
     where
         W: AsyncWrite,
     {
-        loop {
-            match &mut self.state {
-                EncodeState::Idle => return Poll::Ready(Ok(())),
-                EncodeState::Sending { message, phase } => match phase {
-                    SendingPhase::Header => {
-                        match ready!(poll_write_all(
-                            io.as_mut(),
-                            cx,
-                            &message.header().serialize(),
-                            &mut self.offset
-                        )) {
-                            Ok(true) => {
-                                *phase = SendingPhase::Len;
-                                self.offset = 0;
-                            }
-                            Ok(false) => (),
-                            Err(error) => {
-                                self.state = EncodeState::Idle;
-                                return Poll::Ready(Err(error));
-                            }
-                        }
-                    }
-                    SendingPhase::Len => {
-                        let buffer = (message.content.len() as u16).to_be_bytes();
-
-                        match ready!(poll_write_all(io.as_mut(), cx, &buffer, &mut self.offset)) {
-                            Ok(true) => {
-                                if message.content.is_empty() {
-                                    *phase = SendingPhase::Done;
-                                } else {
-                                    *phase = SendingPhase::Content;
-                                }
-                                self.offset = 0;
-                            }
-                            Ok(false) => (),
-                            Err(error) => {
-                                self.state = EncodeState::Idle;
-                                return Poll::Ready(Err(error));
-                            }
-                        }
-                    }
-                    SendingPhase::Content => {
-                        match ready!(poll_write_all(
-                            io.as_mut(),
-                            cx,
-                            &message.content,
-                            &mut self.offset
-                        )) {
-                            Ok(true) => {
-                                *phase = SendingPhase::Done;
-                                self.offset = 0;
-                            }
-                            Ok(false) => (),
-                            Err(error) => {
-                                self.state = EncodeState::Idle;
-                                return Poll::Ready(Err(error));
-                            }
-                        }
-                    }
-                    SendingPhase::Done => return Poll::Ready(Ok(())),
-                },
+        if !self.buffer.is_empty() {
+            self.chunks.push_back(self.buffer.split().freeze());
+        }
+
+        while !self.chunks.is_empty() {
+            let result = if io.is_write_vectored() {
+                let mut slices = [IoSlice::new(&[]); MAX_IO_SLICES];
+                let count = self.chunks.len().min(MAX_IO_SLICES);
+
+                for (slice, chunk) in slices.iter_mut().zip(&self.chunks) {
+                    *slice = IoSlice::new(chunk);
+                }
+
+                ready!(io.as_mut().poll_write_vectored(cx, &slices[..count]))
+            } else {
+                ready!(io.as_mut().poll_write(cx, &self.chunks[0]))
+            };
+
+            match result {
+                Ok(0) => {
+                    self.clear();
+                    return Poll::Ready(Err(io::ErrorKind::WriteZero.into()));
+                }
+                Ok(len) => self.advance(len),
+                Err(error) => {
+                    self.clear();
+                    return Poll::Ready(Err(error));
+                }
             }
         }
+
+        Poll::Ready(Ok(()))
     }
-}
 
-fn poll_write_all<W>(
-    io: Pin<&mut W>,
-    cx: &mut Context,
-    buffer: &[u8],
-    offset: &mut usize,
-) -> Poll<io::Result<bool>>
-where
-    W: AsyncWrite,
-{
-    let len = ready!(io.poll_write(cx, &buffer[*offset..]))?;
+    fn advance(&mut self, mut len: usize) {
+        self.len -= len;
 
-    if len == 0 {
-        return Poll::Ready(Err(io::ErrorKind::WriteZero.into()));
-    }
+        while len > 0 {
+            // unwrap is ok because we never write more than what's in `chunks`.
+            let chunk = self.chunks.front_mut().unwrap();
+
+            if len < chunk.len() {
+                chunk.advance(len);
+                break;
+            }
 
-    *offset += len;
+            len -= chunk.len();
+            self.chunks.pop_front();
+        }
+    }
 
-    Poll::Ready(Ok(*offset >= buffer.len()))
+    fn clear(&mut self) {
+        self.buffer.clear();
+        self.chunks.clear();
+        self.len = 0;
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Decoder
 
-struct Decoder {
-    phase: DecodePhase,
-    buffer: Vec<u8>,
-    offset: usize,
-}
-
-#[derive(Clone, Copy)]
-enum DecodePhase {
-    Header,
-    Len { header: Header },
-    Content { header: Header },
-}
+/// Min free space in the read buffer before reading from the socket. The buffer is reused (its
+/// allocation is reclaimed) once all the messages previously split off of it have been dropped.
+const READ_BUFFER_SIZE: usize = 64 * 1024;
 
-impl Default for Decoder {
-    fn default() -> Self {
-        Self {
-            phase: DecodePhase::Header,
-            buffer: vec![0; Header::SIZE],
-            offset: 0,
-        }
-    }
+#[derive(Default)]
+struct Decoder {
+    buffer: BytesMut,
 }
 
 impl Decoder {
@@ -303,97 +241,53 @@ impl Decoder {
         R: AsyncRead,
     {
         loop {
-            ready!(self.poll_read_exact(io.as_mut(), cx))?;
-
-            match self.phase {
-                DecodePhase::Header => {
-                    let header: [u8; Header::SIZE] = self
-                        .filled()
-                        .try_into()
-                        .map_err(|error| io::Error::new(io::ErrorKind::InvalidData, error))?;
-
-                    let header = match Header::deserialize(&header) {
-                        Some(header) => header,
-                        None => {
-                            return Poll::Ready(Err(io::Error::new(
-                                io::ErrorKind::InvalidData,
-                                BadHeader,
-                            )))
-                        }
-                    };
-
-                    self.phase = DecodePhase::Len { header };
-                    self.buffer.resize(2, 0);
-                    self.offset = 0;
-                }
-                DecodePhase::Len { header } => {
-                    let len = u16::from_be_bytes(
-                        self.filled()
-                            .try_into()
-                            .map_err(|error| io::Error::new(io::ErrorKind::InvalidData, error))?,
-                    );
-
-                    if len > MAX_MESSAGE_SIZE {
-                        return Poll::Ready(Err(io::Error::new(
-                            io::ErrorKind::InvalidData,
-                            LengthError,
-                        )));
-                    }
-
-                    if len > 0 {
-                        self.phase = DecodePhase::Content { header };
-                        self.buffer.resize(len as usize, 0);
-                        self.offset = 0;
-                    } else {
-                        self.phase = DecodePhase::Header;
-                        self.buffer.resize(Header::SIZE, 0);
-                        self.offset = 0;
-
-                        return Poll::Ready(Ok(Message {
-                            channel: header.channel,
-                            content: Vec::new(),
-                        }));
-                    }
-                }
-                DecodePhase::Content { header } => {
-                    let content = mem::take(&mut self.buffer);
+            if let Some(message) = self.decode()? {
+                return Poll::Ready(Ok(message));
+            }
 
-                    self.phase = DecodePhase::Header;
-                    self.buffer.resize(Header::SIZE, 0);
-                    self.offset = 0;
+            if self.buffer.capacity() - self.buffer.len() < READ_BUFFER_SIZE / 4 {
+                self.buffer.reserve(READ_BUFFER_SIZE);
+            }
 
-                    return Poll::Ready(Ok(Message {
-                        channel: header.channel,
-                        content,
-                    }));
-                }
+            if ready!(poll_read_buf(io.as_mut(), cx, &mut self.buffer))? == 0 {
+                return Poll::Ready(Err(io::ErrorKind::UnexpectedEof.into()));
             }
         }
     }
 
-    fn poll_read_exact<R>(&mut self, mut io: Pin<&mut R>, cx: &mut Context) -> Poll<io::Result<()>>
-    where
-        R: AsyncRead,
-    {
-        loop {
-            let mut buf = ReadBuf::new(&mut self.buffer[self.offset..]);
+    // Splits the next complete message off of the buffer, if there is one.
+    fn decode(&mut self) -> io::Result<Option<Message>> {
+        if self.buffer.len() < MESSAGE_OVERHEAD {
+            return Ok(None);
+        }
 
-            match ready!(io.as_mut().poll_read(cx, &mut buf)) {
-                Ok(()) if !buf.filled().is_empty() => {
-                    self.offset += buf.filled().len();
+        // unwrap is ok because the buffer is long enough.
+        let header: [u8; Header::SIZE] = self.buffer[..Header::SIZE].try_into().unwrap();
+        let header = Header::deserialize(&header)
+            .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidData, BadHeader))?;
 
-                    if self.offset >= self.buffer.len() {
-                        return Poll::Ready(Ok(()));
-                    }
-                }
-                Ok(()) => return Poll::Ready(Err(io::ErrorKind::UnexpectedEof.into())),
-                Err(error) => return Poll::Ready(Err(error)),
-            }
+        let len = u16::from_be_bytes([self.buffer[Header::SIZE], self.buffer[Header::SIZE + 1]]);
+
+        if len > MAX_MESSAGE_SIZE {
+            return Err(io::Error::new(io::ErrorKind::InvalidData, LengthError));
         }
-    }
 
-    fn filled(&self) -> &[u8] {
-        &self.buffer[..self.offset]
+        let len = len as usize;
+
+        if self.buffer.len() < MESSAGE_OVERHEAD + len {
+            // Make sure the whole message fits into the buffer.
+            self.buffer
+                .reserve(MESSAGE_OVERHEAD + len - self.buffer.len());
+            return Ok(None);
+        }
+
+        self.buffer.advance(MESSAGE_OVERHEAD);
+        let content = self.buffer.split_to(len).freeze();
+
+        Ok(Some(Message {
+            channel: header.channel,
+            content,
+        }))
     }
 }
 
@@ -404,3 +298,50 @@ struct LengthError;
 #[derive(Debug, Error)]
 #[error("bad header")]
 struct BadHeader;
+
+#[cfg(test)]
+mod tests {
+    use super::{super::message::MessageChannelId, *};
+    use futures_util::{SinkExt, StreamExt};
+    use net::tcp::{TcpListener, TcpStream};
+    use std::net::Ipv4Addr;
+
+    #[tokio::test]
+    async fn coalesced_and_vectored() {
+        let listener = TcpListener::bind((Ipv4Addr::LOCALHOST, 0u16))
+            .await
+            .unwrap();
+        let client = TcpStream::connect(listener.local_addr().unwrap())
+            .await
+            .unwrap();
+        let (server, _) = listener.accept().await.unwrap();
+
+        let mut sink = MessageSink::new(client);
+        let mut stream = MessageStream::new(server);
+
+        let channel = MessageChannelId::random();
+
+        // Mix of small (coalesced) and large (written directly) messages.
+        let contents: Vec<Bytes> = [0, 10, COALESCE_THRESHOLD + 1, 5, MAX_MESSAGE_SIZE as usize]
+            .into_iter()
+            .map(|len| (0..len).map(|i| i as u8).collect::<Vec<_>>().into())
+            .collect();
+
+        for content in &contents {
+            sink.feed(Message {
+                channel,
+                content: content.clone(),
+            })
+            .await
+            .unwrap();
+        }
+
+        sink.flush().await.unwrap();
+
+        for content in contents {
+            let message = stream.next().await.unwrap().unwrap();
+            assert_eq!(message.channel, channel);
+            assert_eq!(message.content, content);
+        }
+    }
+}
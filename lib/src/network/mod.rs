@@ -7,6 +7,7 @@ mod crypto;
 mod debug_payload;
 mod dht_discovery;
 mod gateway;
+mod index_sketch;
 mod ip;
 mod local_discovery;
 mod message;
@@ -20,7 +21,9 @@ mod peer_source;
 mod peer_state;
 mod pending;
 mod protocol;
+mod rate_limiter;
 mod raw;
+mod request_window;
 mod runtime_id;
 mod seen_peers;
 mod server;
@@ -54,6 +57,7 @@ use self::{
     peer_addr::PeerPort,
     peer_exchange::{PexDiscovery, PexRepository},
     protocol::{Version, MAGIC, VERSION},
+    rate_limiter::RateLimiter,
     seen_peers::{SeenPeer, SeenPeers},
     stats::{ByteCounters, StatsTracker},
     stun::StunClients,
@@ -76,7 +80,10 @@ use std::{
     future::Future,
     io, mem,
     net::{SocketAddr, SocketAddrV4, SocketAddrV6},
-    sync::{Arc, Weak},
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc, Weak,
+    },
 };
 use thiserror::Error;
 use tokio::{
@@ -89,6 +96,7 @@ use tracing::{Instrument, Span};
 
 const DHT_ENABLED: &str = "dht_enabled";
 const PEX_ENABLED: &str = "pex_enabled";
+const SEND_RATE_LIMIT: &str = "send_rate_limit";
 
 pub struct Network {
     inner: Arc<Inner>,
@@ -162,6 +170,8 @@ impl Network {
             highest_seen_protocol_version: BlockingMutex::new(VERSION),
             our_addresses: BlockingMutex::new(HashSet::default()),
             stats_tracker: StatsTracker::default(),
+            channel_streams_enabled: AtomicBool::new(false),
+            send_limiter: RateLimiter::new(None),
         });
 
         inner.spawn(inner.clone().handle_incoming_connections(incoming_rx));
@@ -259,6 +269,34 @@ impl Network {
     pub fn is_pex_recv_enabled(&self) -> bool {
         self.inner.pex_discovery.is_recv_enabled()
     }
+    /// Sets whether the messages of each repository are sent on their own QUIC stream, instead of
+    /// multiplexing all of them over a single one. This prevents a large transfer in one repository
+    /// from delaying the traffic of the other repositories shared with the same peer. Applies only
+    /// to QUIC connections established afterwards and only if the peer supports it. TCP
+    /// connections always use a single stream.
+    pub fn set_channel_streams_enabled(&self, enabled: bool) {
+        self.inner
+            .channel_streams_enabled
+            .store(enabled, Ordering::Relaxed);
+    }
+
+    pub fn is_channel_streams_enabled(&self) -> bool {
+        self.inner.channel_streams_enabled.load(Ordering::Relaxed)
+    }
+
+    /// Sets the max total rate (in bytes per second) at which data is sent to all peers, in all
+    /// repositories. `None` means unlimited. When the limit is reached the repositories take turns
+    /// so none of them can starve the others. Index messages are sent before block contents.
+    ///
+    /// See also [Registration::set_send_rate_limit].
+    pub fn set_send_rate_limit(&self, limit: Option<u64>) {
+        self.inner.send_limiter.set_rate(limit)
+    }
+
+    pub fn send_rate_limit(&self) -> Option<u64> {
+        self.inner.send_limiter.rate()
+    }
+
     /// Find out external address using the STUN protocol.
     /// Currently QUIC only.
     pub async fn external_addr_v4(&self) -> Option<SocketAddrV4> {
@@ -353,9 +391,18 @@ impl Network {
             None
         };
 
+        let send_rate_limit: u64 = metadata
+            .get(SEND_RATE_LIMIT)
+            .await
+            .unwrap_or(Some(0))
+            .unwrap_or(0);
+
         let pex = self.inner.pex_discovery.new_repository();
         pex.set_enabled(pex_enabled);
 
+        let send_limiter = RateLimiter::new(Some(self.inner.send_limiter.clone()));
+        send_limiter.set_rate(Some(send_rate_limit).filter(|limit| *limit > 0));
+
         // TODO: This should be global, not per repo
         let response_limiter = Arc::new(Semaphore::new(MAX_UNCHOKED_COUNT));
         let stats_tracker = StatsTracker::default();
@@ -366,6 +413,7 @@ impl Network {
             handle.vault.clone(),
             &pex,
             response_limiter.clone(),
+            send_limiter.clone(),
             stats_tracker.bytes.clone(),
         );
 
@@ -374,6 +422,7 @@ impl Network {
             dht,
             pex,
             response_limiter,
+            send_limiter,
             stats_tracker,
         });
 
@@ -450,6 +499,26 @@ impl Registration {
             .is_enabled()
     }
 
+    /// Sets the max rate (in bytes per second) at which data of this repository is sent to all
+    /// peers. `None` means unlimited. This applies in addition to the total limit set with
+    /// [Network::set_send_rate_limit].
+    pub async fn set_send_rate_limit(&self, limit: Option<u64>) {
+        let metadata = self.inner.state.lock().unwrap().registry[self.key]
+            .vault
+            .metadata();
+        metadata.set(SEND_RATE_LIMIT, limit.unwrap_or(0)).await.ok();
+
+        self.inner.state.lock().unwrap().registry[self.key]
+            .send_limiter
+            .set_rate(limit);
+    }
+
+    pub fn send_rate_limit(&self) -> Option<u64> {
+        self.inner.state.lock().unwrap().registry[self.key]
+            .send_limiter
+            .rate()
+    }
+
     /// Fetch per-repository network statistics.
     pub fn stats(&self) -> Stats {
         self.inner.state.lock().unwrap().registry[self.key]
@@ -482,6 +551,7 @@ struct RegistrationHolder {
     dht: Option<dht_discovery::LookupRequest>,
     pex: PexRepository,
     response_limiter: Arc<Semaphore>,
+    send_limiter: RateLimiter,
     stats_tracker: StatsTracker,
 }
 
@@ -510,6 +580,9 @@ struct Inner {
     // Used to prevent repeatedly connecting to self.
     our_addresses: BlockingMutex<HashSet<PeerAddr>>,
     stats_tracker: StatsTracker,
+    channel_streams_enabled: AtomicBool,
+    // Limits the total send rate. Parent of the per-repository limiters.
+    send_limiter: RateLimiter,
 }
 
 struct State {
@@ -524,6 +597,7 @@ impl State {
         repo: Vault,
         pex: &PexRepository,
         response_limiter: Arc<Semaphore>,
+        send_limiter: RateLimiter,
         byte_counters: Arc<ByteCounters>,
     ) {
         if let Some(brokers) = &mut self.message_brokers {
@@ -532,6 +606,7 @@ impl State {
                     repo.clone(),
                     pex,
                     response_limiter.clone(),
+                    send_limiter.clone(),
                     byte_counters.clone(),
                 )
             }
@@ -900,6 +975,7 @@ impl Inner {
                         holder.vault.clone(),
                         &holder.pex,
                         holder.response_limiter.clone(),
+                        holder.send_limiter.clone(),
                         holder.stats_tracker.bytes.clone(),
                     );
                 }
@@ -908,7 +984,11 @@ impl Inner {
             });
 
             let stream = Instrumented::new(stream, self.stats_tracker.bytes.clone());
-            broker.add_connection(stream, permit);
+            broker.add_connection(
+                stream,
+                permit,
+                self.channel_streams_enabled.load(Ordering::Relaxed),
+            );
         }
 
         let _remover = MessageBrokerEntryGuard {
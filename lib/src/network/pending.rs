@@ -1,14 +1,16 @@
 use super::{
     constants::REQUEST_TIMEOUT,
     debug_payload::{DebugResponse, PendingDebugRequest},
+    index_sketch::IndexSketch,
     message::{Request, Response, ResponseDisambiguator},
+    request_window::RequestWindow,
 };
 use crate::{
     block_tracker::{BlockOffer, BlockPromise},
     collections::HashMap,
     crypto::{sign::PublicKey, CacheHash, Hash, Hashable},
     protocol::{Block, BlockId, InnerNodes, LeafNodes, MultiBlockPresence, UntrustedProof},
-    repository::RepositoryMonitor,
+    repository::{LinkMonitor, RepositoryMonitor},
     sync::delay_map::DelayMap,
 };
 use deadlock::BlockingMutex;
@@ -21,6 +23,12 @@ pub(crate) enum PendingRequest {
     RootNode(PublicKey, PendingDebugRequest),
     ChildNodes(Hash, ResponseDisambiguator, PendingDebugRequest),
     Block(BlockOffer, PendingDebugRequest),
+    IndexSketch(
+        Hash,
+        ResponseDisambiguator,
+        IndexSketch,
+        PendingDebugRequest,
+    ),
 }
 
 /// Response that's been prepared for processing.
@@ -35,6 +43,13 @@ pub(super) enum PreparedResponse {
     RootNodeError(PublicKey, DebugResponse),
     ChildNodesError(Hash, ResponseDisambiguator, DebugResponse),
     BlockError(BlockId, DebugResponse),
+    IndexDiff(
+        Hash,
+        ResponseDisambiguator,
+        Vec<(Hash, ResponseDisambiguator)>,
+        DebugResponse,
+    ),
+    IndexDiffError(Hash, ResponseDisambiguator, DebugResponse),
 }
 
 impl From<Response> for PreparedResponse {
@@ -58,6 +73,12 @@ impl From<Response> for PreparedResponse {
                 Self::ChildNodesError(hash, disambiguator, debug)
             }
             Response::BlockError(block_id, debug) => Self::BlockError(block_id, debug),
+            Response::IndexDiff(hash, disambiguator, parents, debug) => {
+                Self::IndexDiff(hash, disambiguator, parents, debug)
+            }
+            Response::IndexDiffError(hash, disambiguator, debug) => {
+                Self::IndexDiffError(hash, disambiguator, debug)
+            }
         }
     }
 }
@@ -89,6 +110,11 @@ pub(crate) enum IndexKey {
 /// - To know how many requests are in flight which in turn is used to indicate activity.
 /// - To track round trip time / latency.
 /// - To timeout block requests so that we can send them to other peers instead.
+/// - To limit the number of block requests in flight according to how fast the peer responds (see
+///   [`RequestWindow`]), so that slow peers don't hold on to blocks that faster peers could
+///   deliver sooner.
+/// - To suppress requests for child nodes that the peer announced it's going to push on its own
+///   (see [`Self::expect`]).
 ///
 /// Note that only block requests are currently timeouted. This is because we currently send block
 /// request to only one peer at a time. So if this peer was faulty, without the timeout it could
@@ -97,6 +123,7 @@ pub(crate) enum IndexKey {
 /// non-faulty ones should eventually be received.
 pub(super) struct PendingRequests {
     monitor: Arc<RepositoryMonitor>,
+    link_monitor: Arc<LinkMonitor>,
     index: PendingIndexRequests,
     block: Arc<PendingBlockRequests>,
     // This is to ensure the `run_expiration_tracker` task is destroyed with PendingRequests (as
@@ -107,12 +134,13 @@ pub(super) struct PendingRequests {
 }
 
 impl PendingRequests {
-    pub fn new(monitor: Arc<RepositoryMonitor>) -> Self {
+    pub fn new(monitor: Arc<RepositoryMonitor>, link_monitor: Arc<LinkMonitor>) -> Self {
         let index = PendingIndexRequests::default();
         let block = Arc::new(PendingBlockRequests::default());
 
         Self {
             monitor: monitor.clone(),
+            link_monitor,
             index,
             block: block.clone(),
             _expiration_tracker_task: scoped_task::spawn(run_expiration_tracker(monitor, block)),
@@ -125,10 +153,12 @@ impl PendingRequests {
                 .index
                 .try_insert(IndexKey::RootNode(writer_id))
                 .then(|| Request::RootNode(writer_id, debug.send()))?,
-            PendingRequest::ChildNodes(hash, disambiguator, debug) => self
-                .index
-                .try_insert(IndexKey::ChildNodes(hash, disambiguator))
-                .then(|| Request::ChildNodes(hash, disambiguator, debug.send()))?,
+            PendingRequest::ChildNodes(hash, disambiguator, debug) => {
+                let key = IndexKey::ChildNodes(hash, disambiguator);
+
+                (!self.index.is_expected(&key) && self.index.try_insert(key))
+                    .then(|| Request::ChildNodes(hash, disambiguator, debug.send()))?
+            }
             PendingRequest::Block(block_offer, debug) => {
                 let block_promise = block_offer.accept()?;
                 let block_id = *block_promise.block_id();
@@ -136,10 +166,16 @@ impl PendingRequests {
                     .try_insert(block_promise)
                     .then(|| Request::Block(block_id, debug.send()))?
             }
+            // The sketch stands for the request of the child nodes of the root, so it shares the
+            // key with it. This way the two are never in flight at the same time.
+            PendingRequest::IndexSketch(hash, disambiguator, sketch, debug) => self
+                .index
+                .try_insert(IndexKey::ChildNodes(hash, disambiguator))
+                .then(|| Request::IndexSketch(hash, disambiguator, sketch, debug.send()))?,
         };
 
         match request {
-            Request::RootNode(..) | Request::ChildNodes(..) => {
+            Request::RootNode(..) | Request::ChildNodes(..) | Request::IndexSketch(..) => {
                 self.monitor.index_requests_sent.increment(1);
                 self.monitor.index_requests_inflight.increment(1.0);
             }
@@ -152,6 +188,29 @@ impl PendingRequests {
         Some(request)
     }
 
+    /// Marks the given child nodes requests as expected: the peer is going to send their responses
+    /// without being asked. Until those responses are received and processed (see
+    /// [`Self::forget_received`]), any attempt to send those requests is suppressed. If a response
+    /// doesn't arrive within the request timeout, its request is no longer suppressed.
+    pub fn expect(&self, keys: impl IntoIterator<Item = (Hash, ResponseDisambiguator)>) {
+        self.index.expect(
+            keys.into_iter()
+                .map(|(hash, disambiguator)| IndexKey::ChildNodes(hash, disambiguator)),
+        )
+    }
+
+    /// Forgets the expected requests whose responses have already been received. Call this only
+    /// after the received responses have been processed, so that the follow-up requests they
+    /// trigger are still suppressed.
+    pub fn forget_received(&self) {
+        self.index.forget_received()
+    }
+
+    /// Waits until another block request can be sent without exceeding the request window.
+    pub async fn block_request_slot(&self) {
+        self.block.slot().await
+    }
+
     pub fn remove(&self, response: Response) -> PreparedResponse {
         let mut response = PreparedResponse::from(response);
 
@@ -177,7 +236,9 @@ impl PendingRequests {
                 .index
                 .remove(&IndexKey::ChildNodes(nodes.hash(), *disambiguator))
                 .map(|timestamp| (timestamp, ResponseKind::Index)),
-            PreparedResponse::ChildNodesError(hash, disambiguator, ..) => self
+            PreparedResponse::ChildNodesError(hash, disambiguator, ..)
+            | PreparedResponse::IndexDiff(hash, disambiguator, ..)
+            | PreparedResponse::IndexDiffError(hash, disambiguator, ..) => self
                 .index
                 .remove(&IndexKey::ChildNodes(*hash, *disambiguator))
                 .map(|timestamp| (timestamp, ResponseKind::Index)),
@@ -197,7 +258,9 @@ impl PendingRequests {
         };
 
         if let Some((timestamp, kind)) = status {
-            self.monitor.request_latency.record(timestamp.elapsed());
+            let latency = timestamp.elapsed();
+            self.monitor.request_latency.record(latency);
+            self.link_monitor.request_latency.record(latency);
 
             match kind {
                 ResponseKind::Index => self.monitor.index_requests_inflight.decrement(1.0),
@@ -223,6 +286,21 @@ impl Drop for PendingRequests {
 #[derive(Default)]
 struct PendingIndexRequests {
     map: BlockingMutex<HashMap<IndexKey, Instant>>,
+    // Requests whose responses the peer is going to send unsolicited.
+    expected: BlockingMutex<HashMap<IndexKey, Expected>>,
+}
+
+struct Expected {
+    since: Instant,
+    received: bool,
+}
+
+impl Expected {
+    // If the peer doesn't send the response within the request timeout it probably never will
+    // (e.g. it failed to push it or the response got lost), stop suppressing the request then.
+    fn is_expired(&self) -> bool {
+        self.since.elapsed() >= REQUEST_TIMEOUT
+    }
 }
 
 impl PendingIndexRequests {
@@ -237,16 +315,71 @@ impl PendingIndexRequests {
     }
 
     fn remove(&self, key: &IndexKey) -> Option<Instant> {
+        if let Some(expected) = self.expected.lock().unwrap().get_mut(key) {
+            expected.received = true;
+        }
+
         self.map.lock().unwrap().remove(key)
     }
+
+    fn expect(&self, keys: impl IntoIterator<Item = IndexKey>) {
+        let since = Instant::now();
+
+        self.expected
+            .lock()
+            .unwrap()
+            .extend(keys.into_iter().map(|key| {
+                (
+                    key,
+                    Expected {
+                        since,
+                        received: false,
+                    },
+                )
+            }));
+    }
+
+    fn is_expected(&self, key: &IndexKey) -> bool {
+        let mut expected = self.expected.lock().unwrap();
+
+        match expected.get(key) {
+            Some(entry) if entry.is_expired() => {
+                expected.remove(key);
+                false
+            }
+            Some(_) => true,
+            None => false,
+        }
+    }
+
+    fn forget_received(&self) {
+        self.expected
+            .lock()
+            .unwrap()
+            .retain(|_, expected| !expected.received && !expected.is_expired());
+    }
 }
 
-#[derive(Default)]
 struct PendingBlockRequests {
     map: BlockingMutex<DelayMap<BlockId, (Instant, BlockPromise)>>,
     // Notify when item is inserted into previously empty map. This restarts the expiration tracker
     // task.
     notify: Notify,
+    window: BlockingMutex<RequestWindow>,
+    // Notify when item is removed from the map (or the window grows) so another request can be
+    // sent.
+    slot_notify: Notify,
+}
+
+impl Default for PendingBlockRequests {
+    fn default() -> Self {
+        Self {
+            map: BlockingMutex::new(DelayMap::default()),
+            notify: Notify::new(),
+            window: BlockingMutex::new(RequestWindow::new()),
+            slot_notify: Notify::new(),
+        }
+    }
 }
 
 impl PendingBlockRequests {
@@ -268,7 +401,35 @@ impl PendingBlockRequests {
     }
 
     fn remove(&self, block_id: &BlockId) -> Option<(Instant, BlockPromise)> {
-        self.map.lock().unwrap().remove(block_id)
+        let (timestamp, block_promise) = self.map.lock().unwrap().remove(block_id)?;
+
+        self.window
+            .lock()
+            .unwrap()
+            .on_response(timestamp, Instant::now());
+        self.slot_notify.notify_waiters();
+
+        Some((timestamp, block_promise))
+    }
+
+    fn expire(&self, timestamp: Instant) {
+        self.window
+            .lock()
+            .unwrap()
+            .on_timeout(timestamp, Instant::now());
+        self.slot_notify.notify_waiters();
+    }
+
+    async fn slot(&self) {
+        loop {
+            let notified = self.slot_notify.notified();
+
+            if self.map.lock().unwrap().len() < self.window.lock().unwrap().limit() {
+                break;
+            }
+
+            notified.await;
+        }
     }
 }
 
@@ -283,7 +444,8 @@ async fn run_expiration_tracker(
     loop {
         let notified = pending.notify.notified();
 
-        while expired(&pending.map).await {
+        while let Some(timestamp) = expired(&pending.map).await {
+            pending.expire(timestamp);
             monitor.request_timeouts.increment(1);
             monitor.block_requests_inflight.decrement(1.0);
         }
@@ -295,9 +457,11 @@ async fn run_expiration_tracker(
 
 // Wait for the next expired request. This does not block the map so it can be inserted / removed
 // from while this is being awaited.
-// Returns `true` if a request expired and `false` if there are no more pending requests.
-async fn expired(map: &BlockingMutex<DelayMap<BlockId, (Instant, BlockPromise)>>) -> bool {
+// Returns the time the expired request was sent or `None` if there are no more pending requests.
+async fn expired(
+    map: &BlockingMutex<DelayMap<BlockId, (Instant, BlockPromise)>>,
+) -> Option<Instant> {
     future::poll_fn(|cx| Poll::Ready(ready!(map.lock().unwrap().poll_expired(cx))))
         .await
-        .is_some()
+        .map(|(_, (timestamp, _))| timestamp)
 }
@@ -0,0 +1,167 @@
+use std::sync::{
+    atomic::{AtomicU64, Ordering},
+    Arc,
+};
+use tokio::{
+    sync::Mutex,
+    time::{self, Duration, Instant},
+};
+
+/// How much unused bandwidth can be saved up for later, as a duration at the current rate. Allows
+/// short bursts (e.g. a batch of index messages) to go through without delay while keeping the
+/// average rate under the limit.
+const BURST: Duration = Duration::from_millis(250);
+
+/// Token bucket limiting the rate (in bytes per second) at which messages are sent.
+///
+/// Limiters can be chained: acquiring from a limiter acquires also from its parent. This is used
+/// to limit both the send rate of each repository and the total send rate of all of them.
+///
+/// Waiters are served in the order they started waiting. Each link sends one message at a time,
+/// so when the bandwidth runs out the links take turns and no repository can starve the others
+/// regardless of how much it has to send.
+#[derive(Clone)]
+pub(super) struct RateLimiter {
+    shared: Arc<Shared>,
+}
+
+struct Shared {
+    // Bytes per second. Zero means unlimited.
+    rate: AtomicU64,
+    bucket: Mutex<Bucket>,
+    parent: Option<RateLimiter>,
+}
+
+struct Bucket {
+    // Can go negative when a message bigger than the available tokens is sent. The following
+    // messages then have to wait until the debt is repaid.
+    tokens: f64,
+    updated_at: Instant,
+}
+
+impl RateLimiter {
+    /// Creates an unlimited rate limiter.
+    pub fn new(parent: Option<RateLimiter>) -> Self {
+        Self {
+            shared: Arc::new(Shared {
+                rate: AtomicU64::new(0),
+                bucket: Mutex::new(Bucket {
+                    tokens: 0.0,
+                    updated_at: Instant::now(),
+                }),
+                parent,
+            }),
+        }
+    }
+
+    /// Sets the max rate in bytes per second. `None` means unlimited.
+    pub fn set_rate(&self, rate: Option<u64>) {
+        self.shared.rate.store(rate.unwrap_or(0), Ordering::Relaxed);
+    }
+
+    pub fn rate(&self) -> Option<u64> {
+        Some(self.shared.rate.load(Ordering::Relaxed)).filter(|rate| *rate > 0)
+    }
+
+    /// Waits until `bytes` can be sent without exceeding the rate of this limiter and all its
+    /// ancestors.
+    pub async fn acquire(&self, bytes: usize) {
+        let mut limiter = Some(self);
+
+        while let Some(current) = limiter {
+            current.acquire_local(bytes).await;
+            limiter = current.shared.parent.as_ref();
+        }
+    }
+
+    async fn acquire_local(&self, bytes: usize) {
+        if self.rate().is_none() {
+            return;
+        }
+
+        let mut bucket = self.shared.bucket.lock().await;
+
+        loop {
+            // Reload the rate on every iteration because it might have been changed while waiting.
+            let Some(rate) = self.rate() else {
+                return;
+            };
+
+            let rate = rate as f64;
+            let now = Instant::now();
+            let elapsed = now.saturating_duration_since(bucket.updated_at);
+
+            bucket.tokens =
+                (bucket.tokens + elapsed.as_secs_f64() * rate).min(rate * BURST.as_secs_f64());
+            bucket.updated_at = now;
+
+            if bucket.tokens >= 0.0 {
+                bucket.tokens -= bytes as f64;
+                return;
+            }
+
+            // Cap the wait so that a rate increase takes effect reasonably soon.
+            let wait = Duration::from_secs_f64(-bucket.tokens / rate).min(Duration::from_secs(1));
+            time::sleep(wait).await;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[tokio::test(start_paused = true)]
+    async fn unlimited() {
+        let limiter = RateLimiter::new(None);
+        let start = Instant::now();
+
+        for _ in 0..100 {
+            limiter.acquire(1024 * 1024).await;
+        }
+
+        assert_eq!(start.elapsed(), Duration::ZERO);
+    }
+
+    #[tokio::test(start_paused = true)]
+    async fn limited() {
+        let limiter = RateLimiter::new(None);
+        limiter.set_rate(Some(1000));
+
+        let start = Instant::now();
+
+        for _ in 0..11 {
+            limiter.acquire(100).await;
+        }
+
+        // The first message goes through immediately (the bucket starts empty but not in debt),
+        // the remaining 1000 bytes take one second.
+        let elapsed = start.elapsed();
+        assert!(elapsed >= Duration::from_millis(900), "{elapsed:?}");
+        assert!(elapsed <= Duration::from_millis(1100), "{elapsed:?}");
+    }
+
+    #[tokio::test(start_paused = true)]
+    async fn parent_limits_children() {
+        let parent = RateLimiter::new(None);
+        parent.set_rate(Some(1000));
+
+        let child_a = RateLimiter::new(Some(parent.clone()));
+        let child_b = RateLimiter::new(Some(parent.clone()));
+
+        let start = Instant::now();
+
+        let send = |limiter: RateLimiter| async move {
+            for _ in 0..10 {
+                limiter.acquire(100).await;
+            }
+        };
+
+        tokio::join!(send(child_a), send(child_b));
+
+        // Both children together are limited by the parent rate.
+        let elapsed = start.elapsed();
+        assert!(elapsed >= Duration::from_millis(1800), "{elapsed:?}");
+        assert!(elapsed <= Duration::from_millis(2100), "{elapsed:?}");
+    }
+}
@@ -15,6 +15,15 @@ pub enum Stream {
 }
 
 impl Stream {
+    /// Handle for opening additional streams on the same connection. Only QUIC connections support
+    /// them.
+    pub fn uni_streams(&self) -> Option<quic::UniStreams> {
+        match self {
+            Stream::Tcp(_) => None,
+            Stream::Quic(con) => Some(con.uni_streams()),
+        }
+    }
+
     pub fn into_split(self) -> (OwnedReadHalf, OwnedWriteHalf) {
         match self {
             Stream::Tcp(con) => {
@@ -90,6 +99,8 @@ impl AsyncWrite for Stream {
 pub enum OwnedReadHalf {
     Tcp(tcp::OwnedReadHalf),
     Quic(quic::OwnedReadHalf),
+    // Additional unidirectional stream of a QUIC connection.
+    QuicUni(quic::RecvStream),
 }
 
 impl AsyncRead for OwnedReadHalf {
@@ -101,6 +112,7 @@ impl AsyncRead for OwnedReadHalf {
         match self.get_mut() {
             OwnedReadHalf::Tcp(rx) => Pin::new(rx).poll_read(cx, buf),
             OwnedReadHalf::Quic(rx) => Pin::new(rx).poll_read(cx, buf),
+            OwnedReadHalf::QuicUni(rx) => Pin::new(rx).poll_read(cx, buf),
         }
     }
 }
@@ -108,6 +120,8 @@ impl AsyncRead for OwnedReadHalf {
 pub enum OwnedWriteHalf {
     Tcp(tcp::OwnedWriteHalf),
     Quic(quic::OwnedWriteHalf),
+    // Additional unidirectional stream of a QUIC connection.
+    QuicUni(quic::SendStream),
 }
 
 impl AsyncWrite for OwnedWriteHalf {
@@ -119,6 +133,7 @@ impl AsyncWrite for OwnedWriteHalf {
         match self.get_mut() {
             Self::Tcp(s) => Pin::new(s).poll_write(cx, buf),
             Self::Quic(s) => Pin::new(s).poll_write(cx, buf),
+            Self::QuicUni(s) => Pin::new(s).poll_write(cx, buf),
         }
     }
 
@@ -130,6 +145,7 @@ impl AsyncWrite for OwnedWriteHalf {
         match self.get_mut() {
             Self::Tcp(s) => Pin::new(s).poll_write_vectored(cx, bufs),
             Self::Quic(s) => Pin::new(s).poll_write_vectored(cx, bufs),
+            Self::QuicUni(s) => Pin::new(s).poll_write_vectored(cx, bufs),
         }
     }
 
@@ -137,6 +153,7 @@ impl AsyncWrite for OwnedWriteHalf {
         match self {
             Self::Tcp(s) => s.is_write_vectored(),
             Self::Quic(s) => s.is_write_vectored(),
+            Self::QuicUni(s) => s.is_write_vectored(),
         }
     }
 
@@ -144,6 +161,7 @@ impl AsyncWrite for OwnedWriteHalf {
         match self.get_mut() {
             Self::Tcp(s) => Pin::new(s).poll_flush(cx),
             Self::Quic(s) => Pin::new(s).poll_flush(cx),
+            Self::QuicUni(s) => Pin::new(s).poll_flush(cx),
         }
     }
 
@@ -151,6 +169,7 @@ impl AsyncWrite for OwnedWriteHalf {
         match self.get_mut() {
             Self::Tcp(s) => Pin::new(s).poll_shutdown(cx),
             Self::Quic(s) => Pin::new(s).poll_shutdown(cx),
+            Self::QuicUni(s) => Pin::new(s).poll_shutdown(cx),
         }
     }
 }
@@ -0,0 +1,161 @@
+use std::time::{Duration, Instant};
+
+/// Number of block requests allowed in flight to a newly connected peer.
+const INITIAL_SIZE: f64 = 32.0;
+const MIN_SIZE: f64 = 2.0;
+const MAX_SIZE: f64 = 1024.0;
+
+/// Factor the window is multiplied by when the round trip time indicates the requests are being
+/// queued somewhere (the peer is slower than our request rate).
+const DELAY_DECREASE: f64 = 0.7;
+/// Factor the window is multiplied by when a request timeouts.
+const TIMEOUT_DECREASE: f64 = 0.5;
+
+/// Round trip time greater than `QUEUEING_FACTOR * min_rtt + QUEUEING_SLACK` is considered to
+/// be caused by queueing. The slack absorbs the jitter caused by batching on both sides, which
+/// would otherwise dominate on low latency links.
+const QUEUEING_FACTOR: u32 = 2;
+const QUEUEING_SLACK: Duration = Duration::from_millis(50);
+
+/// The min round trip time is forgotten after this long, so that changes in the route (or the
+/// peer load) are eventually picked up.
+const MIN_RTT_LIFETIME: Duration = Duration::from_secs(10);
+
+/// Congestion controlled limit of the number of block requests in flight to a single peer.
+///
+/// Uses AIMD: the window grows by one per response in slow start (doubling every round trip) and
+/// by one per window of responses afterwards. It shrinks multiplicatively when a request timeouts
+/// or when the round trip time grows well above the minimum observed one (delay based signal, as
+/// in BBR / Vegas) which happens long before slow peers start timeouting. At most one decrease
+/// happens per round trip: responses to requests sent before the last decrease are ignored for
+/// that purpose.
+///
+/// Because all block responses have the same size, the response rate (and thus throughput) is
+/// fully determined by the window and the round trip time so no separate bandwidth estimate is
+/// needed.
+pub(super) struct RequestWindow {
+    size: f64,
+    slow_start_threshold: f64,
+    // Min observed round trip time and when it was observed.
+    min_rtt: Option<(Duration, Instant)>,
+    last_decrease: Option<Instant>,
+}
+
+impl RequestWindow {
+    pub fn new() -> Self {
+        Self {
+            size: INITIAL_SIZE,
+            slow_start_threshold: MAX_SIZE,
+            min_rtt: None,
+            last_decrease: None,
+        }
+    }
+
+    /// Max number of block requests that can be in flight.
+    pub fn limit(&self) -> usize {
+        self.size as usize
+    }
+
+    /// Records a response to a request sent at `sent_at`.
+    pub fn on_response(&mut self, sent_at: Instant, now: Instant) {
+        let rtt = now.saturating_duration_since(sent_at);
+        let min_rtt = self.update_min_rtt(rtt, now);
+
+        if rtt > min_rtt * QUEUEING_FACTOR + QUEUEING_SLACK {
+            self.decrease(sent_at, now, DELAY_DECREASE);
+        } else if self.size < self.slow_start_threshold {
+            self.size = (self.size + 1.0).min(MAX_SIZE);
+        } else {
+            self.size = (self.size + 1.0 / self.size).min(MAX_SIZE);
+        }
+    }
+
+    /// Records a timeout of a request sent at `sent_at`.
+    pub fn on_timeout(&mut self, sent_at: Instant, now: Instant) {
+        self.decrease(sent_at, now, TIMEOUT_DECREASE);
+    }
+
+    fn decrease(&mut self, sent_at: Instant, now: Instant, factor: f64) {
+        if self
+            .last_decrease
+            .map(|last_decrease| sent_at < last_decrease)
+            .unwrap_or(false)
+        {
+            return;
+        }
+
+        self.size = (self.size * factor).max(MIN_SIZE);
+        self.slow_start_threshold = self.size;
+        self.last_decrease = Some(now);
+    }
+
+    fn update_min_rtt(&mut self, rtt: Duration, now: Instant) -> Duration {
+        match &mut self.min_rtt {
+            Some((min_rtt, timestamp))
+                if *min_rtt <= rtt
+                    && now.saturating_duration_since(*timestamp) < MIN_RTT_LIFETIME => {}
+            min_rtt => *min_rtt = Some((rtt, now)),
+        }
+
+        // unwrap is OK because it's been set above.
+        self.min_rtt.unwrap().0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn grows_on_fast_responses() {
+        let mut window = RequestWindow::new();
+        let mut now = Instant::now();
+
+        for _ in 0..2000 {
+            let sent_at = now;
+            now += Duration::from_millis(1);
+            window.on_response(sent_at, now);
+        }
+
+        assert_eq!(window.limit(), MAX_SIZE as usize);
+    }
+
+    #[test]
+    fn shrinks_on_queueing_delay() {
+        let mut window = RequestWindow::new();
+        let start = Instant::now();
+
+        window.on_response(start, start + Duration::from_millis(100));
+        assert_eq!(window.limit(), INITIAL_SIZE as usize + 1);
+
+        // Queueing (rtt grew way above the min).
+        let now = start + Duration::from_secs(1);
+        window.on_response(now - Duration::from_millis(500), now);
+        let size = window.limit();
+        assert!(size < INITIAL_SIZE as usize);
+
+        // Responses to requests sent before the decrease don't decrease it again.
+        let later = now + Duration::from_millis(10);
+        window.on_response(now - Duration::from_millis(400), later);
+        assert_eq!(window.limit(), size);
+    }
+
+    #[test]
+    fn shrinks_on_timeouts_down_to_min() {
+        let mut window = RequestWindow::new();
+        let mut now = Instant::now();
+
+        for _ in 0..20 {
+            now += Duration::from_secs(1);
+            window.on_timeout(now, now);
+        }
+
+        assert_eq!(window.limit(), MIN_SIZE as usize);
+
+        // Congestion avoidance (no slow start) after a decrease.
+        let sent_at = now;
+        now += Duration::from_millis(1);
+        window.on_response(sent_at, now);
+        assert_eq!(window.limit(), MIN_SIZE as usize);
+    }
+}
@@ -1,18 +1,22 @@
 use super::{
     constants::{INTEREST_TIMEOUT, MAX_UNCHOKED_DURATION},
     debug_payload::{DebugRequest, DebugResponse},
+    index_sketch::{self, IndexSketch},
     message::{Content, Request, Response, ResponseDisambiguator},
 };
 use crate::{
+    collections::HashMap,
     crypto::{sign::PublicKey, Hash},
     error::{Error, Result},
     event::{Event, Payload},
-    protocol::{BlockContent, BlockId, RootNode, RootNodeFilter},
+    protocol::{BlockContent, BlockId, MultiBlockPresence, RootNode, RootNodeFilter},
     repository::Vault,
     store,
 };
+use deadlock::BlockingMutex;
 use futures_util::TryStreamExt;
-use std::sync::Arc;
+use lru::LruCache;
+use std::{num::NonZeroUsize, sync::Arc};
 use tokio::{
     select,
     sync::{
@@ -23,6 +27,18 @@ use tokio::{
 };
 use tracing::instrument;
 
+// Number of snapshots whose parent nodes are kept for answering index sketches. The peer sends one
+// sketch per branch on connect and possibly retries it once with a bigger sketch, so this needs to
+// cover only the branches currently being reconciled.
+const SKETCH_CACHE_CAPACITY: NonZeroUsize = match NonZeroUsize::new(8) {
+    Some(capacity) => capacity,
+    None => unreachable!(),
+};
+
+// All parent nodes of a snapshot by their sketch keys (see `index_sketch::node_key`), together
+// with their layers. The root is on layer zero.
+type SketchParents = HashMap<u64, (usize, Hash, ResponseDisambiguator)>;
+
 pub(crate) struct Server {
     inner: Inner,
     request_rx: mpsc::Receiver<Request>,
@@ -44,6 +60,7 @@ impl Server {
                 response_tx,
                 content_tx,
                 response_limiter,
+                sketch_cache: BlockingMutex::new(LruCache::new(SKETCH_CACHE_CAPACITY)),
             },
             request_rx,
             response_rx,
@@ -66,6 +83,10 @@ struct Inner {
     response_tx: mpsc::Sender<Response>,
     content_tx: mpsc::UnboundedSender<Content>,
     response_limiter: Arc<Semaphore>,
+    // Parent nodes of the recently sketched snapshots, so that a repeated sketch of the same
+    // snapshot doesn't load all its inner nodes again. Snapshots are identified by their root hash
+    // (and are thus immutable) so the cache never needs to be invalidated.
+    sketch_cache: BlockingMutex<LruCache<(Hash, ResponseDisambiguator), Arc<SketchParents>>>,
 }
 
 impl Inner {
@@ -100,6 +121,10 @@ impl Inner {
                 self.handle_child_nodes(hash, disambiguator, debug).await
             }
             Request::Block(block_id, debug) => self.handle_block(block_id, debug).await,
+            Request::IndexSketch(hash, disambiguator, sketch, debug) => {
+                self.handle_index_sketch(hash, disambiguator, sketch, debug)
+                    .await
+            }
         }
     }
 
@@ -188,6 +213,154 @@ impl Inner {
         Ok(())
     }
 
+    #[instrument(skip(self, sketch, debug), fields(sketch_len = sketch.len()), err(Debug))]
+    async fn handle_index_sketch(
+        &self,
+        root_hash: Hash,
+        disambiguator: ResponseDisambiguator,
+        mut sketch: IndexSketch,
+        debug: DebugRequest,
+    ) -> Result<()> {
+        let debug = debug.begin_reply();
+
+        if !sketch.is_valid() {
+            tracing::trace!("invalid sketch");
+            self.enqueue_response(Response::IndexDiffError(
+                root_hash,
+                disambiguator,
+                debug.send(),
+            ))
+            .await;
+            return Ok(());
+        }
+
+        // Using a transaction so that the children of the parent nodes are all loaded from the same
+        // state of the store.
+        let mut tx = self.vault.store().begin_read().await?;
+
+        let cached = self
+            .sketch_cache
+            .lock()
+            .unwrap()
+            .get(&(root_hash, disambiguator))
+            .cloned();
+
+        let parents = if let Some(parents) = cached {
+            parents
+        } else {
+            let mut parents = SketchParents::default();
+            parents.insert(
+                index_sketch::node_key(&root_hash, &disambiguator),
+                (0, root_hash, disambiguator),
+            );
+
+            let mut nodes = tx.load_descendant_inner_nodes(&root_hash);
+
+            while let Some((layer, node)) = nodes.try_next().await? {
+                let disambiguator = ResponseDisambiguator::new(node.summary.block_presence);
+                parents.insert(
+                    index_sketch::node_key(&node.hash, &disambiguator),
+                    (layer + 1, node.hash, disambiguator),
+                );
+            }
+
+            drop(nodes);
+
+            let parents = Arc::new(parents);
+
+            if parents.len() > 1 {
+                self.sketch_cache
+                    .lock()
+                    .unwrap()
+                    .put((root_hash, disambiguator), parents.clone());
+            }
+
+            parents
+        };
+
+        if parents.len() == 1 {
+            tracing::trace!("snapshot not found");
+            drop(tx);
+            self.enqueue_response(Response::ChildNodesError(
+                root_hash,
+                disambiguator,
+                debug.send(),
+            ))
+            .await;
+            return Ok(());
+        }
+
+        for key in parents.keys() {
+            sketch.remove(*key);
+        }
+
+        // The keys we removed but the peer didn't insert are the parents whose children the peer
+        // is missing or has outdated.
+        let difference = match sketch.decode() {
+            Some(difference) if difference.removed.len() <= index_sketch::MAX_DIFF_LEN => {
+                difference
+            }
+            _ => {
+                tracing::trace!("index diff too big");
+                drop(tx);
+                self.enqueue_response(Response::IndexDiffError(
+                    root_hash,
+                    disambiguator,
+                    debug.send(),
+                ))
+                .await;
+                return Ok(());
+            }
+        };
+
+        // Parents must be sent before their children, otherwise the peer would drop the children.
+        let mut diff: Vec<_> = difference
+            .removed
+            .iter()
+            .filter_map(|key| parents.get(key))
+            .copied()
+            .collect();
+        diff.sort_by_key(|(layer, ..)| *layer);
+
+        let mut announced = Vec::with_capacity(diff.len());
+        let mut responses = Vec::with_capacity(diff.len());
+
+        for (_, hash, disambiguator) in diff {
+            // At most one of these will be non-empty.
+            let inner_nodes = tx.load_inner_nodes(&hash).await?;
+            let leaf_nodes = tx.load_leaf_nodes(&hash).await?;
+
+            let response = if !inner_nodes.is_empty() {
+                Response::InnerNodes(inner_nodes, disambiguator, debug.clone().send())
+            } else if !leaf_nodes.is_empty() {
+                Response::LeafNodes(leaf_nodes, disambiguator, debug.clone().send())
+            } else {
+                continue;
+            };
+
+            announced.push((hash, disambiguator));
+            responses.push(response);
+        }
+
+        drop(tx);
+
+        tracing::trace!(len = announced.len(), "index diff found");
+
+        self.enqueue_response(Response::IndexDiff(
+            root_hash,
+            disambiguator,
+            announced,
+            debug.send(),
+        ))
+        .await;
+
+        for response in responses {
+            self.enqueue_response(response).await;
+        }
+
+        Ok(())
+    }
+
     #[instrument(skip(self, debug), err(Debug))]
     async fn handle_block(&self, block_id: BlockId, debug: DebugRequest) -> Result<()> {
         let debug = debug.begin_reply();
@@ -222,38 +395,70 @@ impl Inner {
     }
 
     async fn handle_events(&self, event_rx: &mut broadcast::Receiver<Event>) -> Result<()> {
+        let mut notifications = RootNodeNotifications::default();
+
         // Initially notify the peer about all root nodes we have.
-        self.handle_unknown_event().await?;
+        self.handle_unknown_event(&mut notifications).await?;
 
         // Then keep notifying every change.
         loop {
-            match event_rx.recv().await {
-                Ok(Event { payload, .. }) => match payload {
-                    Payload::SnapshotApproved(branch_id) => {
-                        self.handle_branch_changed_event(branch_id).await?
-                    }
-                    Payload::BlockReceived(block_id) => {
-                        self.handle_block_received_event(block_id).await?;
+            let deadline = notifications.next_deadline();
+
+            select! {
+                event = event_rx.recv() => match event {
+                    Ok(Event { payload, .. }) => match payload {
+                        Payload::SnapshotApproved(branch_id) => {
+                            self.handle_branch_changed_event(branch_id, &mut notifications)
+                                .await?
+                        }
+                        Payload::BlockReceived(block_id) => {
+                            self.handle_block_received_event(block_id).await?;
+                        }
+                        Payload::SnapshotRejected(_) | Payload::MaintenanceCompleted => continue,
+                    },
+                    Err(RecvError::Lagged(_)) => {
+                        self.handle_unknown_event(&mut notifications).await?
                     }
-                    Payload::SnapshotRejected(_) | Payload::MaintenanceCompleted => continue,
+                    Err(RecvError::Closed) => return Ok(()),
                 },
-                Err(RecvError::Lagged(_)) => self.handle_unknown_event().await?,
-                Err(RecvError::Closed) => return Ok(()),
+                _ = time::sleep_until(deadline.unwrap_or_else(Instant::now)),
+                    if deadline.is_some() =>
+                {
+                    for branch_id in notifications.take_due(Instant::now()) {
+                        self.send_latest_root_node(branch_id, &mut notifications)
+                            .await?;
+                    }
+                }
             }
         }
     }
 
-    async fn handle_branch_changed_event(&self, branch_id: PublicKey) -> Result<()> {
-        let root_node = match self.load_root_node(&branch_id).await {
-            Ok(node) => node,
-            Err(Error::Store(store::Error::BranchNotFound)) => {
-                // branch was removed after the notification was fired.
+    async fn handle_branch_changed_event(
+        &self,
+        branch_id: PublicKey,
+        notifications: &mut RootNodeNotifications,
+    ) -> Result<()> {
+        if notifications.is_scheduled(&branch_id) {
+            // Coalesced with the already scheduled notification which will send the latest root
+            // node at the time it's due.
+            self.vault.monitor.root_nodes_suppressed.increment(1);
+            return Ok(());
+        }
+
+        // Send the first change immediately but delay the subsequent rapid changes so that at
+        // most one notification per branch is sent during the debounce interval.
+        let debounce = self.vault.root_node_debounce();
+
+        if let Some(sent_at) = notifications.sent_at(&branch_id) {
+            let deadline = sent_at + debounce;
+
+            if deadline > Instant::now() {
+                notifications.schedule(branch_id, deadline);
                 return Ok(());
             }
-            Err(error) => return Err(error),
-        };
+        }
 
-        self.send_root_node(root_node).await
+        self.send_latest_root_node(branch_id, notifications).await
     }
 
     async fn handle_block_received_event(&self, block_id: BlockId) -> Result<()> {
@@ -262,16 +467,39 @@ impl Inner {
         Ok(())
     }
 
-    async fn handle_unknown_event(&self) -> Result<()> {
+    async fn handle_unknown_event(&self, notifications: &mut RootNodeNotifications) -> Result<()> {
+        // We don't know which branches changed, but we know what we've already sent so only the
+        // root nodes the peer doesn't have yet are actually sent.
         let root_nodes = self.load_root_nodes().await?;
         for root_node in root_nodes {
-            self.send_root_node(root_node).await?;
+            self.send_root_node(root_node, notifications).await?;
         }
 
         Ok(())
     }
 
-    async fn send_root_node(&self, root_node: RootNode) -> Result<()> {
+    async fn send_latest_root_node(
+        &self,
+        branch_id: PublicKey,
+        notifications: &mut RootNodeNotifications,
+    ) -> Result<()> {
+        let root_node = match self.load_root_node(&branch_id).await {
+            Ok(node) => node,
+            Err(Error::Store(store::Error::BranchNotFound)) => {
+                // branch was removed after the notification was fired.
+                return Ok(());
+            }
+            Err(error) => return Err(error),
+        };
+
+        self.send_root_node(root_node, notifications).await
+    }
+
+    async fn send_root_node(
+        &self,
+        root_node: RootNode,
+        notifications: &mut RootNodeNotifications,
+    ) -> Result<()> {
         if !root_node.summary.state.is_approved() {
             // send only approved snapshots
             return Ok(());
@@ -282,6 +510,16 @@ impl Inner {
             return Ok(());
         }
 
+        if !notifications.record(
+            root_node.proof.writer_id,
+            root_node.proof.hash,
+            root_node.summary.block_presence,
+        ) {
+            // The peer already has this exact root node from us.
+            self.vault.monitor.root_nodes_suppressed.increment(1);
+            return Ok(());
+        }
+
         tracing::trace!(
             branch_id = ?root_node.proof.writer_id,
             hash = ?root_node.proof.hash,
@@ -366,3 +604,73 @@ impl Inner {
         }
     }
 }
+
+/// Keeps track of the unsolicited root nodes sent to the peer and of the branch change
+/// notifications delayed to be coalesced.
+#[derive(Default)]
+struct RootNodeNotifications {
+    // Hash and block presence of the last root node of each branch sent to the peer and when it
+    // was sent.
+    sent: HashMap<PublicKey, (Hash, MultiBlockPresence, Instant)>,
+    // Branches whose notification is delayed and when it's due.
+    scheduled: HashMap<PublicKey, Instant>,
+}
+
+impl RootNodeNotifications {
+    fn sent_at(&self, branch_id: &PublicKey) -> Option<Instant> {
+        self.sent.get(branch_id).map(|(_, _, sent_at)| *sent_at)
+    }
+
+    fn is_scheduled(&self, branch_id: &PublicKey) -> bool {
+        self.scheduled.contains_key(branch_id)
+    }
+
+    fn schedule(&mut self, branch_id: PublicKey, deadline: Instant) {
+        self.scheduled.insert(branch_id, deadline);
+    }
+
+    fn next_deadline(&self) -> Option<Instant> {
+        self.scheduled.values().min().copied()
+    }
+
+    /// Removes and returns the branches whose notification is due.
+    fn take_due(&mut self, now: Instant) -> Vec<PublicKey> {
+        let due: Vec<_> = self
+            .scheduled
+            .iter()
+            .filter(|(_, deadline)| **deadline <= now)
+            .map(|(branch_id, _)| *branch_id)
+            .collect();
+
+        for branch_id in &due {
+            self.scheduled.remove(branch_id);
+        }
+
+        due
+    }
+
+    /// Records that the given root node is being sent. Returns `false` if the same root node has
+    /// already been sent before, in which case it doesn't need to be sent again.
+    fn record(
+        &mut self,
+        branch_id: PublicKey,
+        hash: Hash,
+        block_presence: MultiBlockPresence,
+    ) -> bool {
+        // Whatever was scheduled is superseded by this one.
+        self.scheduled.remove(&branch_id);
+
+        match self.sent.get(&branch_id) {
+            Some((sent_hash, sent_block_presence, _))
+                if *sent_hash == hash && *sent_block_presence == block_presence =>
+            {
+                false
+            }
+            _ => {
+                self.sent
+                    .insert(branch_id, (hash, block_presence, Instant::now()));
+                true
+            }
+        }
+    }
+}
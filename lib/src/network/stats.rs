@@ -151,6 +151,10 @@ impl<T> Instrumented<T> {
     pub fn counters(&self) -> &ByteCounters {
         &self.counters
     }
+
+    pub fn shared_counters(&self) -> &Arc<ByteCounters> {
+        &self.counters
+    }
 }
 
 impl<T> AsyncRead for Instrumented<T>
@@ -12,7 +12,7 @@ use crate::{
     protocol::{
         test_utils::Snapshot, Block, BlockId, Bump, RepositoryId, RootNode, SingleBlockPresence,
     },
-    repository::{RepositoryMonitor, Vault},
+    repository::{LinkMonitor, RepositoryMonitor, Vault},
     store::{Changeset, SnapshotWriter},
     test_utils,
     version_vector::VersionVector,
@@ -399,6 +399,151 @@ async fn failed_block_other_peer() {
     }
 }
 
+// Test that after reconnecting, the changes made to a snapshot while disconnected are received all
+// at once in response to a single index sketch instead of by walking the index node by node.
+#[tokio::test]
+async fn reconcile_index_after_reconnect() {
+    test_utils::init_log();
+
+    let mut rng = StdRng::seed_from_u64(0);
+
+    let write_keys = Keypair::generate(&mut rng);
+    let (_a_base_dir, a_vault, a_choker, a_id) = create_repository(&mut rng, &write_keys).await;
+    let (_b_base_dir, b_vault, _, _) = create_repository(&mut rng, &write_keys).await;
+
+    let snapshot = Snapshot::generate(&mut rng, 64);
+    save_snapshot(&a_vault, a_id, &write_keys, &snapshot).await;
+    save_blocks(&a_vault, &snapshot).await;
+
+    // First connection. B has no previous snapshot to reconcile against so it walks the index.
+    let mut server = create_server(a_vault.clone(), a_choker.clone());
+    let mut client = create_client(b_vault.clone());
+    simulate_connection_until(&mut server, &mut client, async {
+        wait_until_snapshots_in_sync(&a_vault, a_id, &b_vault).await;
+
+        for id in snapshot.blocks().keys() {
+            wait_until_block_exists(&b_vault, id).await;
+        }
+    })
+    .await;
+    drop(server);
+    drop(client);
+
+    // Modify the snapshot while disconnected.
+    create_changeset(&mut rng, &a_vault, &a_id, &write_keys, 2).await;
+
+    // Second connection. Count the index requests sent by B.
+    let (mut server, mut server_send_rx, server_recv_tx) = create_server(a_vault.clone(), a_choker);
+    let (mut client, mut client_send_rx, mut client_recv_tx) = create_client(b_vault.clone());
+
+    let mut sketch_requests = 0;
+    let mut child_nodes_requests = 0;
+
+    let client_to_server = async {
+        while let Some(content) = client_send_rx.recv().await {
+            let request = Request::from(content);
+
+            match &request {
+                Request::IndexSketch(..) => sketch_requests += 1,
+                Request::ChildNodes(..) => child_nodes_requests += 1,
+                Request::RootNode(..) | Request::Block(..) => (),
+            }
+
+            server_recv_tx.send(request).await.unwrap();
+        }
+    };
+
+    let mut server_to_client = Connection {
+        send_rx: &mut server_send_rx,
+        recv_tx: &mut client_recv_tx,
+    };
+
+    run_until(
+        async {
+            select! {
+                result = server.run() => result.unwrap(),
+                result = client.run() => result.unwrap(),
+                _ = client_to_server => panic!("connection closed prematurely"),
+                _ = server_to_client.run() => panic!("connection closed prematurely"),
+            }
+        },
+        wait_until_snapshots_in_sync(&a_vault, a_id, &b_vault),
+    )
+    .await;
+
+    assert_eq!(sketch_requests, 1);
+    assert_eq!(child_nodes_requests, 0);
+}
+
+// Rapid changes of a branch are coalesced into few root node notifications.
+#[tokio::test]
+async fn coalesce_branch_changes() {
+    test_utils::init_log();
+
+    let mut rng = StdRng::seed_from_u64(0);
+
+    let write_keys = Keypair::generate(&mut rng);
+    let (_a_base_dir, a_vault, a_choker, a_id) = create_repository(&mut rng, &write_keys).await;
+    let (_b_base_dir, b_vault, _, _) = create_repository(&mut rng, &write_keys).await;
+
+    a_vault.set_root_node_debounce(Duration::from_secs(1));
+
+    let snapshot = Snapshot::generate(&mut rng, 1);
+    save_snapshot(&a_vault, a_id, &write_keys, &snapshot).await;
+
+    let (mut server, mut server_send_rx, mut server_recv_tx) =
+        create_server(a_vault.clone(), a_choker);
+    let (mut client, mut client_send_rx, client_recv_tx) = create_client(b_vault.clone());
+
+    let mut root_node_responses = 0;
+
+    let server_to_client = async {
+        while let Some(content) = server_send_rx.recv().await {
+            let response = Response::from(content);
+
+            if matches!(response, Response::RootNode(..)) {
+                root_node_responses += 1;
+            }
+
+            client_recv_tx.send(response).await.unwrap();
+        }
+    };
+
+    let mut client_to_server = Connection {
+        send_rx: &mut client_send_rx,
+        recv_tx: &mut server_recv_tx,
+    };
+
+    let change_count = 10;
+
+    run_until(
+        async {
+            select! {
+                result = server.run() => result.unwrap(),
+                result = client.run() => result.unwrap(),
+                _ = server_to_client => panic!("connection closed prematurely"),
+                _ = client_to_server.run() => panic!("connection closed prematurely"),
+            }
+        },
+        async {
+            wait_until_snapshots_in_sync(&a_vault, a_id, &b_vault).await;
+
+            for _ in 0..change_count {
+                create_changeset(&mut rng, &a_vault, &a_id, &write_keys, 1).await;
+            }
+
+            wait_until_snapshots_in_sync(&a_vault, a_id, &b_vault).await;
+        },
+    )
+    .await;
+
+    // The initial root node and then at most the leading and trailing edge of the burst.
+    assert!(
+        root_node_responses <= 3,
+        "root_node_responses = {root_node_responses}"
+    );
+}
+
 async fn create_repository<R: Rng + CryptoRng>(
     rng: &mut R,
     write_keys: &Keypair,
@@ -640,7 +785,8 @@ fn create_server(repo: Vault, response_limiter: Arc<Semaphore>) -> ServerData {
 fn create_client(repo: Vault) -> ClientData {
     let (send_tx, send_rx) = mpsc::unbounded_channel();
     let (recv_tx, recv_rx) = mpsc::channel(CAPACITY);
-    let client = Client::new(repo, send_tx, recv_rx);
+    let link_monitor = Arc::new(LinkMonitor::new(&StateMonitor::make_root()));
+    let client = Client::new(repo, link_monitor, send_tx, recv_rx);
 
     (client, send_rx, recv_tx)
 }
@@ -30,7 +30,7 @@ pub(crate) use self::{
     inner_node::{get_bucket, InnerNode, InnerNodes, EMPTY_INNER_HASH, INNER_LAYER_COUNT},
     leaf_node::{LeafNode, LeafNodes, EMPTY_LEAF_HASH},
     locator::Locator,
-    proof::ProofError,
+    proof::{ProofCache, ProofError},
     root_node::{RootNodeFilter, RootNodeKind},
 };
 
@@ -6,9 +6,18 @@ use crate::{
     },
     version_vector::VersionVector,
 };
+use lru::LruCache;
 use serde::{Deserialize, Serialize};
-use std::ops::Deref;
+use std::{
+    num::NonZeroUsize,
+    ops::Deref,
+    sync::{Arc, Mutex},
+};
 use thiserror::Error;
+use tokio::task;
+
+/// Max number of proofs remembered by `ProofCache`.
+const PROOF_CACHE_CAPACITY: usize = 1024;
 
 /// Information that prove that a snapshot was created by a replica that has write access to the
 /// repository.
@@ -95,3 +104,129 @@ fn signature_material(writer_id: &PublicKey, version_vector: &VersionVector, has
 #[derive(Debug, Error)]
 #[error("proof is invalid")]
 pub struct ProofError(pub UntrustedProof);
+
+/// Cache of recently verified proofs, shared by all the peers of a repository.
+///
+/// The same root node is typically received many times: from every peer that has it, and again
+/// after every reconnect. Verifying a proof means checking its ed25519 signature, which is by far
+/// the most expensive part of handling a root node. With many writer branches this shows up as a
+/// noticeable CPU spike on reconnect, which this cache avoids.
+#[derive(Clone)]
+pub(crate) struct ProofCache {
+    // Signatures of the verified proofs by their signature material.
+    verified: Arc<Mutex<LruCache<Hash, Signature>>>,
+}
+
+impl ProofCache {
+    pub fn new() -> Self {
+        Self {
+            verified: Arc::new(Mutex::new(LruCache::new(
+                // unwrap is OK because the capacity is non-zero.
+                NonZeroUsize::new(PROOF_CACHE_CAPACITY).unwrap(),
+            ))),
+        }
+    }
+
+    /// Verifies the given proofs, returning the results in the same order. The proofs that are not
+    /// in the cache are verified all at once on a blocking thread so the caller is not held up by
+    /// the signature checks.
+    pub async fn verify(
+        &self,
+        repository_id: &RepositoryId,
+        proofs: Vec<UntrustedProof>,
+    ) -> Vec<Result<Proof, ProofError>> {
+        let mut results = Vec::with_capacity(proofs.len());
+        let mut uncached = Vec::new();
+
+        {
+            let mut verified = self.verified.lock().unwrap();
+
+            for (index, proof) in proofs.into_iter().enumerate() {
+                let material =
+                    signature_material(&proof.writer_id, &proof.version_vector, &proof.hash);
+
+                if verified.get(&material) == Some(&proof.signature) {
+                    results.push(Some(Ok(Proof(proof))));
+                } else {
+                    results.push(None);
+                    uncached.push((index, material, proof));
+                }
+            }
+        }
+
+        if uncached.is_empty() {
+            // unwrap is OK because all the results were cached.
+            return results.into_iter().map(Option::unwrap).collect();
+        }
+
+        let repository_id = *repository_id;
+        let uncached = task::spawn_blocking(move || {
+            uncached
+                .into_iter()
+                .map(|(index, material, proof)| (index, material, proof.verify(&repository_id)))
+                .collect::<Vec<_>>()
+        })
+        .await
+        .unwrap();
+
+        let mut verified = self.verified.lock().unwrap();
+
+        for (index, material, result) in uncached {
+            if let Ok(proof) = &result {
+                verified.put(material, proof.signature);
+            }
+
+            results[index] = Some(result);
+        }
+
+        // unwrap is OK because every result is either cached or has just been verified.
+        results.into_iter().map(Option::unwrap).collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::crypto::sign::Keypair;
+    use rand::{rngs::StdRng, SeedableRng};
+
+    #[tokio::test]
+    async fn verify_cached() {
+        let mut rng = StdRng::seed_from_u64(0);
+        let write_keys = Keypair::generate(&mut rng);
+        let repository_id = RepositoryId::from(write_keys.public_key());
+        let writer_id = PublicKey::generate(&mut rng);
+
+        let valid: UntrustedProof = Proof::new(
+            writer_id,
+            VersionVector::first(writer_id),
+            rand::random(),
+            &write_keys,
+        )
+        .into();
+
+        // Same content but signed with a different key.
+        let invalid: UntrustedProof = Proof::new(
+            valid.writer_id,
+            valid.version_vector.clone(),
+            valid.hash,
+            &Keypair::generate(&mut rng),
+        )
+        .into();
+
+        let cache = ProofCache::new();
+
+        for _ in 0..2 {
+            let results = cache
+                .verify(&repository_id, vec![invalid.clone(), valid.clone()])
+                .await;
+
+            assert!(results[0].is_err());
+            assert_eq!(results[1].as_ref().unwrap().hash, valid.hash);
+        }
+
+        // A cached valid proof doesn't make an invalid one with the same content valid.
+        let results = cache.verify(&repository_id, vec![invalid]).await;
+        assert!(results[0].is_err());
+    }
+}
@@ -1,5 +1,8 @@
 use super::{InnerNodes, LeafNodes};
-use crate::format::Hex;
+use crate::{
+    crypto::{Digest, Hashable},
+    format::Hex,
+};
 use serde::{Deserialize, Serialize};
 use sqlx::{
     encode::IsNull,
@@ -296,6 +299,12 @@ impl<'r> Decode<'r, Sqlite> for MultiBlockPresence {
     }
 }
 
+impl Hashable for MultiBlockPresence {
+    fn update_hash<S: Digest>(&self, state: &mut S) {
+        self.checksum().update_hash(state)
+    }
+}
+
 impl fmt::Debug for MultiBlockPresence {
     fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
         match self {
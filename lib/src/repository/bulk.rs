@@ -0,0 +1,89 @@
+//! Import/export of whole directory trees between the host filesystem and a repository.
+
+use super::Repository;
+use crate::{
+    directory::EntryType,
+    error::{Error, Result},
+};
+use camino::{Utf8Path, Utf8PathBuf};
+use futures_util::{stream, TryStreamExt};
+use std::path::{Path, PathBuf};
+use tokio::fs;
+
+/// Max number of files copied at the same time. Copying multiple files concurrently keeps all the
+/// cores busy encrypting and hashing the blocks while some of the files are waiting for their
+/// write transactions. A file being imported buffers at most `BATCH_SIZE` blocks before they are
+/// written to the store, so this also bounds the memory use.
+const CONCURRENCY: usize = 4;
+
+pub(super) async fn import(repo: &Repository, src: &Path, dst: &Utf8Path) -> Result<()> {
+    let mut dirs = vec![(src.to_owned(), dst.to_owned())];
+    let mut files = Vec::new();
+
+    // Create the directories first and collect the files to be copied.
+    while let Some((src_dir, dst_dir)) = dirs.pop() {
+        repo.create_directory(&dst_dir).await?;
+
+        let mut entries = fs::read_dir(&src_dir).await.map_err(Error::Reader)?;
+
+        while let Some(entry) = entries.next_entry().await.map_err(Error::Reader)? {
+            let name = entry
+                .file_name()
+                .into_string()
+                .map_err(|_| Error::NonUtf8FileName)?;
+            let file_type = entry.file_type().await.map_err(Error::Reader)?;
+
+            // Symlinks and special files are skipped.
+            if file_type.is_dir() {
+                dirs.push((entry.path(), dst_dir.join(name)));
+            } else if file_type.is_file() {
+                files.push((entry.path(), dst_dir.join(name)));
+            }
+        }
+    }
+
+    stream::iter(files.into_iter().map(Ok))
+        .try_for_each_concurrent(CONCURRENCY, |(src, dst)| import_file(repo, src, dst))
+        .await
+}
+
+pub(super) async fn export(repo: &Repository, src: &Utf8Path, dst: &Path) -> Result<()> {
+    let mut dirs = vec![(src.to_owned(), dst.to_owned())];
+    let mut files = Vec::new();
+
+    while let Some((src_dir, dst_dir)) = dirs.pop() {
+        fs::create_dir_all(&dst_dir).await.map_err(Error::Writer)?;
+
+        let dir = repo.open_directory(&src_dir).await?;
+
+        for entry in dir.entries() {
+            let name = entry.unique_name();
+            let paths = (src_dir.join(name.as_ref()), dst_dir.join(name.as_ref()));
+
+            match entry.entry_type() {
+                EntryType::File => files.push(paths),
+                EntryType::Directory => dirs.push(paths),
+            }
+        }
+    }
+
+    stream::iter(files.into_iter().map(Ok))
+        .try_for_each_concurrent(CONCURRENCY, |(src, dst)| export_file(repo, src, dst))
+        .await
+}
+
+async fn import_file(repo: &Repository, src: PathBuf, dst: Utf8PathBuf) -> Result<()> {
+    let mut src = fs::File::open(&src).await.map_err(Error::Reader)?;
+    let mut dst = repo.create_file(&dst).await?;
+
+    dst.copy_from_reader(&mut src).await?;
+    dst.flush().await
+}
+
+async fn export_file(repo: &Repository, src: Utf8PathBuf, dst: PathBuf) -> Result<()> {
+    let mut src = repo.open_file(&src).await?;
+    let mut dst = fs::File::create(&dst).await.map_err(Error::Writer)?;
+
+    src.copy_to_writer(&mut dst).await?;
+    dst.sync_all().await.map_err(Error::Writer)
+}
@@ -1,3 +1,4 @@
+use super::BlockStorage;
 use crate::{
     access_control::{
         Access, AccessSecrets, KeyAndSalt, LocalSecret, SetLocalSecret, WriteSecrets,
@@ -13,7 +14,11 @@ use crate::{
 };
 use rand::{rngs::OsRng, Rng};
 use sqlx::Row;
-use std::{borrow::Cow, fmt, time::Duration};
+use std::{
+    borrow::Cow,
+    fmt,
+    time::{Duration, SystemTime},
+};
 use tracing::instrument;
 use zeroize::Zeroize;
 
@@ -35,6 +40,11 @@ const READ_KEY_VALIDATOR: &[u8] = b"read_key_validator";
 
 const QUOTA: &[u8] = b"quota";
 const BLOCK_EXPIRATION: &[u8] = b"block_expiration";
+const BLOCK_STORAGE: &[u8] = b"block_storage";
+const BLOCK_DEDUPLICATION: &[u8] = b"block_deduplication";
+const PAGED_DIRECTORIES: &[u8] = b"paged_directories";
+const GC_FULL_PASS: &[u8] = b"gc_full_pass";
+const SCAN_POSITION: &[u8] = b"scan_position";
 
 // Support for data migrations.
 const DATA_VERSION: &[u8] = b"data_version";
@@ -726,6 +736,135 @@ pub(crate) mod block_expiration {
     }
 }
 
+// -------------------------------------------------------------------
+// Block storage
+// -------------------------------------------------------------------
+pub(crate) mod block_storage {
+    use super::*;
+
+    const FILES: &str = "files";
+
+    pub(crate) async fn get(conn: &mut db::Connection) -> Result<BlockStorage, StoreError> {
+        match get_public::<String>(conn, BLOCK_STORAGE).await?.as_deref() {
+            None => Ok(BlockStorage::Database),
+            Some(FILES) => Ok(BlockStorage::Files),
+            Some(_) => Err(StoreError::MalformedData),
+        }
+    }
+
+    pub(crate) async fn set(
+        tx: &mut db::WriteTransaction,
+        value: BlockStorage,
+    ) -> Result<(), StoreError> {
+        match value {
+            BlockStorage::Database => remove_public(tx, BLOCK_STORAGE).await,
+            BlockStorage::Files => set_public(tx, BLOCK_STORAGE, FILES).await,
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Block deduplication
+// -------------------------------------------------------------------
+pub(crate) mod block_deduplication {
+    use super::*;
+
+    pub(crate) async fn get(conn: &mut db::Connection) -> Result<bool, StoreError> {
+        Ok(get_public(conn, BLOCK_DEDUPLICATION)
+            .await?
+            .unwrap_or(false))
+    }
+
+    pub(crate) async fn set(tx: &mut db::WriteTransaction, value: bool) -> Result<(), StoreError> {
+        if value {
+            set_public(tx, BLOCK_DEDUPLICATION, true).await
+        } else {
+            remove_public(tx, BLOCK_DEDUPLICATION).await
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Paged directories
+// -------------------------------------------------------------------
+pub(crate) mod paged_directories {
+    use super::*;
+
+    pub(crate) async fn get(conn: &mut db::Connection) -> Result<bool, StoreError> {
+        Ok(get_public(conn, PAGED_DIRECTORIES).await?.unwrap_or(false))
+    }
+
+    pub(crate) async fn set(tx: &mut db::WriteTransaction, value: bool) -> Result<(), StoreError> {
+        if value {
+            set_public(tx, PAGED_DIRECTORIES, true).await
+        } else {
+            remove_public(tx, PAGED_DIRECTORIES).await
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Garbage collection
+// -------------------------------------------------------------------
+pub(crate) mod gc_full_pass {
+    use super::*;
+
+    /// Time the garbage collector last scheduled a check of all the blocks in the repository.
+    pub(crate) async fn get(conn: &mut db::Connection) -> Result<Option<SystemTime>, StoreError> {
+        Ok(get_public(conn, GC_FULL_PASS)
+            .await?
+            .map(|millis| SystemTime::UNIX_EPOCH + Duration::from_millis(millis)))
+    }
+
+    pub(crate) async fn set(
+        tx: &mut db::WriteTransaction,
+        value: SystemTime,
+    ) -> Result<(), StoreError> {
+        let millis = value
+            .duration_since(SystemTime::UNIX_EPOCH)
+            .unwrap_or_default()
+            .as_millis();
+
+        set_public(tx, GC_FULL_PASS, u64::try_from(millis).unwrap_or(u64::MAX)).await
+    }
+}
+
+// -------------------------------------------------------------------
+// Missing blocks scan
+// -------------------------------------------------------------------
+pub(crate) mod scan_position {
+    use super::*;
+
+    const SEPARATOR: &str = "/";
+
+    /// Path of the directory the missing blocks scan reached last. Empty means the root.
+    ///
+    /// The path is stored encrypted with the read key, so the names of the directories aren't
+    /// revealed to someone who has access to the database but not to the repository.
+    pub(crate) async fn get(
+        conn: &mut db::Connection,
+        read_key: &cipher::SecretKey,
+    ) -> Result<Vec<String>, StoreError> {
+        let value: Option<Vec<u8>> = get_secret_blob(conn, SCAN_POSITION, read_key).await?;
+
+        // The position is only a hint so if it can't be decoded (e.g., because it's been saved
+        // with a different key) the scan starts from the root.
+        Ok(value
+            .and_then(|value| String::from_utf8(value).ok())
+            .filter(|value| !value.is_empty())
+            .map(|value| value.split(SEPARATOR).map(ToOwned::to_owned).collect())
+            .unwrap_or_default())
+    }
+
+    pub(crate) async fn set(
+        tx: &mut db::WriteTransaction,
+        read_key: &cipher::SecretKey,
+        value: &[String],
+    ) -> Result<(), StoreError> {
+        set_secret_blob(tx, SCAN_POSITION, value.join(SEPARATOR), read_key).await
+    }
+}
+
 // -------------------------------------------------------------------
 // Data version
 // -------------------------------------------------------------------
@@ -1056,6 +1195,35 @@ mod tests {
         assert_ne!(b"world", &v);
     }
 
+    #[tokio::test(flavor = "multi_thread")]
+    async fn scan_position_is_encrypted() {
+        let (_base_dir, pool) = setup().await;
+        let mut tx = pool.begin_write().await.unwrap();
+
+        let read_key = cipher::SecretKey::random();
+        let position = vec!["secret".to_owned(), "dir".to_owned()];
+
+        scan_position::set(&mut tx, &read_key, &position)
+            .await
+            .unwrap();
+
+        assert_eq!(
+            scan_position::get(&mut tx, &read_key).await.unwrap(),
+            position
+        );
+
+        let public: Option<String> = get_public(&mut tx, SCAN_POSITION).await.unwrap();
+        assert_eq!(public, None);
+
+        let value: Vec<u8> = sqlx::query("SELECT value FROM metadata_secret WHERE name = ?")
+            .bind(SCAN_POSITION)
+            .fetch_one(&mut tx)
+            .await
+            .unwrap()
+            .get(0);
+        assert_ne!(value, b"secret/dir");
+    }
+
     #[tokio::test(flavor = "multi_thread")]
     async fn store_restore() {
         let accesses = [
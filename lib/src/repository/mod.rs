@@ -1,21 +1,28 @@
+mod bulk;
 mod credentials;
 mod metadata;
 mod monitor;
 mod params;
+mod root_cache;
 mod vault;
 mod worker;
 
 #[cfg(test)]
 mod tests;
 
-pub use self::{credentials::Credentials, metadata::Metadata, params::RepositoryParams};
+pub use self::{
+    credentials::Credentials,
+    metadata::Metadata,
+    params::{BlockStorage, RepositoryParams},
+};
 
 pub(crate) use self::{
     metadata::{data_version, quota},
-    monitor::RepositoryMonitor,
+    monitor::{LinkMonitor, RepositoryMonitor},
     vault::Vault,
 };
 
+use self::root_cache::{RootCache, RootKey};
 use crate::{
     access_control::{Access, AccessChange, AccessKeys, AccessMode, AccessSecrets, LocalSecret},
     block_tracker::RequestMode,
@@ -30,7 +37,7 @@ use crate::{
     joint_directory::{JointDirectory, JointEntryRef, MissingVersionStrategy},
     path,
     progress::Progress,
-    protocol::{RootNodeFilter, StorageSize, BLOCK_SIZE},
+    protocol::{RootNode, RootNodeFilter, StorageSize, BLOCK_SIZE},
     store,
     sync::stream::Throttle,
     version_vector::VersionVector,
@@ -42,7 +49,13 @@ use futures_util::{stream, StreamExt};
 use metrics::{NoopRecorder, Recorder};
 use scoped_task::ScopedJoinHandle;
 use state_monitor::StateMonitor;
-use std::{borrow::Cow, io, path::Path, pin::pin, sync::Arc};
+use std::{
+    borrow::Cow,
+    io, iter,
+    path::{Path, PathBuf},
+    pin::pin,
+    sync::{atomic::Ordering, Arc},
+};
 use tokio::{
     fs,
     sync::broadcast::{self, error::RecvError},
@@ -62,7 +75,7 @@ pub struct Repository {
 pub async fn delete(store: impl AsRef<Path>) -> io::Result<()> {
     // Sqlite database consists of up to three files: main db (always present), WAL and WAL-index.
     // Try to delete all of them even if any of them fail then return the first error (if any)
-    future::join_all(["", "-wal", "-shm"].into_iter().map(|suffix| {
+    let files = future::join_all(["", "-wal", "-shm"].into_iter().map(|suffix| {
         let mut path = store.as_ref().as_os_str().to_owned();
         path.push(suffix);
 
@@ -73,12 +86,25 @@ pub async fn delete(store: impl AsRef<Path>) -> io::Result<()> {
                 Err(error) => Err(error),
             }
         }
-    }))
-    .await
-    .into_iter()
-    .find_map(Result::err)
-    .map(Err)
-    .unwrap_or(Ok(()))
+    }));
+
+    // Block files (if the repository uses them).
+    let block_files = async {
+        match fs::remove_dir_all(store::block_files_dir(store.as_ref())).await {
+            Ok(()) => Ok(()),
+            Err(error) if error.kind() == io::ErrorKind::NotFound => Ok(()),
+            Err(error) => Err(error),
+        }
+    };
+
+    let (files, block_files) = future::join(files, block_files).await;
+
+    files
+        .into_iter()
+        .chain(iter::once(block_files))
+        .find_map(Result::err)
+        .map(Err)
+        .unwrap_or(Ok(()))
 }
 
 impl Repository {
@@ -94,6 +120,7 @@ impl Repository {
         let writer_id =
             metadata::get_or_generate_writer_id(&mut tx, local_keys.write.as_deref()).await?;
         metadata::set_device_id(&mut tx, &device_id).await?;
+        metadata::block_storage::set(&mut tx, params.block_storage()).await?;
 
         tx.commit().await?;
 
@@ -102,7 +129,9 @@ impl Repository {
             writer_id,
         };
 
-        Self::new(pool, credentials, monitor).init().await
+        Self::new(pool, credentials, monitor)
+            .init(params.block_files_dir())
+            .await
     }
 
     /// Opens an existing repository.
@@ -147,7 +176,9 @@ impl Repository {
 
         let credentials = Credentials { secrets, writer_id };
 
-        Self::new(pool, credentials, monitor).init().await
+        Self::new(pool, credentials, monitor)
+            .init(params.block_files_dir())
+            .await
     }
 
     fn new(pool: db::Pool, credentials: Credentials, monitor: RepositoryMonitor) -> Self {
@@ -158,9 +189,19 @@ impl Repository {
         }
     }
 
-    async fn init(self) -> Result<Self> {
+    async fn init(self, block_files_dir: Option<PathBuf>) -> Result<Self> {
         let credentials = self.credentials();
 
+        // Needs to be enabled before anything reads or writes blocks.
+        let block_storage =
+            metadata::block_storage::get(&mut *self.shared.vault.store().db().acquire().await?)
+                .await?;
+
+        if block_storage == BlockStorage::Files {
+            let dir = block_files_dir.ok_or(Error::OperationNotSupported)?;
+            self.shared.vault.store().enable_block_files(dir).await?;
+        }
+
         if let Some(keys) = credentials
             .secrets
             .write_secrets()
@@ -175,6 +216,17 @@ impl Repository {
 
         {
             let mut conn = self.shared.vault.store().db().acquire().await?;
+
+            self.shared.branch_shared.block_deduplication.store(
+                metadata::block_deduplication::get(&mut conn).await?,
+                Ordering::Relaxed,
+            );
+
+            self.shared.branch_shared.paged_directories.store(
+                metadata::paged_directories::get(&mut conn).await?,
+                Ordering::Relaxed,
+            );
+
             if let Some(block_expiration) = metadata::block_expiration::get(&mut conn).await? {
                 self.shared
                     .vault
@@ -190,7 +242,8 @@ impl Repository {
             "Repository opened"
         );
 
-        *self.worker_handle.lock().unwrap() = Some(spawn_worker(self.shared.clone()));
+        *self.worker_handle.lock().unwrap() =
+            Some(spawn_worker(self.shared.clone(), worker::START_DELAY));
 
         *self.progress_reporter_handle.lock().unwrap() = Some(scoped_task::spawn(
             report_sync_progress(self.shared.vault.clone())
@@ -487,6 +540,115 @@ impl Repository {
         self.shared.vault.block_expiration().await
     }
 
+    /// Enables or disables block deduplication. When enabled, blocks with the same content are
+    /// stored (and synced) only once, even when they are in different files or at different
+    /// positions in the same file. This saves space and bandwidth when the repository contains
+    /// copies of the same files or of their parts. Affects only blocks written after this call.
+    /// Default is disabled.
+    ///
+    /// Deduplication works on whole blocks at fixed offsets (there is no content-defined
+    /// chunking), so data that's shifted by an insert still changes all the following blocks.
+    ///
+    /// NOTE: Deduplicated blocks are encrypted convergently: blocks with the same plaintext have
+    /// the same ciphertext and id. This reveals which blocks have identical content (e.g. that two
+    /// files, or two versions of a file, share some of it) to anyone who can see the block ids,
+    /// including blind replicas (peers that store and sync the repository without having its read
+    /// key). Blind replicas still can't read the content, nor tell whether a block contains some
+    /// known plaintext, because the read key is part of the derivation.
+    ///
+    /// Anyone who holds the read key, however, can compute the id of any block-aligned part of a
+    /// known file and so confirm whether the repository contains it, from the block ids alone and
+    /// without downloading or decrypting anything. This includes former readers, since the read key
+    /// can't be changed, and anyone who can see the block ids of a replica (e.g. a blind replica
+    /// they run) and has obtained the read key.
+    ///
+    /// Don't enable this if the repository is replicated to peers that must not learn this.
+    pub async fn set_block_deduplication(&self, enabled: bool) -> Result<()> {
+        let mut tx = self.db().begin_write().await?;
+        metadata::block_deduplication::set(&mut tx, enabled).await?;
+        tx.commit().await?;
+
+        self.shared
+            .branch_shared
+            .block_deduplication
+            .store(enabled, Ordering::Relaxed);
+
+        Ok(())
+    }
+
+    /// Is block deduplication enabled?
+    pub fn is_block_deduplication_enabled(&self) -> bool {
+        self.shared
+            .branch_shared
+            .block_deduplication
+            .load(Ordering::Relaxed)
+    }
+
+    /// Enable or disable saving big directories in the paged format, where modifying an entry
+    /// rewrites only the part of the directory containing it instead of the whole directory.
+    /// Affects only directories saved after this call: when enabled, directories that don't fit
+    /// into a single block are converted to the paged format the next time they are modified; when
+    /// disabled, paged directories are converted back. Default is disabled.
+    ///
+    /// NOTE: Replicas running a version of this library older than the one which introduced the
+    /// paged format (`DIRECTORY_VERSION` 3) can't read directories stored in it. Enable this only
+    /// once all the replicas of the repository have been upgraded.
+    pub async fn set_paged_directories(&self, enabled: bool) -> Result<()> {
+        let mut tx = self.db().begin_write().await?;
+        metadata::paged_directories::set(&mut tx, enabled).await?;
+        tx.commit().await?;
+
+        self.shared
+            .branch_shared
+            .paged_directories
+            .store(enabled, Ordering::Relaxed);
+
+        Ok(())
+    }
+
+    /// Is saving directories in the paged format enabled?
+    pub fn is_paged_directories_enabled(&self) -> bool {
+        self.shared
+            .branch_shared
+            .paged_directories
+            .load(Ordering::Relaxed)
+    }
+
+    /// Set the memory budget (in bytes) of the cache of decrypted blocks shared by all open files
+    /// of this repository. Use zero to disable the cache. Default is 8 MiB.
+    pub fn set_block_cache_capacity(&self, capacity: u64) {
+        self.shared.vault.set_block_cache_capacity(capacity)
+    }
+
+    /// Get the memory budget (in bytes) of the decrypted block cache.
+    pub fn block_cache_capacity(&self) -> u64 {
+        self.shared.vault.block_cache_capacity()
+    }
+
+    /// Set the memory budget (in bytes) of the cache used to find the blocks of blobs in the
+    /// index. Snapshots that don't fit are evicted, least recently used first. Default is 32 MiB.
+    pub fn set_block_id_cache_capacity(&self, capacity: u64) {
+        self.shared.vault.set_block_id_cache_capacity(capacity)
+    }
+
+    /// Get the memory budget (in bytes) of the block id cache.
+    pub fn block_id_cache_capacity(&self) -> u64 {
+        self.shared.vault.block_id_cache_capacity()
+    }
+
+    /// Set the min interval between two notifications about changes of the same branch sent to a
+    /// peer. Changes made within the interval are coalesced into a single notification sent at its
+    /// end. This prevents flooding the peers when the repository is being modified rapidly (e.g.
+    /// when an app keeps appending to a file in it). Use zero to disable. Default is 500 ms.
+    pub fn set_root_node_debounce(&self, interval: Duration) {
+        self.shared.vault.set_root_node_debounce(interval)
+    }
+
+    /// Get the min interval between two notifications about changes of the same branch.
+    pub fn root_node_debounce(&self) -> Duration {
+        self.shared.vault.root_node_debounce()
+    }
+
     /// Get the total size of the data stored in this repository.
     pub async fn size(&self) -> Result<StorageSize> {
         self.shared.vault.size().await
@@ -578,6 +740,25 @@ impl Repository {
         Ok(())
     }
 
+    /// Imports the directory `src` on the host filesystem (including all its files and
+    /// subdirectories) into the directory `dst` (relative to the repository root) which is created
+    /// if it doesn't exist. Fails with `EntryExists` if any of the imported files already exist.
+    /// Symlinks and special files are skipped.
+    ///
+    /// Multiple files are imported concurrently, each written to the store in batches of up to
+    /// 64 MiB per transaction.
+    pub async fn import_directory<P: AsRef<Utf8Path>>(&self, src: &Path, dst: P) -> Result<()> {
+        bulk::import(self, src, dst.as_ref()).await
+    }
+
+    /// Exports the directory `src` (relative to the repository root, including all its files and
+    /// subdirectories) into the directory `dst` on the host filesystem which is created if it
+    /// doesn't exist. Existing files are overwritten. Concurrent versions of a file are exported
+    /// under their unique names.
+    pub async fn export_directory<P: AsRef<Utf8Path>>(&self, src: P, dst: &Path) -> Result<()> {
+        bulk::export(self, src.as_ref(), dst).await
+    }
+
     /// Looks up an entry by its path. The path must be relative to the repository root.
     /// If the entry exists, returns its `JointEntryType`, otherwise returns `EntryNotFound`.
     pub async fn lookup_type<P: AsRef<Utf8Path>>(&self, path: P) -> Result<EntryType> {
@@ -811,31 +992,48 @@ impl Repository {
     // Opens the root directory across all branches as JointDirectory.
     async fn root(&self) -> Result<JointDirectory> {
         let local_branch = self.local_branch()?;
-        let branches = self.shared.load_branches().await?;
+        let root_nodes = self.shared.load_root_nodes().await?;
+
+        self.shared.root_cache.retain(|branch_id| {
+            root_nodes
+                .iter()
+                .any(|node| node.proof.writer_id == *branch_id)
+        });
+
+        let mut branches = root_nodes
+            .iter()
+            .map(|node| {
+                Ok((
+                    self.shared.get_branch(node.proof.writer_id)?,
+                    Some(RootKey::new(node)),
+                ))
+            })
+            .collect::<Result<Vec<_>>>()?;
 
         // If we are writer and the local branch doesn't exist yet in the db we include it anyway.
         // This fixes a race condition when the local branch doesn't exist yet at the moment we
         // load the branches but is subsequently created by merging a remote branch and the remote
         // branch is then pruned.
-        let branches = if local_branch.keys().write().is_some()
+        if local_branch.keys().write().is_some()
             && branches
                 .iter()
-                .all(|branch| branch.id() != local_branch.id())
+                .all(|(branch, _)| branch.id() != local_branch.id())
         {
-            let mut branches = branches;
-            branches.push(local_branch.clone());
-            branches
-        } else {
+            branches.push((local_branch.clone(), None));
+        }
+
+        // Open the roots concurrently, there can be many branches.
+        let results = future::join_all(
             branches
-        };
+                .iter()
+                .map(|(branch, key)| self.shared.root_cache.open(branch, *key)),
+        )
+        .await;
 
-        let mut dirs = Vec::new();
+        let mut dirs = Vec::with_capacity(branches.len());
 
-        for branch in branches {
-            let dir = match branch
-                .open_root(DirectoryLocking::Enabled, DirectoryFallback::Enabled)
-                .await
-            {
+        for ((branch, _), result) in branches.iter().zip(results) {
+            let dir = match result {
                 Ok(dir) => dir,
                 Err(error @ Error::Store(store::Error::BranchNotFound)) => {
                     tracing::trace!(
@@ -962,7 +1160,10 @@ impl Repository {
             .set_request_mode(request_mode(&credentials.secrets));
 
         *self.shared.credentials.write().unwrap() = credentials;
-        *self.worker_handle.lock().unwrap() = Some(spawn_worker(self.shared.clone()));
+        // The cached roots use the old keys.
+        self.shared.root_cache.clear();
+        *self.worker_handle.lock().unwrap() =
+            Some(spawn_worker(self.shared.clone(), Duration::ZERO));
     }
 }
 
@@ -974,6 +1175,7 @@ struct Shared {
     vault: Vault,
     credentials: BlockingRwLock<Credentials>,
     branch_shared: BranchShared,
+    root_cache: RootCache,
 }
 
 impl Shared {
@@ -989,6 +1191,7 @@ impl Shared {
             vault,
             credentials: BlockingRwLock::new(credentials),
             branch_shared: BranchShared::new(),
+            root_cache: RootCache::new(),
         }
     }
 
@@ -1036,11 +1239,22 @@ impl Shared {
             .try_collect()
             .await
     }
+
+    async fn load_root_nodes(&self) -> Result<Vec<RootNode>> {
+        self.vault
+            .store()
+            .acquire_read()
+            .await?
+            .load_latest_approved_root_nodes()
+            .err_into()
+            .try_collect()
+            .await
+    }
 }
 
-fn spawn_worker(shared: Arc<Shared>) -> ScopedJoinHandle<()> {
+fn spawn_worker(shared: Arc<Shared>, start_delay: Duration) -> ScopedJoinHandle<()> {
     let span = shared.vault.monitor.span().clone();
-    scoped_task::spawn(worker::run(shared).instrument(span))
+    scoped_task::spawn(worker::run(shared, start_delay).instrument(span))
 }
 
 async fn report_sync_progress(vault: Vault) {
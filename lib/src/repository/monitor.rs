@@ -2,7 +2,7 @@ use btdht::InfoHash;
 use metrics::{
     Counter, Gauge, Histogram, Key, KeyName, Level, Metadata, Recorder, SharedString, Unit,
 };
-use state_monitor::{MonitoredValue, StateMonitor};
+use state_monitor::{metrics::MetricsRecorder, MonitoredValue, StateMonitor};
 use std::{
     fmt,
     future::Future,
@@ -34,11 +34,40 @@ pub(crate) struct RepositoryMonitor {
     pub request_latency: Histogram,
     // Total number of timeouted requests.
     pub request_timeouts: Counter,
+    // Number of received responses waiting to be processed, sampled every time the client starts
+    // processing them. Values close to `RESPONSE_BUFFER_SIZE` mean the client can't keep up.
+    pub response_queue_depth: Histogram,
 
     // Total number of responses sent.
     pub responses_sent: Counter,
     // Total number of responses received.
     pub responses_received: Counter,
+    // Total number of root node notifications not sent because they were coalesced with another
+    // change of the same branch or the peer already had them.
+    pub root_nodes_suppressed: Counter,
+
+    // Total number of block reads served from the decrypted block cache.
+    pub block_cache_hits: Counter,
+    // Total number of block reads that had to go to the db.
+    pub block_cache_misses: Counter,
+    // Time to decrypt a block read from the db.
+    pub block_decrypt_time: Histogram,
+    // Time to load the index of a snapshot into the block id cache.
+    pub block_id_cache_load_time: Histogram,
+
+    // Number of blocks tracked by the block expiration tracker.
+    pub block_expiration_tracked: Gauge,
+    // Estimated memory used by the block expiration tracker (in bytes).
+    pub block_expiration_memory: Gauge,
+    // Total number of blocks removed because they expired.
+    pub blocks_expired: Counter,
+
+    // Time to acquire a db connection for reading.
+    pub db_read_wait_time: Histogram,
+    // Time to begin a db write transaction, including waiting for the other writers.
+    pub db_write_wait_time: Histogram,
+    // Current number of tasks waiting to begin a db write transaction.
+    pub db_write_queue_depth: Gauge,
 
     pub scan_job: JobMonitor,
     pub merge_job: JobMonitor,
@@ -68,9 +97,27 @@ impl RepositoryMonitor {
         let requests_received = create_counter(recorder, "requests received", Unit::Count);
         let request_latency = create_histogram(recorder, "request latency", Unit::Seconds);
         let request_timeouts = create_counter(recorder, "request timeouts", Unit::Count);
+        let response_queue_depth = create_histogram(recorder, "response queue depth", Unit::Count);
 
         let responses_sent = create_counter(recorder, "responses sent", Unit::Count);
         let responses_received = create_counter(recorder, "responses received", Unit::Count);
+        let root_nodes_suppressed = create_counter(recorder, "root nodes suppressed", Unit::Count);
+
+        let block_cache_hits = create_counter(recorder, "block cache hits", Unit::Count);
+        let block_cache_misses = create_counter(recorder, "block cache misses", Unit::Count);
+        let block_decrypt_time = create_histogram(recorder, "block decrypt time", Unit::Seconds);
+        let block_id_cache_load_time =
+            create_histogram(recorder, "block id cache load time", Unit::Seconds);
+
+        let block_expiration_tracked =
+            create_gauge(recorder, "block expiration tracked", Unit::Count);
+        let block_expiration_memory =
+            create_gauge(recorder, "block expiration memory", Unit::Bytes);
+        let blocks_expired = create_counter(recorder, "blocks expired", Unit::Count);
+
+        let db_read_wait_time = create_histogram(recorder, "db read wait time", Unit::Seconds);
+        let db_write_wait_time = create_histogram(recorder, "db write wait time", Unit::Seconds);
+        let db_write_queue_depth = create_gauge(recorder, "db write queue depth", Unit::Count);
 
         let scan_job = JobMonitor::new(&node, recorder, "scan");
         let merge_job = JobMonitor::new(&node, recorder, "merge");
@@ -87,9 +134,24 @@ impl RepositoryMonitor {
             requests_received,
             request_latency,
             request_timeouts,
+            response_queue_depth,
 
             responses_sent,
             responses_received,
+            root_nodes_suppressed,
+
+            block_cache_hits,
+            block_cache_misses,
+            block_decrypt_time,
+            block_id_cache_load_time,
+
+            block_expiration_tracked,
+            block_expiration_memory,
+            blocks_expired,
+
+            db_read_wait_time,
+            db_write_wait_time,
+            db_write_queue_depth,
 
             scan_job,
             merge_job,
@@ -114,6 +176,24 @@ impl RepositoryMonitor {
     }
 }
 
+/// Metrics of a single link, that is, of the synchronization of a repository with a single peer.
+/// Reported only to the state monitor (to the link node under the peer node), not to the
+/// repository recorder, so that the number of the exported metrics doesn't grow with the number of
+/// peers.
+pub(crate) struct LinkMonitor {
+    // Time from sending a request to this peer to receiving its response.
+    pub request_latency: Histogram,
+}
+
+impl LinkMonitor {
+    pub fn new(node: &StateMonitor) -> Self {
+        let recorder = MetricsRecorder::new(node.clone());
+        let request_latency = create_histogram(&recorder, "request latency", Unit::Seconds);
+
+        Self { request_latency }
+    }
+}
+
 pub(crate) struct JobMonitor {
     name: String,
     count_running_tx: watch::Sender<usize>,
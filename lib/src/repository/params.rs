@@ -1,5 +1,5 @@
 use super::RepositoryMonitor;
-use crate::{db, device_id::DeviceId, error::Result};
+use crate::{db, device_id::DeviceId, error::Result, store};
 use metrics::{NoopRecorder, Recorder};
 use state_monitor::{metrics::MetricsRecorder, StateMonitor};
 use std::{
@@ -12,6 +12,7 @@ pub struct RepositoryParams<R> {
     device_id: DeviceId,
     parent_monitor: Option<StateMonitor>,
     recorder: Option<R>,
+    block_storage: BlockStorage,
 }
 
 impl<R> RepositoryParams<R> {
@@ -26,12 +27,22 @@ impl<R> RepositoryParams<R> {
         }
     }
 
+    /// Where to store the block contents of a newly created repository. Has no effect when opening
+    /// an existing repository (it keeps using the storage it was created with).
+    pub fn with_block_storage(self, block_storage: BlockStorage) -> Self {
+        Self {
+            block_storage,
+            ..self
+        }
+    }
+
     pub fn with_recorder<S>(self, recorder: S) -> RepositoryParams<S> {
         RepositoryParams {
             store: self.store,
             device_id: self.device_id,
             parent_monitor: self.parent_monitor,
             recorder: Some(recorder),
+            block_storage: self.block_storage,
         }
     }
 
@@ -54,6 +65,19 @@ impl<R> RepositoryParams<R> {
     pub(super) fn device_id(&self) -> DeviceId {
         self.device_id
     }
+
+    pub(super) fn block_storage(&self) -> BlockStorage {
+        self.block_storage
+    }
+
+    /// Directory for the block files, if the store supports them.
+    pub(super) fn block_files_dir(&self) -> Option<PathBuf> {
+        match &self.store {
+            Store::Path(path) => Some(store::block_files_dir(path)),
+            #[cfg(test)]
+            Store::Pool { .. } => None,
+        }
+    }
 }
 
 impl<R> RepositoryParams<R>
@@ -96,10 +120,23 @@ impl RepositoryParams<NoopRecorder> {
             device_id: rand::random(),
             parent_monitor: None,
             recorder: None,
+            block_storage: BlockStorage::default(),
         }
     }
 }
 
+/// Where the block contents are stored.
+#[derive(Clone, Copy, Eq, PartialEq, Debug, Default)]
+pub enum BlockStorage {
+    /// In the repository database.
+    #[default]
+    Database,
+    /// In separate files in a directory next to the repository database (named as the database
+    /// with the `-blocks` suffix). Keeps the database small which makes its operations (including
+    /// checkpointing and vacuuming) faster.
+    Files,
+}
+
 enum Store {
     Path(PathBuf),
     #[cfg(test)]
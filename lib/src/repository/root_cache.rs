@@ -0,0 +1,115 @@
+use crate::{
+    blob::BlobId,
+    branch::Branch,
+    collections::HashMap,
+    crypto::sign::PublicKey,
+    directory::{Directory, DirectoryFallback, DirectoryLocking},
+    error::Result,
+    protocol::{MultiBlockPresence, RootNode, SnapshotId},
+};
+use deadlock::BlockingMutex;
+
+/// Cache of the root directories of all the branches.
+///
+/// Every repository operation that takes a path starts by opening the root directory in every
+/// branch which, with many writers, takes most of the time of the operation. A cached root is
+/// valid as long as the latest snapshot of its branch and the presence of its blocks stay the
+/// same, so it never returns stale content (including content loaded from a previous snapshot
+/// because some blocks were missing) and doesn't need to be invalidated on change notifications
+/// (which are delivered asynchronously and would be late for the operations that follow a local
+/// change).
+///
+/// The cached directories don't hold the read lock on the root blob, so that the branches can
+/// still be pruned. The lock is acquired anew each time a cached root is returned.
+pub(super) struct RootCache {
+    // NOTE: Never held across an await point.
+    inner: BlockingMutex<Inner>,
+}
+
+#[derive(Default)]
+struct Inner {
+    roots: HashMap<PublicKey, (RootKey, Directory)>,
+    // Incremented on `clear` so the roots loaded before it are not inserted after it.
+    generation: u64,
+}
+
+/// State of a branch that determines the content of its root directory.
+#[derive(Clone, Copy, Eq, PartialEq)]
+pub(super) struct RootKey {
+    snapshot_id: SnapshotId,
+    block_presence: MultiBlockPresence,
+}
+
+impl RootKey {
+    pub fn new(root_node: &RootNode) -> Self {
+        Self {
+            snapshot_id: root_node.snapshot_id,
+            block_presence: root_node.summary.block_presence,
+        }
+    }
+}
+
+impl RootCache {
+    pub fn new() -> Self {
+        Self {
+            inner: BlockingMutex::new(Inner::default()),
+        }
+    }
+
+    /// Opens the root directory of the given branch whose latest snapshot is described by `key`.
+    /// `key` is `None` if the branch doesn't have any snapshot yet in which case the root is not
+    /// cached.
+    pub async fn open(&self, branch: &Branch, key: Option<RootKey>) -> Result<Directory> {
+        let Some(key) = key else {
+            return branch
+                .open_root(DirectoryLocking::Enabled, DirectoryFallback::Enabled)
+                .await;
+        };
+
+        let (cached, generation) = {
+            let inner = self.inner.lock().unwrap();
+            let cached = inner
+                .roots
+                .get(branch.id())
+                .filter(|(cached_key, _)| *cached_key == key)
+                .map(|(_, dir)| dir.clone());
+
+            (cached, inner.generation)
+        };
+
+        if let Some(dir) = cached {
+            let lock = branch.locker().read(BlobId::ROOT).await;
+            return Ok(dir.with_lock(Some(lock)));
+        }
+
+        let dir = branch
+            .open_root(DirectoryLocking::Enabled, DirectoryFallback::Enabled)
+            .await?;
+
+        let mut inner = self.inner.lock().unwrap();
+
+        if inner.generation == generation {
+            inner
+                .roots
+                .insert(*branch.id(), (key, dir.clone().with_lock(None)));
+        }
+
+        Ok(dir)
+    }
+
+    /// Removes the roots of the branches not in `branch_ids` (e.g. pruned ones).
+    pub fn retain(&self, branch_ids: impl Fn(&PublicKey) -> bool) {
+        self.inner
+            .lock()
+            .unwrap()
+            .roots
+            .retain(|branch_id, _| branch_ids(branch_id));
+    }
+
+    /// Removes all the cached roots. Needed when the keys of the branches change.
+    pub fn clear(&self) {
+        let mut inner = self.inner.lock().unwrap();
+        inner.roots.clear();
+        inner.generation += 1;
+    }
+}
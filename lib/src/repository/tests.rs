@@ -20,6 +20,27 @@ async fn root_directory_always_exists() {
     let _ = repo.open_directory("/").await.unwrap();
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn root_directory_reflects_changes() {
+    let (_base_dir, repo) = setup().await;
+
+    // The root is cached now.
+    assert!(repo.open_directory("/").await.unwrap().is_empty());
+
+    repo.create_file("a.txt").await.unwrap();
+    repo.create_directory("b").await.unwrap();
+
+    let root = repo.open_directory("/").await.unwrap();
+    assert!(root.lookup_unique("a.txt").is_ok());
+    assert!(root.lookup_unique("b").is_ok());
+
+    repo.remove_entry("a.txt").await.unwrap();
+
+    let root = repo.open_directory("/").await.unwrap();
+    assert_matches!(root.lookup_unique("a.txt"), Err(Error::EntryNotFound));
+    assert!(repo.open_directory("b").await.is_ok());
+}
+
 // Count leaf nodes in the index of the local branch.
 async fn count_local_index_leaf_nodes(repo: &Repository) -> usize {
     let branch = repo.local_branch().unwrap();
@@ -1270,6 +1291,137 @@ async fn export() {
     assert_eq!(dst_repo.access_mode(), AccessMode::Read);
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn import_and_export_directory() {
+    let (base_dir, repo) = setup().await;
+
+    let files = [
+        ("a.dat", random_bytes(3 * BLOCK_SIZE + 17)),
+        ("b/c.dat", random_bytes(1)),
+        ("b/d/e.dat", Vec::new()),
+    ];
+
+    let src_dir = base_dir.path().join("src");
+
+    for (path, content) in &files {
+        let path = src_dir.join(path);
+        fs::create_dir_all(path.parent().unwrap()).await.unwrap();
+        fs::write(path, content).await.unwrap();
+    }
+
+    repo.import_directory(&src_dir, "imported").await.unwrap();
+
+    for (path, content) in &files {
+        let mut file = repo.open_file(format!("imported/{path}")).await.unwrap();
+        assert_eq!(file.read_to_end().await.unwrap(), *content);
+    }
+
+    // Importing again fails because the files already exist.
+    assert_matches!(
+        repo.import_directory(&src_dir, "imported").await,
+        Err(Error::EntryExists)
+    );
+
+    let dst_dir = base_dir.path().join("dst");
+    repo.export_directory("imported", &dst_dir).await.unwrap();
+
+    for (path, content) in &files {
+        assert_eq!(fs::read(dst_dir.join(path)).await.unwrap(), *content);
+    }
+}
+
+#[tokio::test(flavor = "multi_thread")]
+async fn block_deduplication() {
+    let (_base_dir, repo) = setup().await;
+    let content = random_bytes(4 * BLOCK_SIZE);
+
+    async fn write_and_collect_block_ids(
+        repo: &Repository,
+        path: &str,
+        content: &[u8],
+    ) -> Vec<BlockId> {
+        let mut file = repo.create_file(path).await.unwrap();
+        file.write_all(content).await.unwrap();
+        file.flush().await.unwrap();
+
+        let mut block_ids = blob::BlockIds::open(file.branch().clone(), *file.blob_id())
+            .await
+            .unwrap();
+        let mut ids = Vec::new();
+
+        while let Some((block_id, _)) = block_ids.try_next().await.unwrap() {
+            ids.push(block_id);
+        }
+
+        ids
+    }
+
+    // Disabled by default.
+    assert!(!repo.is_block_deduplication_enabled());
+
+    let a = write_and_collect_block_ids(&repo, "a.dat", &content).await;
+    let b = write_and_collect_block_ids(&repo, "b.dat", &content).await;
+    assert!(a.iter().all(|id| !b.contains(id)));
+
+    repo.set_block_deduplication(true).await.unwrap();
+    assert!(repo.is_block_deduplication_enabled());
+
+    let c = write_and_collect_block_ids(&repo, "c.dat", &content).await;
+    let d = write_and_collect_block_ids(&repo, "d.dat", &content).await;
+    assert_eq!(c, d);
+}
+
+#[tokio::test(flavor = "multi_thread")]
+async fn block_files_storage() {
+    test_utils::init_log();
+
+    let base_dir = TempDir::new().unwrap();
+    let store_path = base_dir.path().join(DEFAULT_REPO_NAME);
+    let params = RepositoryParams::new(&store_path).with_block_storage(BlockStorage::Files);
+
+    let repo = Repository::create(
+        &params,
+        Access::WriteUnlocked {
+            secrets: WriteSecrets::random(),
+        },
+    )
+    .await
+    .unwrap();
+
+    let content = random_bytes(4 * BLOCK_SIZE);
+
+    let mut file = repo.create_file("test.dat").await.unwrap();
+    file.write_all(&content).await.unwrap();
+    file.flush().await.unwrap();
+    drop(file);
+
+    repo.close().await.unwrap();
+
+    // The block contents are stored outside of the db.
+    let block_files_dir = store::block_files_dir(&store_path);
+    let mut file_count = 0;
+
+    for shard in std::fs::read_dir(&block_files_dir).unwrap() {
+        file_count += std::fs::read_dir(shard.unwrap().path()).unwrap().count();
+    }
+
+    assert!(file_count > 0);
+
+    // Storage is remembered when reopening (even without specifying it).
+    let repo = Repository::open(&RepositoryParams::new(&store_path), None, AccessMode::Write)
+        .await
+        .unwrap();
+
+    let mut file = repo.open_file("test.dat").await.unwrap();
+    assert_eq!(file.read_to_end().await.unwrap(), content);
+    drop(file);
+
+    repo.close().await.unwrap();
+
+    delete(&store_path).await.unwrap();
+    assert!(!block_files_dir.exists());
+}
+
 const DEFAULT_REPO_NAME: &str = "repo.db";
 
 async fn setup() -> (TempDir, Repository) {
@@ -10,9 +10,10 @@ use crate::{
     debug::DebugPrinter,
     error::Result,
     event::EventSender,
-    protocol::{RepositoryId, StorageSize},
-    store::Store,
+    protocol::{ProofCache, RepositoryId, StorageSize},
+    store::{BlockExpirationMetrics, Store},
 };
+use deadlock::BlockingMutex;
 use sqlx::Row;
 use std::{sync::Arc, time::Duration};
 use tracing::Instrument;
@@ -24,8 +25,13 @@ pub(crate) struct Vault {
     pub event_tx: EventSender,
     pub block_tracker: BlockTracker,
     pub monitor: Arc<RepositoryMonitor>,
+    pub proof_cache: ProofCache,
+    root_node_debounce: Arc<BlockingMutex<Duration>>,
 }
 
+/// Default min interval between two root node notifications of the same branch sent to a peer.
+const DEFAULT_ROOT_NODE_DEBOUNCE: Duration = Duration::from_millis(500);
+
 impl Vault {
     pub fn new(
         repository_id: RepositoryId,
@@ -33,14 +39,29 @@ impl Vault {
         pool: db::Pool,
         monitor: RepositoryMonitor,
     ) -> Self {
+        pool.set_metrics(
+            monitor.db_read_wait_time.clone(),
+            monitor.db_write_wait_time.clone(),
+            monitor.db_write_queue_depth.clone(),
+        );
+
         let store = Store::new(pool);
+        store.set_block_cache_metrics(
+            monitor.block_cache_hits.clone(),
+            monitor.block_cache_misses.clone(),
+            monitor.block_decrypt_time.clone(),
+        );
+        store.set_block_id_cache_metrics(monitor.block_id_cache_load_time.clone());
+        let block_tracker = store.block_download_tracker().clone();
 
         Self {
             repository_id,
             store,
             event_tx,
-            block_tracker: BlockTracker::new(),
+            block_tracker,
             monitor: Arc::new(monitor),
+            proof_cache: ProofCache::new(),
+            root_node_debounce: Arc::new(BlockingMutex::new(DEFAULT_ROOT_NODE_DEBOUNCE)),
         }
     }
 
@@ -93,7 +114,15 @@ impl Vault {
     pub async fn set_block_expiration(&self, duration: Option<Duration>) -> Result<()> {
         Ok(self
             .store
-            .set_block_expiration(duration, self.block_tracker.clone())
+            .set_block_expiration(
+                duration,
+                self.block_tracker.clone(),
+                BlockExpirationMetrics {
+                    tracked_blocks: self.monitor.block_expiration_tracked.clone(),
+                    memory: self.monitor.block_expiration_memory.clone(),
+                    expired_blocks: self.monitor.blocks_expired.clone(),
+                },
+            )
             .instrument(self.monitor.span().clone())
             .await?)
     }
@@ -102,6 +131,30 @@ impl Vault {
         self.store.block_expiration().await
     }
 
+    pub fn set_block_cache_capacity(&self, capacity: u64) {
+        self.store.set_block_cache_capacity(capacity);
+    }
+
+    pub fn block_cache_capacity(&self) -> u64 {
+        self.store.block_cache_capacity()
+    }
+
+    pub fn set_block_id_cache_capacity(&self, capacity: u64) {
+        self.store.set_block_id_cache_capacity(capacity);
+    }
+
+    pub fn block_id_cache_capacity(&self) -> u64 {
+        self.store.block_id_cache_capacity()
+    }
+
+    pub fn set_root_node_debounce(&self, interval: Duration) {
+        *self.root_node_debounce.lock().unwrap() = interval;
+    }
+
+    pub fn root_node_debounce(&self) -> Duration {
+        *self.root_node_debounce.lock().unwrap()
+    }
+
     pub async fn debug_print(&self, print: DebugPrinter) {
         self.store().debug_print_root_node(print).await
     }
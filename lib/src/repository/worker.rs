@@ -9,9 +9,8 @@ use crate::{
     joint_directory::{JointDirectory, JointEntryRef, MissingVersionStrategy},
     store, versioned,
 };
-use async_recursion::async_recursion;
 use futures_util::{stream, StreamExt};
-use std::{future, sync::Arc};
+use std::{future, sync::Arc, time::Duration};
 use tokio::select;
 
 #[cfg(test)]
@@ -20,12 +19,24 @@ mod tests;
 /// Notify the block tracker after marking this many blocks as required.
 const BLOCK_REQUIRE_BATCH_SIZE: u32 = 1024;
 
+/// How long after the repository is opened the jobs start on their own if nothing (a local change
+/// or a message from a peer) starts them sooner. The first run of the jobs traverses the whole
+/// repository which, with many repositories opened at the same time, would slow down the startup
+/// while not being urgent (the repository was fully maintained when it was last closed, except
+/// when the previous run was interrupted). Not applied when the worker is restarted on an already
+/// open repository (e.g. after its credentials changed) because then the jobs are needed right
+/// away.
+pub(super) const START_DELAY: Duration = Duration::from_secs(5);
+
 /// Background worker to perform various jobs on the repository:
 /// - merge remote branches into the local one
 /// - remove outdated branches and snapshots
 /// - remove unreachable blocks
 /// - find missing blocks
-pub(super) async fn run(shared: Arc<Shared>) {
+///
+/// The jobs first run after `start_delay` (see `START_DELAY`) or on the first event, whichever
+/// comes first.
+pub(super) async fn run(shared: Arc<Shared>, start_delay: Duration) {
     let event_scope = EventScope::new();
     let prune_counter = Counter::new();
 
@@ -78,6 +89,7 @@ pub(super) async fn run(shared: Arc<Shared>) {
         utils::run(
             || maintain(&shared, local_branch.as_ref(), &unlock_tx, &prune_counter),
             commands,
+            start_delay,
         )
         .await;
     };
@@ -110,7 +122,7 @@ pub(super) async fn run(shared: Arc<Shared>) {
                 })
             });
 
-        utils::run(|| scan(&shared, &prune_counter), commands).await;
+        utils::run(|| scan(&shared, &prune_counter), commands, start_delay).await;
     };
 
     // Run them in parallel so missing blocks are found as soon as possible
@@ -175,33 +187,64 @@ async fn scan(shared: &Shared, prune_counter: &Counter) {
 }
 
 /// Find missing blocks and mark them as required.
+///
+/// The directory tree is walked depth first in name order, keeping open only the directories on the
+/// path from the root to the one currently being scanned. The position (path of that directory) is
+/// periodically saved so an interrupted scan (because of a new snapshot, the app being killed, ...)
+/// continues from where it left off instead of from the root. Each run covers the whole tree, from
+/// the saved position to the end and then from the beginning up to the saved position. Branches
+/// whose latest snapshot has all its blocks present are skipped.
 mod scan {
-    use crate::protocol::SingleBlockPresence;
-
     use super::*;
+    use crate::{
+        collections::HashSet,
+        crypto::{cipher, sign::PublicKey},
+        protocol::{MultiBlockPresence, RootNodeFilter, SingleBlockPresence},
+        repository::metadata,
+    };
+    use std::{
+        ops::{Bound, RangeBounds},
+        vec,
+    };
+    use tokio::time::{Duration, Instant};
     use tracing::instrument;
 
+    /// How often to save the scan position.
+    const CHECKPOINT_INTERVAL: Duration = Duration::from_secs(5);
+
     pub(super) async fn run(shared: &Shared, prune_counter: &Counter) -> Result<()> {
-        loop {
-            let prune_count_before = prune_counter.get();
-
-            match run_once(shared).await {
-                Ok(()) => return Ok(()),
-                // `BranchNotFound` and `LocatorNotFound` might be caused by a branch being pruned
-                // concurrently as it's being scanned. Check the prune counter to confirm the prune
-                // happened and if so, restart the scan.
-                Err(Error::Store(store::Error::BranchNotFound | store::Error::LocatorNotFound))
-                    if prune_counter.get() != prune_count_before =>
-                {
-                    continue
+        let mut cursor = Cursor::load(shared).await?;
+
+        let result =
+            loop {
+                let prune_count_before = prune_counter.get();
+
+                match run_once(shared, &mut cursor).await {
+                    Ok(()) => break Ok(()),
+                    // `BranchNotFound` and `LocatorNotFound` might be caused by a branch being pruned
+                    // concurrently as it's being scanned. Check the prune counter to confirm the prune
+                    // happened and if so, restart the scan.
+                    Err(Error::Store(
+                        store::Error::BranchNotFound | store::Error::LocatorNotFound,
+                    )) if prune_counter.get() != prune_count_before => continue,
+                    Err(error) => break Err(error),
                 }
-                Err(error) => return Err(error),
-            }
-        }
+            };
+
+        cursor.save(shared).await?;
+
+        result
     }
 
-    async fn run_once(shared: &Shared) -> Result<()> {
+    async fn run_once(shared: &Shared, cursor: &mut Cursor) -> Result<()> {
         let branches = shared.load_branches().await?;
+        let complete = load_complete_branches(shared, &branches).await?;
+
+        if complete.len() == branches.len() {
+            tracing::trace!("all blocks present");
+            return Ok(());
+        }
+
         let mut versions = Vec::with_capacity(branches.len());
 
         for branch in branches {
@@ -225,52 +268,281 @@ mod scan {
             }
         }
 
-        traverse(shared, JointDirectory::new(None, versions)).await
+        let root = JointDirectory::new(None, versions);
+        let start = cursor.position.clone();
+
+        // From the saved position to the end...
+        traverse(
+            shared,
+            &complete,
+            cursor,
+            root.clone(),
+            Range(Bound::Included(&start), Bound::Unbounded),
+        )
+        .await?;
+
+        // ...then from the beginning up to the saved position.
+        if !start.is_empty() {
+            traverse(
+                shared,
+                &complete,
+                cursor,
+                root,
+                Range(Bound::Unbounded, Bound::Excluded(&start)),
+            )
+            .await?;
+        }
+
+        // The whole tree has been scanned, start from the root next time.
+        cursor.position.clear();
+
+        Ok(())
+    }
+
+    async fn traverse(
+        shared: &Shared,
+        complete: &HashSet<PublicKey>,
+        cursor: &mut Cursor,
+        root: JointDirectory,
+        range: Range<'_>,
+    ) -> Result<()> {
+        let mut stack = vec![visit(shared, complete, cursor, &range, root, Vec::new()).await?];
+
+        while let Some(frame) = stack.last_mut() {
+            let Some(name) = frame.subdirs.next() else {
+                stack.pop();
+                continue;
+            };
+
+            // Not using `lookup_unique` because the directory might be in conflict with a file of
+            // the same name, which would make the lookup ambiguous.
+            let entry = frame.dir.lookup(&name).find_map(|entry| match entry {
+                JointEntryRef::Directory(entry) => Some(entry),
+                JointEntryRef::File(_) => None,
+            });
+
+            let dir = match entry {
+                Some(entry) => {
+                    entry
+                        .open_with(MissingVersionStrategy::Fail, DirectoryFallback::Disabled)
+                        .await
+                }
+                // The entry changed since the parent was scanned.
+                None => continue,
+            };
+
+            let dir = match dir {
+                Ok(dir) => dir,
+                Err(error) => {
+                    // Continue processing the remaining entries
+                    tracing::trace!(entry = name, ?error, "Failed to open directory");
+                    continue;
+                }
+            };
+
+            let mut path = frame.path.clone();
+            path.push(name);
+
+            let frame = visit(shared, complete, cursor, &range, dir, path).await?;
+            stack.push(frame);
+        }
+
+        Ok(())
     }
 
-    #[async_recursion]
-    async fn traverse(shared: &Shared, dir: JointDirectory) -> Result<()> {
+    /// Requires the missing blocks of the entries of the given directory (if it's in the range)
+    /// and returns the names of its subdirectories which need to be traversed.
+    async fn visit(
+        shared: &Shared,
+        complete: &HashSet<PublicKey>,
+        cursor: &mut Cursor,
+        range: &Range<'_>,
+        dir: JointDirectory,
+        path: Vec<String>,
+    ) -> Result<Frame> {
         let mut subdirs = Vec::new();
+        let in_range = range.contains(&path);
 
         for entry in dir.entries() {
             match entry {
                 JointEntryRef::File(entry) => {
-                    require_missing_blocks(
-                        shared,
-                        entry.inner().branch(),
-                        *entry.inner().blob_id(),
-                    )
-                    .await?;
+                    if in_range && !complete.contains(entry.branch().id()) {
+                        require_missing_blocks(
+                            shared,
+                            entry.inner().branch(),
+                            *entry.inner().blob_id(),
+                        )
+                        .await?;
+                    }
                 }
                 JointEntryRef::Directory(entry) => {
-                    for version in entry.versions() {
-                        require_missing_blocks(shared, version.branch(), *version.blob_id())
-                            .await?;
+                    if in_range {
+                        for version in entry.versions() {
+                            if !complete.contains(version.branch().id()) {
+                                require_missing_blocks(
+                                    shared,
+                                    version.branch(),
+                                    *version.blob_id(),
+                                )
+                                .await?;
+                            }
+                        }
                     }
 
-                    match entry
-                        .open_with(MissingVersionStrategy::Fail, DirectoryFallback::Disabled)
-                        .await
-                    {
-                        Ok(dir) => subdirs.push(dir),
-                        Err(error) => {
-                            // Continue processing the remaining entries
-                            tracing::trace!(
-                                entry = entry.name(),
-                                ?error,
-                                "Failed to open directory"
-                            );
-                        }
+                    let mut subdir_path = path.clone();
+                    subdir_path.push(entry.name().to_owned());
+
+                    if range.overlaps_subtree(&subdir_path) {
+                        // unwrap is OK because we just pushed it.
+                        subdirs.push(subdir_path.pop().unwrap());
                     }
                 }
             }
         }
 
-        for dir in subdirs {
-            traverse(shared, dir).await?;
+        // Conflicting files and directories of the same name are yielded separately but the
+        // directory needs to be traversed only once.
+        subdirs.dedup();
+
+        if in_range {
+            cursor.advance(shared, &path).await?;
         }
 
-        Ok(())
+        Ok(Frame {
+            dir,
+            path,
+            subdirs: subdirs.into_iter(),
+        })
+    }
+
+    /// Directory being traversed.
+    struct Frame {
+        dir: JointDirectory,
+        path: Vec<String>,
+        // Remaining subdirectories to traverse.
+        subdirs: vec::IntoIter<String>,
+    }
+
+    /// Range of directory paths to scan, in depth first (i.e., lexicographical) order.
+    struct Range<'a>(Bound<&'a Vec<String>>, Bound<&'a Vec<String>>);
+
+    impl Range<'_> {
+        fn contains(&self, path: &Vec<String>) -> bool {
+            (self.0, self.1).contains(path)
+        }
+
+        /// Does the subtree rooted at `path` contain any directory in this range?
+        fn overlaps_subtree(&self, path: &Vec<String>) -> bool {
+            // All the paths in the subtree are greater than or equal to `path` and less than the
+            // path following `path`'s subtree.
+            let above_start = match self.0 {
+                Bound::Included(start) => path >= start || start.starts_with(path),
+                Bound::Excluded(start) => path > start || start.starts_with(path),
+                Bound::Unbounded => true,
+            };
+
+            let below_end = match self.1 {
+                Bound::Included(end) => path <= end,
+                Bound::Excluded(end) => path < end,
+                Bound::Unbounded => true,
+            };
+
+            above_start && below_end
+        }
+    }
+
+    /// Position of the scan.
+    struct Cursor {
+        position: Vec<String>,
+        saved: Vec<String>,
+        saved_at: Instant,
+        // Key to encrypt the saved position with. `None` if the repository isn't readable, in
+        // which case there is nothing to scan and the position is not saved.
+        read_key: Option<cipher::SecretKey>,
+    }
+
+    impl Cursor {
+        async fn load(shared: &Shared) -> Result<Self> {
+            let read_key = shared
+                .credentials
+                .read()
+                .unwrap()
+                .secrets
+                .keys()
+                .map(|keys| keys.read().clone());
+
+            let position = if let Some(read_key) = &read_key {
+                let mut conn = shared.vault.store().db().acquire().await?;
+                metadata::scan_position::get(&mut conn, read_key).await?
+            } else {
+                Vec::new()
+            };
+
+            Ok(Self {
+                saved: position.clone(),
+                position,
+                saved_at: Instant::now(),
+                read_key,
+            })
+        }
+
+        async fn advance(&mut self, shared: &Shared, path: &[String]) -> Result<()> {
+            self.position.clear();
+            self.position.extend_from_slice(path);
+
+            if self.saved_at.elapsed() >= CHECKPOINT_INTERVAL {
+                self.save(shared).await?;
+            }
+
+            Ok(())
+        }
+
+        async fn save(&mut self, shared: &Shared) -> Result<()> {
+            let Some(read_key) = &self.read_key else {
+                return Ok(());
+            };
+
+            if self.position != self.saved {
+                let mut tx = shared.vault.store().db().begin_write().await?;
+                metadata::scan_position::set(&mut tx, read_key, &self.position).await?;
+                tx.commit().await?;
+
+                self.saved.clone_from(&self.position);
+            }
+
+            self.saved_at = Instant::now();
+
+            Ok(())
+        }
+    }
+
+    /// Loads the ids of the branches that have no missing blocks.
+    async fn load_complete_branches(
+        shared: &Shared,
+        branches: &[Branch],
+    ) -> Result<HashSet<PublicKey>> {
+        // Expired blocks count as present in the summaries but they still need to be required.
+        if shared.vault.block_expiration().await.is_some() {
+            return Ok(HashSet::default());
+        }
+
+        let mut reader = shared.vault.store().acquire_read().await?;
+        let mut complete = HashSet::default();
+
+        for branch in branches {
+            match reader
+                .load_latest_approved_root_node(branch.id(), RootNodeFilter::Any)
+                .await
+            {
+                Ok(root_node) if root_node.summary.block_presence == MultiBlockPresence::Full => {
+                    complete.insert(*branch.id());
+                }
+                Ok(_) | Err(store::Error::BranchNotFound) => (),
+                Err(error) => return Err(error.into()),
+            }
+        }
+
+        Ok(complete)
     }
 
     #[instrument(skip(shared, branch), fields(branch_id = ?branch.id()))]
@@ -445,62 +717,153 @@ mod prune {
 }
 
 /// Remove unreachable blocks
+///
+/// Only the blocks whose reachability might have changed since the last run (the GC candidates,
+/// see `store::GcCandidates`) are checked, so when nothing changed nothing needs to be done and
+/// otherwise the number of blocks looked up is proportional to the amount of change, not to the
+/// size of the repository.
 mod trash {
     use super::*;
     use crate::{
         crypto::sign::PublicKey,
         protocol::{BlockId, Bump},
-        store::{Changeset, ReadTransaction, WriteTransaction},
+        repository::metadata,
+        store::{Changeset, GcCandidates, ReadTransaction, WriteTransaction},
     };
     use futures_util::TryStreamExt;
     use std::{
         collections::{BTreeSet, VecDeque},
-        iter,
+        iter, mem,
+        time::{Duration, SystemTime},
     };
 
+    /// How often to check all the blocks in the repository, not just the candidates. This catches
+    /// blocks that became unreachable in ways the candidates don't capture (e.g. an entry being
+    /// removed in a remote branch before we've ever seen it).
+    const FULL_PASS_INTERVAL: Duration = Duration::from_secs(7 * 24 * 60 * 60);
+
     pub(super) async fn run(
         shared: &Shared,
         local_branch: Option<&Branch>,
         unlock_tx: &unlock::Sender,
     ) -> Result<()> {
-        // Perform the scan in multiple passes, to avoid loading too many block ids into memory.
-        const UNREACHABLE_BLOCKS_PAGE_SIZE: u32 = 1_000_000;
+        // Perform the check in multiple passes, to avoid loading too many block ids into memory.
+        // Each pass traverses all the branches, so the page must not be too small either: the full
+        // pass puts every block into the queue and would otherwise need a lot of traversals.
+        const CANDIDATES_PAGE_SIZE: u32 = 1_000_000;
 
-        let mut unreachable_block_ids_page =
-            shared.vault.store().block_ids(UNREACHABLE_BLOCKS_PAGE_SIZE);
+        schedule_full_pass(shared).await?;
+
+        // Process only the candidates recorded so far. Those recorded (or deferred) during this run
+        // are processed by the next one.
+        let Some(end) = shared.vault.store().gc_candidates_end().await? else {
+            return sweep_block_files(shared).await;
+        };
 
         loop {
-            let mut unreachable_block_ids = unreachable_block_ids_page.next().await?;
+            let mut candidates = shared
+                .vault
+                .store()
+                .load_gc_candidates(CANDIDATES_PAGE_SIZE, end)
+                .await?;
 
-            if unreachable_block_ids.is_empty() {
+            if candidates.is_empty() {
                 break;
             }
 
-            exclude_locked_blocks(shared, &mut unreachable_block_ids, unlock_tx).await?;
+            if !candidates.block_ids.is_empty() {
+                check_candidates(shared, local_branch, unlock_tx, &mut candidates).await?;
+            }
 
-            traverse_root_in_all_branches(shared, local_branch, &mut unreachable_block_ids).await?;
+            shared
+                .vault
+                .store()
+                .remove_gc_candidates(&candidates)
+                .await?;
+        }
 
-            // If `merge` started but didn't complete (e.g., due to missing blocks), some of the
-            // entries in the local branch might be outdated. We can't garbage collect their
-            // blocks yet because they might still be needed in future `merge` (e.g., when those
-            // missing blocks become available). Thus we traverse the local root again to exclude
-            // all blocks that are reachable from it even if they belong to outdated entries.
-            // When future `merge` completes, any such blocks will become unreachable and will be
-            // collected during a subsequent `trash`.
-            if let Some(local_branch) = local_branch {
-                traverse_root_in_local_branch(local_branch, &mut unreachable_block_ids).await?;
-            }
+        sweep_block_files(shared).await
+    }
+
+    async fn sweep_block_files(shared: &Shared) -> Result<()> {
+        // Blocks removed implicitly (by db triggers, e.g. on node removal) leave their files
+        // behind (if block files are enabled). Sweep them a few shards at a time.
+        const BLOCK_FILES_SWEEP_SHARDS: usize = 16;
+
+        let count = shared
+            .vault
+            .store()
+            .sweep_block_files(BLOCK_FILES_SWEEP_SHARDS)
+            .await?;
+
+        if count > 0 {
+            tracing::debug!("orphaned block files removed: {}", count);
+        }
+
+        Ok(())
+    }
+
+    async fn schedule_full_pass(shared: &Shared) -> Result<()> {
+        let store = shared.vault.store();
+        let now = SystemTime::now();
+
+        let mut conn = store.db().acquire().await?;
+        let last = metadata::gc_full_pass::get(&mut conn).await?;
+        drop(conn);
+
+        let due = match last {
+            Some(last) => now
+                .duration_since(last)
+                .map(|elapsed| elapsed >= FULL_PASS_INTERVAL)
+                // The clock went backwards.
+                .unwrap_or(true),
+            None => true,
+        };
 
-            remove_unreachable_blocks(shared, local_branch, unreachable_block_ids).await?;
+        if !due {
+            return Ok(());
         }
 
+        tracing::debug!("scheduling full garbage collection");
+
+        store.reset_gc_candidates().await?;
+
+        let mut tx = store.db().begin_write().await?;
+        metadata::gc_full_pass::set(&mut tx, now).await?;
+        tx.commit().await?;
+
         Ok(())
     }
 
+    /// Removes the unreachable candidates.
+    async fn check_candidates(
+        shared: &Shared,
+        local_branch: Option<&Branch>,
+        unlock_tx: &unlock::Sender,
+        candidates: &mut GcCandidates,
+    ) -> Result<()> {
+        exclude_locked_blocks(shared, candidates, unlock_tx).await?;
+
+        traverse_root_in_all_branches(shared, local_branch, candidates).await?;
+
+        // If `merge` started but didn't complete (e.g., due to missing blocks), some of the
+        // entries in the local branch might be outdated. We can't garbage collect their
+        // blocks yet because they might still be needed in future `merge` (e.g., when those
+        // missing blocks become available). Thus we traverse the local root again to exclude
+        // all blocks that are reachable from it even if they belong to outdated entries.
+        // When future `merge` completes, any such blocks will become unreachable and will be
+        // collected during a subsequent `trash`.
+        if let Some(local_branch) = local_branch {
+            traverse_root_in_local_branch(local_branch, candidates).await?;
+        }
+
+        remove_unreachable_blocks(shared, local_branch, mem::take(&mut candidates.block_ids)).await
+    }
+
     async fn traverse_root_in_all_branches(
         shared: &Shared,
         local_branch: Option<&Branch>,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        candidates: &mut GcCandidates,
     ) -> Result<()> {
         let local_branch_id = local_branch.map(Branch::id);
         let branches = shared.load_branches().await?;
@@ -510,8 +873,7 @@ mod trash {
             // Local blocks are be processed in `traverse_root_in_local_branch`, avoid processing
             // them twice.
             if Some(branch.id()) != local_branch_id {
-                exclude_reachable_blocks(branch.clone(), BlobId::ROOT, unreachable_block_ids)
-                    .await?;
+                exclude_reachable_blocks(branch.clone(), BlobId::ROOT, candidates).await?;
             }
 
             // TODO: enable fallback so fallback blocks are not collected
@@ -523,27 +885,27 @@ mod trash {
 
         let dir = JointDirectory::new(local_branch.cloned(), versions);
 
-        traverse(dir, local_branch_id, unreachable_block_ids).await
+        traverse(dir, local_branch_id, candidates).await
     }
 
     async fn traverse_root_in_local_branch(
         local_branch: &Branch,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        candidates: &mut GcCandidates,
     ) -> Result<()> {
-        exclude_reachable_blocks(local_branch.clone(), BlobId::ROOT, unreachable_block_ids).await?;
+        exclude_reachable_blocks(local_branch.clone(), BlobId::ROOT, candidates).await?;
 
         let dir = local_branch
             .open_root(DirectoryLocking::Disabled, DirectoryFallback::Disabled)
             .await?;
         let dir = JointDirectory::new(Some(local_branch.clone()), iter::once(dir));
 
-        traverse(dir, None, unreachable_block_ids).await
+        traverse(dir, None, candidates).await
     }
 
     async fn traverse(
         dir: JointDirectory,
         skip_branch_id: Option<&PublicKey>,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        candidates: &mut GcCandidates,
     ) -> Result<()> {
         let mut queue: VecDeque<_> = iter::once(dir).collect();
 
@@ -558,7 +920,7 @@ mod trash {
                         exclude_reachable_blocks(
                             entry.inner().branch().clone(),
                             *entry.inner().blob_id(),
-                            unreachable_block_ids,
+                            candidates,
                         )
                         .await?;
                     }
@@ -571,7 +933,7 @@ mod trash {
                             exclude_reachable_blocks(
                                 version.branch().clone(),
                                 *version.blob_id(),
-                                unreachable_block_ids,
+                                candidates,
                             )
                             .await?;
                         }
@@ -591,21 +953,29 @@ mod trash {
     async fn exclude_reachable_blocks(
         branch: Branch,
         blob_id: BlobId,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        candidates: &mut GcCandidates,
     ) -> Result<()> {
+        if candidates.block_ids.is_empty() {
+            return Ok(());
+        }
+
         let mut blob_block_ids = BlockIds::open(branch, blob_id).await?;
 
-        while let Some((block_id, _)) = blob_block_ids.try_next().await? {
-            unreachable_block_ids.remove(&block_id);
+        // Only blocks at the candidate locators can be candidates, no need to look up the others.
+        while let Some((block_id, _)) = blob_block_ids
+            .try_next_matching(|locator| candidates.locators.contains(locator))
+            .await?
+        {
+            candidates.block_ids.remove(&block_id);
         }
 
         Ok(())
     }
 
-    /// Exclude blocks of locked blobs from the `unreachable_block_ids` set.
+    /// Defer blocks of locked blobs to a later collection.
     async fn exclude_locked_blocks(
         shared: &Shared,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        candidates: &mut GcCandidates,
         unlock_tx: &unlock::Sender,
     ) -> Result<()> {
         // This can sometimes include pruned branches. It happens when a branch is first loaded,
@@ -632,8 +1002,12 @@ mod trash {
 
                 unlock_tx.send(notify).await;
 
+                // Don't drop them from the queue, they need to be checked again once the blob is
+                // unlocked (the notification above triggers another run then).
                 while let Some((block_id, _)) = blob_block_ids.try_next().await? {
-                    unreachable_block_ids.remove(&block_id);
+                    if candidates.block_ids.remove(&block_id) {
+                        candidates.deferred.push(block_id);
+                    }
                 }
             }
         }
@@ -720,8 +1094,9 @@ mod trash {
     }
 
     async fn remove_blocks(tx: &mut WriteTransaction, block_ids: &[BlockId]) -> Result<()> {
+        tx.remove_blocks(block_ids).await?;
+
         for block_id in block_ids {
-            tx.remove_block(block_id).await?;
             tracing::trace!(?block_id, "unreachable block removed");
         }
 
@@ -735,8 +1110,9 @@ mod utils {
         future::Future,
         pin::pin,
         sync::atomic::{AtomicU64, Ordering},
+        time::Duration,
     };
-    use tokio::select;
+    use tokio::{select, time};
 
     /// Control how the next job should run
     pub(super) enum Command {
@@ -746,24 +1122,38 @@ mod utils {
         Interrupt,
     }
 
-    /// Runs the given job in a loop based on commands received from the given command stream.
-    pub(super) async fn run<JobFn, Job, Commands>(mut job_fn: JobFn, commands: Commands)
-    where
+    /// Runs the given job in a loop based on commands received from the given command stream. The
+    /// first run starts after `start_delay` or on the first command, whichever comes first.
+    pub(super) async fn run<JobFn, Job, Commands>(
+        mut job_fn: JobFn,
+        commands: Commands,
+        start_delay: Duration,
+    ) where
         JobFn: FnMut() -> Job,
         Job: Future<Output = ()>,
         Commands: Stream<Item = Command>,
     {
         enum State {
+            Starting,
             Working,
             Waiting,
             Terminated,
         }
 
-        let mut state = State::Working;
+        let mut state = State::Starting;
         let mut commands = pin!(commands);
 
         loop {
             match state {
+                State::Starting => {
+                    state = select! {
+                        command = commands.next() => match command {
+                            Some(Command::Wait | Command::Interrupt) => State::Working,
+                            None => State::Terminated,
+                        },
+                        _ = time::sleep(start_delay) => State::Working,
+                    };
+                }
                 State::Working => {
                     state = State::Waiting;
 
@@ -1,18 +1,28 @@
 use super::{
     super::{Credentials, RepositoryMonitor, Shared},
-    prune, unlock,
-    utils::Counter,
+    prune, scan, unlock,
+    utils::{self, Command, Counter},
 };
 use crate::{
-    access_control::AccessSecrets, crypto::sign, db, protocol::test_utils::Snapshot,
-    store::SnapshotWriter, version_vector::VersionVector,
+    access_control::AccessSecrets, blob::BlockIds, block_tracker::OfferState, crypto::sign, db,
+    protocol::test_utils::Snapshot, store::SnapshotWriter, version_vector::VersionVector,
 };
 use assert_matches::assert_matches;
+use camino::Utf8Path;
 use futures_util::TryStreamExt;
 use metrics::NoopRecorder;
 use rand::{rngs::StdRng, SeedableRng};
 use state_monitor::StateMonitor;
+use std::{
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
+    time::Duration,
+};
 use tempfile::TempDir;
+use tokio::{sync::mpsc, time};
+use tokio_stream::wrappers::UnboundedReceiverStream;
 
 #[tokio::test]
 async fn prune() {
@@ -163,6 +173,106 @@ async fn prune() {
     );
 }
 
+#[tokio::test]
+async fn scan_directory_in_conflict_with_file() {
+    let mut rng = StdRng::from_entropy();
+    let (_base_dir, shared) = setup(&mut rng).await;
+    let keys = shared.credentials.read().unwrap().secrets.keys().unwrap();
+
+    // Local branch has directory "a" with a file in it...
+    let local_branch = shared.local_branch().unwrap();
+    let mut dir = local_branch
+        .ensure_directory_exists(Utf8Path::new("a"))
+        .await
+        .unwrap();
+    let mut file = dir.create_file("file.txt".into()).await.unwrap();
+    file.write_all(b"hello").await.unwrap();
+    file.flush().await.unwrap();
+    let blob_id = *file.blob_id();
+    drop(file);
+
+    // ...and a concurrent remote branch has file "a".
+    let remote_id = sign::Keypair::generate(&mut rng).public_key();
+    let remote_branch = shared.get_branch(remote_id).unwrap().reopen(keys);
+    let mut root = remote_branch.open_or_create_root().await.unwrap();
+    let mut file = root.create_file("a".into()).await.unwrap();
+    file.flush().await.unwrap();
+    drop(file);
+
+    // Make the block of the file in the directory missing.
+    let (block_id, _) = BlockIds::open(local_branch, blob_id)
+        .await
+        .unwrap()
+        .try_next()
+        .await
+        .unwrap()
+        .unwrap();
+
+    let mut tx = shared.vault.store().begin_write().await.unwrap();
+    tx.remove_block(&block_id).await.unwrap();
+    tx.commit().await.unwrap();
+
+    scan::run(&shared, &Counter::new()).await.unwrap();
+
+    // The missing block is required even though its directory is in conflict with a file.
+    let client = shared.vault.block_tracker.client();
+    client.register(block_id, OfferState::Approved);
+    assert_eq!(
+        client.offers().try_next().map(|offer| *offer.block_id()),
+        Some(block_id)
+    );
+}
+
+#[tokio::test(start_paused = true)]
+async fn job_starts_after_delay() {
+    let (_command_tx, runs) = spawn_job(Duration::from_secs(5));
+
+    time::sleep(Duration::from_secs(4)).await;
+    assert_eq!(runs.load(Ordering::Relaxed), 0);
+
+    time::sleep(Duration::from_secs(2)).await;
+    assert_eq!(runs.load(Ordering::Relaxed), 1);
+}
+
+#[tokio::test(start_paused = true)]
+async fn job_starts_on_command_before_delay() {
+    let (command_tx, runs) = spawn_job(Duration::from_secs(5));
+
+    command_tx.send(Command::Wait).unwrap();
+
+    time::sleep(Duration::from_secs(1)).await;
+    assert_eq!(runs.load(Ordering::Relaxed), 1);
+}
+
+#[tokio::test(start_paused = true)]
+async fn job_starts_immediately_without_delay() {
+    let (_command_tx, runs) = spawn_job(Duration::ZERO);
+
+    time::sleep(Duration::from_millis(1)).await;
+    assert_eq!(runs.load(Ordering::Relaxed), 1);
+}
+
+// Spawns `utils::run` with a job that counts how many times it ran.
+fn spawn_job(start_delay: Duration) -> (mpsc::UnboundedSender<Command>, Arc<AtomicUsize>) {
+    let (command_tx, command_rx) = mpsc::unbounded_channel();
+    let runs = Arc::new(AtomicUsize::new(0));
+
+    tokio::spawn({
+        let runs = runs.clone();
+
+        utils::run(
+            move || {
+                runs.fetch_add(1, Ordering::Relaxed);
+                async {}
+            },
+            UnboundedReceiverStream::new(command_rx),
+            start_delay,
+        )
+    });
+
+    (command_tx, runs)
+}
+
 async fn setup(rng: &mut StdRng) -> (TempDir, Shared) {
     crate::test_utils::init_log();
 
@@ -1,17 +1,29 @@
-use super::error::Error;
+use super::{block_files::BlockFiles, error::Error};
 use crate::{
+    collections::HashSet,
     db,
     protocol::{Block, BlockContent, BlockId, BlockNonce, BLOCK_SIZE},
 };
-use sqlx::Row;
+use sqlx::{QueryBuilder, Row};
+
+// Max number of blocks written by a single multi-row `INSERT` statement. Each row binds three
+// parameters so this keeps the statement well below the SQLite bound parameters limit.
+const MAX_WRITE_BATCH: usize = 256;
+
+// Max number of block ids in a single `IN (...)` list.
+pub(super) const MAX_ID_BATCH: usize = 512;
 
 /// Reads a block from the store into a buffer.
 ///
+/// Blocks whose content is stored outside of the db (it's empty in the db) are read from
+/// `files`.
+///
 /// # Panics
 ///
 /// Panics if `buffer` length is less than [`BLOCK_SIZE`].
 pub(super) async fn read(
     conn: &mut db::Connection,
+    files: Option<&BlockFiles>,
     id: &BlockId,
     content: &mut BlockContent,
 ) -> Result<BlockNonce, Error> {
@@ -32,7 +44,151 @@ pub(super) async fn read(
     let nonce: &[u8] = row.get(0);
     let nonce = BlockNonce::try_from(nonce).map_err(|_| Error::MalformedData)?;
 
-    let src_content: &[u8] = row.get(1);
+    decode_content(files, id, row.get(1), content).await?;
+
+    Ok(nonce)
+}
+
+/// Reads multiple blocks from the store using as few statements as possible. Returns the found
+/// blocks as `(id, nonce, content)` triples in unspecified order. Blocks not found are omitted from
+/// the result.
+pub(super) async fn read_many(
+    conn: &mut db::Connection,
+    files: Option<&BlockFiles>,
+    ids: &[BlockId],
+) -> Result<Vec<(BlockId, BlockNonce, BlockContent)>, Error> {
+    let mut blocks = Vec::with_capacity(ids.len());
+
+    for chunk in ids.chunks(MAX_ID_BATCH) {
+        let mut builder = QueryBuilder::new("SELECT id, nonce, content FROM blocks WHERE id IN (");
+
+        let mut separated = builder.separated(", ");
+        for id in chunk {
+            separated.push_bind(id);
+        }
+
+        builder.push(")");
+
+        let rows = builder.build().fetch_all(&mut *conn).await?;
+
+        for row in rows {
+            let id: BlockId = row.get(0);
+
+            let nonce: &[u8] = row.get(1);
+            let nonce = BlockNonce::try_from(nonce).map_err(|_| Error::MalformedData)?;
+
+            let mut content = BlockContent::new();
+
+            match decode_content(files, &id, row.get(2), &mut content).await {
+                Ok(()) => (),
+                // The file might have been removed concurrently.
+                Err(Error::BlockNotFound) => continue,
+                Err(error) => return Err(error),
+            }
+
+            blocks.push((id, nonce, content));
+        }
+    }
+
+    Ok(blocks)
+}
+
+/// Writes multiple blocks into the store using multi-row inserts. Blocks that already exist are
+/// skipped. If `files` is `Some`, the block contents are stored there and only the ids and nonces
+/// go into the db.
+///
+/// # Panics
+///
+/// Panics if any block content length is not equal to [`BLOCK_SIZE`].
+pub(super) async fn write_many(
+    tx: &mut db::WriteTransaction,
+    files: Option<&BlockFiles>,
+    blocks: &[Block],
+) -> Result<(), Error> {
+    for block in blocks {
+        assert_eq!(
+            block.content.len(),
+            BLOCK_SIZE,
+            "incorrect buffer length for block write"
+        );
+    }
+
+    // Write the files first so that when the db rows become visible (on commit) the files already
+    // exist.
+    if let Some(files) = files {
+        files
+            .write(
+                blocks
+                    .iter()
+                    .map(|block| (block.id, block.content.clone()))
+                    .collect(),
+            )
+            .await?;
+    }
+
+    for chunk in blocks.chunks(MAX_WRITE_BATCH) {
+        let mut builder = QueryBuilder::new("INSERT INTO blocks (id, nonce, content) ");
+
+        builder.push_values(chunk, |mut row, block| {
+            row.push_bind(&block.id).push_bind(&block.nonce[..]);
+
+            if files.is_some() {
+                row.push_bind(&b""[..]);
+            } else {
+                row.push_bind(&block.content[..]);
+            }
+        });
+
+        builder.push(" ON CONFLICT (id) DO NOTHING");
+        builder.build().execute(&mut *tx).await?;
+    }
+
+    Ok(())
+}
+
+/// Out of the given block ids, returns those whose content is stored outside of the db.
+pub(super) async fn load_external(
+    conn: &mut db::Connection,
+    ids: &[BlockId],
+) -> Result<HashSet<BlockId>, Error> {
+    let mut output = HashSet::default();
+
+    for chunk in ids.chunks(MAX_ID_BATCH) {
+        let mut builder =
+            QueryBuilder::new("SELECT id FROM blocks WHERE length(content) = 0 AND id IN (");
+
+        let mut separated = builder.separated(", ");
+        for id in chunk {
+            separated.push_bind(id);
+        }
+
+        builder.push(")");
+
+        let rows = builder.build().fetch_all(&mut *conn).await?;
+        output.extend(rows.into_iter().map(|row| row.get::<BlockId, _>(0)));
+    }
+
+    Ok(output)
+}
+
+async fn decode_content(
+    files: Option<&BlockFiles>,
+    id: &BlockId,
+    src_content: &[u8],
+    dst_content: &mut BlockContent,
+) -> Result<(), Error> {
+    if src_content.is_empty() {
+        return if let Some(files) = files {
+            files.read(id, dst_content).await
+        } else {
+            tracing::error!(
+                ?id,
+                "Block content stored externally but no block files configured"
+            );
+            Err(Error::MalformedData)
+        };
+    }
+
     if src_content.len() != BLOCK_SIZE {
         tracing::error!(
             expected = BLOCK_SIZE,
@@ -42,9 +198,9 @@ pub(super) async fn read(
         return Err(Error::MalformedData);
     }
 
-    content.copy_from_slice(src_content);
+    dst_content.copy_from_slice(src_content);
 
-    Ok(nonce)
+    Ok(())
 }
 
 /// Writes a block into the store.
@@ -55,6 +211,7 @@ pub(super) async fn read(
 ///
 /// Panics if buffer length is not equal to [`BLOCK_SIZE`].
 ///
+#[cfg(test)]
 pub(super) async fn write(tx: &mut db::WriteTransaction, block: &Block) -> Result<(), Error> {
     assert_eq!(
         block.content.len(),
@@ -85,6 +242,26 @@ pub(super) async fn remove(tx: &mut db::WriteTransaction, id: &BlockId) -> Resul
     Ok(())
 }
 
+/// Removes multiple blocks from the store using as few statements as possible.
+pub(super) async fn remove_many(
+    tx: &mut db::WriteTransaction,
+    ids: &[BlockId],
+) -> Result<(), Error> {
+    for chunk in ids.chunks(MAX_ID_BATCH) {
+        let mut builder = QueryBuilder::new("DELETE FROM blocks WHERE id IN (");
+
+        let mut separated = builder.separated(", ");
+        for id in chunk {
+            separated.push_bind(id);
+        }
+
+        builder.push(")");
+        builder.build().execute(&mut *tx).await?;
+    }
+
+    Ok(())
+}
+
 /// Returns the total number of blocks in the store.
 pub(super) async fn count(conn: &mut db::Connection) -> Result<u64, Error> {
     Ok(db::decode_u64(
@@ -121,7 +298,7 @@ mod tests {
         write(&mut tx, &block).await.unwrap();
 
         let mut content = BlockContent::new();
-        read(&mut tx, &block.id, &mut content).await.unwrap();
+        read(&mut tx, None, &block.id, &mut content).await.unwrap();
 
         assert_eq!(&content[..], &block.content[..]);
     }
@@ -136,7 +313,7 @@ mod tests {
 
         let mut conn = pool.acquire().await.unwrap();
 
-        match read(&mut conn, &id, &mut content).await {
+        match read(&mut conn, None, &id, &mut content).await {
             Err(Error::BlockNotFound) => (),
             Err(error) => panic!("unexpected error: {:?}", error),
             Ok(_) => panic!("unexpected success"),
@@ -155,6 +332,46 @@ mod tests {
         write(&mut tx, &block).await.unwrap();
     }
 
+    #[tokio::test(flavor = "multi_thread")]
+    async fn write_read_and_remove_many_blocks() {
+        let (_base_dir, pool) = setup().await;
+
+        // More than one batch to exercise the chunking.
+        let blocks: Vec<Block> = (0..MAX_WRITE_BATCH + 1).map(|_| rand::random()).collect();
+        let ids: Vec<_> = blocks.iter().map(|block| block.id).collect();
+
+        let mut tx = pool.begin_write().await.unwrap();
+
+        write_many(&mut tx, None, &blocks).await.unwrap();
+        // Writing already existing blocks is a no-op.
+        write_many(&mut tx, None, &blocks[..2]).await.unwrap();
+
+        assert_eq!(count(&mut tx).await.unwrap(), blocks.len() as u64);
+
+        let missing_id = rand::random();
+        let mut read_ids = ids.clone();
+        read_ids.push(missing_id);
+
+        let mut read_blocks = read_many(&mut tx, None, &read_ids).await.unwrap();
+        read_blocks.sort_by_key(|(id, _, _)| *id);
+
+        let mut expected_blocks = blocks.clone();
+        expected_blocks.sort_by_key(|block| block.id);
+
+        assert_eq!(read_blocks.len(), expected_blocks.len());
+
+        for ((id, nonce, content), block) in read_blocks.iter().zip(&expected_blocks) {
+            assert_eq!(*id, block.id);
+            assert_eq!(nonce, &block.nonce);
+            assert_eq!(&content[..], &block.content[..]);
+        }
+
+        remove_many(&mut tx, &ids[1..]).await.unwrap();
+
+        assert_eq!(count(&mut tx).await.unwrap(), 1);
+        assert!(exists(&mut tx, &ids[0]).await.unwrap());
+    }
+
     async fn setup() -> (TempDir, db::Pool) {
         db::create_temp().await.unwrap()
     }
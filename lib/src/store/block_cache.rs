@@ -0,0 +1,201 @@
+use crate::{
+    collections::hash_map::RandomState,
+    protocol::{BlockContent, BlockId, BLOCK_SIZE},
+};
+use lru::LruCache;
+use metrics::{Counter, Histogram};
+use std::{
+    num::NonZeroUsize,
+    sync::{Arc, Mutex, OnceLock},
+    time::Duration,
+};
+
+/// Default memory budget of the block cache, in bytes.
+pub(super) const DEFAULT_BLOCK_CACHE_CAPACITY: u64 = 8 * 1024 * 1024; // 256 blocks
+
+/// Size-bounded LRU cache of decrypted block contents, shared by all blobs of a repository.
+///
+/// Blocks are immutable and content-addressed so a given `BlockId` always maps to the same
+/// plaintext. This means the cache never needs to be invalidated on writes, only on block removal.
+#[derive(Clone)]
+pub(super) struct BlockCache {
+    inner: Arc<Mutex<Inner>>,
+    // Kept outside of `inner` so recording it (on every block decryption) doesn't need the lock.
+    decrypt_time: Arc<OnceLock<Histogram>>,
+}
+
+struct Inner {
+    // `None` means the cache is disabled (capacity is zero).
+    blocks: Option<LruCache<BlockId, BlockContent, RandomState>>,
+    hits: Counter,
+    misses: Counter,
+}
+
+impl BlockCache {
+    /// Creates a cache with the given memory budget in bytes. Zero disables the cache.
+    pub fn new(capacity: u64) -> Self {
+        Self {
+            inner: Arc::new(Mutex::new(Inner {
+                blocks: capacity_to_blocks(capacity)
+                    .map(|capacity| LruCache::with_hasher(capacity, RandomState::default())),
+                hits: Counter::noop(),
+                misses: Counter::noop(),
+            })),
+            decrypt_time: Arc::new(OnceLock::new()),
+        }
+    }
+
+    /// Returns a copy of the decrypted content of the given block, if cached.
+    pub fn get(&self, id: &BlockId) -> Option<BlockContent> {
+        let mut inner = self.inner.lock().unwrap();
+        let content = inner
+            .blocks
+            .as_mut()
+            .and_then(|blocks| blocks.get(id))
+            .cloned();
+
+        if content.is_some() {
+            inner.hits.increment(1);
+        } else {
+            inner.misses.increment(1);
+        }
+
+        content
+    }
+
+    /// Checks whether the given block is cached without affecting its recency or the hit/miss
+    /// counters.
+    pub fn contains(&self, id: &BlockId) -> bool {
+        self.inner
+            .lock()
+            .unwrap()
+            .blocks
+            .as_ref()
+            .map(|blocks| blocks.contains(id))
+            .unwrap_or(false)
+    }
+
+    /// Inserts the decrypted content of the given block into the cache, potentially evicting the
+    /// least recently used block.
+    pub fn insert(&self, id: BlockId, content: &BlockContent) {
+        if let Some(blocks) = &mut self.inner.lock().unwrap().blocks {
+            blocks.put(id, content.clone());
+        }
+    }
+
+    /// Removes the given block from the cache.
+    pub fn remove(&self, id: &BlockId) {
+        if let Some(blocks) = &mut self.inner.lock().unwrap().blocks {
+            blocks.pop(id);
+        }
+    }
+
+    /// Changes the memory budget (in bytes) of the cache, evicting blocks if necessary. Zero
+    /// disables the cache.
+    pub fn set_capacity(&self, capacity: u64) {
+        let mut inner = self.inner.lock().unwrap();
+
+        match (capacity_to_blocks(capacity), &mut inner.blocks) {
+            (Some(capacity), Some(blocks)) => blocks.resize(capacity),
+            (Some(capacity), blocks @ None) => {
+                *blocks = Some(LruCache::with_hasher(capacity, RandomState::default()))
+            }
+            (None, blocks) => *blocks = None,
+        }
+    }
+
+    /// Returns the current memory budget (in bytes) of the cache.
+    pub fn capacity(&self) -> u64 {
+        self.inner
+            .lock()
+            .unwrap()
+            .blocks
+            .as_ref()
+            .map(|blocks| blocks.cap().get() as u64 * BLOCK_SIZE as u64)
+            .unwrap_or(0)
+    }
+
+    /// Sets the counters to report cache hits and misses to and the histogram to report the time
+    /// to decrypt the blocks (that is, the cost of a miss) to. The histogram can be set only once,
+    /// subsequent calls keep the original one.
+    pub fn set_metrics(&self, hits: Counter, misses: Counter, decrypt_time: Histogram) {
+        let mut inner = self.inner.lock().unwrap();
+        inner.hits = hits;
+        inner.misses = misses;
+
+        self.decrypt_time.set(decrypt_time).ok();
+    }
+
+    /// Records the time it took to decrypt a block read from the db. Does nothing if the metrics
+    /// haven't been set.
+    pub fn record_decrypt_time(&self, time: Duration) {
+        if let Some(decrypt_time) = self.decrypt_time.get() {
+            decrypt_time.record(time);
+        }
+    }
+}
+
+fn capacity_to_blocks(capacity: u64) -> Option<NonZeroUsize> {
+    NonZeroUsize::new(
+        (capacity / BLOCK_SIZE as u64)
+            .try_into()
+            .unwrap_or(usize::MAX),
+    )
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn insert_and_get() {
+        let cache = BlockCache::new(DEFAULT_BLOCK_CACHE_CAPACITY);
+
+        let id: BlockId = rand::random();
+        let content: BlockContent = rand::random();
+
+        assert!(cache.get(&id).is_none());
+
+        cache.insert(id, &content);
+        assert_eq!(&cache.get(&id).unwrap()[..], &content[..]);
+
+        cache.remove(&id);
+        assert!(cache.get(&id).is_none());
+    }
+
+    #[test]
+    fn evict_least_recently_used() {
+        let cache = BlockCache::new(2 * BLOCK_SIZE as u64);
+
+        let ids: [BlockId; 3] = rand::random();
+        let content: BlockContent = rand::random();
+
+        cache.insert(ids[0], &content);
+        cache.insert(ids[1], &content);
+
+        // Touch the first one so the second one becomes the least recently used.
+        assert!(cache.get(&ids[0]).is_some());
+
+        cache.insert(ids[2], &content);
+
+        assert!(cache.get(&ids[0]).is_some());
+        assert!(cache.get(&ids[1]).is_none());
+        assert!(cache.get(&ids[2]).is_some());
+    }
+
+    #[test]
+    fn zero_capacity_disables_cache() {
+        let cache = BlockCache::new(0);
+
+        let id: BlockId = rand::random();
+        let content: BlockContent = rand::random();
+
+        cache.insert(id, &content);
+        assert!(cache.get(&id).is_none());
+
+        cache.set_capacity(BLOCK_SIZE as u64);
+        cache.insert(id, &content);
+        assert!(cache.get(&id).is_some());
+        assert_eq!(cache.capacity(), BLOCK_SIZE as u64);
+    }
+}
@@ -1,7 +1,7 @@
 use super::{block, error::Error, index, leaf_node, root_node};
 use crate::{
     block_tracker::BlockTracker as BlockDownloadTracker,
-    collections::{hash_map, HashMap, HashSet},
+    collections::{HashMap, HashSet},
     crypto::sign::PublicKey,
     db,
     future::TryStreamExt as _,
@@ -10,20 +10,46 @@ use crate::{
 };
 use deadlock::BlockingMutex;
 use futures_util::{StreamExt, TryStreamExt};
+use metrics::{Counter, Gauge};
 use scoped_task::{self, ScopedJoinHandle};
 use sqlx::Row;
-use std::{
-    collections::{btree_map, BTreeMap},
-    sync::Arc,
-    time::{Duration, SystemTime},
+use std::{collections::VecDeque, mem, sync::Arc, time::Duration};
+use tokio::{
+    select,
+    sync::watch,
+    time::{self, Instant},
 };
-use tokio::{select, sync::watch, time::sleep};
 use tracing::{Instrument, Span};
 
+/// Number of buckets the expiration time is divided into. Blocks are expired a whole bucket at a
+/// time so a block expires at most `expiration_time / BUCKETS_PER_EXPIRATION` late.
+const BUCKETS_PER_EXPIRATION: u32 = 64;
+
+/// Min duration of a bucket, to not create a bucket for every block update when the expiration
+/// time is very short.
+const MIN_BUCKET_DURATION: Duration = Duration::from_millis(1);
+
+/// Max number of blocks expired (or set as missing) in a single write transaction.
+const BATCH_SIZE: usize = 256;
+
+/// Min time between two full batches. Limits the rate of the write transactions (and thus their
+/// impact on the other writers) when a lot of blocks expire at the same time (e.g., when all the
+/// blocks loaded on startup expire together).
+const BATCH_INTERVAL: Duration = Duration::from_millis(50);
+
+/// Stale entries in the buckets are removed once there is more than this many of them and they
+/// outnumber the tracked blocks.
+const MIN_STALE_ENTRIES_TO_COMPACT: usize = 1024;
+
 /// This structure keeps track (in memory) of which blocks are currently in the database. To each
 /// one block it assigns a time when it should expire to free space. Once a block is expired, it is
 /// removed from the DB and its state is changed from "Present" to "Expired" in the index.
 ///
+/// The blocks are grouped into time buckets (a timing wheel with a single level, as all the blocks
+/// share the same expiration time) by the time they were last updated. Each block is stored once
+/// in the map of the tracked blocks and once in the bucket of its last update. The buckets are
+/// processed in order and the expired blocks removed in batches, in rate-limited transactions.
+///
 /// One tricky thing in implementing this structure properly is to ensure the following invariant
 /// holds:
 ///
@@ -41,12 +67,11 @@ use tracing::{Instrument, Span};
 /// 2. The removal of a block from the expiration tracker is done, but removal from the database
 ///    fails.
 ///
-/// For more information about the first case, see the `expiration_race` test below. To ensure it
-/// doesn't happen we assign to each "add" and "remove" DB operation a db::TransactionId and then
-/// require that no "remove" operation swaps order with an "add" operation.
+/// The first case is checked by the `atomicity` test below, which runs many concurrent block
+/// insertions and removals.
 ///
-/// The second case is enforced by requiring db::CommitId when invoking the "remove" operation to
-/// ensure the block has already been successfully removed from the DB.
+/// The second case is prevented by untracking the blocks only after the transaction that removed
+/// them from the DB has been successfully committed (see `UntrackTransaction`).
 pub(crate) struct BlockExpirationTracker {
     shared: Arc<BlockingMutex<Shared>>,
     watch_tx: uninitialized_watch::Sender<()>,
@@ -60,12 +85,9 @@ impl BlockExpirationTracker {
         expiration_time: Duration,
         block_download_tracker: BlockDownloadTracker,
         client_reload_index_tx: broadcast_hash_set::Sender<PublicKey>,
+        metrics: BlockExpirationMetrics,
     ) -> Result<Self, Error> {
-        let mut shared = Shared {
-            blocks_by_id: Default::default(),
-            blocks_by_expiration: Default::default(),
-            to_missing_if_expired: Default::default(),
-        };
+        let mut shared = Shared::new(bucket_duration(expiration_time), metrics.clone());
 
         let mut tx = pool.begin_read().await?;
 
@@ -75,7 +97,7 @@ impl BlockExpirationTracker {
                 .fetch(&mut tx)
                 .map_ok(|row| row.get(0));
 
-        let now = SystemTime::now();
+        let now = Instant::now();
 
         while let Some(id) = ids.next().await {
             shared.insert_block(&id?, now);
@@ -98,6 +120,7 @@ impl BlockExpirationTracker {
                     expiration_time_rx,
                     block_download_tracker,
                     client_reload_index_tx,
+                    metrics.expired_blocks,
                 )
                 .await
                 {
@@ -116,9 +139,10 @@ impl BlockExpirationTracker {
     }
 
     pub fn handle_block_update(&self, block_id: &BlockId, is_missing: bool) {
-        // Not inlining these lines to call `SystemTime::now()` only once the `lock` is acquired.
+        // Not inlining these lines to call `Instant::now()` only once the `lock` is acquired (which
+        // keeps the bucket indices of the updates monotonic).
         let mut lock = self.shared.lock().unwrap();
-        lock.insert_block(block_id, SystemTime::now());
+        lock.insert_block(block_id, Instant::now());
         if is_missing {
             lock.to_missing_if_expired.insert(*block_id);
         }
@@ -127,6 +151,10 @@ impl BlockExpirationTracker {
     }
 
     pub fn set_expiration_time(&self, expiration_time: Duration) {
+        self.shared
+            .lock()
+            .unwrap()
+            .set_bucket_duration(bucket_duration(expiration_time));
         self.expiration_time_tx.send(expiration_time).unwrap_or(());
     }
 
@@ -147,6 +175,27 @@ impl BlockExpirationTracker {
     }
 }
 
+/// Metrics reported by the `BlockExpirationTracker`.
+#[derive(Clone)]
+pub(crate) struct BlockExpirationMetrics {
+    /// Number of tracked blocks.
+    pub tracked_blocks: Gauge,
+    /// Estimated memory used by the tracker (in bytes).
+    pub memory: Gauge,
+    /// Total number of expired blocks.
+    pub expired_blocks: Counter,
+}
+
+impl BlockExpirationMetrics {
+    pub fn noop() -> Self {
+        Self {
+            tracked_blocks: Gauge::noop(),
+            memory: Gauge::noop(),
+            expired_blocks: Counter::noop(),
+        }
+    }
+}
+
 /// This struct is used to stop tracking blocks inside the BlockExpirationTracker. The reason for
 /// "untracking" blocks in a transaction - as opposed to just removing blocks through a simple
 /// BlockExpirationTracker method - is that we only want to actually untrack a block once it's been
@@ -174,109 +223,329 @@ impl UntrackTransaction {
         for block_id in &self.block_ids {
             shared.remove_block(block_id);
         }
+
+        shared.compact_if_needed();
     }
 }
 
+fn bucket_duration(expiration_time: Duration) -> Duration {
+    (expiration_time / BUCKETS_PER_EXPIRATION).max(MIN_BUCKET_DURATION)
+}
+
 // For semantics
-type TimeUpdated = SystemTime;
+type BucketIndex = u64;
 
 struct Shared {
-    // Invariant #1: There exists `(block, time_updated)` in `blocks_by_id` *iff*
-    // there exists `block` in `blocks_by_expiration[time_updated]`.
+    // Start of the bucket with index 0.
+    epoch: Instant,
+    // Determined by the expiration time. Changing the expiration time moves the blocks into the
+    // buckets of the new duration (see `set_bucket_duration`).
+    bucket_duration: Duration,
+
+    // Invariant #1: For every `(block, index)` in `blocks_by_id` there exists a bucket with
+    // `index` that contains `block`.
+    //
+    // Invariant #2: The buckets are ordered by their indices (oldest first), there is at most one
+    // bucket with any given index and no bucket is empty.
     //
-    // Invariant #2: `blocks_by_expiration[x]` is never empty for any `x`.
+    // A block in a bucket other than the one in `blocks_by_id` (because the block has been updated
+    // since or is no longer tracked) is stale and is skipped when the bucket expires. The stale
+    // entries are periodically removed (see `compact_if_needed`) so they don't grow unbounded.
     //
-    blocks_by_id: HashMap<BlockId, TimeUpdated>,
-    blocks_by_expiration: BTreeMap<TimeUpdated, HashSet<BlockId>>,
+    blocks_by_id: HashMap<BlockId, BucketIndex>,
+    buckets: VecDeque<Bucket>,
+    // Total number of entries in all the buckets, including the stale ones.
+    bucket_entries: usize,
 
     to_missing_if_expired: HashSet<BlockId>,
+
+    metrics: BlockExpirationMetrics,
+}
+
+struct Bucket {
+    index: BucketIndex,
+    blocks: Vec<BlockId>,
 }
 
 impl Shared {
-    /// Add the `block` into `Self`. If it's already there, remove it and add it back with the new
-    /// time stamp.
-    fn insert_block(&mut self, block: &BlockId, ts: TimeUpdated) {
-        // Asserts and unwraps are OK due to the `Shared` invariants defined above.
-        match self.blocks_by_id.entry(*block) {
-            hash_map::Entry::Occupied(mut entry) => {
-                let old_ts = *entry.get();
-                if old_ts == ts {
-                    return;
-                }
+    fn new(bucket_duration: Duration, metrics: BlockExpirationMetrics) -> Self {
+        Self {
+            epoch: Instant::now(),
+            bucket_duration,
+            blocks_by_id: HashMap::default(),
+            buckets: VecDeque::new(),
+            bucket_entries: 0,
+            to_missing_if_expired: HashSet::default(),
+            metrics,
+        }
+    }
+
+    /// Add the `block` into `Self`. If it's already there, move it to the bucket corresponding to
+    /// `now`.
+    fn insert_block(&mut self, block: &BlockId, now: Instant) {
+        let index = self.bucket_index(now);
+        // `now` should never go backwards but make sure the buckets stay ordered even if it did.
+        let index = self
+            .buckets
+            .back()
+            .map(|bucket| bucket.index.max(index))
+            .unwrap_or(index);
+
+        if self.blocks_by_id.insert(*block, index) == Some(index) {
+            return;
+        }
+
+        match self.buckets.back_mut() {
+            Some(bucket) if bucket.index == index => bucket.blocks.push(*block),
+            _ => self.buckets.push_back(Bucket {
+                index,
+                blocks: vec![*block],
+            }),
+        }
+
+        self.bucket_entries += 1;
+
+        self.compact_if_needed();
+        self.update_metrics();
+    }
+
+    fn remove_block(&mut self, block: &BlockId) {
+        self.blocks_by_id.remove(block);
+        self.update_metrics();
+    }
+
+    /// Changes the duration of the buckets and moves the tracked blocks into the new buckets, so
+    /// the blocks keep expiring at most one bucket late after the expiration time changes. A block
+    /// is moved into the new bucket that contains the end of its old bucket, so it never expires
+    /// earlier than it would have before. Drops the stale entries as well.
+    fn set_bucket_duration(&mut self, bucket_duration: Duration) {
+        if bucket_duration == self.bucket_duration {
+            return;
+        }
+
+        let old_duration = self.bucket_duration.as_nanos();
+        let new_duration = bucket_duration.as_nanos();
+        let blocks_by_id = &mut self.blocks_by_id;
+        let mut buckets: VecDeque<Bucket> = VecDeque::with_capacity(self.buckets.len());
+
+        for mut bucket in mem::take(&mut self.buckets) {
+            bucket
+                .blocks
+                .retain(|block| blocks_by_id.get(block) == Some(&bucket.index));
+
+            // The index of the new bucket is non-decreasing in the old index, which maintains
+            // invariant #2.
+            let index = (((bucket.index as u128 + 1) * old_duration - 1) / new_duration)
+                .try_into()
+                .unwrap_or(BucketIndex::MAX);
+
+            for block in &bucket.blocks {
+                blocks_by_id.insert(*block, index);
+            }
+
+            match buckets.back_mut() {
+                Some(last) if last.index == index => last.blocks.append(&mut bucket.blocks),
+                _ if bucket.blocks.is_empty() => (),
+                _ => buckets.push_back(Bucket {
+                    index,
+                    blocks: bucket.blocks,
+                }),
+            }
+        }
+
+        self.buckets = buckets;
+        self.bucket_entries = self.buckets.iter().map(|bucket| bucket.blocks.len()).sum();
+        self.bucket_duration = bucket_duration;
+
+        self.update_metrics();
+    }
+
+    /// Removes and returns up to `limit` blocks from the buckets that have expired by `now`. The
+    /// blocks are returned together with the index of their bucket and are still tracked until
+    /// they are passed to `remove_expired`.
+    fn take_expired(
+        &mut self,
+        now: Instant,
+        expiration_time: Duration,
+        limit: usize,
+    ) -> Vec<(BlockId, BucketIndex)> {
+        let mut batch = Vec::new();
+
+        while batch.len() < limit {
+            let Some(expires_at) = self.next_expiration(expiration_time) else {
+                break;
+            };
+
+            if expires_at > now {
+                break;
+            }
 
-                entry.insert(ts);
+            // Unwrap OK because `next_expiration` returned `Some`.
+            let bucket = self.buckets.front_mut().unwrap();
 
-                let mut entry = match self.blocks_by_expiration.entry(old_ts) {
-                    btree_map::Entry::Occupied(entry) => entry,
-                    btree_map::Entry::Vacant(_) => unreachable!(),
+            while batch.len() < limit {
+                let Some(block) = bucket.blocks.pop() else {
+                    break;
                 };
 
-                assert!(entry.get_mut().remove(block));
+                self.bucket_entries -= 1;
 
-                if entry.get().is_empty() {
-                    entry.remove();
+                if self.blocks_by_id.get(&block) == Some(&bucket.index) {
+                    batch.push((block, bucket.index));
                 }
+            }
 
-                assert!(self
-                    .blocks_by_expiration
-                    .entry(ts)
-                    .or_default()
-                    .insert(*block));
+            // Maintain invariant #2.
+            if bucket.blocks.is_empty() {
+                self.buckets.pop_front();
             }
-            hash_map::Entry::Vacant(entry) => {
-                assert!(self
-                    .blocks_by_expiration
-                    .entry(ts)
-                    .or_default()
-                    .insert(*block));
-
-                entry.insert(ts);
+        }
+
+        self.update_metrics();
+
+        batch
+    }
+
+    /// Stops tracking the blocks returned from `take_expired`, except those that have been updated
+    /// since.
+    fn remove_expired(&mut self, blocks: &[(BlockId, BucketIndex)]) {
+        for (block, index) in blocks {
+            if self.blocks_by_id.get(block) == Some(index) {
+                self.blocks_by_id.remove(block);
             }
         }
+
+        self.compact_if_needed();
+        self.update_metrics();
     }
 
-    fn remove_block(&mut self, block: &BlockId) {
-        // Asserts and unwraps are OK due to the `Shared` invariants defined above.
-        let Some(time_updated) = self.blocks_by_id.remove(block) else {
+    /// Removes and returns up to `limit` blocks to be set as missing if expired.
+    fn take_to_missing_if_expired(&mut self, limit: usize) -> HashSet<BlockId> {
+        if self.to_missing_if_expired.len() <= limit {
+            return mem::take(&mut self.to_missing_if_expired);
+        }
+
+        let batch: HashSet<_> = self
+            .to_missing_if_expired
+            .iter()
+            .take(limit)
+            .copied()
+            .collect();
+
+        self.to_missing_if_expired
+            .retain(|block| !batch.contains(block));
+
+        batch
+    }
+
+    /// Time when the oldest bucket expires, if any.
+    fn next_expiration(&self, expiration_time: Duration) -> Option<Instant> {
+        let index = self.buckets.front()?.index;
+        let end = Duration::from_nanos(
+            (self.bucket_duration.as_nanos() * (index as u128 + 1))
+                .try_into()
+                .unwrap_or(u64::MAX),
+        );
+
+        Some(self.epoch + end + expiration_time)
+    }
+
+    fn bucket_index(&self, now: Instant) -> BucketIndex {
+        (now.saturating_duration_since(self.epoch).as_nanos() / self.bucket_duration.as_nanos())
+            as BucketIndex
+    }
+
+    /// Removes the stale entries from the buckets if they outnumber the tracked blocks. This
+    /// keeps the memory used by the buckets bounded by about twice the number of tracked blocks
+    /// regardless of how often the blocks are updated.
+    fn compact_if_needed(&mut self) {
+        let stale = self.bucket_entries.saturating_sub(self.blocks_by_id.len());
+
+        if stale < MIN_STALE_ENTRIES_TO_COMPACT || stale < self.blocks_by_id.len() {
             return;
-        };
+        }
 
-        let mut entry = match self.blocks_by_expiration.entry(time_updated) {
-            btree_map::Entry::Occupied(entry) => entry,
-            btree_map::Entry::Vacant(_) => unreachable!(),
-        };
+        let blocks_by_id = &self.blocks_by_id;
+
+        for bucket in &mut self.buckets {
+            bucket
+                .blocks
+                .retain(|block| blocks_by_id.get(block) == Some(&bucket.index));
+            bucket.blocks.shrink_to_fit();
+        }
 
-        assert!(entry.get_mut().remove(block));
+        self.buckets.retain(|bucket| !bucket.blocks.is_empty());
+        self.buckets.shrink_to_fit();
+        self.bucket_entries = self.buckets.iter().map(|bucket| bucket.blocks.len()).sum();
 
-        if entry.get().is_empty() {
-            entry.remove();
+        // The map doesn't shrink by itself after many blocks were untracked.
+        if self.blocks_by_id.capacity() > 2 * self.blocks_by_id.len() {
+            self.blocks_by_id.shrink_to_fit();
         }
+
+        self.update_metrics();
+    }
+
+    /// Estimated memory used by the tracked blocks (in bytes). Counts the hash map slots and the
+    /// bucket entries but not the allocator overhead.
+    fn memory_usage(&self) -> usize {
+        // One control byte per slot in the hash map.
+        let map_slot = mem::size_of::<(BlockId, BucketIndex)>() + 1;
+        let set_slot = mem::size_of::<BlockId>() + 1;
+
+        self.blocks_by_id.capacity() * map_slot
+            + self.buckets.capacity() * mem::size_of::<Bucket>()
+            + self.bucket_entries * mem::size_of::<BlockId>()
+            + self.to_missing_if_expired.capacity() * set_slot
+    }
+
+    fn update_metrics(&self) {
+        self.metrics
+            .tracked_blocks
+            .set(self.blocks_by_id.len() as f64);
+        self.metrics.memory.set(self.memory_usage() as f64);
     }
 
     #[cfg(test)]
     fn assert_invariants(&self) {
-        // #1 =>
-        for (block, ts) in self.blocks_by_id.iter() {
-            assert!(self.blocks_by_expiration.get(ts).unwrap().contains(block));
+        // #1
+        for (block, index) in &self.blocks_by_id {
+            let bucket = self
+                .buckets
+                .iter()
+                .find(|bucket| bucket.index == *index)
+                .unwrap();
+            assert!(bucket.blocks.contains(block));
         }
-        // #1 <=
-        for (ts, blocks) in self.blocks_by_expiration.iter() {
-            for block in blocks.iter() {
-                assert_eq!(self.blocks_by_id.get(block).unwrap(), ts);
-            }
+
+        // #2
+        for (a, b) in self.buckets.iter().zip(self.buckets.iter().skip(1)) {
+            assert!(a.index < b.index);
         }
-        // Degenerate case
+
+        for bucket in &self.buckets {
+            assert!(!bucket.blocks.is_empty());
+        }
+
         assert_eq!(
-            self.blocks_by_id.is_empty(),
-            self.blocks_by_expiration.is_empty()
+            self.bucket_entries,
+            self.buckets
+                .iter()
+                .map(|bucket| bucket.blocks.len())
+                .sum::<usize>()
         );
-        // #2
-        for blocks in self.blocks_by_expiration.values() {
-            assert!(!blocks.is_empty());
-        }
     }
 }
 
+enum Action {
+    // Nothing to do until a block is updated.
+    Wait,
+    // Nothing to do until the given time (or until a block is updated).
+    Sleep(Instant),
+    Expire(Vec<(BlockId, BucketIndex)>),
+    ToMissing(HashSet<BlockId>),
+}
+
 async fn run_task(
     shared: Arc<BlockingMutex<Shared>>,
     pool: db::Pool,
@@ -284,94 +553,97 @@ async fn run_task(
     mut expiration_time_rx: watch::Receiver<Duration>,
     block_download_tracker: BlockDownloadTracker,
     client_reload_index_tx: broadcast_hash_set::Sender<PublicKey>,
+    expired_blocks: Counter,
 ) -> Result<(), Error> {
     loop {
         let expiration_time = *expiration_time_rx.borrow();
 
-        let (ts, block_id) = {
-            enum Enum {
-                OldestEntry(Option<(TimeUpdated, BlockId)>),
-                ToMissing(HashSet<BlockId>),
-            }
+        let action = {
+            let mut lock = shared.lock().unwrap();
 
-            let action = {
-                let mut lock = shared.lock().unwrap();
-
-                if !lock.to_missing_if_expired.is_empty() {
-                    Enum::ToMissing(std::mem::take(&mut lock.to_missing_if_expired))
-                } else {
-                    Enum::OldestEntry(
-                        lock.blocks_by_expiration
-                            .first_entry()
-                            // Unwrap OK due to the invariant #2.
-                            .map(|e| (*e.key(), *e.get().iter().next().unwrap())),
-                    )
-                }
-            };
+            if !lock.to_missing_if_expired.is_empty() {
+                Action::ToMissing(lock.take_to_missing_if_expired(BATCH_SIZE))
+            } else {
+                let now = Instant::now();
 
-            match action {
-                Enum::OldestEntry(Some((time_updated, block_id))) => (time_updated, block_id),
-                Enum::OldestEntry(None) => {
-                    if watch_rx.changed().await.is_err() {
-                        return Ok(());
-                    }
-                    continue;
-                }
-                Enum::ToMissing(to_missing_if_expired) => {
-                    set_as_missing_if_expired(
-                        &pool,
-                        to_missing_if_expired,
-                        &block_download_tracker,
-                        &client_reload_index_tx,
-                    )
-                    .await?;
-                    continue;
+                match lock.next_expiration(expiration_time) {
+                    Some(expires_at) if expires_at > now => Action::Sleep(expires_at),
+                    Some(_) => Action::Expire(lock.take_expired(now, expiration_time, BATCH_SIZE)),
+                    None => Action::Wait,
                 }
             }
         };
 
-        let expires_at = ts + expiration_time;
-        let now = SystemTime::now();
+        let batch_len = match action {
+            Action::Wait => {
+                if watch_rx.changed().await.is_err() {
+                    return Ok(());
+                }
 
-        if expires_at > now {
-            if let Ok(duration) = expires_at.duration_since(now) {
+                continue;
+            }
+            Action::Sleep(until) => {
                 select! {
-                    _ = sleep(duration) => (),
-                    _ = expiration_time_rx.changed() => {
-                        continue;
-                    }
-                    _ = watch_rx.changed() => {
-                        continue;
-                    }
+                    _ = time::sleep_until(until) => (),
+                    _ = expiration_time_rx.changed() => (),
+                    _ = watch_rx.changed() => (),
                 }
+
+                continue;
             }
+            Action::Expire(blocks) => {
+                let len = blocks.len();
+                let count = expire(&pool, &blocks).await?;
 
-            // Check it's still the oldest block.
+                shared.lock().unwrap().remove_expired(&blocks);
+                expired_blocks.increment(count as u64);
 
-            let mut lock = shared.lock().unwrap();
-
-            let first_entry = match lock.blocks_by_expiration.first_entry() {
-                Some(first_entry) => first_entry,
-                None => continue,
-            };
+                len
+            }
+            Action::ToMissing(blocks) => {
+                let len = blocks.len();
+
+                set_as_missing_if_expired(
+                    &pool,
+                    blocks,
+                    &block_download_tracker,
+                    &client_reload_index_tx,
+                )
+                .await?;
 
-            if *first_entry.key() > ts || !first_entry.get().contains(&block_id) {
-                continue;
+                len
             }
+        };
+
+        if batch_len >= BATCH_SIZE {
+            time::sleep(BATCH_INTERVAL).await;
         }
+    }
+}
 
-        let mut tx = pool.begin_write().await?;
+/// Removes the given blocks from the db and marks them as expired in the index, all in a single
+/// transaction. Blocks that are not present in the index are skipped. Returns the number of
+/// removed blocks.
+async fn expire(pool: &db::Pool, blocks: &[(BlockId, BucketIndex)]) -> Result<usize, Error> {
+    // All the blocks in the expired buckets might have been stale.
+    if blocks.is_empty() {
+        return Ok(0);
+    }
+
+    let mut tx = pool.begin_write().await?;
+    let mut expired = Vec::with_capacity(blocks.len());
 
-        if !leaf_node::set_expired_if_present(&mut tx, &block_id).await? {
-            return Ok(());
+    for (block_id, _) in blocks {
+        if leaf_node::set_expired_if_present(&mut tx, block_id).await? {
+            expired.push(*block_id);
         }
+    }
 
-        block::remove(&mut tx, &block_id).await?;
+    block::remove_many(&mut tx, &expired).await?;
 
-        tx.commit().await?;
+    tx.commit().await?;
 
-        shared.lock().unwrap().remove_block(&block_id);
-    }
+    Ok(expired.len())
 }
 
 async fn set_as_missing_if_expired(
@@ -425,24 +697,20 @@ mod test {
     use rand::seq::SliceRandom;
     use rand::Rng;
     use tempfile::TempDir;
-    use tokio::task;
+    use tokio::{task, time::sleep};
 
     #[test]
     fn shared_state() {
-        let mut shared = Shared {
-            blocks_by_id: Default::default(),
-            blocks_by_expiration: Default::default(),
-            to_missing_if_expired: Default::default(),
-        };
+        let mut shared = Shared::new(Duration::from_secs(1), BlockExpirationMetrics::noop());
 
         // add once
 
-        let ts = SystemTime::now();
+        let ts = Instant::now();
         let block: BlockId = rand::random();
 
         shared.insert_block(&block, ts);
 
-        assert_eq!(*shared.blocks_by_id.get(&block).unwrap(), ts,);
+        assert_eq!(*shared.blocks_by_id.get(&block).unwrap(), 0);
         shared.assert_invariants();
 
         shared.remove_block(&block);
@@ -455,7 +723,16 @@ mod test {
         shared.insert_block(&block, ts);
         shared.insert_block(&block, ts);
 
-        assert_eq!(*shared.blocks_by_id.get(&block).unwrap(), ts);
+        assert_eq!(*shared.blocks_by_id.get(&block).unwrap(), 0);
+        assert_eq!(shared.bucket_entries, 2);
+        shared.assert_invariants();
+
+        // update
+
+        shared.insert_block(&block, ts + Duration::from_secs(2));
+
+        assert_eq!(*shared.blocks_by_id.get(&block).unwrap(), 2);
+        assert_eq!(shared.buckets.len(), 2);
         shared.assert_invariants();
 
         shared.remove_block(&block);
@@ -464,6 +741,132 @@ mod test {
         shared.assert_invariants();
     }
 
+    #[test]
+    fn shared_state_expire() {
+        let bucket_duration = Duration::from_secs(1);
+        let expiration_time = Duration::from_secs(10);
+        let mut shared = Shared::new(bucket_duration, BlockExpirationMetrics::noop());
+
+        let start = shared.epoch;
+        let blocks: Vec<BlockId> = (0..10).map(|_| rand::random()).collect();
+
+        for (offset, block) in blocks.iter().enumerate() {
+            shared.insert_block(block, start + bucket_duration * offset as u32);
+        }
+
+        // The first block is updated so it's not expired with its original bucket.
+        shared.insert_block(&blocks[0], start + bucket_duration * 5);
+        shared.assert_invariants();
+
+        assert_eq!(
+            shared.next_expiration(expiration_time),
+            Some(start + bucket_duration + expiration_time)
+        );
+
+        // Buckets 0 to 2 expired
+        let now = start + bucket_duration * 3 + expiration_time;
+        let batch = shared.take_expired(now, expiration_time, usize::MAX);
+        let mut expired: Vec<_> = batch.iter().map(|(block, _)| *block).collect();
+        expired.sort();
+
+        let mut expected = blocks[1..3].to_vec();
+        expected.sort();
+
+        assert_eq!(expired, expected);
+
+        // Still tracked until removed.
+        assert!(shared.blocks_by_id.contains_key(&blocks[1]));
+        shared.remove_expired(&batch);
+        assert!(!shared.blocks_by_id.contains_key(&blocks[1]));
+        assert!(shared.blocks_by_id.contains_key(&blocks[0]));
+        shared.assert_invariants();
+
+        // Batch limit
+        let now = start + bucket_duration * 10 + expiration_time;
+        let batch = shared.take_expired(now, expiration_time, 3);
+        assert_eq!(batch.len(), 3);
+        shared.remove_expired(&batch);
+        shared.assert_invariants();
+
+        let batch = shared.take_expired(now, expiration_time, usize::MAX);
+        assert_eq!(batch.len(), 5);
+        shared.remove_expired(&batch);
+        shared.assert_invariants();
+
+        assert!(shared.blocks_by_id.is_empty());
+        assert!(shared.buckets.is_empty());
+        assert_eq!(shared.next_expiration(expiration_time), None);
+    }
+
+    #[test]
+    fn shared_state_bounded_memory() {
+        let bucket_duration = Duration::from_millis(1);
+        let mut shared = Shared::new(bucket_duration, BlockExpirationMetrics::noop());
+
+        let start = shared.epoch;
+        let blocks: Vec<BlockId> = (0..10).map(|_| rand::random()).collect();
+
+        // Update the same few blocks many times, each time in a different bucket.
+        for i in 0..10 * MIN_STALE_ENTRIES_TO_COMPACT {
+            shared.insert_block(
+                &blocks[i % blocks.len()],
+                start + bucket_duration * i as u32,
+            );
+
+            assert!(shared.bucket_entries <= blocks.len() + MIN_STALE_ENTRIES_TO_COMPACT);
+        }
+
+        shared.assert_invariants();
+        assert_eq!(shared.blocks_by_id.len(), blocks.len());
+    }
+
+    #[test]
+    fn shared_state_change_bucket_duration() {
+        let bucket_duration = Duration::from_secs(1);
+        let mut shared = Shared::new(bucket_duration, BlockExpirationMetrics::noop());
+
+        let start = shared.epoch;
+        let blocks: Vec<BlockId> = (0..8).map(|_| rand::random()).collect();
+
+        for (offset, block) in blocks.iter().enumerate() {
+            shared.insert_block(block, start + bucket_duration * offset as u32);
+        }
+
+        // Stale entry
+        shared.insert_block(&blocks[0], start + bucket_duration * 7);
+
+        // Longer buckets: the old buckets are merged.
+        let expiration_time = Duration::from_secs(256);
+        shared.set_bucket_duration(bucket_duration * 4);
+        shared.assert_invariants();
+
+        assert_eq!(shared.bucket_entries, blocks.len());
+        assert_eq!(shared.buckets.len(), 2);
+        assert_eq!(shared.blocks_by_id.get(&blocks[0]), Some(&1));
+        assert_eq!(shared.blocks_by_id.get(&blocks[1]), Some(&0));
+        assert_eq!(shared.blocks_by_id.get(&blocks[4]), Some(&1));
+
+        // No block expires earlier than it would have in its original bucket.
+        assert_eq!(
+            shared.next_expiration(expiration_time),
+            Some(start + bucket_duration * 4 + expiration_time)
+        );
+
+        // Shorter buckets: each old bucket is moved to the new bucket containing its end.
+        shared.set_bucket_duration(bucket_duration / 2);
+        shared.assert_invariants();
+
+        assert_eq!(shared.buckets.len(), 2);
+        assert_eq!(shared.blocks_by_id.get(&blocks[1]), Some(&7));
+        assert_eq!(shared.blocks_by_id.get(&blocks[0]), Some(&15));
+
+        // Blocks updated after the change go into the buckets of the new duration.
+        shared.insert_block(&blocks[1], start + bucket_duration * 9);
+        shared.assert_invariants();
+
+        assert_eq!(shared.blocks_by_id.get(&blocks[1]), Some(&18));
+    }
+
     async fn setup() -> (TempDir, Store) {
         let (temp_dir, pool) = db::create_temp().await.unwrap();
         (temp_dir, Store::new(pool))
@@ -493,6 +896,7 @@ mod test {
             Duration::from_secs(1),
             BlockDownloadTracker::new(),
             broadcast_hash_set::channel().0,
+            BlockExpirationMetrics::noop(),
         )
         .await
         .unwrap();
@@ -528,6 +932,7 @@ mod test {
                 // expiring in this test.
                 Some(Duration::from_secs(60 * 60 /* one hour */)),
                 BlockDownloadTracker::new(),
+                BlockExpirationMetrics::noop(),
             )
             .await
             .unwrap();
@@ -611,6 +1016,55 @@ mod test {
         }
     }
 
+    #[tokio::test]
+    async fn remove_blocks_in_batches() {
+        crate::test_utils::init_log();
+
+        let count = 2 * BATCH_SIZE + 1;
+
+        let (_base_dir, store) = setup().await;
+        let write_keys = Keypair::random();
+        let branch_id = PublicKey::random();
+
+        let mut tx = store.begin_write().await.unwrap();
+        let mut changeset = Changeset::new();
+
+        for block in rand::thread_rng()
+            .sample_iter::<Block, _>(Standard)
+            .take(count)
+        {
+            changeset.link_block(rand::random(), block.id, SingleBlockPresence::Present);
+            changeset.write_block(block);
+        }
+
+        changeset
+            .apply(&mut tx, &branch_id, &write_keys)
+            .await
+            .unwrap();
+        tx.commit().await.unwrap();
+
+        assert_eq!(count_blocks(store.db()).await, count as u64);
+
+        let _tracker = BlockExpirationTracker::enable_expiration(
+            store.db().clone(),
+            Duration::from_millis(100),
+            BlockDownloadTracker::new(),
+            broadcast_hash_set::channel().0,
+            BlockExpirationMetrics::noop(),
+        )
+        .await
+        .unwrap();
+
+        // Expired in three batches, separated by `BATCH_INTERVAL`.
+        time::timeout(Duration::from_secs(10), async {
+            while count_blocks(store.db()).await > 0 {
+                sleep(Duration::from_millis(10)).await;
+            }
+        })
+        .await
+        .unwrap();
+    }
+
     async fn add_block(
         block: Block,
         write_keys: &Keypair,
@@ -0,0 +1,311 @@
+use super::error::Error;
+use crate::protocol::{BlockContent, BlockId, BLOCK_SIZE};
+use std::{
+    collections::BTreeSet,
+    ffi::OsString,
+    fs, io,
+    path::{Path, PathBuf},
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
+};
+use tokio::task;
+
+/// Number of shard directories the block files are distributed into.
+pub(super) const SHARD_COUNT: usize = 256;
+
+const TEMP_SUFFIX: &str = ".tmp";
+
+/// Returns the directory where the block files of the repository at the given db path are stored.
+pub(crate) fn dir_for(store_path: &Path) -> PathBuf {
+    let mut path = store_path.as_os_str().to_owned();
+    path.push("-blocks");
+    path.into()
+}
+
+/// Block content storage outside of the db. Each block ciphertext is stored in its own file named
+/// after the block id, sharded into subdirectories by the first byte of the id. The db then keeps
+/// only the block id and nonce (with empty content).
+///
+/// Files are written atomically (write to a temp file, then rename) so a reader never observes a
+/// partially written block.
+#[derive(Clone)]
+pub(super) struct BlockFiles {
+    shared: Arc<Shared>,
+}
+
+struct Shared {
+    root: PathBuf,
+    // Next shard to be swept for orphaned files.
+    next_sweep_shard: AtomicUsize,
+}
+
+impl BlockFiles {
+    /// Opens the block files storage at the given directory, creating it if it doesn't exist.
+    pub async fn open(root: PathBuf) -> Result<Self, Error> {
+        let root = task::spawn_blocking(move || {
+            for shard in 0..SHARD_COUNT {
+                fs::create_dir_all(shard_path(&root, shard))?;
+            }
+
+            Ok::<_, io::Error>(root)
+        })
+        .await
+        .unwrap()?;
+
+        Ok(Self {
+            shared: Arc::new(Shared {
+                root,
+                next_sweep_shard: AtomicUsize::new(0),
+            }),
+        })
+    }
+
+    pub fn root(&self) -> &Path {
+        &self.shared.root
+    }
+
+    /// Reads the content of the given block into `content`.
+    pub async fn read(&self, id: &BlockId, content: &mut BlockContent) -> Result<(), Error> {
+        let path = self.path(id);
+        let (result, buffer) = task::spawn_blocking({
+            let mut buffer = BlockContent::new();
+            move || (read_file(&path, &mut buffer), buffer)
+        })
+        .await
+        .unwrap();
+
+        match result {
+            Ok(()) => {
+                content.copy_from_slice(&buffer);
+                Ok(())
+            }
+            Err(error) if error.kind() == io::ErrorKind::NotFound => Err(Error::BlockNotFound),
+            Err(error) if error.kind() == io::ErrorKind::UnexpectedEof => {
+                tracing::error!(?id, "Wrong block file length");
+                Err(Error::MalformedData)
+            }
+            Err(error) => Err(error.into()),
+        }
+    }
+
+    /// Writes the given blocks, replacing any existing files with the same ids.
+    pub async fn write(&self, blocks: Vec<(BlockId, BlockContent)>) -> Result<(), Error> {
+        let this = self.clone();
+
+        task::spawn_blocking(move || {
+            let files: Vec<_> = blocks
+                .iter()
+                .map(|(id, content)| (this.path(id), &content[..]))
+                .collect();
+
+            write_files(&files)
+        })
+        .await
+        .unwrap()?;
+
+        Ok(())
+    }
+
+    /// Removes the files of the given blocks. Missing files are ignored.
+    ///
+    /// NOTE: This is a blocking operation. It's intended to be called from the
+    /// `commit_and_then_blocking` callback which must complete before the next write transaction
+    /// begins.
+    pub fn remove_blocking(&self, ids: &[BlockId]) {
+        for id in ids {
+            match fs::remove_file(self.path(id)) {
+                Ok(()) => (),
+                Err(error) if error.kind() == io::ErrorKind::NotFound => (),
+                Err(error) => tracing::warn!(?id, ?error, "Failed to remove block file"),
+            }
+        }
+    }
+
+    /// Lists the ids of all blocks stored in the given shard, together with the temp files found
+    /// there. Those are leftovers from interrupted writes or belong to writes still in progress,
+    /// so they must be removed only while no write transaction is running.
+    pub async fn list(&self, shard: usize) -> Result<(Vec<BlockId>, Vec<PathBuf>), Error> {
+        let path = shard_path(self.root(), shard);
+
+        let listing = task::spawn_blocking(move || {
+            let mut ids = Vec::new();
+            let mut temps = Vec::new();
+
+            for entry in fs::read_dir(&path)? {
+                let entry = entry?;
+                let name = entry.file_name();
+
+                if let Some(id) = parse_file_name(&name) {
+                    ids.push(id);
+                } else if name.to_string_lossy().ends_with(TEMP_SUFFIX) {
+                    temps.push(entry.path());
+                }
+            }
+
+            Ok::<_, io::Error>((ids, temps))
+        })
+        .await
+        .unwrap()?;
+
+        Ok(listing)
+    }
+
+    /// Removes the given temp files. Missing files are ignored.
+    ///
+    /// NOTE: This is a blocking operation, see `remove_blocking`.
+    pub fn remove_temps_blocking(&self, paths: &[PathBuf]) {
+        for path in paths {
+            match fs::remove_file(path) {
+                Ok(()) => (),
+                Err(error) if error.kind() == io::ErrorKind::NotFound => (),
+                Err(error) => tracing::warn!(?path, ?error, "Failed to remove temp block file"),
+            }
+        }
+    }
+
+    /// Returns the next shard to sweep, cycling through all of them.
+    pub fn next_sweep_shard(&self) -> usize {
+        self.shared.next_sweep_shard.fetch_add(1, Ordering::Relaxed) % SHARD_COUNT
+    }
+
+    /// Copies all the block files into the given directory.
+    pub async fn copy_to(&self, dst: PathBuf) -> Result<(), Error> {
+        let src = self.root().to_owned();
+
+        task::spawn_blocking(move || {
+            for shard in 0..SHARD_COUNT {
+                let src_shard = shard_path(&src, shard);
+                let dst_shard = shard_path(&dst, shard);
+
+                fs::create_dir_all(&dst_shard)?;
+
+                for entry in fs::read_dir(&src_shard)? {
+                    let entry = entry?;
+                    let name = entry.file_name();
+
+                    if parse_file_name(&name).is_some() {
+                        fs::copy(entry.path(), dst_shard.join(name))?;
+                    }
+                }
+            }
+
+            Ok::<_, io::Error>(())
+        })
+        .await
+        .unwrap()?;
+
+        Ok(())
+    }
+
+    fn path(&self, id: &BlockId) -> PathBuf {
+        shard_path(self.root(), id.as_ref()[0] as usize).join(hex::encode(id.as_ref()))
+    }
+}
+
+fn shard_path(root: &Path, shard: usize) -> PathBuf {
+    root.join(format!("{shard:02x}"))
+}
+
+fn parse_file_name(name: &OsString) -> Option<BlockId> {
+    let bytes = hex::decode(name.to_str()?).ok()?;
+    BlockId::try_from(&bytes[..]).ok()
+}
+
+fn read_file(path: &Path, buffer: &mut [u8]) -> io::Result<()> {
+    use io::Read;
+
+    let mut file = fs::File::open(path)?;
+    file.read_exact(&mut buffer[..BLOCK_SIZE])?;
+
+    Ok(())
+}
+
+// Writes the given files atomically. All the data is written out first and only then synced so
+// the fsyncs of the whole batch are issued back to back instead of interleaved with the writes.
+// The directories containing the files are then synced (once each) to make the renames durable.
+fn write_files(files: &[(PathBuf, &[u8])]) -> io::Result<()> {
+    use io::Write;
+
+    let mut temps = Vec::with_capacity(files.len());
+
+    for (path, content) in files {
+        let mut temp_path = path.as_os_str().to_owned();
+        temp_path.push(TEMP_SUFFIX);
+        let temp_path = PathBuf::from(temp_path);
+
+        let mut file = fs::File::create(&temp_path)?;
+        file.write_all(content)?;
+
+        temps.push((file, temp_path));
+    }
+
+    for (file, _) in &temps {
+        file.sync_data()?;
+    }
+
+    let mut dirs = BTreeSet::new();
+
+    for ((_, temp_path), (path, _)) in temps.into_iter().zip(files) {
+        fs::rename(&temp_path, path)?;
+
+        if let Some(dir) = path.parent() {
+            dirs.insert(dir);
+        }
+    }
+
+    for dir in dirs {
+        sync_dir(dir)?;
+    }
+
+    Ok(())
+}
+
+#[cfg(unix)]
+fn sync_dir(path: &Path) -> io::Result<()> {
+    fs::File::open(path)?.sync_all()
+}
+
+// Directories can't be opened as regular files on windows and NTFS journals the renames anyway.
+#[cfg(not(unix))]
+fn sync_dir(_path: &Path) -> io::Result<()> {
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::protocol::Block;
+    use tempfile::TempDir;
+
+    #[tokio::test]
+    async fn write_read_list_and_remove() {
+        let base_dir = TempDir::new().unwrap();
+        let files = BlockFiles::open(base_dir.path().join("blocks"))
+            .await
+            .unwrap();
+
+        let block: Block = rand::random();
+
+        let mut content = BlockContent::new();
+        assert!(matches!(
+            files.read(&block.id, &mut content).await,
+            Err(Error::BlockNotFound)
+        ));
+
+        files
+            .write(vec![(block.id, block.content.clone())])
+            .await
+            .unwrap();
+
+        files.read(&block.id, &mut content).await.unwrap();
+        assert_eq!(&content[..], &block.content[..]);
+
+        let shard = block.id.as_ref()[0] as usize;
+        assert_eq!(files.list(shard).await.unwrap(), (vec![block.id], vec![]));
+
+        files.remove_blocking(&[block.id]);
+        assert!(files.list(shard).await.unwrap().0.is_empty());
+    }
+}
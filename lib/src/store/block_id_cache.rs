@@ -3,17 +3,23 @@ use crate::{
     collections::{hash_map::Entry, HashMap},
     crypto::Hash,
     db,
-    protocol::{BlockId, RootNode, SingleBlockPresence},
+    protocol::{get_bucket, BlockId, RootNode, SingleBlockPresence, INNER_LAYER_COUNT},
     version_vector::VersionVector,
 };
 use futures_util::TryStreamExt;
+use metrics::Histogram;
 use sqlx::Row;
 use std::{
     cmp::Ordering,
+    future, mem,
     sync::{Arc, Mutex},
+    time::Instant,
 };
 use tokio::sync::Notify;
 
+/// Default memory budget of the block id cache, in bytes.
+pub(super) const DEFAULT_BLOCK_ID_CACHE_CAPACITY: u64 = 32 * 1024 * 1024;
+
 #[derive(Eq, PartialEq, Debug)]
 pub(super) enum LookupError {
     NotFound,
@@ -21,23 +27,81 @@ pub(super) enum LookupError {
 }
 
 /// Cache for fast block id lookups.
-#[derive(Clone, Default)]
+///
+/// The cache mirrors the index trees of the cached snapshots. The nodes are stored by their hash
+/// and shared by all the snapshots that contain them, the same way they are in the db. This means
+/// that caching a new snapshot loads only the subtrees that changed since the previous one (which
+/// is typically a tiny fraction of the whole index) and that concurrent snapshots of different
+/// branches (which are usually almost identical) take very little extra memory.
+///
+/// When the cached nodes exceed the memory budget, the least recently used snapshots are evicted.
+#[derive(Clone)]
 pub(super) struct BlockIdCache {
-    snapshots: Arc<Mutex<HashMap<Hash, Snapshot>>>,
+    inner: Arc<Mutex<Inner>>,
     notify: Arc<Notify>,
 }
 
+struct Inner {
+    snapshots: HashMap<Hash, Snapshot>,
+    nodes: HashMap<Hash, Node>,
+    // Approximate memory used by the nodes, in bytes.
+    size: u64,
+    capacity: u64,
+    // Incremented on every access. Used to find the least recently used snapshot.
+    clock: u64,
+    load_time: Histogram,
+}
+
 enum Snapshot {
     Loading,
     Loaded {
-        blocks: HashMap<Hash, (BlockId, SingleBlockPresence)>,
         version_vector: VersionVector,
+        last_used: u64,
     },
 }
 
+struct Node {
+    // Number of parent nodes and snapshots referencing this node.
+    refs: usize,
+    children: Children,
+}
+
+enum Children {
+    // Sorted by bucket.
+    Inner(Vec<(u8, Hash)>),
+    Leaves(Vec<(Hash, BlockId, SingleBlockPresence)>),
+}
+
+impl Node {
+    fn new(children: Children) -> Self {
+        Self { refs: 0, children }
+    }
+
+    fn size(&self) -> u64 {
+        let children = match &self.children {
+            Children::Inner(children) => children.len() * mem::size_of::<(u8, Hash)>(),
+            Children::Leaves(children) => {
+                children.len() * mem::size_of::<(Hash, BlockId, SingleBlockPresence)>()
+            }
+        };
+
+        (mem::size_of::<(Hash, Node)>() + children) as u64
+    }
+}
+
 impl BlockIdCache {
-    pub fn new() -> Self {
-        Self::default()
+    pub fn new(capacity: u64) -> Self {
+        Self {
+            inner: Arc::new(Mutex::new(Inner {
+                snapshots: HashMap::default(),
+                nodes: HashMap::default(),
+                size: 0,
+                capacity,
+                clock: 0,
+                load_time: Histogram::noop(),
+            })),
+            notify: Arc::new(Notify::new()),
+        }
     }
 
     /// Looks up a block id (and its block presence) in the given snapshot by the given locator.
@@ -49,23 +113,46 @@ impl BlockIdCache {
         root_hash: &Hash,
         encoded_locator: &Hash,
     ) -> Result<(BlockId, SingleBlockPresence), LookupError> {
-        match self.snapshots.lock().unwrap().get(root_hash) {
-            Some(Snapshot::Loaded { blocks, .. }) => match blocks.get(encoded_locator) {
-                Some((block_id, block_presence)) => Ok((*block_id, *block_presence)),
-                None => Err(LookupError::NotFound),
-            },
-            Some(Snapshot::Loading) | None => Err(LookupError::CacheMiss),
+        let mut inner = self.inner.lock().unwrap();
+        let inner = &mut *inner;
+
+        match inner.snapshots.get_mut(root_hash) {
+            Some(Snapshot::Loaded { last_used, .. }) => {
+                inner.clock += 1;
+                *last_used = inner.clock;
+            }
+            Some(Snapshot::Loading) | None => return Err(LookupError::CacheMiss),
+        }
+
+        let leaves = inner
+            .find_leaves(root_hash, encoded_locator)
+            .ok_or(LookupError::NotFound)?;
+
+        match inner.nodes.get(&leaves).map(|node| &node.children) {
+            Some(Children::Leaves(children)) => children
+                .iter()
+                .find(|(locator, _, _)| locator == encoded_locator)
+                .map(|(_, block_id, block_presence)| (*block_id, *block_presence))
+                .ok_or(LookupError::NotFound),
+            Some(Children::Inner(_)) | None => Err(LookupError::NotFound),
         }
     }
 
-    /// Populate the cache with the data from the given snapshot.
+    /// Populate the cache with the data from the given snapshot. Only the subtrees that are not
+    /// already cached (as part of other snapshots) are loaded from the db.
     ///
     /// Note: This method is idempotent, even when called concurrently.
     pub async fn load(&self, conn: &mut db::Connection, root_node: &RootNode) -> Result<(), Error> {
         loop {
             let notified = self.notify.notified();
 
-            match self.snapshots.lock().unwrap().entry(root_node.proof.hash) {
+            match self
+                .inner
+                .lock()
+                .unwrap()
+                .snapshots
+                .entry(root_node.proof.hash)
+            {
                 Entry::Occupied(entry) => match entry.get() {
                     Snapshot::Loading => (),
                     Snapshot::Loaded { .. } => return Ok(()),
@@ -79,29 +166,25 @@ impl BlockIdCache {
             notified.await;
         }
 
+        let start = Instant::now();
         let guard = LoadGuard::new(self, root_node);
+        let mut nodes = HashMap::default();
 
-        let block_ids = sqlx::query(
-            "WITH RECURSIVE
-                 inner_nodes(hash) AS (
-                     SELECT first.hash FROM snapshot_inner_nodes AS first WHERE first.parent = ?
-                     UNION ALL
-                     SELECT next.hash
-                         FROM snapshot_inner_nodes AS next
-                         INNER JOIN inner_nodes AS prev ON prev.hash = next.parent
-                 )
-             SELECT locator, block_id, block_presence
-                 FROM snapshot_leaf_nodes
-                 WHERE parent IN inner_nodes
-             ",
-        )
-        .bind(&root_node.proof.hash)
-        .fetch(conn)
-        .map_ok(|row| (row.get(0), (row.get(1), row.get(2))))
-        .try_collect()
-        .await?;
+        let children = load_inner_children(conn, &root_node.proof.hash).await?;
 
-        guard.complete(block_ids);
+        for (_, hash) in &children {
+            if self.inner.lock().unwrap().nodes.contains_key(hash) || nodes.contains_key(hash) {
+                continue;
+            }
+
+            load_subtree(conn, hash, &mut nodes).await?;
+        }
+
+        nodes.insert(root_node.proof.hash, Node::new(Children::Inner(children)));
+
+        guard.complete(nodes);
+
+        self.inner.lock().unwrap().load_time.record(start.elapsed());
 
         Ok(())
     }
@@ -112,31 +195,300 @@ impl BlockIdCache {
     /// this operation constant time (per entry and snapshot). Without it it would have to perform
     /// linear search for each entry.
     pub fn set_present(&self, entries: &[(Hash, BlockId)]) {
-        let mut snapshots = self.snapshots.lock().unwrap();
+        let mut inner = self.inner.lock().unwrap();
+        let inner = &mut *inner;
+
+        let roots: Vec<_> = inner
+            .snapshots
+            .iter()
+            .filter(|(_, snapshot)| matches!(snapshot, Snapshot::Loaded { .. }))
+            .map(|(root_hash, _)| *root_hash)
+            .collect();
+
+        for (encoded_locator, block_id) in entries {
+            for root_hash in &roots {
+                // The leaves are shared so this might update the same node multiple times but
+                // that's harmless.
+                let Some(leaves) = inner.find_leaves(root_hash, encoded_locator) else {
+                    continue;
+                };
+
+                let Some(Node {
+                    children: Children::Leaves(children),
+                    ..
+                }) = inner.nodes.get_mut(&leaves)
+                else {
+                    continue;
+                };
+
+                for (locator, cached_block_id, block_presence) in children {
+                    if locator == encoded_locator && cached_block_id == block_id {
+                        *block_presence = SingleBlockPresence::Present;
+                    }
+                }
+            }
+        }
+    }
+
+    /// Changes the memory budget (in bytes) of the cache, evicting snapshots if necessary.
+    pub fn set_capacity(&self, capacity: u64) {
+        let mut inner = self.inner.lock().unwrap();
+        inner.capacity = capacity;
+        inner.evict(None);
+    }
+
+    /// Returns the memory budget (in bytes) of the cache.
+    pub fn capacity(&self) -> u64 {
+        self.inner.lock().unwrap().capacity
+    }
+
+    /// Sets the histogram to report the time of loading a snapshot into the cache to. Only the
+    /// loads that actually hit the db are reported.
+    pub fn set_metrics(&self, load_time: Histogram) {
+        self.inner.lock().unwrap().load_time = load_time;
+    }
+}
 
-        for snapshot in snapshots.values_mut() {
-            let Snapshot::Loaded { blocks, .. } = snapshot else {
+impl Inner {
+    /// Finds the hash of the node containing the leaves at the given locator.
+    fn find_leaves(&self, root_hash: &Hash, encoded_locator: &Hash) -> Option<Hash> {
+        let mut hash = *root_hash;
+
+        for layer in 0..INNER_LAYER_COUNT {
+            let bucket = get_bucket(encoded_locator, layer);
+
+            // The nodes of loaded snapshots are never evicted, but `get` is used anyway to not
+            // panic on a corrupted index.
+            let Children::Inner(children) = &self.nodes.get(&hash)?.children else {
+                return None;
+            };
+
+            let index = children
+                .binary_search_by_key(&bucket, |(bucket, _)| *bucket)
+                .ok()?;
+
+            hash = children[index].1;
+        }
+
+        Some(hash)
+    }
+
+    /// Checks whether the whole tree rooted at `hash` is either already cached or in `pending`.
+    fn is_complete(&self, hash: &Hash, pending: &HashMap<Hash, Node>) -> bool {
+        let mut stack = vec![*hash];
+
+        while let Some(hash) = stack.pop() {
+            if self.nodes.contains_key(&hash) {
                 continue;
+            }
+
+            let Some(node) = pending.get(&hash) else {
+                return false;
             };
 
-            for (encoded_locator, block_id) in entries {
-                if let Some(block_presence) = blocks
-                    .get_mut(encoded_locator)
-                    .filter(|(cached_block_id, _)| cached_block_id == block_id)
-                    .map(|(_, block_presence)| block_presence)
-                {
-                    *block_presence = SingleBlockPresence::Present;
-                }
+            if let Children::Inner(children) = &node.children {
+                stack.extend(children.iter().map(|(_, hash)| *hash));
+            }
+        }
+
+        true
+    }
+
+    /// Adds a reference to the node with the given hash, moving it (and its subtree) from
+    /// `pending` into the cache if it's not there yet.
+    fn acquire(&mut self, hash: &Hash, pending: &mut HashMap<Hash, Node>) {
+        let mut stack = vec![*hash];
+
+        while let Some(hash) = stack.pop() {
+            if let Some(node) = self.nodes.get_mut(&hash) {
+                node.refs += 1;
+                continue;
+            }
+
+            // unwrap is OK because `is_complete` has been checked before.
+            let mut node = pending.remove(&hash).unwrap();
+            node.refs = 1;
+
+            if let Children::Inner(children) = &node.children {
+                stack.extend(children.iter().map(|(_, hash)| *hash));
             }
+
+            self.size += node.size();
+            self.nodes.insert(hash, node);
+        }
+    }
+
+    /// Removes a reference to the node with the given hash, removing it (and the nodes of its
+    /// subtree not referenced from anywhere else) from the cache if it was the last one.
+    fn release(&mut self, hash: &Hash) {
+        let mut stack = vec![*hash];
+
+        while let Some(hash) = stack.pop() {
+            let Entry::Occupied(mut entry) = self.nodes.entry(hash) else {
+                continue;
+            };
+
+            entry.get_mut().refs -= 1;
+
+            if entry.get().refs > 0 {
+                continue;
+            }
+
+            let node = entry.remove();
+            self.size -= node.size();
+
+            if let Children::Inner(children) = node.children {
+                stack.extend(children.into_iter().map(|(_, hash)| hash));
+            }
+        }
+    }
+
+    fn remove_snapshot(&mut self, root_hash: &Hash) {
+        if let Some(Snapshot::Loaded { .. }) = self.snapshots.remove(root_hash) {
+            self.release(root_hash);
+        }
+    }
+
+    /// Evicts the least recently used snapshots (except `keep`) until the cache fits into its
+    /// budget.
+    fn evict(&mut self, keep: Option<&Hash>) {
+        while self.size > self.capacity {
+            let Some(root_hash) = self
+                .snapshots
+                .iter()
+                .filter(|(root_hash, _)| Some(*root_hash) != keep)
+                .filter_map(|(root_hash, snapshot)| match snapshot {
+                    Snapshot::Loaded { last_used, .. } => Some((root_hash, *last_used)),
+                    Snapshot::Loading => None,
+                })
+                .min_by_key(|(_, last_used)| *last_used)
+                .map(|(root_hash, _)| *root_hash)
+            else {
+                break;
+            };
+
+            self.remove_snapshot(&root_hash);
         }
     }
 }
 
+async fn load_inner_children(
+    conn: &mut db::Connection,
+    parent: &Hash,
+) -> Result<Vec<(u8, Hash)>, Error> {
+    Ok(sqlx::query(
+        "SELECT bucket, hash FROM snapshot_inner_nodes WHERE parent = ? ORDER BY bucket",
+    )
+    .bind(parent)
+    .fetch(conn)
+    .map_ok(|row| (row.get::<u32, _>(0), row.get(1)))
+    .try_filter_map(|(bucket, hash)| {
+        future::ready(Ok(u8::try_from(bucket).ok().map(|bucket| (bucket, hash))))
+    })
+    .try_collect()
+    .await?)
+}
+
+/// Loads the whole subtree rooted at the given inner node into `nodes`.
+async fn load_subtree(
+    conn: &mut db::Connection,
+    hash: &Hash,
+    nodes: &mut HashMap<Hash, Node>,
+) -> Result<(), Error> {
+    let mut inner_nodes = sqlx::query(
+        "WITH RECURSIVE
+             inner_nodes(parent, bucket, hash) AS (
+                 SELECT parent, bucket, hash FROM snapshot_inner_nodes WHERE parent = ?
+                 UNION ALL
+                 SELECT next.parent, next.bucket, next.hash
+                     FROM snapshot_inner_nodes AS next
+                     INNER JOIN inner_nodes AS prev ON prev.hash = next.parent
+             )
+         SELECT parent, bucket, hash FROM inner_nodes ORDER BY parent, bucket
+         ",
+    )
+    .bind(hash)
+    .fetch(&mut *conn)
+    .map_ok(|row| {
+        (
+            row.get::<Hash, _>(0),
+            row.get::<u32, _>(1),
+            row.get::<Hash, _>(2),
+        )
+    });
+
+    let mut parents = vec![*hash];
+
+    while let Some((parent, bucket, hash)) = inner_nodes.try_next().await? {
+        let Ok(bucket) = u8::try_from(bucket) else {
+            continue;
+        };
+
+        let node = nodes
+            .entry(parent)
+            .or_insert_with(|| Node::new(Children::Inner(Vec::new())));
+
+        if let Children::Inner(children) = &mut node.children {
+            children.push((bucket, hash));
+        }
+
+        parents.push(hash);
+    }
+
+    drop(inner_nodes);
+
+    let mut leaf_nodes = sqlx::query(
+        "WITH RECURSIVE
+             inner_nodes(hash) AS (
+                 SELECT hash FROM snapshot_inner_nodes WHERE parent = ?
+                 UNION ALL
+                 SELECT next.hash
+                     FROM snapshot_inner_nodes AS next
+                     INNER JOIN inner_nodes AS prev ON prev.hash = next.parent
+             )
+         SELECT parent, locator, block_id, block_presence
+             FROM snapshot_leaf_nodes
+             WHERE parent IN inner_nodes OR parent = ?
+         ",
+    )
+    .bind(hash)
+    .bind(hash)
+    .fetch(conn)
+    .map_ok(|row| {
+        (
+            row.get::<Hash, _>(0),
+            row.get::<Hash, _>(1),
+            row.get::<BlockId, _>(2),
+            row.get::<SingleBlockPresence, _>(3),
+        )
+    });
+
+    while let Some((parent, locator, block_id, block_presence)) = leaf_nodes.try_next().await? {
+        let node = nodes
+            .entry(parent)
+            .or_insert_with(|| Node::new(Children::Leaves(Vec::new())));
+
+        if let Children::Leaves(children) = &mut node.children {
+            children.push((locator, block_id, block_presence));
+        }
+    }
+
+    // Inner nodes with no children (can happen only in a corrupted index, but the tree must still
+    // be complete).
+    for parent in parents {
+        nodes
+            .entry(parent)
+            .or_insert_with(|| Node::new(Children::Inner(Vec::new())));
+    }
+
+    Ok(())
+}
+
 /// Cancel safety for `BlockIdCache::load`.
 struct LoadGuard<'a> {
     cache: &'a BlockIdCache,
     root_node: &'a RootNode,
-    blocks: Option<HashMap<Hash, (BlockId, SingleBlockPresence)>>,
+    nodes: Option<HashMap<Hash, Node>>,
 }
 
 impl<'a> LoadGuard<'a> {
@@ -144,12 +496,12 @@ impl<'a> LoadGuard<'a> {
         Self {
             cache,
             root_node,
-            blocks: None,
+            nodes: None,
         }
     }
 
-    fn complete(mut self, blocks: HashMap<Hash, (BlockId, SingleBlockPresence)>) {
-        self.blocks = Some(blocks);
+    fn complete(mut self, nodes: HashMap<Hash, Node>) {
+        self.nodes = Some(nodes);
     }
 }
 
@@ -157,37 +509,61 @@ impl Drop for LoadGuard<'_> {
     fn drop(&mut self) {
         // NOTE: Not using `lock().unwrap()` to avoid potential double panic. We don't care about
         // poisoning here anyway (the data in the mutex can't be corrupted by panics in this case).
-        let mut snapshots = self
+        let mut inner = self
             .cache
-            .snapshots
+            .inner
             .lock()
             .unwrap_or_else(|error| error.into_inner());
 
-        if let Some(blocks) = self.blocks.take() {
-            // Remove outdated snapshots
-            snapshots.retain(|_, snapshot| {
-                let Snapshot::Loaded { version_vector, .. } = snapshot else {
-                    return true;
-                };
+        let root_hash = self.root_node.proof.hash;
+
+        // A node that was already cached when the load checked it could have been evicted since.
+        // In that case the load fails and the next lookup retries it.
+        match self.nodes.take() {
+            Some(mut nodes) if inner.is_complete(&root_hash, &nodes) => {
+                // Remove outdated snapshots
+                let outdated: Vec<_> = inner
+                    .snapshots
+                    .iter()
+                    .filter(|(_, snapshot)| {
+                        let Snapshot::Loaded { version_vector, .. } = snapshot else {
+                            return false;
+                        };
+
+                        match (*version_vector).partial_cmp(&self.root_node.proof.version_vector) {
+                            Some(Ordering::Greater) | None => false,
+                            Some(Ordering::Less | Ordering::Equal) => true,
+                        }
+                    })
+                    .map(|(root_hash, _)| *root_hash)
+                    .collect();
+
+                // Acquire the new snapshot first so the nodes it shares with the outdated ones are
+                // not evicted and re-inserted.
+                inner.acquire(&root_hash, &mut nodes);
+                inner.clock += 1;
+
+                let last_used = inner.clock;
+                inner.snapshots.insert(
+                    root_hash,
+                    Snapshot::Loaded {
+                        version_vector: self.root_node.proof.version_vector.clone(),
+                        last_used,
+                    },
+                );
 
-                match (*version_vector).partial_cmp(&self.root_node.proof.version_vector) {
-                    Some(Ordering::Greater) | None => true,
-                    Some(Ordering::Less | Ordering::Equal) => false,
+                for root_hash in outdated {
+                    inner.remove_snapshot(&root_hash);
                 }
-            });
 
-            snapshots.insert(
-                self.root_node.proof.hash,
-                Snapshot::Loaded {
-                    blocks,
-                    version_vector: self.root_node.proof.version_vector.clone(),
-                },
-            );
-        } else {
-            snapshots.remove(&self.root_node.proof.hash);
+                inner.evict(Some(&root_hash));
+            }
+            Some(_) | None => {
+                inner.snapshots.remove(&root_hash);
+            }
         }
 
-        drop(snapshots);
+        drop(inner);
 
         self.cache.notify.notify_waiters();
     }
@@ -249,7 +625,7 @@ mod tests {
             .await
             .unwrap();
 
-        let cache = BlockIdCache::new();
+        let cache = BlockIdCache::new(DEFAULT_BLOCK_ID_CACHE_CAPACITY);
 
         // Initially all lookups are cache misses.
         for leaf_node in snapshot.leaf_nodes() {
@@ -349,7 +725,7 @@ mod tests {
             .await
             .unwrap();
 
-        let cache = BlockIdCache::new();
+        let cache = BlockIdCache::new(DEFAULT_BLOCK_ID_CACHE_CAPACITY);
 
         // Populate the cache with both of them
         let mut tx = store.db().begin_read().await.unwrap();
@@ -412,4 +788,123 @@ mod tests {
             );
         }
     }
+
+    #[tokio::test]
+    async fn share_unchanged_subtrees() {
+        let mut rng = rand::thread_rng();
+        let (_temp_dir, pool) = db::create_temp().await.unwrap();
+        let store = Store::new(pool);
+
+        let write_keys = Keypair::generate(&mut rng);
+        let writer_id_a = PublicKey::generate(&mut rng);
+        let writer_id_b = PublicKey::generate(&mut rng);
+
+        // Two concurrent snapshots that differ in a single block.
+        let snapshot_a = Snapshot::generate(&mut rng, 1000);
+        let snapshot_b = Snapshot::new(
+            snapshot_a
+                .locators_and_blocks()
+                .map(|(locator, block)| (*locator, block.clone()))
+                .chain(iter::once(rng.gen())),
+        );
+
+        let root_node_a = save_snapshot(&store, &snapshot_a, &write_keys, writer_id_a).await;
+        let root_node_b = save_snapshot(&store, &snapshot_b, &write_keys, writer_id_b).await;
+
+        let cache = BlockIdCache::new(DEFAULT_BLOCK_ID_CACHE_CAPACITY);
+
+        let mut conn = store.db().acquire().await.unwrap();
+        cache.load(&mut conn, &root_node_a).await.unwrap();
+        let size_a = cache.inner.lock().unwrap().size;
+
+        cache.load(&mut conn, &root_node_b).await.unwrap();
+        let size_ab = cache.inner.lock().unwrap().size;
+        drop(conn);
+
+        // The second snapshot adds only the nodes on the path to the new block.
+        assert!(size_ab < size_a + size_a / 10);
+
+        for (snapshot, root_node) in [(&snapshot_a, &root_node_a), (&snapshot_b, &root_node_b)] {
+            for leaf_node in snapshot.leaf_nodes() {
+                assert_eq!(
+                    cache.lookup(&root_node.proof.hash, &leaf_node.locator),
+                    Ok((leaf_node.block_id, SingleBlockPresence::Missing))
+                );
+            }
+        }
+
+        // Marking a shared block as present updates it in both snapshots.
+        let leaf_node = snapshot_a.leaf_nodes().next().unwrap();
+        cache.set_present(&[(leaf_node.locator, leaf_node.block_id)]);
+
+        for root_node in [&root_node_a, &root_node_b] {
+            assert_eq!(
+                cache.lookup(&root_node.proof.hash, &leaf_node.locator),
+                Ok((leaf_node.block_id, SingleBlockPresence::Present))
+            );
+        }
+    }
+
+    #[tokio::test]
+    async fn evict_least_recently_used_snapshot() {
+        let mut rng = rand::thread_rng();
+        let (_temp_dir, pool) = db::create_temp().await.unwrap();
+        let store = Store::new(pool);
+
+        let write_keys = Keypair::generate(&mut rng);
+        let writer_id_a = PublicKey::generate(&mut rng);
+        let writer_id_b = PublicKey::generate(&mut rng);
+
+        let snapshot_a = Snapshot::generate(&mut rng, 100);
+        let snapshot_b = Snapshot::generate(&mut rng, 100);
+
+        let root_node_a = save_snapshot(&store, &snapshot_a, &write_keys, writer_id_a).await;
+        let root_node_b = save_snapshot(&store, &snapshot_b, &write_keys, writer_id_b).await;
+
+        let cache = BlockIdCache::new(DEFAULT_BLOCK_ID_CACHE_CAPACITY);
+
+        let mut conn = store.db().acquire().await.unwrap();
+        cache.load(&mut conn, &root_node_a).await.unwrap();
+
+        // Fits only one of the snapshots.
+        let size_a = cache.inner.lock().unwrap().size;
+        cache.set_capacity(size_a + size_a / 2);
+
+        cache.load(&mut conn, &root_node_b).await.unwrap();
+        drop(conn);
+
+        let locator_a = snapshot_a.leaf_nodes().next().unwrap().locator;
+        let locator_b = snapshot_b.leaf_nodes().next().unwrap().locator;
+
+        assert_eq!(
+            cache.lookup(&root_node_a.proof.hash, &locator_a),
+            Err(LookupError::CacheMiss)
+        );
+        assert!(cache.lookup(&root_node_b.proof.hash, &locator_b).is_ok());
+
+        // Nodes of evicted snapshots are released.
+        assert!(cache.inner.lock().unwrap().size <= size_a + size_a / 2);
+    }
+
+    async fn save_snapshot(
+        store: &Store,
+        snapshot: &Snapshot,
+        write_keys: &Keypair,
+        writer_id: PublicKey,
+    ) -> RootNode {
+        SnapshotWriter::begin(store, snapshot)
+            .await
+            .save_nodes(write_keys, writer_id, VersionVector::first(writer_id))
+            .await
+            .commit()
+            .await;
+
+        store
+            .acquire_read()
+            .await
+            .unwrap()
+            .load_latest_approved_root_node(&writer_id, RootNodeFilter::Published)
+            .await
+            .unwrap()
+    }
 }
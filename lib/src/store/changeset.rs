@@ -1,4 +1,4 @@
-use super::{block, error::Error, patch::Patch, WriteTransaction};
+use super::{block, error::Error, gc_candidates, patch::Patch, WriteTransaction};
 use crate::{
     crypto::{
         sign::{Keypair, PublicKey},
@@ -13,6 +13,7 @@ pub(crate) struct Changeset {
     links: Vec<(Hash, BlockId, SingleBlockPresence)>,
     unlinks: Vec<(Hash, Option<BlockId>)>,
     blocks: Vec<Block>,
+    gc_candidates: Vec<Hash>,
     bump: Bump,
     bump_force: bool,
 }
@@ -32,22 +33,28 @@ impl Changeset {
     ) -> Result<bool, Error> {
         let mut patch = Patch::new(tx, *branch_id).await?;
         let mut changed = false;
+        // Blocks added to or removed from the branch. Their reachability might have changed.
+        let mut changed_block_ids = Vec::new();
 
         for (encoded_locator, block_id, block_presence) in self.links {
-            if patch
+            let (linked, old_block_id) = patch
                 .insert(tx, encoded_locator, block_id, block_presence)
-                .await?
-            {
+                .await?;
+
+            if linked {
                 changed = true;
+                changed_block_ids.push(block_id);
+                changed_block_ids.extend(old_block_id.filter(|old| *old != block_id));
             }
         }
 
         for (encoded_locator, expected_block_id) in self.unlinks {
-            if patch
+            if let Some(old_block_id) = patch
                 .remove(tx, &encoded_locator, expected_block_id.as_ref())
                 .await?
             {
                 changed = true;
+                changed_block_ids.push(old_block_id);
             }
         }
 
@@ -59,16 +66,23 @@ impl Changeset {
             patch.save(tx, self.bump, write_keys).await?;
         }
 
-        for block in self.blocks {
-            block::write(tx.db(), &block).await?;
+        if !self.blocks.is_empty() {
+            let files = tx.block_files.clone();
+            block::write_many(tx.db(), files.as_ref(), &self.blocks).await?;
 
             if let Some(tracker) = &tx.block_expiration_tracker {
-                tracker.handle_block_update(&block.id, false);
+                for block in &self.blocks {
+                    tracker.handle_block_update(&block.id, false);
+                }
             }
 
             changed = true;
         }
 
+        gc_candidates::insert(tx.db(), changed_block_ids).await?;
+
+        gc_candidates::insert_at(tx.db(), &self.gc_candidates).await?;
+
         Ok(changed)
     }
 
@@ -86,6 +100,13 @@ impl Changeset {
         self.unlinks.push((encoded_locator, expected_block_id));
     }
 
+    /// Makes the blocks at the given locator (in all branches) candidates for garbage collection.
+    /// Use this when they might have become unreachable without any change at the locator itself,
+    /// e.g. when removing the entry of a blob from a directory.
+    pub fn mark_gc_candidates(&mut self, encoded_locator: Hash) {
+        self.gc_candidates.push(encoded_locator);
+    }
+
     /// Writes a block into the store.
     pub fn write_block(&mut self, block: Block) {
         self.blocks.push(block);
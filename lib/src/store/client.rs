@@ -3,8 +3,9 @@ use futures_util::TryStreamExt as _;
 use super::{
     block,
     block_expiration_tracker::BlockExpirationTracker,
+    block_files::BlockFiles,
     block_id_cache::BlockIdCache,
-    block_ids, index, inner_node, leaf_node,
+    block_ids, gc_candidates, index, inner_node, leaf_node,
     quota::{self, QuotaError},
     root_node::{self, RootNodeStatus},
     Error,
@@ -23,33 +24,46 @@ use crate::{
 };
 use std::{mem, sync::Arc};
 
+// Max number of received blocks buffered in memory before being written to the db.
+const BLOCK_WRITE_BATCH_SIZE: usize = 64;
+
 /// Store operations for the client side of the sync protocol.
 pub(crate) struct ClientWriter {
     db: db::WriteTransaction,
+    block_files: Option<BlockFiles>,
     block_expiration_tracker: Option<Arc<BlockExpirationTracker>>,
     quota: Option<StorageSize>,
     summary_updates: Vec<Hash>,
     saved_blocks: Vec<SavedBlock>,
+    // Received blocks not yet written to the db. They are written in batches.
+    pending_blocks: Vec<Block>,
     block_id_cache: BlockIdCache,
     block_id_cache_updates: Vec<(Hash, BlockId)>,
+    // Blocks that became present in some snapshot. They might be unreachable (e.g. an outdated
+    // version) so the garbage collector needs to check them.
+    gc_candidates: Vec<BlockId>,
 }
 
 impl ClientWriter {
     pub(super) async fn begin(
         mut db: db::WriteTransaction,
         block_id_cache: BlockIdCache,
+        block_files: Option<BlockFiles>,
         block_expiration_tracker: Option<Arc<BlockExpirationTracker>>,
     ) -> Result<Self, Error> {
         let quota = repository::quota::get(&mut db).await?;
 
         Ok(Self {
             db,
+            block_files,
             block_expiration_tracker,
             quota,
             summary_updates: Vec::new(),
             saved_blocks: Vec::new(),
+            pending_blocks: Vec::new(),
             block_id_cache,
             block_id_cache_updates: Vec::new(),
+            gc_candidates: Vec::new(),
         })
     }
 
@@ -126,8 +140,19 @@ impl ClientWriter {
 
         let nodes = nodes.into_inner();
         let mut new_block_offers = Vec::new();
+        let mut present_block_ids = Vec::new();
 
         for node in &nodes {
+            let local_presence =
+                leaf_node::load_block_presence(&mut self.db, &node.block_id).await?;
+
+            // The block can already be present locally even if this node is new, because other
+            // nodes can point to the same block (with block deduplication). Such block is never
+            // requested, so the new node needs to be marked as present here.
+            if local_presence == Some(SingleBlockPresence::Present) {
+                present_block_ids.push(node.block_id);
+            }
+
             // Create the block offer only if the block is `Missing` locally and `Present` or
             // `Expired` remotely.
             //
@@ -138,7 +163,7 @@ impl ClientWriter {
             // remote peer to switch the block to `Missing` and request it from other peers.
             match node.block_presence {
                 SingleBlockPresence::Present | SingleBlockPresence::Expired => {
-                    match leaf_node::load_block_presence(&mut self.db, &node.block_id).await? {
+                    match local_presence {
                         Some(SingleBlockPresence::Missing) | None => {
                             // Missing, expired or not yet stored locally
                             let offer_state = if self.quota.is_some() {
@@ -165,6 +190,18 @@ impl ClientWriter {
             self.summary_updates.push(parent_hash);
         }
 
+        for block_id in present_block_ids {
+            let mut updates = leaf_node::set_present(&mut self.db, &block_id);
+
+            while let Some(update) = updates.try_next().await? {
+                self.summary_updates.push(update.parent);
+                self.block_id_cache_updates
+                    .push((update.encoded_locator, block_id));
+            }
+
+            self.gc_candidates.push(block_id);
+        }
+
         Ok(LeafNodesStatus { new_block_offers })
     }
 
@@ -188,10 +225,11 @@ impl ClientWriter {
         };
 
         if updated {
-            block::write(&mut self.db, block).await?;
+            self.pending_blocks.push(block.clone());
+            self.gc_candidates.push(block.id);
 
-            if let Some(tracker) = &self.block_expiration_tracker {
-                tracker.handle_block_update(&block.id, false);
+            if self.pending_blocks.len() >= BLOCK_WRITE_BATCH_SIZE {
+                self.write_pending_blocks().await?;
             }
         }
 
@@ -210,6 +248,9 @@ impl ClientWriter {
         F: FnOnce(CommitStatus) -> R + Send + 'static,
         R: Send + 'static,
     {
+        self.write_pending_blocks().await?;
+        gc_candidates::insert(&mut self.db, mem::take(&mut self.gc_candidates)).await?;
+
         let FinalizeStatus {
             approved_branches,
             rejected_branches,
@@ -262,6 +303,29 @@ impl ClientWriter {
         self.commit_and_then(|status| status).await
     }
 
+    async fn write_pending_blocks(&mut self) -> Result<(), Error> {
+        if self.pending_blocks.is_empty() {
+            return Ok(());
+        }
+
+        block::write_many(
+            &mut self.db,
+            self.block_files.as_ref(),
+            &self.pending_blocks,
+        )
+        .await?;
+
+        if let Some(tracker) = &self.block_expiration_tracker {
+            for block in &self.pending_blocks {
+                tracker.handle_block_update(&block.id, false);
+            }
+        }
+
+        self.pending_blocks.clear();
+
+        Ok(())
+    }
+
     async fn finalize_snapshots(&mut self) -> Result<FinalizeStatus, Error> {
         self.summary_updates.sort();
         self.summary_updates.dedup();
@@ -1,3 +1,4 @@
+use std::io;
 use thiserror::Error;
 
 #[derive(Debug, Error)]
@@ -16,4 +17,6 @@ pub enum Error {
     LocatorNotFound,
     #[error("block not found")]
     BlockNotFound,
+    #[error("block file")]
+    BlockFile(#[from] io::Error),
 }
@@ -0,0 +1,311 @@
+use super::{block::MAX_ID_BATCH, error::Error, inner_node, leaf_node};
+use crate::{
+    collections::HashSet,
+    crypto::Hash,
+    db,
+    protocol::{
+        BlockId, NodeState, SingleBlockPresence, EMPTY_INNER_HASH, EMPTY_LEAF_HASH,
+        INNER_LAYER_COUNT,
+    },
+};
+use futures_util::TryStreamExt;
+use sqlx::{QueryBuilder, Row};
+use std::collections::BTreeSet;
+
+/// Blocks whose reachability might have changed since the last garbage collection.
+///
+/// A block can become unreachable only when it's added to or removed from some branch (e.g., a
+/// newer version of the blob is written to the same locator, or the blob is truncated or removed).
+/// Those blocks are recorded in bulk where the changes happen: `Changeset::apply` records the
+/// blocks it links and unlinks, `ClientWriter` the received blocks and the prune path the blocks
+/// of the removed snapshots that are not in the current one. `Changeset::mark_gc_candidates`
+/// records the blocks of blobs whose directory entries were replaced. The garbage collector then
+/// needs to check only those and not all the blocks in the repository.
+pub(crate) struct GcCandidates {
+    // The candidates are processed in their insertion order and this is the greatest position
+    // loaded. Candidates re-inserted afterwards get a greater one so they are not lost when this
+    // batch is removed.
+    upper_bound: Option<i64>,
+    /// Candidate blocks present in at least one approved snapshot.
+    pub block_ids: BTreeSet<BlockId>,
+    /// Encoded locators of the candidate blocks. Blocks at any other locator don't need to be
+    /// looked up when determining which candidates are reachable.
+    pub locators: HashSet<Hash>,
+    /// Candidates that can't be checked now (e.g., because their blob is locked). They are put
+    /// back to the end of the queue when this batch is removed.
+    pub deferred: Vec<BlockId>,
+}
+
+impl GcCandidates {
+    pub fn is_empty(&self) -> bool {
+        self.upper_bound.is_none()
+    }
+}
+
+/// Returns the position of the newest candidate, if any.
+pub(super) async fn end(conn: &mut db::Connection) -> Result<Option<i64>, Error> {
+    Ok(sqlx::query("SELECT MAX(rowid) FROM gc_candidates")
+        .fetch_one(conn)
+        .await?
+        .get(0))
+}
+
+/// Loads (at most) the `limit` oldest candidates whose position is at most `end`.
+pub(super) async fn load(
+    conn: &mut db::Connection,
+    limit: u32,
+    end: i64,
+) -> Result<GcCandidates, Error> {
+    let rows: Vec<(i64, BlockId)> = sqlx::query(
+        "SELECT rowid, block_id FROM gc_candidates WHERE rowid <= ? ORDER BY rowid LIMIT ?",
+    )
+    .bind(end)
+    .bind(limit)
+    .fetch(&mut *conn)
+    .map_ok(|row| (row.get(0), row.get(1)))
+    .try_collect()
+    .await?;
+
+    let upper_bound = rows.last().map(|(rowid, _)| *rowid);
+    let ids: Vec<_> = rows.into_iter().map(|(_, block_id)| block_id).collect();
+
+    let mut block_ids = BTreeSet::new();
+    let mut locators = HashSet::default();
+
+    for chunk in ids.chunks(MAX_ID_BATCH) {
+        // Consider only blocks that the whole-repository traversal would consider. Blocks of
+        // snapshots that are not yet approved must not be collected because the traversal doesn't
+        // see them.
+        let present = load_present_in_approved_snapshot(conn, chunk).await?;
+
+        if present.is_empty() {
+            continue;
+        }
+
+        locators.extend(load_locators(conn, &present).await?);
+        block_ids.extend(present);
+    }
+
+    Ok(GcCandidates {
+        upper_bound,
+        block_ids,
+        locators,
+        deferred: Vec::new(),
+    })
+}
+
+/// Removes the given candidates (including the ones that turned out to be reachable) after they've
+/// been processed. The deferred ones are re-inserted with a new position so they are processed
+/// again later.
+pub(super) async fn remove(
+    tx: &mut db::WriteTransaction,
+    candidates: &GcCandidates,
+) -> Result<(), Error> {
+    let Some(upper_bound) = candidates.upper_bound else {
+        return Ok(());
+    };
+
+    sqlx::query("DELETE FROM gc_candidates WHERE rowid <= ?")
+        .bind(upper_bound)
+        .execute(&mut *tx)
+        .await?;
+
+    insert(tx, candidates.deferred.clone()).await
+}
+
+/// Makes the given blocks candidates.
+pub(super) async fn insert(
+    tx: &mut db::WriteTransaction,
+    mut ids: Vec<BlockId>,
+) -> Result<(), Error> {
+    ids.sort();
+    ids.dedup();
+
+    for chunk in ids.chunks(MAX_ID_BATCH) {
+        let mut builder = QueryBuilder::new("INSERT OR REPLACE INTO gc_candidates (block_id) ");
+        builder.push_values(chunk, |mut row, id| {
+            row.push_bind(id);
+        });
+        builder.build().execute(&mut *tx).await?;
+    }
+
+    Ok(())
+}
+
+/// Makes candidates of the blocks referenced from the snapshot with the root hash `old` but not
+/// from the one with the root hash `new`. Call this before `old` is pruned. Only the subtrees that
+/// differ between the two snapshots are visited, so the cost is proportional to the changes
+/// between them, not to their size.
+pub(super) async fn insert_removed(
+    tx: &mut db::WriteTransaction,
+    old: &Hash,
+    new: &Hash,
+) -> Result<(), Error> {
+    let mut ids = Vec::new();
+    let mut stack = vec![(*old, *new, 0)];
+
+    while let Some((old, new, layer)) = stack.pop() {
+        if old == new {
+            continue;
+        }
+
+        if layer < INNER_LAYER_COUNT {
+            let old_nodes = inner_node::load_children(tx, &old).await?;
+            let new_nodes = inner_node::load_children(tx, &new).await?;
+
+            for (bucket, old_node) in &old_nodes {
+                let new_hash = new_nodes
+                    .get(bucket)
+                    .map(|node| node.hash)
+                    .unwrap_or_else(|| empty_hash(layer));
+
+                stack.push((old_node.hash, new_hash, layer + 1));
+            }
+        } else {
+            let old_nodes = leaf_node::load_children(tx, &old).await?;
+            let new_nodes = leaf_node::load_children(tx, &new).await?;
+
+            ids.extend(
+                old_nodes
+                    .iter()
+                    .filter(|old_node| {
+                        new_nodes
+                            .get(&old_node.locator)
+                            .map(|new_node| new_node.block_id != old_node.block_id)
+                            .unwrap_or(true)
+                    })
+                    .map(|old_node| old_node.block_id),
+            );
+        }
+    }
+
+    insert(tx, ids).await
+}
+
+/// Makes all the blocks at the given locators candidates.
+pub(super) async fn insert_at(
+    tx: &mut db::WriteTransaction,
+    locators: &[Hash],
+) -> Result<(), Error> {
+    for chunk in locators.chunks(MAX_ID_BATCH) {
+        let mut builder = QueryBuilder::new(
+            "INSERT OR REPLACE INTO gc_candidates (block_id)
+                 SELECT DISTINCT block_id FROM snapshot_leaf_nodes WHERE locator IN (",
+        );
+
+        let mut separated = builder.separated(", ");
+        for locator in chunk {
+            separated.push_bind(locator);
+        }
+
+        builder.push(")");
+        builder.build().execute(&mut *tx).await?;
+    }
+
+    Ok(())
+}
+
+/// Makes (at most) `limit` stored blocks with ids greater than `after` candidates. Returns the id
+/// of the last one, or `None` when there are no more. Calling this repeatedly, each time with the
+/// previously returned id, makes every stored block a candidate. Used to periodically recheck the
+/// whole repository in case a block became unreachable without any change at its locators (e.g.
+/// when a whole directory was removed in a branch whose earlier snapshots we've never seen).
+pub(super) async fn reset(
+    tx: &mut db::WriteTransaction,
+    after: Option<&BlockId>,
+    limit: u32,
+) -> Result<Option<BlockId>, Error> {
+    let ids: Vec<BlockId> =
+        sqlx::query("SELECT id FROM blocks WHERE id > COALESCE(?, x'') ORDER BY id LIMIT ?")
+            .bind(after)
+            .bind(limit)
+            .fetch(&mut *tx)
+            .map_ok(|row| row.get(0))
+            .try_collect()
+            .await?;
+
+    let last = ids.last().copied();
+    insert(tx, ids).await?;
+
+    Ok(last)
+}
+
+// Hash of an empty node at the given layer.
+fn empty_hash(layer: usize) -> Hash {
+    if layer < INNER_LAYER_COUNT - 1 {
+        *EMPTY_INNER_HASH
+    } else {
+        *EMPTY_LEAF_HASH
+    }
+}
+
+// Loads the locators of the given blocks.
+async fn load_locators(conn: &mut db::Connection, ids: &[BlockId]) -> Result<Vec<Hash>, Error> {
+    let mut builder = QueryBuilder::new(
+        "SELECT DISTINCT locator FROM snapshot_leaf_nodes WHERE block_presence = ",
+    );
+    builder.push_bind(SingleBlockPresence::Present);
+    builder.push(" AND block_id IN (");
+
+    let mut separated = builder.separated(", ");
+    for id in ids {
+        separated.push_bind(id);
+    }
+
+    builder.push(")");
+
+    let locators = builder
+        .build()
+        .fetch(conn)
+        .map_ok(|row| row.get::<Hash, _>(0))
+        .try_collect()
+        .await?;
+
+    Ok(locators)
+}
+
+// Returns those of the given blocks that are present in at least one approved snapshot.
+async fn load_present_in_approved_snapshot(
+    conn: &mut db::Connection,
+    ids: &[BlockId],
+) -> Result<Vec<BlockId>, Error> {
+    // Walk from the leaf nodes up to the roots. This is proportional to the depth of the index
+    // (and the number of snapshots sharing the nodes), not to its size.
+    let mut builder = QueryBuilder::new(
+        "WITH RECURSIVE
+             ancestors(block_id, hash) AS (
+                 SELECT block_id, parent
+                     FROM snapshot_leaf_nodes
+                     WHERE block_presence = ",
+    );
+    builder.push_bind(SingleBlockPresence::Present);
+    builder.push(" AND block_id IN (");
+
+    let mut separated = builder.separated(", ");
+    for id in ids {
+        separated.push_bind(id);
+    }
+
+    builder.push(
+        ")
+                 UNION
+                 SELECT a.block_id, i.parent
+                     FROM snapshot_inner_nodes AS i
+                     INNER JOIN ancestors AS a ON a.hash = i.hash
+             )
+         SELECT DISTINCT a.block_id
+             FROM ancestors AS a
+             INNER JOIN snapshot_root_nodes AS r ON r.hash = a.hash
+             WHERE r.state = ",
+    );
+    builder.push_bind(NodeState::Approved);
+
+    let ids = builder
+        .build()
+        .fetch(conn)
+        .map_ok(|row| row.get::<BlockId, _>(0))
+        .try_collect()
+        .await?;
+
+    Ok(ids)
+}
@@ -49,6 +49,42 @@ pub(super) async fn load_children(
     .map_err(From::from)
 }
 
+/// Load all inner nodes in the subtree with the specified root hash, together with the layer each
+/// of them is on (the children of the root are on layer zero). The order is unspecified.
+pub(super) fn load_descendants<'a>(
+    conn: &'a mut db::Connection,
+    root: &'a Hash,
+) -> impl Stream<Item = Result<(usize, InnerNode), Error>> + 'a {
+    sqlx::query(
+        "WITH RECURSIVE
+             inner_nodes(hash, state, block_presence, layer) AS (
+                 SELECT hash, state, block_presence, 0
+                     FROM snapshot_inner_nodes
+                     WHERE parent = ?
+                 UNION
+                 SELECT c.hash, c.state, c.block_presence, p.layer + 1
+                     FROM snapshot_inner_nodes AS c
+                     INNER JOIN inner_nodes AS p ON p.hash = c.parent
+             )
+         SELECT hash, state, block_presence, layer FROM inner_nodes",
+    )
+    .bind(root)
+    .fetch(conn)
+    .map_ok(|row| {
+        let node = InnerNode {
+            hash: row.get(0),
+            summary: Summary {
+                state: row.get(1),
+                block_presence: row.get(2),
+            },
+        };
+        let layer: u32 = row.get(3);
+
+        (layer as usize, node)
+    })
+    .err_into()
+}
+
 pub(super) async fn load(
     conn: &mut db::Connection,
     hash: &Hash,
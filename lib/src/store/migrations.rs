@@ -11,6 +11,12 @@ pub(super) async fn run_data(
     this_writer_id: PublicKey,
     write_keys: &Keypair,
 ) -> Result<(), Error> {
+    // Fast path for the common case of an already migrated repository which avoids taking the
+    // write lock on every open.
+    if data_version::get(store.acquire_read().await?.db()).await? >= DATA_VERSION {
+        return Ok(());
+    }
+
     v1::run(store, this_writer_id, write_keys).await?;
 
     // Ensure we are at the latest version.
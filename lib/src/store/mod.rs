@@ -1,10 +1,13 @@
 mod block;
+mod block_cache;
 mod block_expiration_tracker;
+mod block_files;
 mod block_id_cache;
 mod block_ids;
 mod changeset;
 mod client;
 mod error;
+mod gc_candidates;
 mod index;
 mod inner_node;
 mod leaf_node;
@@ -23,40 +26,49 @@ pub use error::Error;
 pub use migrations::DATA_VERSION;
 
 pub(crate) use {
+    block_expiration_tracker::BlockExpirationMetrics,
+    block_files::dir_for as block_files_dir,
     block_ids::BlockIdsPage,
     changeset::Changeset,
     client::{ClientReader, ClientWriter},
+    gc_candidates::GcCandidates,
 };
 
 #[cfg(test)]
 pub(crate) use test_utils::SnapshotWriter;
 
 use self::{
+    block_cache::{BlockCache, DEFAULT_BLOCK_CACHE_CAPACITY},
     block_expiration_tracker::BlockExpirationTracker,
-    block_id_cache::{BlockIdCache, LookupError},
+    block_files::BlockFiles,
+    block_id_cache::{BlockIdCache, LookupError, DEFAULT_BLOCK_ID_CACHE_CAPACITY},
 };
 use crate::{
     block_tracker::BlockTracker as BlockDownloadTracker,
+    collections::HashSet,
     crypto::{
         sign::{Keypair, PublicKey},
         Hash,
     },
     db,
     debug::DebugPrinter,
+    future::TryStreamExt as _,
     progress::Progress,
     protocol::{
-        BlockContent, BlockId, BlockNonce, InnerNodes, LeafNodes, RootNode, RootNodeFilter,
-        SingleBlockPresence,
+        BlockContent, BlockId, BlockNonce, InnerNode, InnerNodes, LeafNodes, RootNode,
+        RootNodeFilter, SingleBlockPresence, EMPTY_INNER_HASH,
     },
     sync::broadcast_hash_set,
 };
 use futures_util::{Stream, TryStreamExt};
+use metrics::{Counter, Histogram};
 use std::{
     borrow::Cow,
     future::Future,
     ops::{Deref, DerefMut},
-    path::Path,
-    sync::Arc,
+    path::{Path, PathBuf},
+    slice,
+    sync::{Arc, OnceLock},
     time::Duration,
 };
 // TODO: Consider creating an async `RwLock` in the `deadlock` module and use it here.
@@ -67,6 +79,9 @@ use tokio::sync::RwLock;
 pub(crate) struct Store {
     db: db::Pool,
     block_id_cache: BlockIdCache,
+    block_cache: BlockCache,
+    block_files: Arc<OnceLock<BlockFiles>>,
+    block_download_tracker: BlockDownloadTracker,
     pub client_reload_index_tx: broadcast_hash_set::Sender<PublicKey>,
     block_expiration_tracker: Arc<RwLock<Option<Arc<BlockExpirationTracker>>>>,
 }
@@ -77,7 +92,10 @@ impl Store {
 
         Self {
             db,
-            block_id_cache: BlockIdCache::new(),
+            block_id_cache: BlockIdCache::new(DEFAULT_BLOCK_ID_CACHE_CAPACITY),
+            block_cache: BlockCache::new(DEFAULT_BLOCK_CACHE_CAPACITY),
+            block_files: Arc::new(OnceLock::new()),
+            block_download_tracker: BlockDownloadTracker::new(),
             client_reload_index_tx,
             block_expiration_tracker: Arc::new(RwLock::new(None)),
         }
@@ -101,6 +119,7 @@ impl Store {
         &self,
         expiration_time: Option<Duration>,
         block_download_tracker: BlockDownloadTracker,
+        metrics: BlockExpirationMetrics,
     ) -> Result<(), Error> {
         let mut tracker_lock = self.block_expiration_tracker.write().await;
 
@@ -122,6 +141,7 @@ impl Store {
             expiration_time,
             block_download_tracker,
             self.client_reload_index_tx.clone(),
+            metrics,
         )
         .await?;
 
@@ -143,9 +163,116 @@ impl Store {
         self.block_expiration_tracker.read().await.as_ref().cloned()
     }
 
-    /// Export the whole repository db to the given file.
+    /// Sets the memory budget (in bytes) of the decrypted block cache. Zero disables the cache.
+    pub fn set_block_cache_capacity(&self, capacity: u64) {
+        self.block_cache.set_capacity(capacity);
+    }
+
+    /// Returns the memory budget (in bytes) of the decrypted block cache.
+    pub fn block_cache_capacity(&self) -> u64 {
+        self.block_cache.capacity()
+    }
+
+    /// Sets the memory budget (in bytes) of the block id cache.
+    pub fn set_block_id_cache_capacity(&self, capacity: u64) {
+        self.block_id_cache.set_capacity(capacity);
+    }
+
+    /// Returns the memory budget (in bytes) of the block id cache.
+    pub fn block_id_cache_capacity(&self) -> u64 {
+        self.block_id_cache.capacity()
+    }
+
+    /// Sets the counters to report the decrypted block cache hits and misses to and the histogram
+    /// to report the block decryption times to.
+    pub fn set_block_cache_metrics(&self, hits: Counter, misses: Counter, decrypt_time: Histogram) {
+        self.block_cache.set_metrics(hits, misses, decrypt_time);
+    }
+
+    /// Sets the histogram to report the block id cache load times to.
+    pub fn set_block_id_cache_metrics(&self, load_time: Histogram) {
+        self.block_id_cache.set_metrics(load_time);
+    }
+
+    /// Stores the contents of newly written blocks as files in the given directory instead of in the
+    /// db. Blocks already in the db stay there. Reading blocks whose content is stored in files
+    /// requires this to be enabled (with the same directory). Can be enabled only once.
+    pub async fn enable_block_files(&self, dir: PathBuf) -> Result<(), Error> {
+        if self.block_files.get().is_some() {
+            return Ok(());
+        }
+
+        let files = BlockFiles::open(dir).await?;
+        self.block_files.set(files).ok();
+
+        Ok(())
+    }
+
+    /// Removes block files that are no longer referenced from the db (e.g., because their blocks
+    /// were removed by a db trigger), going through at most `shards` shards. Each call continues
+    /// where the previous one stopped. Returns the number of removed files.
+    pub async fn sweep_block_files(&self, shards: usize) -> Result<usize, Error> {
+        let Some(files) = self.block_files.get() else {
+            return Ok(0);
+        };
+
+        // List the files and find the unreferenced ones without holding the write transaction so
+        // the writers aren't blocked by the filesystem access.
+        let mut candidates = Vec::new();
+        let mut temps = Vec::new();
+
+        for _ in 0..shards {
+            let (ids, shard_temps) = files.list(files.next_sweep_shard()).await?;
+
+            let mut tx = self.db.begin_read().await?;
+            let referenced = block::load_external(&mut tx, &ids).await?;
+
+            candidates.extend(ids.into_iter().filter(|id| !referenced.contains(id)));
+            temps.extend(shard_temps);
+        }
+
+        if candidates.is_empty() && temps.is_empty() {
+            return Ok(0);
+        }
+
+        // The files of blocks being written concurrently look unreferenced too until their
+        // transaction commits. Confirm the candidates while no write is in progress and remove the
+        // files after the commit, before the next write transaction begins (as `OnCommit` does).
+        let mut tx = self.db.begin_write().await?;
+        let referenced = block::load_external(&mut tx, &candidates).await?;
+        let orphaned: Vec<_> = candidates
+            .into_iter()
+            .filter(|id| !referenced.contains(id))
+            .collect();
+        let removed = orphaned.len();
+
+        let files = files.clone();
+        tx.commit_and_then_blocking(move || {
+            files.remove_blocking(&orphaned);
+            files.remove_temps_blocking(&temps);
+        })
+        .await?;
+
+        Ok(removed)
+    }
+
+    /// Tracker of the missing blocks that should be downloaded from peers.
+    pub fn block_download_tracker(&self) -> &BlockDownloadTracker {
+        &self.block_download_tracker
+    }
+
+    /// Export the whole repository db to the given file. If block files are enabled, they are
+    /// exported too, into the directory given by `block_files_dir(dst)`.
     pub async fn export(&self, dst: &Path) -> Result<(), Error> {
-        misc::export(&mut *self.db.acquire().await?, dst).await
+        if let Some(files) = self.block_files.get() {
+            // Hold a write transaction (without using it) so no block files are removed while
+            // exporting. `VACUUM INTO` can't run inside a transaction so use a separate connection.
+            let _tx = self.db.begin_write().await?;
+            misc::export(&mut *self.db.acquire().await?, dst).await?;
+            files.copy_to(block_files::dir_for(dst)).await
+        } else {
+            misc::export(&mut *self.db.acquire().await?, dst).await
+        }
     }
 
     /// Acquires a `Reader`
@@ -153,6 +280,8 @@ impl Store {
         Ok(Reader {
             inner: Handle::Connection(self.db.acquire().await?),
             block_id_cache: self.block_id_cache.clone(),
+            block_cache: self.block_cache.clone(),
+            block_files: self.block_files.get().cloned(),
             block_expiration_tracker: self.block_expiration_tracker.read().await.clone(),
         })
     }
@@ -167,6 +296,8 @@ impl Store {
                 inner: Reader {
                     inner: Handle::ReadTransaction(tx.await?),
                     block_id_cache: self.block_id_cache.clone(),
+                    block_cache: self.block_cache.clone(),
+                    block_files: self.block_files.get().cloned(),
                     block_expiration_tracker: self.block_expiration_tracker.read().await.clone(),
                 },
             })
@@ -184,6 +315,8 @@ impl Store {
                     inner: Reader {
                         inner: Handle::WriteTransaction(tx.await?),
                         block_id_cache: self.block_id_cache.clone(),
+                        block_cache: self.block_cache.clone(),
+                        block_files: self.block_files.get().cloned(),
                         block_expiration_tracker: self
                             .block_expiration_tracker
                             .read()
@@ -192,6 +325,7 @@ impl Store {
                     },
                 },
                 untrack_blocks: None,
+                removed_blocks: Vec::new(),
             })
         }
     }
@@ -211,6 +345,7 @@ impl Store {
             ClientWriter::begin(
                 tx.await?,
                 self.block_id_cache.clone(),
+                self.block_files.get().cloned(),
                 self.block_expiration_tracker.read().await.clone(),
             )
             .await
@@ -279,8 +414,10 @@ impl Store {
                 continue;
             }
 
-            // `old` can't serve as fallback for `self` and so we can safely remove it
+            // `old` can't serve as fallback for `self` and so we can safely remove it. The blocks
+            // that are only in `old` might become unreachable.
             let mut tx = self.begin_write().await?;
+            gc_candidates::insert_removed(tx.db(), &old.proof.hash, &root_node.proof.hash).await?;
             root_node::remove(tx.db(), &old).await?;
             tx.commit().await?;
 
@@ -301,6 +438,51 @@ impl Store {
         BlockIdsPage::new(self.db.clone(), page_size)
     }
 
+    /// Returns the position of the newest garbage collection candidate, or `None` if there are no
+    /// candidates.
+    pub async fn gc_candidates_end(&self) -> Result<Option<i64>, Error> {
+        let mut conn = self.db.acquire().await?;
+        gc_candidates::end(&mut conn).await
+    }
+
+    /// Loads (at most) `limit` blocks that might have become unreachable since they were last
+    /// checked by the garbage collector, skipping those recorded after the position `end`.
+    pub async fn load_gc_candidates(&self, limit: u32, end: i64) -> Result<GcCandidates, Error> {
+        let mut conn = self.db.acquire().await?;
+        gc_candidates::load(&mut conn, limit, end).await
+    }
+
+    /// Marks the given garbage collection candidates as processed.
+    pub async fn remove_gc_candidates(&self, candidates: &GcCandidates) -> Result<(), Error> {
+        let mut tx = self.db.begin_write().await?;
+        gc_candidates::remove(&mut tx, candidates).await?;
+        tx.commit().await?;
+
+        Ok(())
+    }
+
+    /// Makes every stored block a garbage collection candidate so the next collections recheck the
+    /// whole repository.
+    pub async fn reset_gc_candidates(&self) -> Result<(), Error> {
+        // Insert them in batches, each in its own transaction, so the writer is not held for too
+        // long when the repository is big.
+        const BATCH_SIZE: u32 = 64 * 1024;
+
+        let mut last = None;
+
+        loop {
+            let mut tx = self.db.begin_write().await?;
+            last = gc_candidates::reset(&mut tx, last.as_ref(), BATCH_SIZE).await?;
+            tx.commit().await?;
+
+            if last.is_none() {
+                break;
+            }
+        }
+
+        Ok(())
+    }
+
     pub async fn debug_print_root_node(&self, printer: DebugPrinter) {
         match self.acquire_read().await {
             Ok(mut reader) => root_node::debug_print(reader.db(), printer).await,
@@ -325,6 +507,8 @@ impl Store {
 pub(crate) struct Reader {
     inner: Handle,
     block_id_cache: BlockIdCache,
+    block_cache: BlockCache,
+    block_files: Option<BlockFiles>,
     block_expiration_tracker: Option<Arc<BlockExpirationTracker>>,
 }
 
@@ -339,7 +523,7 @@ impl Reader {
         id: &BlockId,
         content: &mut BlockContent,
     ) -> Result<BlockNonce, Error> {
-        let result = block::read(self.db(), id, content).await;
+        let result = block::read(&mut self.inner, self.block_files.as_ref(), id, content).await;
 
         if let Some(expiration_tracker) = &self.block_expiration_tracker {
             let is_missing = matches!(result, Err(Error::BlockNotFound));
@@ -349,6 +533,54 @@ impl Reader {
         result
     }
 
+    /// Reads multiple blocks from the store at once. Returns the found blocks as
+    /// `(id, nonce, content)` triples in unspecified order. Blocks not found are omitted.
+    pub async fn read_blocks(
+        &mut self,
+        ids: &[BlockId],
+    ) -> Result<Vec<(BlockId, BlockNonce, BlockContent)>, Error> {
+        let blocks = block::read_many(&mut self.inner, self.block_files.as_ref(), ids).await?;
+
+        if let Some(expiration_tracker) = &self.block_expiration_tracker {
+            let found: HashSet<_> = blocks.iter().map(|(id, _, _)| *id).collect();
+
+            for id in ids {
+                expiration_tracker.handle_block_update(id, !found.contains(id));
+            }
+        }
+
+        Ok(blocks)
+    }
+
+    /// Returns the decrypted content of the block from the decrypted block cache, if present.
+    pub fn load_cached_block(&self, id: &BlockId) -> Option<BlockContent> {
+        let content = self.block_cache.get(id)?;
+
+        // Cache hit still counts as a block access.
+        if let Some(expiration_tracker) = &self.block_expiration_tracker {
+            expiration_tracker.handle_block_update(id, false);
+        }
+
+        Some(content)
+    }
+
+    /// Checks whether the decrypted content of the block is in the decrypted block cache. Unlike
+    /// `load_cached_block` this doesn't count as a block access.
+    pub fn is_block_cached(&self, id: &BlockId) -> bool {
+        self.block_cache.contains(id)
+    }
+
+    /// Stores the decrypted content of the block into the decrypted block cache so subsequent
+    /// reads of it don't need to touch the db nor decrypt it again.
+    pub fn cache_block(&self, id: BlockId, content: &BlockContent) {
+        self.block_cache.insert(id, content);
+    }
+
+    /// Records the time it took to decrypt a block read from the store.
+    pub fn record_block_decrypt_time(&self, time: Duration) {
+        self.block_cache.record_decrypt_time(time);
+    }
+
     /// Checks whether the block exists in the store.
     #[cfg(test)]
     pub async fn block_exists(&mut self, id: &BlockId) -> Result<bool, Error> {
@@ -442,6 +674,14 @@ impl Reader {
         inner_node::load_children(self.db(), parent_hash).await
     }
 
+    /// Load all inner nodes of the snapshot with the given root hash, together with their layers.
+    pub fn load_descendant_inner_nodes<'a>(
+        &'a mut self,
+        root_hash: &'a Hash,
+    ) -> impl Stream<Item = Result<(usize, InnerNode), Error>> + 'a {
+        inner_node::load_descendants(self.db(), root_hash)
+    }
+
     // TODO: use cache and remove `ReadTransaction::load_leaf_nodes_with_cache`
     pub async fn load_leaf_nodes(&mut self, parent_hash: &Hash) -> Result<LeafNodes, Error> {
         leaf_node::load_children(self.db(), parent_hash).await
@@ -523,17 +763,41 @@ impl DerefMut for ReadTransaction {
 pub(crate) struct WriteTransaction {
     inner: ReadTransaction,
     untrack_blocks: Option<block_expiration_tracker::UntrackTransaction>,
+    // Blocks removed in this transaction whose files should be removed once it's committed.
+    removed_blocks: Vec<BlockId>,
 }
 
 impl WriteTransaction {
     /// Removes the specified block from the store and marks it as missing in the index.
     pub async fn remove_block(&mut self, id: &BlockId) -> Result<(), Error> {
+        self.remove_blocks(slice::from_ref(id)).await
+    }
+
+    /// Removes the specified blocks from the store and marks them as missing in the index.
+    pub async fn remove_blocks(&mut self, ids: &[BlockId]) -> Result<(), Error> {
         let db = self.db();
 
-        block::remove(db, id).await?;
-        let parent_hashes = leaf_node::set_missing(db, id).try_collect().await?;
+        block::remove_many(db, ids).await?;
+
+        let mut parent_hashes = Vec::new();
+        for id in ids {
+            leaf_node::set_missing(db, id)
+                .try_collect_into(&mut parent_hashes)
+                .await?;
+        }
+
+        parent_hashes.sort();
+        parent_hashes.dedup();
         index::update_summaries(db, parent_hashes).await?;
 
+        for id in ids {
+            self.block_cache.remove(id);
+        }
+
+        if self.block_files.is_some() {
+            self.removed_blocks.extend_from_slice(ids);
+        }
+
         let WriteTransaction {
             inner:
                 ReadTransaction {
@@ -544,17 +808,23 @@ impl WriteTransaction {
                         },
                 },
             untrack_blocks,
+            ..
         } = self;
 
         if let Some(tracker) = block_expiration_tracker {
             let untrack_tx = untrack_blocks.get_or_insert_with(|| tracker.begin_untrack_blocks());
-            untrack_tx.untrack(*id);
+
+            for id in ids {
+                untrack_tx.untrack(*id);
+            }
         }
 
         Ok(())
     }
 
     pub async fn remove_branch(&mut self, root_node: &RootNode) -> Result<(), Error> {
+        gc_candidates::insert_removed(self.db(), &root_node.proof.hash, &*EMPTY_INNER_HASH).await?;
+
         root_node::remove_older(self.db(), root_node).await?;
         root_node::remove(self.db(), root_node).await?;
 
@@ -581,16 +851,16 @@ impl WriteTransaction {
     }
 
     pub async fn commit(self) -> Result<(), Error> {
-        let inner = self.inner.inner.inner.into_write();
+        let (inner, on_commit) = self.into_parts();
 
-        if let Some(untrack) = self.untrack_blocks {
-            inner
-                .commit_and_then(move || {
-                    untrack.commit();
-                })
-                .await?
-        } else {
-            inner.commit().await?;
+        match on_commit {
+            Some(on_commit) if on_commit.is_blocking() => {
+                inner
+                    .commit_and_then_blocking(move || on_commit.run())
+                    .await?
+            }
+            Some(on_commit) => inner.commit_and_then(move || on_commit.run()).await?,
+            None => inner.commit().await?,
         }
 
         Ok(())
@@ -605,26 +875,83 @@ impl WriteTransaction {
         F: FnOnce() -> R + Send + 'static,
         R: Send + 'static,
     {
-        let inner = self.inner.inner.inner.into_write();
+        let (inner, on_commit) = self.into_parts();
 
-        if let Some(untrack) = self.untrack_blocks {
-            Ok(inner
+        match on_commit {
+            Some(on_commit) if on_commit.is_blocking() => Ok(inner
+                .commit_and_then_blocking(move || {
+                    on_commit.run();
+                    f()
+                })
+                .await?),
+            Some(on_commit) => Ok(inner
                 .commit_and_then(move || {
-                    untrack.commit();
+                    on_commit.run();
                     f()
                 })
-                .await?)
-        } else {
-            Ok(inner.commit_and_then(f).await?)
+                .await?),
+            None => Ok(inner.commit_and_then(f).await?),
         }
     }
 
+    // Splits this transaction into the underlying db transaction and the actions to run once it's
+    // successfully committed (if any).
+    fn into_parts(self) -> (db::WriteTransaction, Option<OnCommit>) {
+        let Self {
+            inner:
+                ReadTransaction {
+                    inner:
+                        Reader {
+                            inner, block_files, ..
+                        },
+                },
+            untrack_blocks,
+            removed_blocks,
+        } = self;
+
+        let remove_block_files = block_files
+            .filter(|_| !removed_blocks.is_empty())
+            .map(|files| (files, removed_blocks));
+
+        let on_commit =
+            (untrack_blocks.is_some() || remove_block_files.is_some()).then_some(OnCommit {
+                untrack_blocks,
+                remove_block_files,
+            });
+
+        (inner.into_write(), on_commit)
+    }
+
     // Access the underlying database transaction.
     fn db(&mut self) -> &mut db::WriteTransaction {
         self.inner.inner.inner.as_write()
     }
 }
 
+struct OnCommit {
+    untrack_blocks: Option<block_expiration_tracker::UntrackTransaction>,
+    remove_block_files: Option<(BlockFiles, Vec<BlockId>)>,
+}
+
+impl OnCommit {
+    // Whether `run` performs blocking io and so must not be called on the async runtime.
+    fn is_blocking(&self) -> bool {
+        self.remove_block_files.is_some()
+    }
+
+    fn run(self) {
+        if let Some(untrack) = self.untrack_blocks {
+            untrack.commit();
+        }
+
+        // Runs before the next write transaction begins so a block removed here can't be
+        // concurrently re-added by another transaction.
+        if let Some((files, ids)) = self.remove_block_files {
+            files.remove_blocking(&ids);
+        }
+    }
+}
+
 impl Deref for WriteTransaction {
     type Target = ReadTransaction;
 
@@ -63,25 +63,29 @@ impl Patch {
         &self.vv
     }
 
+    /// Returns whether this changed anything and the id of the block previously at the locator
+    /// (if any).
     pub async fn insert(
         &mut self,
         tx: &mut ReadTransaction,
         encoded_locator: Hash,
         block_id: BlockId,
         block_presence: SingleBlockPresence,
-    ) -> Result<bool, Error> {
+    ) -> Result<(bool, Option<BlockId>), Error> {
         let nodes = self.fetch(tx, &encoded_locator).await?;
+        let old_block_id = nodes.get(&encoded_locator).map(|node| node.block_id);
         let changed = nodes.insert(encoded_locator, block_id, block_presence);
 
-        Ok(changed)
+        Ok((changed, old_block_id))
     }
 
+    /// Returns the id of the removed block, if any.
     pub async fn remove(
         &mut self,
         tx: &mut ReadTransaction,
         encoded_locator: &Hash,
         expected_block_id: Option<&BlockId>,
-    ) -> Result<bool, Error> {
+    ) -> Result<Option<BlockId>, Error> {
         let nodes = self.fetch(tx, encoded_locator).await?;
 
         let old = if let Some(block_id) = expected_block_id {
@@ -90,7 +94,7 @@ impl Patch {
             nodes.remove(encoded_locator)
         };
 
-        Ok(old.is_some())
+        Ok(old.map(|node| node.block_id))
     }
 
     pub async fn save(
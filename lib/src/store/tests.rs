@@ -464,6 +464,177 @@ async fn prune_case(ops: Vec<PruneTestOp>, rng_seed: u64) {
     }
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn gc_candidates_of_changed_blocks() {
+    let (_base_dir, store) = setup().await;
+    let read_key = SecretKey::random();
+    let write_keys = Keypair::random();
+
+    let branch_a = PublicKey::random();
+    let branch_b = PublicKey::random();
+
+    let locator_1 = random_head_locator().encode(&read_key);
+    let locator_2 = random_head_locator().encode(&read_key);
+    let locator_3 = random_head_locator().encode(&read_key);
+
+    let block_1: Block = rand::random();
+    let block_2: Block = rand::random();
+    let block_3: Block = rand::random();
+    let block_4: Block = rand::random();
+
+    // Branch A: 1 -> block 1, 2 -> block 2
+    apply(
+        &store,
+        &branch_a,
+        &write_keys,
+        [(locator_1, &block_1), (locator_2, &block_2)],
+    )
+    .await;
+
+    let candidates = store.load_gc_candidates(u32::MAX, i64::MAX).await.unwrap();
+    assert_eq!(
+        candidates.block_ids,
+        [block_1.id, block_2.id].into_iter().collect()
+    );
+    store.remove_gc_candidates(&candidates).await.unwrap();
+
+    // Nothing changed since the last check.
+    assert!(store
+        .load_gc_candidates(u32::MAX, i64::MAX)
+        .await
+        .unwrap()
+        .is_empty());
+
+    // Branch B: 1 -> block 3, 2 -> block 2, 3 -> block 1
+    //
+    // Only the blocks added to branch B are candidates, including the ones that were already
+    // stored. The blocks of branch A are not, even at the same locators.
+    apply(
+        &store,
+        &branch_b,
+        &write_keys,
+        [
+            (locator_1, &block_3),
+            (locator_2, &block_2),
+            (locator_3, &block_1),
+        ],
+    )
+    .await;
+
+    let candidates = store.load_gc_candidates(u32::MAX, i64::MAX).await.unwrap();
+    assert_eq!(
+        candidates.block_ids,
+        [block_1.id, block_2.id, block_3.id].into_iter().collect()
+    );
+    store.remove_gc_candidates(&candidates).await.unwrap();
+
+    // Branch A: 2 -> block 4
+    //
+    // Both the replaced and the new block are candidates.
+    apply(&store, &branch_a, &write_keys, [(locator_2, &block_4)]).await;
+
+    let candidates = store.load_gc_candidates(u32::MAX, i64::MAX).await.unwrap();
+    assert_eq!(
+        candidates.block_ids,
+        [block_2.id, block_4.id].into_iter().collect()
+    );
+    assert!(candidates.locators.contains(&locator_2));
+    assert!(!candidates.locators.contains(&locator_1));
+    store.remove_gc_candidates(&candidates).await.unwrap();
+
+    // Removing branch B makes its blocks candidates. Only block 1 is still stored (referenced from
+    // branch A), the others were removed together with the branch.
+    let mut tx = store.begin_write().await.unwrap();
+    let root_node = tx
+        .load_latest_approved_root_node(&branch_b, RootNodeFilter::Any)
+        .await
+        .unwrap();
+    tx.remove_branch(&root_node).await.unwrap();
+    tx.commit().await.unwrap();
+
+    let candidates = store.load_gc_candidates(u32::MAX, i64::MAX).await.unwrap();
+    assert_eq!(candidates.block_ids, [block_1.id].into_iter().collect());
+
+    async fn apply<'a>(
+        store: &Store,
+        branch_id: &PublicKey,
+        write_keys: &Keypair,
+        links: impl IntoIterator<Item = (Hash, &'a Block)>,
+    ) {
+        let mut tx = store.begin_write().await.unwrap();
+        let mut changeset = Changeset::new();
+
+        for (encoded_locator, block) in links {
+            changeset.link_block(encoded_locator, block.id, SingleBlockPresence::Present);
+            changeset.write_block(block.clone());
+        }
+
+        changeset.bump(Bump::increment(*branch_id));
+        changeset
+            .apply(&mut tx, branch_id, write_keys)
+            .await
+            .unwrap();
+        tx.commit().await.unwrap();
+    }
+}
+
+#[tokio::test(flavor = "multi_thread")]
+async fn gc_candidates_reset_in_batches() {
+    let (_base_dir, store) = setup().await;
+    let read_key = SecretKey::random();
+    let write_keys = Keypair::random();
+    let branch_id = PublicKey::random();
+
+    let blocks: Vec<Block> = (0..5).map(|_| rand::random()).collect();
+
+    let mut tx = store.begin_write().await.unwrap();
+    let mut changeset = Changeset::new();
+
+    for block in &blocks {
+        changeset.link_block(
+            random_head_locator().encode(&read_key),
+            block.id,
+            SingleBlockPresence::Present,
+        );
+        changeset.write_block(block.clone());
+    }
+
+    changeset.bump(Bump::increment(branch_id));
+    changeset
+        .apply(&mut tx, &branch_id, &write_keys)
+        .await
+        .unwrap();
+    tx.commit().await.unwrap();
+
+    let candidates = store.load_gc_candidates(u32::MAX, i64::MAX).await.unwrap();
+    store.remove_gc_candidates(&candidates).await.unwrap();
+
+    let mut last = None;
+    let mut batches = 0;
+
+    loop {
+        let mut tx = store.begin_write().await.unwrap();
+        last = gc_candidates::reset(tx.db(), last.as_ref(), 2)
+            .await
+            .unwrap();
+        tx.commit().await.unwrap();
+
+        if last.is_none() {
+            break;
+        }
+
+        batches += 1;
+    }
+
+    assert_eq!(batches, 3);
+
+    let candidates = store.load_gc_candidates(u32::MAX, i64::MAX).await.unwrap();
+    assert_eq!(
+        candidates.block_ids,
+        blocks.iter().map(|block| block.id).collect()
+    );
+}
+
 async fn setup() -> (TempDir, Store) {
     let (temp_dir, pool) = db::create_temp().await.unwrap();
     let store = Store::new(pool);
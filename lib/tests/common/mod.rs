@@ -133,8 +133,22 @@ pub(crate) mod env {
 
     impl<'a> Env<'a> {
         pub fn new() -> Self {
+            Self::with_builder(turmoil::Builder::new())
+        }
+
+        /// Creates the environment whose simulated network delivers every message with a
+        /// latency (one way) between `min` and `max`.
+        #[allow(unused)]
+        pub fn with_message_latency(min: Duration, max: Duration) -> Self {
+            let mut builder = turmoil::Builder::new();
+            builder.min_message_latency(min).max_message_latency(max);
+
+            Self::with_builder(builder)
+        }
+
+        fn with_builder(mut builder: turmoil::Builder) -> Self {
             let context = Context::new(&Handle::current());
-            let runner = turmoil::Builder::new()
+            let runner = builder
                 .simulation_duration(Duration::from_secs(90))
                 .build_with_rng(Box::new(rand::thread_rng()));
 
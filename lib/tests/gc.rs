@@ -6,6 +6,7 @@ mod common;
 use self::common::{actor, Env, DEFAULT_REPO};
 use common::Proto;
 use ouisync::{AccessMode, File, Repository, BLOB_HEADER_SIZE, BLOCK_SIZE};
+use std::io::SeekFrom;
 use tokio::sync::mpsc;
 
 #[test]
@@ -29,6 +30,35 @@ fn local_delete_local_file() {
     });
 }
 
+#[test]
+fn local_delete_open_local_file() {
+    let mut env = Env::new();
+
+    env.actor("local", async {
+        let repo = actor::create_repo("test").await;
+
+        let content = common::random_bytes(2 * BLOCK_SIZE - BLOB_HEADER_SIZE);
+
+        let mut file = repo.create_file("test.dat").await.unwrap();
+        file.write_all(&content).await.unwrap();
+        file.flush().await.unwrap();
+
+        // 2 blocks for the file + 1 block for the root directory
+        expect_block_count(&repo, 3).await;
+
+        repo.remove_entry("test.dat").await.unwrap();
+
+        // The file is still open so its blocks must not be collected yet.
+        file.seek(SeekFrom::Start(0));
+        assert_eq!(file.read_to_end().await.unwrap(), content);
+
+        drop(file);
+
+        // Once it's closed, they are.
+        expect_block_count(&repo, 1).await;
+    });
+}
+
 #[test]
 fn local_delete_remote_file() {
     let mut env = Env::new();
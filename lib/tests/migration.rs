@@ -8,7 +8,7 @@ use futures_util::future;
 use once_cell::sync::Lazy;
 use ouisync::{
     Access, AccessMode, AccessSecrets, Network, PeerAddr, Repository, RepositoryParams,
-    DATA_VERSION, DIRECTORY_VERSION, SCHEMA_VERSION,
+    BLOB_HEADER_SIZE, BLOCK_SIZE, DATA_VERSION, DIRECTORY_VERSION, SCHEMA_VERSION,
 };
 use rand::{
     distributions::{Alphanumeric, DistString, Standard},
@@ -32,7 +32,15 @@ use tracing::{instrument, Instrument};
 const DB_EXTENSION: &str = "db";
 const DB_DUMP_EXTENSION: &str = "db.dump";
 
-static DUMP: Lazy<dump::Directory> = Lazy::new(|| {
+/// Directory version which introduced the paged directory format.
+const PAGED_DIRECTORY_VERSION: u32 = 3;
+
+static DUMP: Lazy<dump::Directory> = Lazy::new(|| base_dump().add("dir-paged", paged_directory()));
+
+/// Content of the dumps created before `PAGED_DIRECTORY_VERSION`.
+static DUMP_BEFORE_PAGED: Lazy<dump::Directory> = Lazy::new(base_dump);
+
+fn base_dump() -> dump::Directory {
     dump::Directory::new()
         .add("empty.txt", vec![])
         .add("small.txt", b"foo".to_vec())
@@ -44,7 +52,54 @@ static DUMP: Lazy<dump::Directory> = Lazy::new(|| {
                 .add("file-in-dir-b.txt", b"bar".to_vec())
                 .add("subdir", dump::Directory::new()),
         )
-});
+}
+
+/// Directory which is stored in the paged format. Its only file doesn't make it big enough for
+/// that, so it's also filled with tombstones (see `create_paged_directory_tombstones`) which don't
+/// show up in the dump but don't need any blocks besides the directory's own.
+fn paged_directory() -> dump::Directory {
+    dump::Directory::new().add("a.txt", b"baz".to_vec())
+}
+
+/// Number of tombstones in `paged_directory`. Each one is created as a file which is then removed.
+/// Creating the last one makes the directory content not fit into the first block of its blob, so
+/// it's switched to the paged format (and stays in it after the file is removed).
+const PAGED_DIRECTORY_TOMBSTONE_COUNT: usize = {
+    const NAME_LEN: usize = 3;
+
+    // Space left for the tombstones and the last file in the first block, after the blob header,
+    // the number of entries and the "a.txt" entry.
+    let space = BLOCK_SIZE - BLOB_HEADER_SIZE - 8 - file_entry_size("a.txt".len());
+
+    // The last file is the first one that doesn't fit after the tombstones created before it.
+    let last = (space - file_entry_size(NAME_LEN)) / tombstone_entry_size(NAME_LEN) + 1;
+
+    last + 1
+};
+
+// Sizes of the serialized directory entries (with a single writer in their version vectors).
+const VERSION_VECTOR_SIZE: usize = 8 + (8 + 32) + 8;
+
+const fn file_entry_size(name_len: usize) -> usize {
+    // name, variant, blob id, version vector
+    8 + name_len + 4 + 32 + VERSION_VECTOR_SIZE
+}
+
+const fn tombstone_entry_size(name_len: usize) -> usize {
+    // name, variant, cause, version vector
+    8 + name_len + 4 + 4 + VERSION_VECTOR_SIZE
+}
+
+/// Expected content of the given dump, which depends on its directory version.
+fn expected_dump(input_dump: &Path) -> &'static dump::Directory {
+    let (_, _, directory_version) = parse_versions(input_dump);
+
+    if directory_version >= PAGED_DIRECTORY_VERSION {
+        &DUMP
+    } else {
+        &DUMP_BEFORE_PAGED
+    }
+}
 
 /// Runs all tests on all db dumps.
 #[tokio::test(flavor = "multi_thread")]
@@ -114,7 +169,7 @@ async fn test_load_writer(work_dir: &Path, input_dump: &Path) {
     assert!(repo.check_integrity().await.unwrap());
 
     let dump = dump::save(&repo).await;
-    similar_asserts::assert_eq!(dump, *DUMP);
+    similar_asserts::assert_eq!(dump, *expected_dump(input_dump));
 
     info!("done");
 }
@@ -127,7 +182,7 @@ async fn test_load_reader(work_dir: &Path, input_dump: &Path) {
     assert!(repo.check_integrity().await.unwrap());
 
     let dump = dump::save(&repo).await;
-    similar_asserts::assert_eq!(dump, *DUMP);
+    similar_asserts::assert_eq!(dump, *expected_dump(input_dump));
 
     info!("done");
 }
@@ -167,7 +222,7 @@ async fn test_sync(work_dir: &Path, input_dump: &Path) {
     future::join(tx.run(&repo_a), rx.run(&repo_b)).await;
 
     let dump = dump::save(&repo_b).await;
-    similar_asserts::assert_eq!(dump, *DUMP);
+    similar_asserts::assert_eq!(dump, *expected_dump(input_dump));
 
     info!("done");
 }
@@ -196,8 +251,12 @@ async fn create_repo_dump(work_dir: &Path, output_path: &Path) {
     .await
     .unwrap();
 
+    // So `paged_directory` is stored in the paged format.
+    repo.set_paged_directories(true).await.unwrap();
+
     // Populate it with data
     dump::load(&repo, &DUMP).await;
+    create_paged_directory_tombstones(&repo).await;
 
     repo.close().await.unwrap();
 
@@ -205,6 +264,14 @@ async fn create_repo_dump(work_dir: &Path, output_path: &Path) {
     save_db_dump(&store_path, output_path).await;
 }
 
+async fn create_paged_directory_tombstones(repo: &Repository) {
+    for index in 0..PAGED_DIRECTORY_TOMBSTONE_COUNT {
+        let path = format!("dir-paged/{index:03}");
+        repo.create_file(&path).await.unwrap();
+        repo.remove_entry(&path).await.unwrap();
+    }
+}
+
 async fn load_repo(work_dir: &Path, input_dump: &Path, access_mode: AccessMode) -> Repository {
     let store_path = make_store_path(work_dir);
 
@@ -200,6 +200,46 @@ fn sync_many_files() {
     sync_dump_case(dump);
 }
 
+#[test]
+fn sync_deduplicated_blocks() {
+    let mut env = Env::new();
+    let (tx, rx) = sync_watch::channel();
+
+    // Two identical files whose content also repeats within each file, so most of their blocks
+    // have the same id.
+    let content = common::random_bytes(BLOCK_SIZE).repeat(8);
+    let dump = Arc::new(
+        dump::Directory::new()
+            .add("a.dat", content.clone())
+            .add("b.dat", content),
+    );
+
+    env.actor("writer", {
+        let dump = dump.clone();
+        async move {
+            let (_network, repo, _reg) = actor::setup().await;
+            repo.set_block_deduplication(true).await.unwrap();
+
+            dump::load(&repo, &dump).await;
+
+            tx.run(&repo).await;
+        }
+    });
+
+    env.actor("reader", {
+        async move {
+            let (network, repo, _reg) = actor::setup().await;
+            network.add_user_provided_peer(&actor::lookup_addr("writer").await);
+
+            // Completes only when all the blocks (including the shared ones) are present.
+            rx.run(&repo).await;
+
+            let actual_dump = dump::save(&repo).await;
+            similar_asserts::assert_eq!(actual_dump, *dump);
+        }
+    });
+}
+
 fn sync_dump_case(dump: dump::Directory) {
     let mut env = Env::new();
     let (tx, rx) = sync_watch::channel();
@@ -1,11 +1,9 @@
 mod add_labels;
+#[cfg(feature = "influxdb")]
 mod influxdb;
 mod pair;
 mod shared;
 
-pub use self::{
-    add_labels::AddLabels,
-    influxdb::{InfluxDbParams, InfluxDbRecorder},
-    pair::Pair,
-    shared::Shared,
-};
+#[cfg(feature = "influxdb")]
+pub use self::influxdb::{InfluxDbParams, InfluxDbRecorder};
+pub use self::{add_labels::AddLabels, pair::Pair, shared::Shared};
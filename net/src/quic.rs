@@ -1,5 +1,6 @@
 use crate::KEEP_ALIVE_INTERVAL;
 use bytes::BytesMut;
+use futures_util::FutureExt;
 use std::{
     io,
     net::SocketAddr,
@@ -20,6 +21,12 @@ use tokio::{
 
 const CERT_DOMAIN: &str = "ouisync.net";
 
+/// Max number of unidirectional streams the peer can have open at the same time on a single
+/// connection (see [`UniStreams`]). The streams are used one per channel (shared repository) and
+/// live as long as the connection, so this only needs to cover the number of repositories commonly
+/// shared with a single peer. Channels beyond it fall back to the main stream.
+const MAX_CONCURRENT_UNI_STREAMS: u32 = 128;
+
 pub type Result<T> = std::result::Result<T, Error>;
 
 //------------------------------------------------------------------------------
@@ -31,7 +38,7 @@ impl Connector {
     pub async fn connect(&self, remote_addr: SocketAddr) -> Result<Connection> {
         let connection = self.endpoint.connect(remote_addr, CERT_DOMAIN)?.await?;
         let (tx, rx) = connection.open_bi().await?;
-        Ok(Connection::new(rx, tx, connection.remote_address()))
+        Ok(Connection::new(rx, tx, connection))
     }
 
     // forcefully close all connections (any pending operation on any connection will immediatelly
@@ -68,7 +75,7 @@ impl Connecting {
     pub async fn finish(self) -> Result<Connection> {
         let connection = self.connecting.await?;
         let (tx, rx) = connection.accept_bi().await?;
-        Ok(Connection::new(rx, tx, connection.remote_address()))
+        Ok(Connection::new(rx, tx, connection))
     }
 }
 
@@ -76,16 +83,18 @@ impl Connecting {
 pub struct Connection {
     rx: Option<quinn::RecvStream>,
     tx: Option<quinn::SendStream>,
+    connection: quinn::Connection,
     remote_address: SocketAddr,
     can_finish: bool,
 }
 
 impl Connection {
-    pub fn new(rx: quinn::RecvStream, tx: quinn::SendStream, remote_address: SocketAddr) -> Self {
+    fn new(rx: quinn::RecvStream, tx: quinn::SendStream, connection: quinn::Connection) -> Self {
         Self {
             rx: Some(rx),
             tx: Some(tx),
-            remote_address,
+            remote_address: connection.remote_address(),
+            connection,
             can_finish: true,
         }
     }
@@ -94,6 +103,13 @@ impl Connection {
         &self.remote_address
     }
 
+    /// Handle for opening and accepting additional streams on this connection.
+    pub fn uni_streams(&self) -> UniStreams {
+        UniStreams {
+            connection: self.connection.clone(),
+        }
+    }
+
     pub fn into_split(mut self) -> (OwnedReadHalf, OwnedWriteHalf) {
         // Unwrap OK because `self` can't be split more than once and we're not `taking` from `rx`
         // anywhere else.
@@ -217,6 +233,33 @@ impl Drop for Connection {
     }
 }
 
+//------------------------------------------------------------------------------
+pub use quinn::{RecvStream, SendStream};
+
+/// Opens and accepts additional unidirectional streams on a connection. Each stream has its own
+/// flow control, so a stalled or busy stream doesn't block the others.
+#[derive(Clone)]
+pub struct UniStreams {
+    connection: quinn::Connection,
+}
+
+impl UniStreams {
+    /// Opens a new stream, if the peer allows it. Returns `None` if the peer doesn't allow
+    /// opening more streams right now, which is also the case when it doesn't support them at all
+    /// (older versions allowed no unidirectional streams).
+    ///
+    /// Doesn't wait for the peer to grant more streams because the caller has a message to send
+    /// right now and falling back to another stream is preferable to stalling it indefinitely.
+    pub fn try_open(&self) -> Option<SendStream> {
+        self.connection.open_uni().now_or_never()?.ok()
+    }
+
+    /// Accepts the next stream opened by the peer.
+    pub async fn accept(&self) -> Result<RecvStream> {
+        Ok(self.connection.accept_uni().await?)
+    }
+}
+
 //------------------------------------------------------------------------------
 pub struct OwnedReadHalf {
     rx: quinn::RecvStream,
@@ -396,7 +439,7 @@ fn make_client_config() -> quinn::ClientConfig {
     let mut transport_config = quinn::TransportConfig::default();
 
     transport_config
-        .max_concurrent_uni_streams(0_u8.into())
+        .max_concurrent_uni_streams(MAX_CONCURRENT_UNI_STREAMS.into())
         // Documentation says that only one side needs to set the keep alive interval, chosing this
         // to be on the client side with the reasoning that the server side has a better chance of
         // being behind a non restrictive NAT, and so that sending the packets from the client side
@@ -421,7 +464,7 @@ fn make_server_config() -> Result<quinn::ServerConfig> {
     let mut transport_config = quinn::TransportConfig::default();
 
     transport_config
-        .max_concurrent_uni_streams(0_u8.into())
+        .max_concurrent_uni_streams(MAX_CONCURRENT_UNI_STREAMS.into())
         .max_idle_timeout((2 * KEEP_ALIVE_INTERVAL).try_into().ok());
 
     server_config.transport_config(Arc::new(transport_config));
@@ -669,6 +712,44 @@ mod tests {
         h2.await.unwrap();
     }
 
+    #[tokio::test(flavor = "multi_thread")]
+    async fn uni_streams() {
+        let (connector, mut acceptor, _) =
+            configure((Ipv4Addr::LOCALHOST, 0).into()).await.unwrap();
+
+        let addr = *acceptor.local_addr();
+
+        let h1 = task::spawn(async move {
+            let conn = acceptor.accept().await.unwrap().finish().await.unwrap();
+            let streams = conn.uni_streams();
+
+            for message in [&b"one"[..], &b"two"[..]] {
+                let mut stream = streams.accept().await.unwrap();
+                let buf = stream.read_to_end(1024).await.unwrap();
+                assert_eq!(buf, message);
+            }
+        });
+
+        let h2 = task::spawn(async move {
+            let mut conn = connector.connect(addr).await.unwrap();
+            // The main stream is announced to the peer only after something is written to it.
+            conn.write_all(b"hello").await.unwrap();
+
+            let streams = conn.uni_streams();
+
+            for message in [&b"one"[..], &b"two"[..]] {
+                let mut stream = streams.try_open().unwrap();
+                stream.write_all(message).await.unwrap();
+                stream.finish().await.unwrap();
+            }
+
+            conn.finish().await.unwrap();
+        });
+
+        h1.await.unwrap();
+        h2.await.unwrap();
+    }
+
     #[tokio::test(flavor = "multi_thread")]
     async fn side_channel() {
         let (_connector, mut acceptor, side_channel_maker) =
@@ -13,6 +13,11 @@ impl<T> ScopedJoinHandle<T> {
     pub fn abort(&self) {
         self.0.abort()
     }
+
+    /// Checks whether the task has finished (completed, panicked or been aborted).
+    pub fn is_finished(&self) -> bool {
+        self.0.is_finished()
+    }
 }
 
 impl<T> Drop for ScopedJoinHandle<T> {
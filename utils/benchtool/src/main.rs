@@ -2,7 +2,7 @@ use anyhow::{format_err, Result};
 use clap::Parser;
 use comfy_table::{Attribute, Cell, CellAlignment, Table};
 use indicatif::HumanBytes;
-use rand::seq::SliceRandom;
+use rand::{seq::SliceRandom, Rng};
 use serde::{de::Error as _, Deserialize, Deserializer};
 use std::{
     env,
@@ -19,6 +19,9 @@ use tempfile::NamedTempFile;
 
 const BENCH_DIR: &str = "benches";
 
+/// Number of random permutations used to estimate the p-value of a regression.
+const PERMUTATIONS: usize = 10_000;
+
 fn main() -> Result<()> {
     let options = Options::parse();
 
@@ -38,6 +41,13 @@ fn main() -> Result<()> {
 ///     > cargo run -p benchtool -- <BENCH_NAME> --build
 ///     > git checkout perf-improvements
 ///     > cargo run -p benchtool -- <BENCH_NAME> --run --samples 10
+///
+/// To gate changes on performance regressions, save the samples of a reference version as a
+/// baseline and then compare other versions against it. The run fails if any of them is slower
+/// than the baseline by more than the threshold and the slowdown is statistically significant:
+///
+///     > cargo run -p benchtool -- <BENCH_NAME> --run master --samples 10 --save-baseline base.json
+///     > cargo run -p benchtool -- <BENCH_NAME> --run perf-improvements --samples 10 --baseline base.json
 #[derive(Parser, Debug)]
 #[command(verbatim_doc_comment)]
 struct Options {
@@ -71,6 +81,26 @@ struct Options {
     #[arg(short, long, default_value_t = 1)]
     samples: usize,
 
+    /// Save the samples of the run bench version to PATH to be used later as a baseline. Requires
+    /// exactly one bench version to be run.
+    #[arg(long, value_name = "PATH")]
+    save_baseline: Option<PathBuf>,
+
+    /// Compare the run bench versions with the baseline previously saved to PATH and fail if any
+    /// of them regressed.
+    #[arg(long, value_name = "PATH", conflicts_with = "save_baseline")]
+    baseline: Option<PathBuf>,
+
+    /// Slowdown relative to the baseline (in percent) above which a bench version is considered
+    /// regressed.
+    #[arg(long, default_value_t = 5.0, value_name = "PERCENT")]
+    threshold: f64,
+
+    /// Significance level of the regression test. A slowdown is considered significant only if
+    /// the probability of it being due to chance is below this level.
+    #[arg(long, default_value_t = 0.05, value_name = "P")]
+    significance: f64,
+
     /// Bench target to build and/or run.
     #[arg(value_name = "NAME")]
     bench: String,
@@ -172,6 +202,21 @@ fn run(options: &Options) -> Result<()> {
 
     let dir = options.bench_dir();
     let mut bench_versions = list_bench_versions(&dir, &options.bench, label.as_ref())?;
+
+    if options.save_baseline.is_some() && bench_versions.len() != 1 {
+        return Err(format_err!(
+            "--save-baseline requires exactly one bench version to run, found {}",
+            bench_versions.len()
+        ));
+    }
+
+    // Load the baseline before running the benches so that a wrong path is reported early.
+    let baseline = options
+        .baseline
+        .as_ref()
+        .map(|path| read_summaries(&mut File::open(path)?))
+        .transpose()?;
+
     let mut output = NamedTempFile::new()?;
     let mut rng = rand::thread_rng();
 
@@ -214,13 +259,36 @@ fn run(options: &Options) -> Result<()> {
         println!();
     }
 
+    if let Some(path) = &options.save_baseline {
+        fs::copy(output.path(), path)?;
+        println!("Saved baseline: {}", path.display());
+    }
+
     let summaries = read_summaries(output.as_file_mut())?;
-    let summaries = aggregate_summaries(summaries);
 
+    let regressions = if let Some(baseline) = baseline {
+        let comparisons = compare_with_baseline(&baseline, &summaries, options, &mut rng)?;
+        let count = comparisons.iter().filter(|c| c.is_regression).count();
+
+        Some((build_baseline_table(comparisons), count))
+    } else {
+        None
+    };
+
+    let summaries = aggregate_summaries(summaries);
     let table = build_comparison_table(summaries);
 
     println!("{table}");
 
+    if let Some((table, count)) = regressions {
+        println!();
+        println!("{table}");
+
+        if count > 0 {
+            return Err(format_err!("{count} bench version(s) regressed"));
+        }
+    }
+
     Ok(())
 }
 
@@ -349,18 +417,143 @@ fn read_summaries(file: &mut File) -> Result<Vec<Summary>> {
 }
 
 fn aggregate_summaries(mut summaries: Vec<Summary>) -> Vec<Summary> {
-    summaries.sort_by(|a, b| a.label.cmp(&b.label));
+    summaries.sort_by_cached_key(|s| (s.label.clone(), s.params.to_string()));
     summaries
-        .chunk_by(|a, b| a.label == b.label)
+        .chunk_by(|a, b| a.label == b.label && a.params == b.params)
         .map(Summary::avg)
         .collect()
 }
 
+/// Compares the durations of each bench version with the baseline. Only samples with the same
+/// parameters are compared with each other (e.g. the swarm bench runs once for each number of
+/// readers). Fails if the baseline has no samples with the parameters of some bench run.
+fn compare_with_baseline(
+    baseline: &[Summary],
+    summaries: &[Summary],
+    options: &Options,
+    rng: &mut impl Rng,
+) -> Result<Vec<BaselineComparison>> {
+    let mut keys: Vec<_> = summaries.iter().map(|s| (&s.label, &s.params)).collect();
+    keys.sort_by_cached_key(|(label, params)| ((*label).clone(), params.to_string()));
+    keys.dedup();
+
+    keys.into_iter()
+        .map(|(label, params)| {
+            let baseline: Vec<_> = baseline
+                .iter()
+                .filter(|s| s.params == *params)
+                .map(|s| s.duration.as_secs_f64())
+                .collect();
+
+            if baseline.is_empty() {
+                return Err(format_err!(
+                    "baseline has no samples with parameters {}",
+                    format_params(params)
+                ));
+            }
+
+            let baseline_mean = mean(&baseline);
+
+            let durations: Vec<_> = summaries
+                .iter()
+                .filter(|s| s.label == *label && s.params == *params)
+                .map(|s| s.duration.as_secs_f64())
+                .collect();
+            let duration_mean = mean(&durations);
+
+            let change = duration_mean / baseline_mean - 1.0;
+            let p_value = permutation_test(&baseline, &durations, rng);
+
+            Ok(BaselineComparison {
+                label: label.to_owned(),
+                params: format_params(params),
+                baseline: baseline_mean,
+                duration: duration_mean,
+                change,
+                p_value,
+                is_regression: change * 100.0 > options.threshold && p_value < options.significance,
+            })
+        })
+        .collect()
+}
+
+fn format_params(params: &serde_json::Value) -> String {
+    match params {
+        serde_json::Value::Null => String::new(),
+        serde_json::Value::Object(params) => params
+            .iter()
+            .map(|(name, value)| format!("{name}={value}"))
+            .collect::<Vec<_>>()
+            .join(" "),
+        params => params.to_string(),
+    }
+}
+
+/// One-sided permutation test of the difference of the means. Returns the (estimated) probability
+/// that `current` would be at least this much slower than `baseline` if both were samples of the
+/// same bench. Makes no assumption about the distribution of the durations, which is often far
+/// from normal.
+fn permutation_test(baseline: &[f64], current: &[f64], rng: &mut impl Rng) -> f64 {
+    let observed = mean(current) - mean(baseline);
+
+    let mut pool: Vec<_> = baseline.iter().chain(current).copied().collect();
+    let mut hits = 0;
+
+    for _ in 0..PERMUTATIONS {
+        pool.shuffle(rng);
+        let (a, b) = pool.split_at(baseline.len());
+
+        if mean(b) - mean(a) >= observed {
+            hits += 1;
+        }
+    }
+
+    (hits + 1) as f64 / (PERMUTATIONS + 1) as f64
+}
+
+fn mean(values: &[f64]) -> f64 {
+    values.iter().sum::<f64>() / values.len() as f64
+}
+
+fn build_baseline_table(comparisons: Vec<BaselineComparison>) -> Table {
+    let mut table = Table::new();
+
+    table.set_header(vec![
+        Cell::new("label"),
+        Cell::new("params"),
+        Cell::new("baseline"),
+        Cell::new("duration"),
+        Cell::new("change"),
+        Cell::new("p-value"),
+        Cell::new("result"),
+    ]);
+
+    for comparison in comparisons {
+        table.add_row(vec![
+            Cell::new(comparison.label),
+            Cell::new(comparison.params),
+            Cell::new(format!("{:.2} s", comparison.baseline)),
+            Cell::new(format!("{:.2} s", comparison.duration)),
+            Cell::new(format!("{:+.1} %", comparison.change * 100.0))
+                .set_alignment(CellAlignment::Right),
+            Cell::new(format!("{:.3}", comparison.p_value)).set_alignment(CellAlignment::Right),
+            if comparison.is_regression {
+                Cell::new("REGRESSED").add_attribute(Attribute::Bold)
+            } else {
+                Cell::new("ok")
+            },
+        ]);
+    }
+
+    table
+}
+
 fn build_comparison_table(summaries: Vec<Summary>) -> Table {
     let mut table = Table::new();
 
     table.set_header(vec![
         Cell::new("label"),
+        Cell::new("params"),
         Cell::new("duration"),
         Cell::new("send min").add_attribute(Attribute::Dim),
         Cell::new("send max").add_attribute(Attribute::Dim),
@@ -375,6 +568,7 @@ fn build_comparison_table(summaries: Vec<Summary>) -> Table {
     for summary in summaries {
         table.add_row(vec![
             Cell::new(summary.label),
+            Cell::new(format_params(&summary.params)),
             Cell::new(format!("{:.2} s", summary.duration.as_secs_f64())),
             Cell::new(HumanBytes(summary.send.min))
                 .set_alignment(CellAlignment::Right)
@@ -412,6 +606,8 @@ struct BuildMessage<'a> {
 struct Summary {
     #[serde(default)]
     label: String,
+    #[serde(default)]
+    params: serde_json::Value,
     #[serde(deserialize_with = "deserialize_duration")]
     duration: Duration,
     send: BytesSummary,
@@ -430,6 +626,11 @@ impl Summary {
                             } else {
                                 sum.label
                             },
+                            params: if sum.params.is_null() {
+                                item.params.clone()
+                            } else {
+                                sum.params
+                            },
                             duration: sum.duration + item.duration,
                             send: sum.send + item.send,
                             recv: sum.recv + item.recv,
@@ -448,6 +649,7 @@ impl Div<u32> for Summary {
     fn div(self, rhs: u32) -> Self::Output {
         Self {
             label: self.label,
+            params: self.params,
             duration: self.duration / rhs,
             send: self.send / rhs,
             recv: self.recv / rhs,
@@ -455,6 +657,17 @@ impl Div<u32> for Summary {
     }
 }
 
+struct BaselineComparison {
+    label: String,
+    params: String,
+    // Mean durations in seconds.
+    baseline: f64,
+    duration: f64,
+    change: f64,
+    p_value: f64,
+    is_regression: bool,
+}
+
 #[derive(Default, Copy, Clone, Debug, Deserialize)]
 struct BytesSummary {
     min: u64,
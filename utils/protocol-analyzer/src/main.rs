@@ -38,16 +38,22 @@ async fn main() -> Result<()> {
                 let key = (line.that_label.clone(), line.common_prefix.label.clone());
                 let value = context.from_to_root_nodes.entry(key).or_default();
                 value.push(line.common_prefix.line_number);
+                context.record_sync(&line.common_prefix, &line.that_label, &line.debug);
             }
             Line::ReceivedInnerNode(line) => {
                 let key = (line.that_label.clone(), line.common_prefix.label.clone());
                 let value = context.from_to_inner_nodes.entry(key).or_default();
                 value.push(line.common_prefix.line_number);
+                context.record_sync(&line.common_prefix, &line.that_label, &line.debug);
             }
             Line::ReceivedLeafNode(line) => {
                 let key = (line.that_label.clone(), line.common_prefix.label.clone());
                 let value = context.from_to_leaf_nodes.entry(key).or_default();
                 value.push(line.common_prefix.line_number);
+                context.record_sync(&line.common_prefix, &line.that_label, &line.debug);
+            }
+            Line::ReceivedIndexDiff(line) => {
+                context.record_sync(&line.common_prefix, &line.that_label, &line.debug);
             }
             Line::ReceivedBlock(line) => {
                 let key = (line.that_label.clone(), line.common_prefix.label.clone());
@@ -73,6 +79,29 @@ async fn main() -> Result<()> {
     for ((from, to), lines) in &context.from_to_blocks {
         println!("  {to:?} <- {from:?}: {}     {:?}", lines.len(), lines);
     }
+    println!("Syncs");
+    for ((from, to, exchange_id), sync) in &context.syncs {
+        println!(
+            "  {to:?} <- {from:?} #{exchange_id}: {} round trips, {} responses, {} ms",
+            sync.round_trips,
+            sync.responses,
+            (sync.end - sync.start).num_milliseconds(),
+        );
+    }
+    if !context.syncs.is_empty() {
+        let total: u32 = context.syncs.values().map(|sync| sync.round_trips).sum();
+        let max = context
+            .syncs
+            .values()
+            .map(|sync| sync.round_trips)
+            .max()
+            .unwrap_or(0);
+        println!(
+            "  average: {:.2} round trips, max: {} round trips",
+            total as f64 / context.syncs.len() as f64,
+            max,
+        );
+    }
 
     Ok(())
 }
@@ -83,6 +112,8 @@ struct Context {
     from_to_inner_nodes: BTreeMap<(String, String), Vec<u32>>,
     from_to_leaf_nodes: BTreeMap<(String, String), Vec<u32>>,
     from_to_blocks: BTreeMap<(String, String), Vec<u32>>,
+    // Syncs (index exchanges started by a root node) by (from, to, exchange_id).
+    syncs: BTreeMap<(String, String, u32), SyncStats>,
 }
 
 impl Context {
@@ -93,8 +124,38 @@ impl Context {
             from_to_inner_nodes: Default::default(),
             from_to_leaf_nodes: Default::default(),
             from_to_blocks: Default::default(),
+            syncs: Default::default(),
         }
     }
+
+    fn record_sync(&mut self, prefix: &CommonPrefix, that_label: &str, debug: &DebugLine) {
+        let key = (
+            that_label.to_owned(),
+            prefix.label.clone(),
+            debug.exchange_id,
+        );
+        let sync = self.syncs.entry(key).or_insert_with(|| SyncStats {
+            round_trips: 0,
+            responses: 0,
+            start: prefix.date,
+            end: prefix.date,
+        });
+
+        sync.round_trips = sync.round_trips.max(debug.round_trip);
+        sync.responses += 1;
+        sync.start = sync.start.min(prefix.date);
+        sync.end = sync.end.max(prefix.date);
+    }
+}
+
+/// Statistics of a single index sync.
+struct SyncStats {
+    /// Number of request/response round trips it took.
+    round_trips: u32,
+    /// Number of received responses.
+    responses: u32,
+    start: NaiveDateTime,
+    end: NaiveDateTime,
 }
 
 #[derive(Debug)]
@@ -103,9 +164,17 @@ enum Line {
     ReceivedRootNode(ReceivedRootNodeLine),
     ReceivedInnerNode(ReceivedInnerNodeLine),
     ReceivedLeafNode(ReceivedLeafNodeLine),
+    ReceivedIndexDiff(ReceivedIndexDiffLine),
     ReceivedBlock(ReceivedBlockLine),
 }
 
+/// The debug payload of a response.
+#[derive(Debug)]
+struct DebugLine {
+    exchange_id: u32,
+    round_trip: u32,
+}
+
 #[derive(Debug)]
 struct ThisRuntimeIdLine {
     common_prefix: CommonPrefix,
@@ -118,7 +187,16 @@ struct ReceivedRootNodeLine {
     common_prefix: CommonPrefix,
     that_label: String,
     hash: String,
-    exchange_id: u32,
+    debug: DebugLine,
+}
+
+#[allow(dead_code)]
+#[derive(Debug)]
+struct ReceivedIndexDiffLine {
+    common_prefix: CommonPrefix,
+    that_label: String,
+    len: u32,
+    debug: DebugLine,
 }
 
 #[allow(dead_code)]
@@ -126,7 +204,7 @@ struct ReceivedRootNodeLine {
 struct ReceivedInnerNodeLine {
     common_prefix: CommonPrefix,
     that_label: String,
-    exchange_id: u32,
+    debug: DebugLine,
 }
 
 #[allow(dead_code)]
@@ -134,7 +212,7 @@ struct ReceivedInnerNodeLine {
 struct ReceivedLeafNodeLine {
     common_prefix: CommonPrefix,
     that_label: String,
-    exchange_id: u32,
+    debug: DebugLine,
 }
 
 #[allow(dead_code)]
@@ -183,6 +261,9 @@ mod parse {
         if let Some(line) = received_leaf_node_line(line_number, &mut input, context) {
             return Some(Line::ReceivedLeafNode(line));
         }
+        if let Some(line) = received_index_diff_line(line_number, &mut input, context) {
+            return Some(Line::ReceivedIndexDiff(line));
+        }
         if let Some(line) = received_block_line(line_number, &mut input, context) {
             return Some(Line::ReceivedBlock(line));
         }
@@ -208,8 +289,7 @@ mod parse {
         find_string("Received root node", s)?;
         find_string(" hash=", s)?;
         let hash = alphanumeric_string(s)?.into();
-        find_string("DebugResponse { exchange_id: ", s)?;
-        let exchange_id = digits(s)?.parse().ok()?;
+        let debug = debug_response(s)?;
         find_string("message_broker{", s)?;
         let that_runtime_id = alphanumeric_string(s)?;
         Some(ReceivedRootNodeLine {
@@ -220,7 +300,7 @@ mod parse {
                 .unwrap()
                 .clone(),
             hash,
-            exchange_id,
+            debug,
         })
     }
 
@@ -235,8 +315,7 @@ mod parse {
         char('/', s)?;
         digits(s)?;
         string(" inner nodes:", s)?;
-        find_string("DebugResponse { exchange_id: ", s)?;
-        let exchange_id = digits(s)?.parse().ok()?;
+        let debug = debug_response(s)?;
         find_string("message_broker{", s)?;
         let that_runtime_id = alphanumeric_string(s)?;
         Some(ReceivedInnerNodeLine {
@@ -246,7 +325,7 @@ mod parse {
                 .get(that_runtime_id)
                 .unwrap()
                 .clone(),
-            exchange_id,
+            debug,
         })
     }
 
@@ -261,8 +340,7 @@ mod parse {
         char('/', s)?;
         digits(s)?;
         string(" leaf nodes:", s)?;
-        find_string("DebugResponse { exchange_id: ", s)?;
-        let exchange_id = digits(s)?.parse().ok()?;
+        let debug = debug_response(s)?;
         find_string("message_broker{", s)?;
         let that_runtime_id = alphanumeric_string(s)?;
         Some(ReceivedLeafNodeLine {
@@ -272,7 +350,41 @@ mod parse {
                 .get(that_runtime_id)
                 .unwrap()
                 .clone(),
+            debug,
+        })
+    }
+
+    fn received_index_diff_line(
+        line_number: u32,
+        s: &mut &str,
+        context: &Context,
+    ) -> Option<ReceivedIndexDiffLine> {
+        let common_prefix = common_prefix(line_number, s)?;
+        find_string("Received index diff of ", s)?;
+        let len = num_u32(s)?;
+        let debug = debug_response(s)?;
+        find_string("message_broker{", s)?;
+        let that_runtime_id = alphanumeric_string(s)?;
+        Some(ReceivedIndexDiffLine {
+            common_prefix,
+            that_label: context
+                .runtime_id_to_label
+                .get(that_runtime_id)
+                .unwrap()
+                .clone(),
+            len,
+            debug,
+        })
+    }
+
+    fn debug_response(s: &mut &str) -> Option<DebugLine> {
+        find_string("DebugResponse { exchange_id: ", s)?;
+        let exchange_id = num_u32(s)?;
+        string(", round_trip: ", s)?;
+        let round_trip = num_u32(s)?;
+        Some(DebugLine {
             exchange_id,
+            round_trip,
         })
     }
 
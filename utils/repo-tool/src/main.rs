@@ -1,22 +1,40 @@
 use futures_util::StreamExt;
-use ouisync::{db, protocol::RootNode};
-use std::{env, ops::DerefMut, process::ExitCode};
+use ouisync::{
+    crypto::Password, db, protocol::RootNode, AccessMode, LocalSecret, Repository, RepositoryParams,
+};
+use std::{env, ops::DerefMut, path::Path, process::ExitCode, time::Instant};
 
-// Tool for inspecting (and possibly to do modifications in the future) ouisync repositories.
-// Right now it only prints out root nodes, but we can expand the functionality later for other
-// use cases.
+// Tool for inspecting and bulk importing/exporting ouisync repositories.
+
+/// Environment variable with the local password of the repository (if it has one).
+const PASSWORD_VAR: &str = "OUISYNC_PASSWORD";
 
 #[tokio::main]
 async fn main() -> ExitCode {
-    let arg = env::args().nth(1).unwrap_or_default();
+    let args: Vec<_> = env::args().skip(1).collect();
+    let args: Vec<_> = args.iter().map(String::as_str).collect();
 
-    if arg.is_empty() {
-        println!("Missing repository path");
-        help();
-        return ExitCode::FAILURE;
+    match args[..] {
+        ["import", repo, src] => import(repo, src, "/").await,
+        ["import", repo, src, dst] => import(repo, src, dst).await,
+        ["export", repo, dst] => export(repo, "/", dst).await,
+        ["export", repo, dst, src] => export(repo, src, dst).await,
+        [repo] if repo != "import" && repo != "export" => print_root_nodes(repo).await,
+        [] => {
+            println!("Missing repository path");
+            help();
+            ExitCode::FAILURE
+        }
+        _ => {
+            println!("Invalid arguments");
+            help();
+            ExitCode::FAILURE
+        }
     }
+}
 
-    let pool = db::open_without_migrations(arg).await.unwrap();
+async fn print_root_nodes(path: &str) -> ExitCode {
+    let pool = db::open_without_migrations(path).await.unwrap();
     let mut conn = pool.acquire().await.unwrap();
 
     let mut query = sqlx::query_as::<_, RootNode>(
@@ -46,7 +64,78 @@ async fn main() -> ExitCode {
     ExitCode::SUCCESS
 }
 
+async fn import(repo: &str, src: &str, dst: &str) -> ExitCode {
+    let Some(repo) = open(repo, AccessMode::Write).await else {
+        return ExitCode::FAILURE;
+    };
+
+    let start = Instant::now();
+    let result = repo.import_directory(Path::new(src), dst).await;
+
+    finish(repo, result, start).await
+}
+
+async fn export(repo: &str, src: &str, dst: &str) -> ExitCode {
+    let Some(repo) = open(repo, AccessMode::Read).await else {
+        return ExitCode::FAILURE;
+    };
+
+    let start = Instant::now();
+    let result = repo.export_directory(src, Path::new(dst)).await;
+
+    finish(repo, result, start).await
+}
+
+async fn open(path: &str, access_mode: AccessMode) -> Option<Repository> {
+    let local_secret = env::var(PASSWORD_VAR)
+        .ok()
+        .map(|password| LocalSecret::Password(Password::from(password)));
+
+    match Repository::open(&RepositoryParams::new(path), local_secret, access_mode).await {
+        Ok(repo) if repo.access_mode() >= access_mode => Some(repo),
+        Ok(repo) => {
+            println!("Insufficient access mode: {:?}", repo.access_mode());
+            repo.close().await.ok();
+            None
+        }
+        Err(err) => {
+            println!("Error opening repository: {err:?}");
+            None
+        }
+    }
+}
+
+async fn finish(repo: Repository, result: ouisync::Result<()>, start: Instant) -> ExitCode {
+    let elapsed = start.elapsed();
+
+    if let Err(err) = repo.close().await {
+        println!("Error closing repository: {err:?}");
+        return ExitCode::FAILURE;
+    }
+
+    match result {
+        Ok(()) => {
+            println!("Done in {elapsed:.2?}");
+            ExitCode::SUCCESS
+        }
+        Err(err) => {
+            println!("Error: {}", err.verbose());
+            ExitCode::FAILURE
+        }
+    }
+}
+
 fn help() {
-    println!("Usage: {} <PATH-TO-REPOSITORY>", env!("CARGO_PKG_NAME"));
+    let name = env!("CARGO_PKG_NAME");
+
+    println!("Usage:");
+    println!("    {name} <PATH-TO-REPOSITORY>");
+    println!("        Print the root nodes of the repository");
+    println!("    {name} import <PATH-TO-REPOSITORY> <SRC-DIR> [<DST-DIR-IN-REPOSITORY>]");
+    println!("        Import a directory tree into the repository");
+    println!("    {name} export <PATH-TO-REPOSITORY> <DST-DIR> [<SRC-DIR-IN-REPOSITORY>]");
+    println!("        Export a directory tree from the repository");
+    println!();
+    println!("The local password of the repository (if any) is read from ${PASSWORD_VAR}.");
     println!();
 }
@@ -1,12 +1,12 @@
 use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
-use ouisync_lib::{Access, Repository, RepositoryParams, WriteSecrets};
+use ouisync_lib::{Access, AccessMode, Repository, RepositoryParams, WriteSecrets};
 use ouisync_vfs::MountGuard;
 use rand::{rngs::StdRng, Rng, SeedableRng};
-use std::path::Path;
+use std::{path::Path, thread};
 use tempfile::TempDir;
 use tokio::runtime::{Handle, Runtime};
 
-criterion_group!(default, write_file);
+criterion_group!(default, write_file, read_file, write_small_files);
 criterion_main!(default);
 
 fn write_file(c: &mut Criterion) {
@@ -30,6 +30,80 @@ fn write_file(c: &mut Criterion) {
     group.finish();
 }
 
+fn read_file(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let file_size = 16 * 1024 * 1024;
+
+    let mut group = c.benchmark_group("vfs/read_file");
+    group.sample_size(20);
+    group.throughput(Throughput::Bytes(file_size));
+    group.bench_function(BenchmarkId::from_parameter(file_size), |b| {
+        b.iter_batched_ref(
+            || {
+                let (mut rng, base_dir, mount_guard) = runtime.block_on(utils::setup());
+                let file_path = base_dir.path().join("mnt").join("file.dat");
+                utils::write_file(&mut rng, &file_path, file_size);
+
+                // Remount so the reads are not served from the page cache.
+                drop(mount_guard);
+                let mount_guard = runtime.block_on(utils::remount(&base_dir));
+
+                (file_path, base_dir, mount_guard)
+            },
+            |(file_path, _base_dir, _mount_guard)| {
+                utils::read_file(file_path);
+            },
+            BatchSize::LargeInput,
+        );
+    });
+    group.finish();
+}
+
+// Many small files written from several threads at once, similar to unpacking an archive or
+// building a source tree inside the mount.
+fn write_small_files(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let thread_count = 8;
+    let file_count = 32; // per thread
+    let file_size = 4 * 1024;
+
+    let mut group = c.benchmark_group("vfs/write_small_files");
+    group.sample_size(10);
+    group.throughput(Throughput::Bytes(thread_count * file_count * file_size));
+    group.bench_function(
+        BenchmarkId::from_parameter(format!("{thread_count}x{file_count}x{file_size}")),
+        |b| {
+            b.iter_batched_ref(
+                || runtime.block_on(utils::setup()),
+                |(_rng, base_dir, _mount_guard)| {
+                    let mount_dir = base_dir.path().join("mnt");
+
+                    thread::scope(|scope| {
+                        for thread_index in 0..thread_count {
+                            let mount_dir = &mount_dir;
+
+                            scope.spawn(move || {
+                                let mut rng = StdRng::seed_from_u64(thread_index);
+                                let dir_path = mount_dir.join(format!("dir-{thread_index}"));
+                                std::fs::create_dir(&dir_path).unwrap();
+
+                                for file_index in 0..file_count {
+                                    let file_path = dir_path.join(format!("file-{file_index}.dat"));
+                                    utils::write_file(&mut rng, &file_path, file_size);
+                                }
+                            });
+                        }
+                    });
+                },
+                BatchSize::LargeInput,
+            );
+        },
+    );
+    group.finish();
+}
+
 mod utils {
     use super::*;
     use std::{
@@ -61,6 +135,17 @@ mod utils {
         (rng, base_dir, mount_guard)
     }
 
+    // Mounts the repository created by `setup` again. The previous mount must be dropped first.
+    pub async fn remount(base_dir: &TempDir) -> MountGuard {
+        let params = RepositoryParams::new(base_dir.path().join("repo.db"));
+        let repo = Repository::open(&params, None, AccessMode::Write)
+            .await
+            .unwrap();
+        let repo = Arc::new(repo);
+
+        ouisync_vfs::mount(Handle::current(), repo, base_dir.path().join("mnt")).unwrap()
+    }
+
     pub fn write_file(rng: &mut StdRng, path: &Path, size: u64) {
         let mut src = RngRead(rng).take(size);
         let mut dst = File::create(path).unwrap();
@@ -68,6 +153,11 @@ mod utils {
         io::copy(&mut src, &mut dst).unwrap();
     }
 
+    pub fn read_file(path: &Path) {
+        let mut src = File::open(path).unwrap();
+        io::copy(&mut src, &mut io::sink()).unwrap();
+    }
+
     struct RngRead<'a>(&'a mut StdRng);
 
     impl Read for RngRead<'_> {
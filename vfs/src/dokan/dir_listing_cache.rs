@@ -0,0 +1,130 @@
+use camino::{Utf8Path, Utf8PathBuf};
+use ouisync_lib::{crypto::sign::PublicKey, VersionVector};
+use std::{
+    collections::{BTreeMap, HashMap},
+    sync::{Arc, Mutex},
+};
+
+/// Max total number of file entries cached across all the directories of a repository.
+const MAX_CACHED_ENTRIES: usize = 64 * 1024;
+
+/// Cache of the file lengths of the recently listed directories.
+///
+/// Listing a directory requires opening every file in it to find out its length, which dominates
+/// the time of `find_files` on large directories (and Explorer lists the same directory many times
+/// in a row). The cached length of a file is reused as long as the version vector and the branch
+/// of the file entry stay the same, so the cache never returns stale lengths and doesn't need to be
+/// explicitly invalidated.
+pub(super) struct DirListingCache {
+    // NOTE: Never held across an await point.
+    inner: Mutex<Inner>,
+}
+
+#[derive(Default)]
+struct Inner {
+    listings: HashMap<Utf8PathBuf, (u64, Arc<Listing>)>,
+    // Least recently used listings first.
+    order: BTreeMap<u64, Utf8PathBuf>,
+    next_stamp: u64,
+    entry_count: usize,
+}
+
+impl DirListingCache {
+    pub fn new() -> Self {
+        Self {
+            inner: Mutex::new(Inner::default()),
+        }
+    }
+
+    pub fn get(&self, path: &Utf8Path) -> Option<Arc<Listing>> {
+        let mut inner = self.inner.lock().unwrap();
+        let inner = &mut *inner;
+
+        let stamp = inner.next_stamp;
+        let (old_stamp, listing) = inner.listings.get_mut(path)?;
+
+        inner.order.remove(old_stamp);
+        inner.order.insert(stamp, path.to_owned());
+        inner.next_stamp += 1;
+        *old_stamp = stamp;
+
+        Some(listing.clone())
+    }
+
+    pub fn insert(&self, path: Utf8PathBuf, listing: Listing) {
+        let mut inner = self.inner.lock().unwrap();
+
+        inner.remove(&path);
+
+        if listing.entries.len() > MAX_CACHED_ENTRIES {
+            return;
+        }
+
+        while inner.entry_count + listing.entries.len() > MAX_CACHED_ENTRIES {
+            let Some((_, path)) = inner.order.pop_first() else {
+                break;
+            };
+
+            inner.remove(&path);
+        }
+
+        let stamp = inner.next_stamp;
+        inner.next_stamp += 1;
+        inner.entry_count += listing.entries.len();
+        inner.order.insert(stamp, path.clone());
+        inner.listings.insert(path, (stamp, Arc::new(listing)));
+    }
+}
+
+impl Inner {
+    fn remove(&mut self, path: &Utf8Path) {
+        if let Some((stamp, listing)) = self.listings.remove(path) {
+            self.order.remove(&stamp);
+            self.entry_count -= listing.entries.len();
+        }
+    }
+}
+
+/// Lengths of the files in a single directory, keyed by their unique names.
+#[derive(Default)]
+pub(super) struct Listing {
+    entries: HashMap<String, CachedFile>,
+}
+
+struct CachedFile {
+    branch_id: PublicKey,
+    version_vector: VersionVector,
+    len: u64,
+}
+
+impl Listing {
+    /// Returns the cached length of the given file if it hasn't changed since it's been cached.
+    pub fn file_len(
+        &self,
+        unique_name: &str,
+        branch_id: &PublicKey,
+        version_vector: &VersionVector,
+    ) -> Option<u64> {
+        self.entries
+            .get(unique_name)
+            .filter(|file| file.branch_id == *branch_id && file.version_vector == *version_vector)
+            .map(|file| file.len)
+    }
+
+    pub fn insert_file(
+        &mut self,
+        unique_name: String,
+        branch_id: PublicKey,
+        version_vector: VersionVector,
+        len: u64,
+    ) {
+        self.entries.insert(
+            unique_name,
+            CachedFile {
+                branch_id,
+                version_vector,
+                len,
+            },
+        );
+    }
+}
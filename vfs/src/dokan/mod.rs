@@ -1,7 +1,9 @@
+mod dir_listing_cache;
 pub(crate) mod multi_repo_mount;
 pub(crate) mod single_repo_mount;
 
-use camino::Utf8PathBuf;
+use self::dir_listing_cache::{DirListingCache, Listing};
+use camino::{Utf8Path, Utf8PathBuf};
 use deadlock::{AsyncMutex, AsyncMutexGuard};
 use dokan::{
     CreateFileInfo, DiskSpaceInfo, FileInfo, FileSystemHandler, FileTimeOperation, FillDataError,
@@ -16,6 +18,7 @@ use ouisync_lib::{path, File, JointDirectory, JointEntryRef, Repository};
 use std::{
     collections::{hash_map, HashMap},
     fmt,
+    hash::{BuildHasher, RandomState},
     io::SeekFrom,
     sync::{
         atomic::{AtomicU64, Ordering},
@@ -35,7 +38,8 @@ pub const MAX_COMPONENT_LENGTH: u32 = 255;
 struct VirtualFilesystem {
     rt: tokio::runtime::Handle,
     repo: Arc<Repository>,
-    handles: Arc<AsyncMutex<Handles>>,
+    handles: Handles,
+    dir_listings: DirListingCache,
     entry_id_generator: Arc<EntryIdGenerator>,
 }
 
@@ -48,7 +52,8 @@ impl VirtualFilesystem {
         Self {
             rt,
             repo,
-            handles: Arc::new(AsyncMutex::new(Default::default())),
+            handles: Handles::new(),
+            dir_listings: DirListingCache::new(),
             entry_id_generator,
         }
     }
@@ -64,7 +69,9 @@ impl VirtualFilesystem {
 
         let id = self.entry_id_generator.generate_id();
 
-        match self.handles.lock().await.entry(path.clone()) {
+        let _removal = self.handles.removal.read().await;
+
+        match self.handles.shard(&path).lock().await.entry(path.clone()) {
             hash_map::Entry::Occupied(entry) => {
                 let shared = entry.get().clone();
                 let mut lock = shared.write().await;
@@ -206,7 +213,7 @@ impl VirtualFilesystem {
             .await;
 
         if result.is_err() {
-            match self.handles.lock().await.entry(path.clone()) {
+            match self.handles.shard(&path).lock().await.entry(path.clone()) {
                 hash_map::Entry::Occupied(entry) => {
                     let mut handle = entry.get().write().await;
                     handle.handle_count -= 1;
@@ -223,17 +230,25 @@ impl VirtualFilesystem {
         result.map(|(entry, is_new)| (entry, is_new, id))
     }
 
+    /// Closes one handle of the entry. Returns the path of the entry if it should now be deleted.
+    /// In that case, `exclusive` must be true (meaning the caller holds `Handles::removal` for
+    /// writing), otherwise this returns `Err(NeedsExclusive)` without closing anything.
     async fn close_shared(
         &self,
         shared: &Arc<AsyncRwLock<Shared>>,
-        handles: &mut AsyncMutexGuard<'_, Handles>,
-    ) -> Option<Utf8PathBuf> {
+        handles: &mut AsyncMutexGuard<'_, HandleShard>,
+        exclusive: bool,
+    ) -> Result<Option<Utf8PathBuf>, NeedsExclusive> {
         let mut lock = shared.write().await;
 
         match handles.entry(lock.path.clone()) {
             hash_map::Entry::Occupied(occupied) => {
                 assert_eq!(Arc::as_ptr(occupied.get()), Arc::as_ptr(shared));
 
+                if lock.handle_count == 1 && lock.delete_on_close && !exclusive {
+                    return Err(NeedsExclusive);
+                }
+
                 lock.handle_count -= 1;
 
                 if lock.handle_count == 0 {
@@ -246,10 +261,10 @@ impl VirtualFilesystem {
                     drop(lock);
                     occupied.remove();
 
-                    return to_delete;
+                    return Ok(to_delete);
                 }
 
-                None
+                Ok(None)
             }
             // This FileEntry exists, so it must be in `handles`.
             hash_map::Entry::Vacant(_) => {
@@ -265,6 +280,8 @@ impl VirtualFilesystem {
         pattern: Option<&U16CStr>,
     ) -> Result<(), Error> {
         let dir = dir_entry.cached_or_load_dir().await?;
+        let cached_listing = self.dir_listings.get(&dir_entry.path);
+        let mut listing = Listing::default();
 
         for entry in dir.entries() {
             let name = entry.unique_name();
@@ -274,15 +291,40 @@ impl VirtualFilesystem {
             }
 
             // TODO: Unwrap
-            let file_name = U16CString::from_str(entry.unique_name().as_ref()).unwrap();
+            let file_name = U16CString::from_str(name.as_ref()).unwrap();
+
+            // Match the pattern first so that the files that don't match don't need to be opened.
+            if let Some(pattern) = pattern {
+                let ignore_case = true;
+                if !dokan::is_name_in_expression(pattern, &file_name, ignore_case) {
+                    continue;
+                }
+            }
 
             let (attributes, file_size) = match &entry {
                 JointEntryRef::File(file) => {
-                    let file_size = match file.open().await {
-                        Ok(file) => file.len(),
-                        Err(_) => 0,
+                    let branch_id = *file.branch().id();
+                    let version_vector = file.version_vector();
+
+                    let file_size = match cached_listing
+                        .as_ref()
+                        .and_then(|listing| listing.file_len(&name, &branch_id, version_vector))
+                    {
+                        Some(file_size) => Some(file_size),
+                        None => file.open().await.ok().map(|file| file.len()),
                     };
-                    (winnt::FILE_ATTRIBUTE_NORMAL, file_size)
+
+                    // Files that failed to open are not cached so they are retried next time.
+                    if let Some(file_size) = file_size {
+                        listing.insert_file(
+                            name.clone().into_owned(),
+                            branch_id,
+                            version_vector.clone(),
+                            file_size,
+                        );
+                    }
+
+                    (winnt::FILE_ATTRIBUTE_NORMAL, file_size.unwrap_or(0))
                 }
                 JointEntryRef::Directory(_) => {
                     // TODO: Count block sizes
@@ -290,13 +332,6 @@ impl VirtualFilesystem {
                 }
             };
 
-            if let Some(pattern) = pattern {
-                let ignore_case = true;
-                if !dokan::is_name_in_expression(pattern, &file_name, ignore_case) {
-                    continue;
-                }
-            }
-
             fill_find_data(&FindData {
                 attributes,
                 // TODO
@@ -308,6 +343,12 @@ impl VirtualFilesystem {
             })
             .or_else(ignore_name_too_long)?;
         }
+
+        // A listing filtered by a pattern is incomplete so it must not replace the full one.
+        if pattern.is_none() {
+            self.dir_listings.insert(dir_entry.path.clone(), listing);
+        }
+
         Ok(())
     }
 
@@ -392,13 +433,6 @@ impl VirtualFilesystem {
     ) {
         tracing::trace!("enter");
 
-        // We need to lock `self.handles` here to prevent anything from opening the file while this
-        // function runs. It is because if the file is marked for removal here and if some other
-        // function opens the file, then the function `self.repo.remove_entry` will fail with
-        // `Error::Locked`.
-        // Also see this issue: https://github.com/equalitie/ouisync-app/issues/414
-        let mut handles = self.handles.lock().await;
-
         match &context.entry {
             Entry::File(entry) => {
                 let mut file_lock = entry.file.lock().await;
@@ -422,15 +456,48 @@ impl VirtualFilesystem {
             Entry::Directory(_) => (),
         };
 
-        if let Some(to_delete) = self
-            .close_shared(context.entry.shared(), &mut handles)
-            .await
-        {
-            // Now all handles to this particular entry are closed, so we shouldn't get the
-            // `ouisync_lib::Error::Locked` error.
-            if let Err(error) = self.repo.remove_entry(to_delete.clone()).await {
-                tracing::warn!("Failed to delete file \"{to_delete:?}\" on close: {error:?}");
+        // If the entry is going to be removed here, we need to prevent anything from opening it
+        // (or, if it's a directory, anything inside it) while this function runs. It is because if
+        // some other function opens the entry, then the function `self.repo.remove_entry` will
+        // fail with `Error::Locked`. The entries inside a directory can be in any shard of
+        // `self.handles`, so this is done by holding `removal` for writing. Otherwise locking only
+        // the shard of the entry is enough.
+        // Also see this issue: https://github.com/equalitie/ouisync-app/issues/414
+        let (path, mut exclusive) = {
+            let shared = context.entry.shared().read().await;
+            (shared.path.clone(), shared.delete_on_close)
+        };
+
+        loop {
+            let (_removal_read, _removal_write) = if exclusive {
+                (None, Some(self.handles.removal.write().await))
+            } else {
+                (Some(self.handles.removal.read().await), None)
+            };
+
+            let mut handles = self.handles.shard(&path).lock().await;
+
+            let to_delete = match self
+                .close_shared(context.entry.shared(), &mut handles, exclusive)
+                .await
+            {
+                Ok(to_delete) => to_delete,
+                // Marked for deletion since we checked.
+                Err(NeedsExclusive) => {
+                    exclusive = true;
+                    continue;
+                }
+            };
+
+            if let Some(to_delete) = to_delete {
+                // Now all handles to this particular entry are closed, so we shouldn't get the
+                // `ouisync_lib::Error::Locked` error.
+                if let Err(error) = self.repo.remove_entry(to_delete.clone()).await {
+                    tracing::warn!("Failed to delete file \"{to_delete:?}\" on close: {error:?}");
+                }
             }
+
+            break;
         }
     }
 
@@ -1147,9 +1214,10 @@ impl From<Error> for i32 {
                     E::InvalidArgument | E::OffsetOutOfRange => STATUS_INVALID_PARAMETER,
                     E::DirectoryNotEmpty => STATUS_DIRECTORY_NOT_EMPTY,
                     E::OperationNotSupported => STATUS_NOT_IMPLEMENTED,
-                    E::Writer(_) => STATUS_IO_DEVICE_ERROR,
+                    E::Reader(_) | E::Writer(_) => STATUS_IO_DEVICE_ERROR,
                     E::StorageVersionMismatch => STATUS_IO_DEVICE_ERROR,
                     E::Locked => STATUS_LOCK_NOT_GRANTED,
+                    E::Interrupted => STATUS_CANCELLED,
                 }
             }
         }
@@ -1168,7 +1236,44 @@ fn to_path(path_cstr: &U16CStr) -> OperationResult<Utf8PathBuf> {
     Ok(Utf8PathBuf::from(path_str))
 }
 
-type Handles = HashMap<Utf8PathBuf, Arc<AsyncRwLock<Shared>>>;
+// Number of independently locked shards of `Handles`.
+const HANDLE_SHARD_COUNT: usize = 16;
+
+type HandleShard = HashMap<Utf8PathBuf, Arc<AsyncRwLock<Shared>>>;
+
+/// Shared state of the open entries, keyed by path. Split into shards by the hash of the path so
+/// that opening and closing entries at different paths doesn't contend on a single lock. All the
+/// handles of the same path are always in the same shard so locking the shard still prevents the
+/// entry from being opened.
+struct Handles {
+    shards: Vec<AsyncMutex<HandleShard>>,
+    hasher: RandomState,
+    // Held for reading while opening an entry and for writing while removing one, so that nothing
+    // is opened while an entry is being removed, including the entries inside a removed directory
+    // which can be in other shards (see `async_cleanup`). Always locked before the shards.
+    removal: AsyncRwLock<()>,
+}
+
+impl Handles {
+    fn new() -> Self {
+        Self {
+            shards: (0..HANDLE_SHARD_COUNT)
+                .map(|_| AsyncMutex::new(HashMap::new()))
+                .collect(),
+            hasher: RandomState::new(),
+            removal: AsyncRwLock::new(()),
+        }
+    }
+
+    fn shard(&self, path: &Utf8Path) -> &AsyncMutex<HandleShard> {
+        let index = self.hasher.hash_one(path) as usize % self.shards.len();
+        &self.shards[index]
+    }
+}
+
+/// Returned from `close_shared` when closing the handle requires removing the entry but the caller
+/// doesn't hold `Handles::removal` for writing.
+struct NeedsExclusive;
 
 struct Shared {
     path: Utf8PathBuf,
@@ -1,41 +1,52 @@
-use ouisync_lib::{DebugPrinter, Error, File, JointDirectory, JointEntry, Result};
+use ouisync_lib::{DebugPrinter, Error, JointEntry, Result};
 use slab::Slab;
-use std::convert::TryInto;
+use std::{
+    convert::TryInto,
+    sync::{Arc, Mutex},
+};
+use tokio::sync::{Mutex as AsyncMutex, OwnedMutexGuard};
 
 pub type FileHandle = u64;
 
 // TODO: create separate maps for files and directories
 
+/// Open file and directory handles. Each entry has its own lock so requests on different handles
+/// can run concurrently while requests on the same handle (which share the seek position) are
+/// serialized.
 #[derive(Default)]
-pub struct EntryMap(Slab<JointEntry>);
+pub struct EntryMap(Mutex<Slab<Arc<AsyncMutex<JointEntry>>>>);
 
 impl EntryMap {
-    pub fn insert(&mut self, entry: JointEntry) -> FileHandle {
-        index_to_handle(self.0.insert(entry))
+    pub fn insert(&self, entry: JointEntry) -> FileHandle {
+        index_to_handle(
+            self.0
+                .lock()
+                .unwrap()
+                .insert(Arc::new(AsyncMutex::new(entry))),
+        )
     }
 
-    pub fn remove(&mut self, handle: FileHandle) -> JointEntry {
-        self.0.remove(handle_to_index(handle))
-    }
-
-    pub fn get_file_mut(&mut self, handle: FileHandle) -> Result<&mut File> {
-        self.get_mut(handle)?.as_file_mut()
-    }
-
-    pub fn get_directory(&self, handle: FileHandle) -> Result<&JointDirectory> {
-        self.get(handle)?.as_directory()
-    }
-
-    fn get(&self, handle: FileHandle) -> Result<&JointEntry> {
+    pub fn remove(&self, handle: FileHandle) -> Result<()> {
         self.0
-            .get(handle_to_index(handle))
+            .lock()
+            .unwrap()
+            .try_remove(handle_to_index(handle))
+            .map(|_| ())
             .ok_or(Error::EntryNotFound)
     }
 
-    fn get_mut(&mut self, handle: FileHandle) -> Result<&mut JointEntry> {
-        self.0
-            .get_mut(handle_to_index(handle))
-            .ok_or(Error::EntryNotFound)
+    /// Locks the entry with the given handle. The entry stays alive while the guard exists even
+    /// if the handle is removed in the meantime.
+    pub async fn lock(&self, handle: FileHandle) -> Result<OwnedMutexGuard<JointEntry>> {
+        let entry = self
+            .0
+            .lock()
+            .unwrap()
+            .get(handle_to_index(handle))
+            .cloned()
+            .ok_or(Error::EntryNotFound)?;
+
+        Ok(entry.lock_owned().await)
     }
 
     // For debugging, use when needed
@@ -43,9 +54,17 @@ impl EntryMap {
     pub async fn debug_print(&self, print: DebugPrinter) {
         print.display(&"EntryMap");
         let print = print.indent();
-        for (i, entry) in &self.0 {
-            let h = index_to_handle(i);
-            match entry {
+
+        let entries: Vec<_> = self
+            .0
+            .lock()
+            .unwrap()
+            .iter()
+            .map(|(i, entry)| (index_to_handle(i), entry.clone()))
+            .collect();
+
+        for (h, entry) in entries {
+            match &*entry.lock().await {
                 JointEntry::File(file) => {
                     print.display(&format_args!("{h}: {file:?}"));
                 }
@@ -156,6 +156,7 @@ impl InodeMap {
     }
 }
 
+#[derive(Clone, Copy)]
 pub enum Representation {
     // Because a single directory may be present in multiple branches, we can't simply store a
     // single locator to a directory. We could - in principle - store a set of locators here, but
@@ -9,9 +9,10 @@ pub use multi_repo_vfs::MultiRepoVFS;
 use self::{
     entry_map::{EntryMap, FileHandle},
     flags::{OpenFlags, RenameFlags},
-    inode::{Inode, InodeMap, InodeView, Representation},
+    inode::{Inode, InodeMap, Representation},
     utils::{FormatOptionScope, MaybeOwnedMut},
 };
+use camino::Utf8PathBuf;
 use fuser::{
     BackgroundSession, FileAttr, FileType, KernelConfig, MountOption, ReplyAttr, ReplyCreate,
     ReplyData, ReplyDirectory, ReplyEmpty, ReplyEntry, ReplyOpen, ReplyWrite, Request, TimeOrNow,
@@ -23,11 +24,15 @@ use ouisync_lib::{
 use std::{
     convert::TryInto,
     ffi::OsStr,
+    future::Future,
     io::{self, SeekFrom},
     os::raw::c_int,
     panic::{self, AssertUnwindSafe},
     path::Path,
-    sync::Arc,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc, Mutex, MutexGuard,
+    },
     time::SystemTime,
 };
 use tokio::time::Duration;
@@ -88,12 +93,23 @@ impl Drop for MountGuard {
     }
 }
 
-// time-to-live for some fuse reply types.
-// TODO: find out what is this for and whether 0 is OK.
-const TTL: Duration = Duration::from_secs(0);
+// How long the kernel can cache the attributes and the lookups of the entries. Changes made
+// outside of the mount (e.g., synced from other replicas) become visible after at most this long.
+const TTL: Duration = Duration::from_secs(1);
 
-// https://libfuse.github.io/doxygen/fuse__common_8h.html#a4c81f2838716f43fe493a61c87a62816
-const FUSE_CAP_ATOMIC_O_TRUNC: u32 = 8; // 0b0001
+// Max size of a single read or write request. Larger requests amortize the per-request overhead
+// which otherwise dominates the throughput of sequential I/O.
+const MAX_IO_SIZE: u32 = 1024 * 1024;
+
+// Max number of background requests (readahead, writeback) the kernel keeps in flight.
+const MAX_BACKGROUND: u16 = 64;
+
+// https://libfuse.github.io/doxygen/fuse__common_8h.html
+const FUSE_CAP_ASYNC_READ: u32 = 1 << 0;
+const FUSE_CAP_ATOMIC_O_TRUNC: u32 = 1 << 3;
+const FUSE_CAP_BIG_WRITES: u32 = 1 << 5;
+const FUSE_CAP_WRITEBACK_CACHE: u32 = 1 << 16;
+const FUSE_CAP_PARALLEL_DIROPS: u32 = 1 << 18;
 
 // Convenience macro that unwraps the result or reports its error in the given reply and
 // returns.
@@ -117,20 +133,31 @@ macro_rules! record_fmt {
 
 struct VirtualFilesystem {
     rt: tokio::runtime::Handle,
-    inner: Inner,
+    inner: Arc<Inner>,
 }
 
 impl VirtualFilesystem {
     fn new(runtime_handle: tokio::runtime::Handle, repository: Arc<Repository>) -> Self {
         Self {
             rt: runtime_handle,
-            inner: Inner {
+            inner: Arc::new(Inner {
                 repository,
-                inodes: InodeMap::new(),
+                inodes: Mutex::new(InodeMap::new()),
                 entries: EntryMap::default(),
-            },
+                writeback_cache: AtomicBool::new(false),
+            }),
         }
     }
+
+    // Handles the request in a separate task so the session can read the next requests while
+    // this one is still in progress. The kernel doesn't need the replies in order.
+    fn spawn<F, Fut>(&self, f: F)
+    where
+        F: FnOnce(Arc<Inner>) -> Fut,
+        Fut: Future<Output = ()> + Send + 'static,
+    {
+        self.rt.spawn(f(self.inner.clone()));
+    }
 }
 
 impl fuser::Filesystem for VirtualFilesystem {
@@ -143,12 +170,45 @@ impl fuser::Filesystem for VirtualFilesystem {
             return Err(libc::ENOSYS);
         }
 
+        // Optional capabilities. The writeback cache lets the kernel coalesce small writes into
+        // large ones and send them to us on `flush` / `fsync` or when the pages are evicted.
+        for (name, capability) in [
+            ("FUSE_CAP_ASYNC_READ", FUSE_CAP_ASYNC_READ),
+            ("FUSE_CAP_BIG_WRITES", FUSE_CAP_BIG_WRITES),
+            ("FUSE_CAP_WRITEBACK_CACHE", FUSE_CAP_WRITEBACK_CACHE),
+            ("FUSE_CAP_PARALLEL_DIROPS", FUSE_CAP_PARALLEL_DIROPS),
+        ] {
+            if config.add_capabilities(capability).is_err() {
+                tracing::warn!("fuse capability {} not supported", name);
+            } else if capability == FUSE_CAP_WRITEBACK_CACHE {
+                self.inner.writeback_cache.store(true, Ordering::Relaxed);
+            }
+        }
+
+        if let Err(max) = config.set_max_write(MAX_IO_SIZE) {
+            tracing::debug!(max, "max_write limited by the kernel");
+            config.set_max_write(max).ok();
+        }
+
+        if let Err(max) = config.set_max_readahead(MAX_IO_SIZE) {
+            tracing::debug!(max, "max_readahead limited by the kernel");
+            config.set_max_readahead(max).ok();
+        }
+
+        if let Err(max) = config.set_max_background(MAX_BACKGROUND) {
+            tracing::debug!(max, "max_background limited by the kernel");
+        }
+
         Ok(())
     }
 
     fn lookup(&mut self, _req: &Request, parent: Inode, name: &OsStr, reply: ReplyEntry) {
-        let attr = try_request!(self.rt.block_on(self.inner.lookup(parent, name)), reply);
-        reply.entry(&TTL, &attr, 0)
+        let name = name.to_owned();
+
+        self.spawn(|inner| async move {
+            let attr = try_request!(inner.lookup(parent, &name).await, reply);
+            reply.entry(&TTL, &attr, 0)
+        });
     }
 
     // NOTE: This should be called for every `lookup` but also for `mkdir`, `mknod`, 'symlink`,
@@ -160,8 +220,10 @@ impl fuser::Filesystem for VirtualFilesystem {
     }
 
     fn getattr(&mut self, _req: &Request, inode: Inode, reply: ReplyAttr) {
-        let attr = try_request!(self.rt.block_on(self.inner.getattr(inode)), reply);
-        reply.attr(&TTL, &attr)
+        self.spawn(|inner| async move {
+            let attr = try_request!(inner.getattr(inode).await, reply);
+            reply.attr(&TTL, &attr)
+        });
     }
 
     fn setattr(
@@ -182,23 +244,26 @@ impl fuser::Filesystem for VirtualFilesystem {
         flags: Option<u32>,
         reply: ReplyAttr,
     ) {
-        let attr = try_request!(
-            self.rt.block_on(self.inner.setattr(
-                inode, mode, uid, gid, size, atime, mtime, ctime, fh, crtime, chgtime, bkuptime,
-                flags,
-            )),
-            reply
-        );
-        reply.attr(&TTL, &attr);
+        self.spawn(|inner| async move {
+            let attr = try_request!(
+                inner
+                    .setattr(
+                        inode, mode, uid, gid, size, atime, mtime, ctime, fh, crtime, chgtime,
+                        bkuptime, flags,
+                    )
+                    .await,
+                reply
+            );
+            reply.attr(&TTL, &attr);
+        });
     }
 
     fn opendir(&mut self, _req: &Request, inode: Inode, flags: i32, reply: ReplyOpen) {
-        let handle = try_request!(
-            self.rt.block_on(self.inner.opendir(inode, flags.into())),
-            reply
-        );
-        // TODO: what about `flags`?
-        reply.opened(handle, 0);
+        self.spawn(|inner| async move {
+            let handle = try_request!(inner.opendir(inode, flags.into()).await, reply);
+            // TODO: what about `flags`?
+            reply.opened(handle, 0);
+        });
     }
 
     fn releasedir(
@@ -209,8 +274,10 @@ impl fuser::Filesystem for VirtualFilesystem {
         flags: i32,
         reply: ReplyEmpty,
     ) {
-        try_request!(self.inner.releasedir(inode, handle, flags.into()), reply);
-        reply.ok();
+        self.spawn(|inner| async move {
+            try_request!(inner.releasedir(inode, handle, flags.into()).await, reply);
+            reply.ok();
+        });
     }
 
     fn readdir(
@@ -221,12 +288,13 @@ impl fuser::Filesystem for VirtualFilesystem {
         offset: i64,
         mut reply: ReplyDirectory,
     ) {
-        try_request!(
-            self.rt
-                .block_on(self.inner.readdir(inode, handle, offset, &mut reply)),
-            reply
-        );
-        reply.ok();
+        self.spawn(|inner| async move {
+            try_request!(
+                inner.readdir(inode, handle, offset, &mut reply).await,
+                reply
+            );
+            reply.ok();
+        });
     }
 
     fn mkdir(
@@ -238,22 +306,30 @@ impl fuser::Filesystem for VirtualFilesystem {
         umask: u32,
         reply: ReplyEntry,
     ) {
-        let attr = try_request!(
-            self.rt
-                .block_on(self.inner.mkdir(parent, name, mode, umask)),
-            reply
-        );
-        reply.entry(&TTL, &attr, 0);
+        let name = name.to_owned();
+
+        self.spawn(|inner| async move {
+            let attr = try_request!(inner.mkdir(parent, &name, mode, umask).await, reply);
+            reply.entry(&TTL, &attr, 0);
+        });
     }
 
     fn rmdir(&mut self, _req: &Request, parent: Inode, name: &OsStr, reply: ReplyEmpty) {
-        try_request!(self.rt.block_on(self.inner.rmdir(parent, name)), reply);
-        reply.ok();
+        let name = name.to_owned();
+
+        self.spawn(|inner| async move {
+            try_request!(inner.rmdir(parent, &name).await, reply);
+            reply.ok();
+        });
     }
 
     fn unlink(&mut self, _req: &Request, parent: Inode, name: &OsStr, reply: ReplyEmpty) {
-        try_request!(self.rt.block_on(self.inner.unlink(parent, name)), reply);
-        reply.ok();
+        let name = name.to_owned();
+
+        self.spawn(|inner| async move {
+            try_request!(inner.unlink(parent, &name).await, reply);
+            reply.ok();
+        });
     }
 
     fn fsyncdir(
@@ -264,12 +340,10 @@ impl fuser::Filesystem for VirtualFilesystem {
         datasync: bool,
         reply: ReplyEmpty,
     ) {
-        try_request!(
-            self.rt
-                .block_on(self.inner.fsyncdir(inode, handle, datasync)),
-            reply
-        );
-        reply.ok();
+        self.spawn(|inner| async move {
+            try_request!(inner.fsyncdir(inode, handle, datasync).await, reply);
+            reply.ok();
+        });
     }
 
     fn create(
@@ -282,22 +356,26 @@ impl fuser::Filesystem for VirtualFilesystem {
         flags: i32,
         reply: ReplyCreate,
     ) {
-        let (attr, handle, flags) = try_request!(
-            self.rt.block_on(
-                self.inner
-                    .create(parent, name, mode, umask, flags.into(), req)
-            ),
-            reply
-        );
-        reply.created(&TTL, &attr, 0, handle, flags);
+        let name = name.to_owned();
+        let uid = req.uid();
+        let gid = req.gid();
+
+        self.spawn(|inner| async move {
+            let (attr, handle, flags) = try_request!(
+                inner
+                    .create(parent, &name, mode, umask, flags.into(), uid, gid)
+                    .await,
+                reply
+            );
+            reply.created(&TTL, &attr, 0, handle, flags);
+        });
     }
 
     fn open(&mut self, _req: &Request, inode: Inode, flags: i32, reply: ReplyOpen) {
-        let (handle, flags) = try_request!(
-            self.rt.block_on(self.inner.open(inode, flags.into())),
-            reply
-        );
-        reply.opened(handle, flags);
+        self.spawn(|inner| async move {
+            let (handle, flags) = try_request!(inner.open(inode, flags.into()).await, reply);
+            reply.opened(handle, flags);
+        });
     }
 
     fn release(
@@ -310,12 +388,13 @@ impl fuser::Filesystem for VirtualFilesystem {
         flush: bool,
         reply: ReplyEmpty,
     ) {
-        try_request!(
-            self.rt
-                .block_on(self.inner.release(inode, handle, flags.into(), flush)),
-            reply
-        );
-        reply.ok()
+        self.spawn(|inner| async move {
+            try_request!(
+                inner.release(inode, handle, flags.into(), flush).await,
+                reply
+            );
+            reply.ok()
+        });
     }
 
     fn read(
@@ -329,12 +408,13 @@ impl fuser::Filesystem for VirtualFilesystem {
         _lock: Option<u64>,
         reply: ReplyData,
     ) {
-        let data = try_request!(
-            self.rt
-                .block_on(self.inner.read(inode, handle, offset, size, flags.into())),
-            reply
-        );
-        reply.data(&data);
+        self.spawn(|inner| async move {
+            let data = try_request!(
+                inner.read(inode, handle, offset, size, flags.into()).await,
+                reply
+            );
+            reply.data(&data);
+        });
     }
 
     fn write(
@@ -351,12 +431,19 @@ impl fuser::Filesystem for VirtualFilesystem {
     ) {
         // TODO: what about `write_flags` and `lock_owner`?
 
-        let size = try_request!(
-            self.rt
-                .block_on(self.inner.write(inode, handle, offset, data, flags.into())),
-            reply
-        );
-        reply.written(size);
+        // The data is borrowed from the session buffer which is reused for the next request, so
+        // it needs to be copied.
+        let data = data.to_vec();
+
+        self.spawn(|inner| async move {
+            let size = try_request!(
+                inner
+                    .write(inode, handle, offset, &data, flags.into())
+                    .await,
+                reply
+            );
+            reply.written(size);
+        });
     }
 
     fn flush(
@@ -367,8 +454,10 @@ impl fuser::Filesystem for VirtualFilesystem {
         _lock_owner: u64,
         reply: ReplyEmpty,
     ) {
-        try_request!(self.rt.block_on(self.inner.flush(inode, handle)), reply);
-        reply.ok();
+        self.spawn(|inner| async move {
+            try_request!(inner.flush(inode, handle).await, reply);
+            reply.ok();
+        });
     }
 
     fn fsync(
@@ -379,11 +468,10 @@ impl fuser::Filesystem for VirtualFilesystem {
         datasync: bool,
         reply: ReplyEmpty,
     ) {
-        try_request!(
-            self.rt.block_on(self.inner.fsync(inode, handle, datasync)),
-            reply
-        );
-        reply.ok();
+        self.spawn(|inner| async move {
+            try_request!(inner.fsync(inode, handle, datasync).await, reply);
+            reply.ok();
+        });
     }
 
     fn rename(
@@ -396,34 +484,39 @@ impl fuser::Filesystem for VirtualFilesystem {
         flags: u32,
         reply: ReplyEmpty,
     ) {
-        try_request!(
-            self.rt.block_on(self.inner.rename(
-                src_parent,
-                src_name,
-                dst_parent,
-                dst_name,
-                flags.into()
-            )),
-            reply
-        );
-        reply.ok()
+        let src_name = src_name.to_owned();
+        let dst_name = dst_name.to_owned();
+
+        self.spawn(|inner| async move {
+            try_request!(
+                inner
+                    .rename(src_parent, &src_name, dst_parent, &dst_name, flags.into())
+                    .await,
+                reply
+            );
+            reply.ok()
+        });
     }
 }
 
 struct Inner {
     repository: Arc<Repository>,
-    inodes: InodeMap,
+    // NOTE: Never held across an await point.
+    inodes: Mutex<InodeMap>,
     entries: EntryMap,
+    // Whether `FUSE_CAP_WRITEBACK_CACHE` was negotiated in `init`. With it the kernel maintains
+    // the file timestamps itself and sends them to us in `setattr`.
+    writeback_cache: AtomicBool,
 }
 
 impl Inner {
     #[instrument(skip(self, parent, name), fields(path), err(Debug))]
-    async fn lookup(&mut self, parent: Inode, name: &OsStr) -> Result<FileAttr> {
+    async fn lookup(&self, parent: Inode, name: &OsStr) -> Result<FileAttr> {
         let name = name.to_str().ok_or(Error::NonUtf8FileName)?;
 
         self.record_path(parent, Some(name));
 
-        let parent_path = self.inodes.get(parent).calculate_path();
+        let parent_path = self.inodes().get(parent).calculate_path();
         let parent_dir = self.repository.open_directory(parent_path).await?;
 
         let entry = parent_dir.lookup_unique(name)?;
@@ -437,23 +530,23 @@ impl Inner {
             }
         };
 
-        let inode = self.inodes.lookup(parent, entry.name(), name, repr);
+        let inode = self.inodes().lookup(parent, entry.name(), name, repr);
 
         // TODO: uid, gid
         Ok(make_file_attr(inode, entry.entry_type(), len, 0, 0))
     }
 
     #[instrument(skip(self, inode), fields(path))]
-    fn forget(&mut self, inode: Inode, lookups: u64) {
+    fn forget(&self, inode: Inode, lookups: u64) {
         self.record_path(inode, None);
-        self.inodes.forget(inode, lookups)
+        self.inodes().forget(inode, lookups)
     }
 
     #[instrument(skip(self, inode), fields(path), err(Debug))]
-    async fn getattr(&mut self, inode: Inode) -> Result<FileAttr> {
+    async fn getattr(&self, inode: Inode) -> Result<FileAttr> {
         self.record_path(inode, None);
 
-        let entry = self.open_entry_by_inode(self.inodes.get(inode)).await?;
+        let entry = self.open_entry_by_inode(inode).await?;
 
         // TODO: uid, gid
         Ok(make_file_attr_for_entry(&entry, inode, 0, 0).await)
@@ -469,7 +562,7 @@ impl Inner {
         err(Debug)
     )]
     async fn setattr(
-        &mut self,
+        &self,
         inode: Inode,
         mode: Option<u32>,
         uid: Option<u32>,
@@ -517,7 +610,6 @@ impl Inner {
         check_unsupported(mode)?;
         check_unsupported(uid)?;
         check_unsupported(gid)?;
-        check_unsupported(ctime)?;
         check_unsupported(crtime)?;
         check_unsupported(chgtime)?;
         check_unsupported(bkuptime)?;
@@ -527,8 +619,17 @@ impl Inner {
         // check_unsupported(atime)?;
         // check_unsupported(mtime)?;
 
+        // With the writeback cache the kernel sends `ctime` on `ftruncate` and when it flushes
+        // the dirty timestamps on `close` / `fsync`. We don't store timestamps so we ignore it
+        // (same as `atime` and `mtime`), otherwise those calls would fail.
+        if !self.writeback_cache.load(Ordering::Relaxed) {
+            check_unsupported(ctime)?;
+        }
+
+        let mut entry;
         let mut file = if let Some(handle) = handle {
-            MaybeOwnedMut::Borrowed(self.entries.get_file_mut(handle)?)
+            entry = self.entries.lock(handle).await?;
+            MaybeOwnedMut::Borrowed(entry.as_file_mut()?)
         } else {
             MaybeOwnedMut::Owned(self.open_file_by_inode(inode).await?)
         };
@@ -549,7 +650,7 @@ impl Inner {
     }
 
     #[instrument(skip(self, inode, flags), fields(path, ?flags), err(Debug))]
-    async fn opendir(&mut self, inode: Inode, flags: OpenFlags) -> Result<FileHandle> {
+    async fn opendir(&self, inode: Inode, flags: OpenFlags) -> Result<FileHandle> {
         self.record_path(inode, None);
 
         let dir = self.open_directory_by_inode(inode).await?;
@@ -559,20 +660,18 @@ impl Inner {
     }
 
     #[instrument(skip(self, inode, flags), fields(path, handle, ?flags), err(Debug))]
-    fn releasedir(&mut self, inode: Inode, handle: FileHandle, flags: OpenFlags) -> Result<()> {
+    async fn releasedir(&self, inode: Inode, handle: FileHandle, flags: OpenFlags) -> Result<()> {
         self.record_path(inode, None);
 
         // TODO: what about `flags`?
 
-        self.entries.get_directory(handle)?;
-        self.entries.remove(handle);
-
-        Ok(())
+        self.entries.lock(handle).await?.as_directory()?;
+        self.entries.remove(handle)
     }
 
     #[instrument(skip(self, inode, reply), fields(path, handle), err(Debug))]
     async fn readdir(
-        &mut self,
+        &self,
         inode: Inode,
         handle: FileHandle,
         offset: i64,
@@ -589,8 +688,9 @@ impl Inner {
             return Err(Error::OffsetOutOfRange);
         }
 
-        let parent = self.inodes.get(inode).parent();
-        let dir = self.entries.get_directory(handle)?;
+        let parent = self.inodes().get(inode).parent();
+        let entry = self.entries.lock(handle).await?;
+        let dir = entry.as_directory()?;
 
         // Handle . and ..
         if offset <= 0 && reply.add(inode, 1, FileType::Directory, ".") {
@@ -635,24 +735,18 @@ impl Inner {
     }
 
     #[instrument(skip(self, parent, name), fields(path), err(Debug))]
-    async fn mkdir(
-        &mut self,
-        parent: Inode,
-        name: &OsStr,
-        mode: u32,
-        umask: u32,
-    ) -> Result<FileAttr> {
+    async fn mkdir(&self, parent: Inode, name: &OsStr, mode: u32, umask: u32) -> Result<FileAttr> {
         record_fmt!("mode", "{:#o}", mode);
         record_fmt!("umask", "{:#o}", umask);
 
         let name = name.to_str().ok_or(Error::NonUtf8FileName)?;
         self.record_path(parent, Some(name));
 
-        let path = self.inodes.get(parent).calculate_path().join(name);
+        let path = self.inodes().get(parent).calculate_path().join(name);
         let dir = self.repository.create_directory(path).await?;
 
         let inode = self
-            .inodes
+            .inodes()
             .lookup(parent, name, name, Representation::Directory);
         let len = dir.len();
 
@@ -661,16 +755,16 @@ impl Inner {
     }
 
     #[instrument(skip(self, parent, name), fields(path), err(Debug))]
-    async fn rmdir(&mut self, parent: Inode, name: &OsStr) -> Result<()> {
+    async fn rmdir(&self, parent: Inode, name: &OsStr) -> Result<()> {
         let name = name.to_str().ok_or(Error::NonUtf8FileName)?;
         self.record_path(parent, Some(name));
 
-        let parent_path = self.inodes.get(parent).calculate_path();
+        let parent_path = self.inodes().get(parent).calculate_path();
         self.repository.remove_entry(parent_path.join(name)).await
     }
 
     #[instrument(skip(self, inode), fields(path), err(Debug))]
-    async fn fsyncdir(&mut self, inode: Inode, handle: FileHandle, datasync: bool) -> Result<()> {
+    async fn fsyncdir(&self, inode: Inode, handle: FileHandle, datasync: bool) -> Result<()> {
         self.record_path(inode, None);
 
         // All directory operations are immediatelly synced, so there is nothing to do here.
@@ -678,15 +772,17 @@ impl Inner {
         Ok(())
     }
 
+    #[allow(clippy::too_many_arguments)]
     #[instrument(skip_all, fields(path, mode, umask, ?flags), err(Debug))]
     async fn create(
-        &mut self,
+        &self,
         parent: Inode,
         name: &OsStr,
         mode: u32,
         umask: u32,
         flags: OpenFlags,
-        req: &Request<'_>,
+        uid: u32,
+        gid: u32,
     ) -> Result<(FileAttr, FileHandle, u32)> {
         record_fmt!("mode", "{:#o}", mode);
         record_fmt!("umask", "{:#o}", umask);
@@ -694,23 +790,23 @@ impl Inner {
         let name = name.to_str().ok_or(Error::NonUtf8FileName)?;
         self.record_path(parent, Some(name));
 
-        let path = self.inodes.get(parent).calculate_path().join(name);
+        let path = self.inodes().get(parent).calculate_path().join(name);
         let mut file = self.repository.create_file(&path).await?;
         file.flush().await?;
 
         let branch_id = *file.branch().id();
         let entry = JointEntry::File(file);
         let inode = self
-            .inodes
+            .inodes()
             .lookup(parent, name, name, Representation::File(branch_id));
-        let attr = make_file_attr_for_entry(&entry, inode, req.uid(), req.gid()).await;
+        let attr = make_file_attr_for_entry(&entry, inode, uid, gid).await;
         let handle = self.entries.insert(entry);
 
         Ok((attr, handle, 0))
     }
 
     #[instrument(skip_all, fields(path, ?flags), err(Debug))]
-    async fn open(&mut self, inode: Inode, flags: OpenFlags) -> Result<(FileHandle, u32)> {
+    async fn open(&self, inode: Inode, flags: OpenFlags) -> Result<(FileHandle, u32)> {
         self.record_path(inode, None);
 
         let mut file = self.open_file_by_inode(inode).await?;
@@ -734,7 +830,7 @@ impl Inner {
 
     #[instrument(skip(self, inode, flags), fields(path, ?flags), err(Debug))]
     async fn release(
-        &mut self,
+        &self,
         inode: Inode,
         handle: FileHandle,
         flags: OpenFlags,
@@ -743,20 +839,18 @@ impl Inner {
         self.record_path(inode, None);
 
         // TODO: what about `flags`?
-        let file = self.entries.get_file_mut(handle)?;
+        let mut entry = self.entries.lock(handle).await?;
 
         if flush {
-            file.flush().await?;
+            entry.as_file_mut()?.flush().await?;
         }
 
-        self.entries.remove(handle);
-
-        Ok(())
+        self.entries.remove(handle)
     }
 
     #[instrument(skip(self, inode, flags), fields(path, ?flags), err(Debug))]
     async fn read(
-        &mut self,
+        &self,
         inode: Inode,
         handle: FileHandle,
         offset: i64,
@@ -767,7 +861,8 @@ impl Inner {
 
         // TODO: what about flags?
 
-        let file = self.entries.get_file_mut(handle)?;
+        let mut entry = self.entries.lock(handle).await?;
+        let file = entry.as_file_mut()?;
 
         let offset: u64 = offset.try_into().map_err(|_| Error::OffsetOutOfRange)?;
         file.seek(SeekFrom::Start(offset));
@@ -792,7 +887,7 @@ impl Inner {
         err(Debug)
     )]
     async fn write(
-        &mut self,
+        &self,
         inode: Inode,
         handle: FileHandle,
         offset: i64,
@@ -804,7 +899,8 @@ impl Inner {
         let offset: u64 = offset.try_into().map_err(|_| Error::OffsetOutOfRange)?;
         let local_branch = self.repository.local_branch()?;
 
-        let file = self.entries.get_file_mut(handle)?;
+        let mut entry = self.entries.lock(handle).await?;
+        let file = entry.as_file_mut()?;
         file.seek(SeekFrom::Start(offset));
         file.fork(local_branch).await?;
 
@@ -819,26 +915,38 @@ impl Inner {
     }
 
     #[instrument(skip(self, inode), fields(path), err(Debug))]
-    async fn flush(&mut self, inode: Inode, handle: FileHandle) -> Result<()> {
+    async fn flush(&self, inode: Inode, handle: FileHandle) -> Result<()> {
         self.record_path(inode, None);
 
-        self.entries.get_file_mut(handle)?.flush().await
+        // With the writeback cache enabled, the kernel writes the dirty pages of the file before
+        // sending this, so flushing the file here persists all the data written before `close`.
+        self.entries
+            .lock(handle)
+            .await?
+            .as_file_mut()?
+            .flush()
+            .await
     }
 
     #[instrument(skip(self, inode), fields(path), err(Debug))]
-    async fn fsync(&mut self, inode: Inode, handle: FileHandle, datasync: bool) -> Result<()> {
+    async fn fsync(&self, inode: Inode, handle: FileHandle, datasync: bool) -> Result<()> {
         self.record_path(inode, None);
 
         // TODO: what about `datasync`?
-        self.entries.get_file_mut(handle)?.flush().await
+        self.entries
+            .lock(handle)
+            .await?
+            .as_file_mut()?
+            .flush()
+            .await
     }
 
     #[instrument(skip(self, parent, name), fields(path), err(Debug))]
-    async fn unlink(&mut self, parent: Inode, name: &OsStr) -> Result<()> {
+    async fn unlink(&self, parent: Inode, name: &OsStr) -> Result<()> {
         let name = name.to_str().ok_or(Error::NonUtf8FileName)?;
         self.record_path(parent, Some(name));
 
-        let path = self.inodes.get(parent).calculate_path().join(name);
+        let path = self.inodes().get(parent).calculate_path().join(name);
         self.repository.remove_entry(path).await?;
         Ok(())
     }
@@ -849,7 +957,7 @@ impl Inner {
         err(Debug)
     )]
     async fn rename(
-        &mut self,
+        &self,
         src_parent: Inode,
         src_name: &OsStr,
         dst_parent: Inode,
@@ -865,23 +973,23 @@ impl Inner {
         record_fmt!(
             "src_path",
             "{}",
-            self.inodes.path_display(src_parent, Some(src_name)),
+            self.inodes().path_display(src_parent, Some(src_name)),
         );
 
         let dst_name = dst_name.to_str().ok_or(Error::NonUtf8FileName)?;
         record_fmt!(
             "dst_path",
             "{}",
-            self.inodes.path_display(dst_parent, Some(dst_name)),
+            self.inodes().path_display(dst_parent, Some(dst_name)),
         );
 
-        let src_dir = self.inodes.get(src_parent).calculate_path();
+        let src_dir = self.inodes().get(src_parent).calculate_path();
 
         let dst_dir = if src_parent == dst_parent {
             // TODO: Maybe we could use something like Cow?
             src_dir.clone()
         } else {
-            self.inodes.get(dst_parent).calculate_path()
+            self.inodes().get(dst_parent).calculate_path()
         };
 
         self.repository
@@ -890,27 +998,26 @@ impl Inner {
     }
 
     async fn open_file_by_inode(&self, inode: Inode) -> Result<File> {
-        let inode = self.inodes.get(inode);
-        let branch_id = inode.representation().file_version()?;
-        let path = inode.calculate_path();
+        let (path, representation) = self.inode_path_and_representation(inode);
+        let branch_id = representation.file_version()?;
 
         self.repository.open_file_version(path, branch_id).await
     }
 
     async fn open_directory_by_inode(&self, inode: Inode) -> Result<JointDirectory> {
-        let path = self.inodes.get(inode).calculate_path();
+        let path = self.inodes().get(inode).calculate_path();
         self.repository.open_directory(path).await
     }
 
-    async fn open_entry_by_inode(&self, inode: InodeView<'_>) -> Result<JointEntry> {
-        let path = inode.calculate_path();
+    async fn open_entry_by_inode(&self, inode: Inode) -> Result<JointEntry> {
+        let (path, representation) = self.inode_path_and_representation(inode);
 
-        match inode.representation() {
+        match representation {
             Representation::Directory => Ok(JointEntry::Directory(
                 self.repository.open_directory(path).await?,
             )),
             Representation::File(branch_id) => {
-                let file = self.repository.open_file_version(path, branch_id).await?;
+                let file = self.repository.open_file_version(path, &branch_id).await?;
                 Ok(JointEntry::File(file))
             }
         }
@@ -925,7 +1032,18 @@ impl Inner {
     }
 
     fn record_path(&self, inode: Inode, last: Option<&str>) {
-        record_fmt!("path", "{}", self.inodes.path_display(inode, last))
+        record_fmt!("path", "{}", self.inodes().path_display(inode, last))
+    }
+
+    fn inode_path_and_representation(&self, inode: Inode) -> (Utf8PathBuf, Representation) {
+        let inodes = self.inodes();
+        let inode = inodes.get(inode);
+
+        (inode.calculate_path(), *inode.representation())
+    }
+
+    fn inodes(&self) -> MutexGuard<'_, InodeMap> {
+        self.inodes.lock().unwrap()
     }
 }
 
@@ -968,6 +1086,7 @@ fn to_error_code(error: &Error) -> libc::c_int {
         | Error::Store(_)
         | Error::MalformedData
         | Error::MalformedDirectory
+        | Error::Reader(_)
         | Error::Writer(_)
         | Error::StorageVersionMismatch => libc::EIO,
         Error::EntryNotFound | Error::AmbiguousEntry => libc::ENOENT,
@@ -980,6 +1099,7 @@ fn to_error_code(error: &Error) -> libc::c_int {
         Error::DirectoryNotEmpty => libc::ENOTEMPTY,
         Error::OperationNotSupported => libc::ENOTSUP,
         Error::Locked => libc::EBUSY,
+        Error::Interrupted => libc::EINTR,
     }
 }
 
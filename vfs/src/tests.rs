@@ -7,7 +7,7 @@ use std::{
     ffi::{OsStr, OsString},
     fs::Metadata,
     future::Future,
-    io::{ErrorKind, SeekFrom},
+    io::{self, ErrorKind, SeekFrom},
     path::{Path, PathBuf},
     sync::Arc,
     thread,
@@ -279,6 +279,141 @@ async fn append_to_file(setup: Setup) {
 
 // -----------------------------------------------------------------------------
 
+#[tokio::test(flavor = "multi_thread")]
+async fn truncate_open_file_single() {
+    let setup = Setup::new_single("").await;
+    truncate_open_file(setup).await
+}
+
+#[tokio::test(flavor = "multi_thread")]
+async fn truncate_open_file_multi() {
+    let setup = Setup::new_multi("").await;
+    truncate_open_file(setup).await
+}
+
+// ----------------------------------
+
+async fn truncate_open_file(setup: Setup) {
+    let path = setup.mount_dir_path().join("file.txt");
+
+    let mut file = File::create(&path).await.unwrap();
+    file.write_all(b"foobar").await.unwrap();
+
+    // `ftruncate` on an open file. With the writeback cache this sends `setattr` with both
+    // `size` and `ctime`.
+    file.set_len(3).await.unwrap();
+    file.sync_all().await.unwrap();
+    close(file).await.unwrap();
+
+    let content = fs::read(&path).await.unwrap();
+    assert_eq!(content, b"foo");
+
+    let mut file = OpenOptions::new().write(true).open(&path).await.unwrap();
+    file.set_len(6).await.unwrap();
+    close(file).await.unwrap();
+
+    let content = fs::read(&path).await.unwrap();
+    assert_eq!(content, b"foo\0\0\0");
+}
+
+// -----------------------------------------------------------------------------
+
+#[tokio::test(flavor = "multi_thread")]
+async fn close_after_write_single() {
+    let setup = Setup::new_single("").await;
+    close_after_write(setup).await
+}
+
+#[tokio::test(flavor = "multi_thread")]
+async fn close_after_write_multi() {
+    let setup = Setup::new_multi("").await;
+    close_after_write(setup).await
+}
+
+// ----------------------------------
+
+async fn close_after_write(setup: Setup) {
+    let path = setup.mount_dir_path().join("file.txt");
+
+    // Close without an explicit sync first. The kernel flushes the dirty pages and timestamps
+    // on close and any error there must be reported by `close` itself.
+    let mut file = File::create(&path).await.unwrap();
+    file.write_all(b"foo").await.unwrap();
+    file.flush().await.unwrap();
+    close(file).await.unwrap();
+
+    // Then write, sync and close.
+    let mut file = OpenOptions::new().append(true).open(&path).await.unwrap();
+    file.write_all(b"bar").await.unwrap();
+    file.sync_all().await.unwrap();
+    file.sync_data().await.unwrap();
+    close(file).await.unwrap();
+
+    let content = fs::read(&path).await.unwrap();
+    assert_eq!(content, b"foobar");
+}
+
+// -----------------------------------------------------------------------------
+
+#[tokio::test(flavor = "multi_thread")]
+async fn concurrent_write_and_read_single() {
+    let setup = Setup::new_single("").await;
+    concurrent_write_and_read(setup).await
+}
+
+#[tokio::test(flavor = "multi_thread")]
+async fn concurrent_write_and_read_multi() {
+    let setup = Setup::new_multi("").await;
+    concurrent_write_and_read(setup).await
+}
+
+// ----------------------------------
+
+async fn concurrent_write_and_read(setup: Setup) {
+    let mount_dir = setup.mount_dir_path();
+    let datas: Vec<Vec<u8>> = (0..8)
+        .map(|seed| {
+            StdRng::seed_from_u64(seed)
+                .sample_iter(Standard)
+                .take(256 * 1024)
+                .collect()
+        })
+        .collect();
+
+    let tasks: Vec<_> = datas
+        .iter()
+        .enumerate()
+        .map(|(index, data)| {
+            let path = mount_dir.join(format!("file-{index}.dat"));
+            let data = data.clone();
+
+            tokio::spawn(async move {
+                let mut file = File::create(&path).await.unwrap();
+                file.write_all(&data).await.unwrap();
+                file.sync_all().await.unwrap();
+            })
+        })
+        .collect();
+
+    for task in tasks {
+        task.await.unwrap();
+    }
+
+    let tasks: Vec<_> = (0..datas.len())
+        .map(|index| tokio::spawn(fs::read(mount_dir.join(format!("file-{index}.dat")))))
+        .collect();
+
+    for (task, data) in tasks.into_iter().zip(&datas) {
+        let read_data = task.await.unwrap().unwrap();
+
+        // Not using `assert_eq!(read_data, data)` to avoid huge output on failure
+        assert_eq!(read_data.len(), data.len());
+        assert!(&read_data == data);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
 #[proptest]
 fn seek_and_read_single(
     #[strategy(0usize..64 * 1024)] len: usize,
@@ -494,6 +629,32 @@ async fn read_dir(path: impl AsRef<Path>) -> HashMap<OsString, Metadata> {
     entries
 }
 
+// Closes the file and returns the error from `close`, if any. Dropping the file would silently
+// ignore it.
+async fn close(file: File) -> io::Result<()> {
+    let file = file.into_std().await;
+
+    #[cfg(target_os = "linux")]
+    {
+        use std::os::unix::io::IntoRawFd;
+
+        let fd = file.into_raw_fd();
+
+        // SAFETY: `fd` was just released from `file` so we are its only owner.
+        if unsafe { libc::close(fd) } == 0 {
+            Ok(())
+        } else {
+            Err(io::Error::last_os_error())
+        }
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    {
+        drop(file);
+        Ok(())
+    }
+}
+
 fn init_log() {
     use tracing::metadata::LevelFilter;
     use tracing_subscriber::EnvFilter;